@@ -161,7 +161,11 @@ libsrc = \
   vl\aib.c \
   vl\array.c \
   vl\covdet.c \
+  vl\covdet_avx2.c \
+  vl\covdet_sse2.c \
   vl\dsift.c \
+  vl\dsift_avx2.c \
+  vl\dsift_sse2.c \
   vl\generic.c \
   vl\getopt_long.c \
   vl\hikmeans.c \
@@ -170,23 +174,30 @@ libsrc = \
   vl\host.c \
   vl\ikmeans.c \
   vl\imopv.c \
+  vl\imopv_avx2.c \
   vl\imopv_sse2.c \
   vl\kdtree.c \
   vl\kmeans.c \
   vl\lbp.c \
   vl\mathop.c \
+  vl\mathop_avx2.c \
+  vl\mathop_avx512.c \
   vl\mathop_sse2.c \
   vl\mser.c \
   vl\pegasos.c \
   vl\pgm.c \
+  vl\phow.c \
   vl\quickshift.c \
   vl\random.c \
   vl\rodrigues.c \
   vl\scalespace.c \
   vl\sift.c \
+  vl\sift_avx2.c \
+  vl\sift_sse2.c \
   vl\slic.c \
   vl\stringop.c \
-  vl\svmdataset.c
+  vl\svmdataset.c \
+  vl\threads.c
 
 cmdsrc = \
   src\aib.c \
@@ -388,6 +399,43 @@ $(objdir)\imopv_sse2.obj : vl\imopv_sse2.c
 	@echo .... CC [+SSE2] $(@)
 	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:SSE2 /D"__SSE2__" /c /Fo"$(@)" "vl\$(@B).c"
 
+$(objdir)\sift_sse2.obj : vl\sift_sse2.c
+	@echo .... CC [+SSE2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:SSE2 /D"__SSE2__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\covdet_sse2.obj : vl\covdet_sse2.c
+	@echo .... CC [+SSE2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:SSE2 /D"__SSE2__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\dsift_sse2.obj : vl\dsift_sse2.c
+	@echo .... CC [+SSE2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:SSE2 /D"__SSE2__" /c /Fo"$(@)" "vl\$(@B).c"
+
+# special sources with AVX2 and AVX-512 support
+$(objdir)\mathop_avx2.obj : vl\mathop_avx2.c
+	@echo .... CC [+AVX2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX2 /D"__SSE2__" /D"__AVX2__" /D"__FMA__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\sift_avx2.obj : vl\sift_avx2.c
+	@echo .... CC [+AVX2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX2 /D"__SSE2__" /D"__AVX2__" /D"__FMA__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\imopv_avx2.obj : vl\imopv_avx2.c
+	@echo .... CC [+AVX2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX2 /D"__SSE2__" /D"__AVX2__" /D"__FMA__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\covdet_avx2.obj : vl\covdet_avx2.c
+	@echo .... CC [+AVX2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX2 /D"__SSE2__" /D"__AVX2__" /D"__FMA__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\dsift_avx2.obj : vl\dsift_avx2.c
+	@echo .... CC [+AVX2] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX2 /D"__SSE2__" /D"__AVX2__" /D"__FMA__" /c /Fo"$(@)" "vl\$(@B).c"
+
+$(objdir)\mathop_avx512.obj : vl\mathop_avx512.c
+	@echo .... CC [+AVX512] $(@)
+	@$(CC) $(CFLAGS) $(DLL_CFLAGS) /arch:AVX512 /D"__SSE2__" /D"__AVX512F__" /c /Fo"$(@)" "vl\$(@B).c"
+
 # vl\*.c -> $objdir\*.obj
 {vl}.c{$(objdir)}.obj:
 	@echo .... CC $(@)
@@ -23,6 +23,8 @@ DLL_NAME = vl
 DLL_CFLAGS  = $(STD_CFLAGS)
 DLL_CFLAGS += -fvisibility=hidden -fPIC -DVL_BUILD_DLL -pthread
 DLL_CFLAGS += $(call if-like,%_sse2,$*,-msse2)
+DLL_CFLAGS += $(call if-like,%_avx2,$*,-mavx2 -mfma)
+DLL_CFLAGS += $(call if-like,%_avx512,$*,-mavx512f)
 
 DLL_LDFLAGS += -lm
 
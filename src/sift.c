@@ -755,10 +755,10 @@ main(int argc, char **argv)
 
           if (dsc.active) {
             int l ;
+            vl_uint8 packed [128] ;
+            vl_sift_pack_descriptor (packed, VL_SIFT_DESCR_UINT8, descr) ;
             for (l = 0 ; l < 128 ; ++l) {
-              double x = 512.0 * descr[l] ;
-              x = (x < 255.0) ? x : 255.0 ;
-              vl_file_meta_put_uint8 (&dsc, (vl_uint8) (x)) ;
+              vl_file_meta_put_uint8 (&dsc, packed [l]) ;
             }
             if (dsc.protocol == VL_PROT_ASCII) fprintf(dsc.file, "\n") ;
           }
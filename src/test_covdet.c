@@ -0,0 +1,284 @@
+/** @file   test_covdet.c
+ ** @brief  Test the covariant feature detector
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/covdet.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+
+#define WIDTH 200
+#define HEIGHT 160
+/* not a multiple of the SIMD width, so that the rows have a tail */
+#define ODD_WIDTH 203
+#define ODD_HEIGHT 157
+#define NUM_BLOBS 150
+
+/* random Gaussian blobs of various sizes */
+float *
+make_image (int width, int height)
+{
+  float * image = vl_calloc (width * height, sizeof(float)) ;
+  VlRand rand ;
+  vl_uindex b ;
+  int x, y ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (b = 0 ; b < NUM_BLOBS ; ++b) {
+    double cx = width * vl_rand_real1 (&rand) ;
+    double cy = height * vl_rand_real1 (&rand) ;
+    double sigma = 1.5 + 8 * vl_rand_real1 (&rand) ;
+    double a = vl_rand_real1 (&rand) - 0.5 ;
+    for (y = 0 ; y < height ; ++y) {
+      for (x = 0 ; x < width ; ++x) {
+        double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy) ;
+        image [x + y * width] += (float) (a * exp (- 0.5 * r2 / (sigma * sigma))) ;
+      }
+    }
+  }
+  return image ;
+}
+
+/* detect the features, run the per-feature stages and compute the
+   descriptors twice, as the second call reuses the detector buffers */
+VlCovDetFeature *
+detect (float const * image, VlCovDetMethod method, vl_size numThreads,
+        vl_size * numFeatures, float ** descriptors)
+{
+  VlCovDet * covdet = vl_covdet_new (method) ;
+  VlCovDetFeature * features ;
+  float * again ;
+
+  vl_set_num_threads (numThreads) ;
+  check (vl_covdet_put_image (covdet, image, WIDTH, HEIGHT) == VL_ERR_OK) ;
+  vl_covdet_detect (covdet) ;
+  if (method == VL_COVDET_METHOD_HESSIAN) {
+    vl_covdet_extract_laplacian_scales (covdet) ;
+  } else {
+    vl_covdet_extract_affine_shape (covdet) ;
+  }
+  vl_covdet_extract_orientations (covdet) ;
+
+  *numFeatures = vl_covdet_get_num_features (covdet) ;
+  features = vl_malloc (sizeof(VlCovDetFeature) * *numFeatures) ;
+  memcpy (features, vl_covdet_get_features (covdet),
+          sizeof(VlCovDetFeature) * *numFeatures) ;
+
+  *descriptors = vl_malloc (sizeof(float) * 128 * *numFeatures) ;
+  again = vl_malloc (sizeof(float) * 128 * *numFeatures) ;
+  check (vl_covdet_extract_descriptors (covdet, *descriptors, 15, 7.5, 1) == VL_ERR_OK) ;
+  check (vl_covdet_extract_descriptors (covdet, again, 15, 7.5, 1) == VL_ERR_OK) ;
+  check (memcmp (again, *descriptors, sizeof(float) * 128 * *numFeatures) == 0,
+         "method %d: the descriptors differ when computed again", (int)method) ;
+  vl_free (again) ;
+  vl_covdet_delete (covdet) ;
+  return features ;
+}
+
+/* the features must not depend on the number of threads */
+void
+check_threads (float const * image, VlCovDetMethod method)
+{
+  vl_size numFeatures, numExpectedFeatures ;
+  float * descriptors, * expectedDescriptors ;
+  VlCovDetFeature * expected = detect (image, method, 1, &numExpectedFeatures,
+                                       &expectedDescriptors) ;
+  VlCovDetFeature * features = detect (image, method, 4, &numFeatures,
+                                       &descriptors) ;
+
+  check (numExpectedFeatures > 0, "no features detected") ;
+  check (numFeatures == numExpectedFeatures,
+         "method %d: %d features with 4 threads instead of %d",
+         (int)method, (int)numFeatures, (int)numExpectedFeatures) ;
+  check (memcmp (features, expected,
+                 sizeof(VlCovDetFeature) * numFeatures) == 0,
+         "method %d: the features differ with 4 threads", (int)method) ;
+  check (memcmp (descriptors, expectedDescriptors,
+                 sizeof(float) * 128 * numFeatures) == 0,
+         "method %d: the descriptors differ with 4 threads", (int)method) ;
+
+  vl_free (features) ;
+  vl_free (expected) ;
+  vl_free (descriptors) ;
+  vl_free (expectedDescriptors) ;
+}
+
+/* exported by covdet.c but not declared in covdet.h */
+VL_EXPORT vl_size
+vl_find_local_extrema_3 (vl_index ** extrema, vl_size * bufferSize,
+                         float const * map,
+                         vl_size width, vl_size height, vl_size depth,
+                         double threshold) ;
+
+VL_EXPORT vl_size
+vl_find_local_extrema_2 (vl_index ** extrema, vl_size * bufferSize,
+                         float const * map,
+                         vl_size width, vl_size height,
+                         double threshold) ;
+
+vl_size
+find_extrema (vl_index ** extrema, float const * map, vl_size depth,
+              vl_bool simd)
+{
+  vl_size bufferSize = 0 ;
+  *extrema = NULL ;
+  vl_set_simd_enabled (simd) ;
+  if (depth > 1) {
+    return vl_find_local_extrema_3 (extrema, &bufferSize, map,
+                                    ODD_WIDTH, ODD_HEIGHT, depth, 0.1) ;
+  } else {
+    return vl_find_local_extrema_2 (extrema, &bufferSize, map,
+                                    ODD_WIDTH, ODD_HEIGHT, 0.1) ;
+  }
+}
+
+/* the vectorized extrema scanner must find the same extrema as the
+   scalar neighbour check; the map is quantized so that many
+   neighbours are equal */
+void
+check_extrema (vl_size depth)
+{
+  vl_size const size = ODD_WIDTH * ODD_HEIGHT * depth ;
+  float * map = vl_malloc (sizeof(float) * size) ;
+  vl_index * extrema, * expected ;
+  vl_size numExtrema, numExpected ;
+  VlRand rand ;
+  vl_uindex i ;
+
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 2) ;
+  for (i = 0 ; i < size ; ++i) {
+    map[i] = (float) vl_rand_uint32 (&rand) / 0x40000000 - 2 ;
+    map[i] = (float) floor (map[i] * 4) / 4 ;
+  }
+  numExpected = find_extrema (&expected, map, depth, VL_FALSE) ;
+  numExtrema = find_extrema (&extrema, map, depth, VL_TRUE) ;
+
+  check (numExpected > 0, "depth %d: no extrema", (int)depth) ;
+  check (numExtrema == numExpected,
+         "depth %d: %d extrema with SIMD instead of %d",
+         (int)depth, (int)numExtrema, (int)numExpected) ;
+  check (memcmp (extrema, expected,
+                 sizeof(vl_index) * (depth > 1 ? 3 : 2) * numExtrema) == 0,
+         "depth %d: the extrema differ with SIMD", (int)depth) ;
+
+  vl_free (extrema) ;
+  vl_free (expected) ;
+  vl_free (map) ;
+}
+
+VlCovDetFeature *
+detect_frames (float const * image, VlCovDetMethod method, vl_bool simd,
+               vl_size * numFeatures)
+{
+  VlCovDet * covdet = vl_covdet_new (method) ;
+  VlCovDetFeature * features ;
+
+  vl_set_simd_enabled (simd) ;
+  check (vl_covdet_put_image (covdet, image, ODD_WIDTH, ODD_HEIGHT) == VL_ERR_OK) ;
+  vl_covdet_detect (covdet) ;
+  *numFeatures = vl_covdet_get_num_features (covdet) ;
+  features = vl_malloc (sizeof(VlCovDetFeature) * *numFeatures) ;
+  memcpy (features, vl_covdet_get_features (covdet),
+          sizeof(VlCovDetFeature) * *numFeatures) ;
+  vl_covdet_delete (covdet) ;
+  return features ;
+}
+
+/* the detected frames must not depend on SIMD; as the vectorized
+   smoothing rounds differently, only the features are compared
+   exactly and their geometry up to a small tolerance */
+void
+check_simd (float const * image, VlCovDetMethod method)
+{
+  vl_size numFeatures, numExpectedFeatures ;
+  VlCovDetFeature * expected = detect_frames (image, method, VL_FALSE,
+                                              &numExpectedFeatures) ;
+  VlCovDetFeature * features = detect_frames (image, method, VL_TRUE,
+                                              &numFeatures) ;
+  vl_uindex i ;
+
+  check (numExpectedFeatures > 0, "no features detected") ;
+  check (numFeatures == numExpectedFeatures,
+         "method %d: %d features with SIMD instead of %d",
+         (int)method, (int)numFeatures, (int)numExpectedFeatures) ;
+  for (i = 0 ; i < numFeatures ; ++i) {
+    VlFrameOrientedEllipse const * a = &features[i].frame ;
+    VlFrameOrientedEllipse const * b = &expected[i].frame ;
+    check (fabs (a->x - b->x) < 1e-3 && fabs (a->y - b->y) < 1e-3 &&
+           fabs (a->a11 - b->a11) < 1e-3 * fabs (b->a11) &&
+           fabs (a->a22 - b->a22) < 1e-3 * fabs (b->a22),
+           "method %d: frame %d differs with SIMD", (int)method, (int)i) ;
+  }
+
+  vl_free (features) ;
+  vl_free (expected) ;
+}
+
+/* at most one feature per cell must be kept, even without non-extrema
+   suppression */
+void
+check_cell_limit (float const * image)
+{
+  VlCovDet * covdet = vl_covdet_new (VL_COVDET_METHOD_HESSIAN) ;
+  VlCovDetFeature const * features ;
+  vl_size numFeatures, numAllFeatures ;
+  vl_uindex i, j ;
+
+  vl_covdet_set_non_extrema_suppression_threshold (covdet, 0) ;
+  vl_covdet_put_image (covdet, image, WIDTH, HEIGHT) ;
+  vl_covdet_detect (covdet) ;
+  numAllFeatures = vl_covdet_get_num_features (covdet) ;
+
+  vl_covdet_set_max_num_features_per_cell (covdet, 1) ;
+  vl_covdet_set_feature_cell_size (covdet, 40) ;
+  vl_covdet_detect (covdet) ;
+  numFeatures = vl_covdet_get_num_features (covdet) ;
+  features = vl_covdet_get_features (covdet) ;
+
+  check (numFeatures > 0 && numFeatures < numAllFeatures,
+         "%d of %d features kept", (int)numFeatures, (int)numAllFeatures) ;
+  for (i = 0 ; i < numFeatures ; ++i) {
+    for (j = 0 ; j < i ; ++j) {
+      check (floor (log (features[i].frame.a11) / log (2.0)) !=
+             floor (log (features[j].frame.a11) / log (2.0)) ||
+             floor (features[i].frame.x / 40) != floor (features[j].frame.x / 40) ||
+             floor (features[i].frame.y / 40) != floor (features[j].frame.y / 40),
+             "features %d and %d are in the same cell", (int)i, (int)j) ;
+    }
+  }
+  vl_covdet_delete (covdet) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  float * image = make_image (WIDTH, HEIGHT) ;
+  float * oddImage = make_image (ODD_WIDTH, ODD_HEIGHT) ;
+  check_threads (image, VL_COVDET_METHOD_HESSIAN) ;
+  check_threads (image, VL_COVDET_METHOD_HESSIAN_LAPLACE) ;
+  check_simd (oddImage, VL_COVDET_METHOD_HESSIAN) ;
+  check_simd (oddImage, VL_COVDET_METHOD_HESSIAN_LAPLACE) ;
+  check_simd (oddImage, VL_COVDET_METHOD_DOG) ;
+  check_extrema (1) ;
+  check_extrema (5) ;
+  vl_set_simd_enabled (VL_TRUE) ;
+  check_cell_limit (image) ;
+  vl_free (oddImage) ;
+  vl_free (image) ;
+  check_signoff () ;
+  return 0 ;
+}
@@ -0,0 +1,120 @@
+/** @file   test_dsift.c
+ ** @brief  Test dense SIFT
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/dsift.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <string.h>
+
+#include "check.h"
+
+/* not a multiple of the SIMD width, so that the rows have a tail */
+#define WIDTH 203
+#define HEIGHT 157
+
+float *
+make_image (void)
+{
+  float * image = vl_malloc (sizeof(float) * WIDTH * HEIGHT) ;
+  VlRand rand ;
+  vl_uindex i ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (i = 0 ; i < WIDTH * HEIGHT ; ++i) {
+    image[i] = (float) vl_rand_real1 (&rand) ;
+  }
+  return image ;
+}
+
+/* the gradient planes, one after the other */
+float *
+compute_planes (VlDsiftFilter const * dsift, float const * image,
+                vl_bool simd, vl_size numThreads)
+{
+  int numBinT = vl_dsift_get_geometry (dsift)->numBinT ;
+  float * data = vl_malloc (sizeof(float) * WIDTH * HEIGHT * numBinT) ;
+  float * planes [16] ;
+  int t ;
+  for (t = 0 ; t < numBinT ; ++t) planes[t] = data + t * WIDTH * HEIGHT ;
+  vl_set_simd_enabled (simd) ;
+  vl_set_num_threads (numThreads) ;
+  vl_dsift_compute_planes (dsift, planes, image) ;
+  return data ;
+}
+
+float *
+compute_descriptors (float const * image, vl_bool flatWindow,
+                     vl_size numThreads, vl_size * size)
+{
+  VlDsiftFilter * dsift = vl_dsift_new_basic (WIDTH, HEIGHT, 3, 4) ;
+  float * descriptors ;
+
+  vl_set_num_threads (numThreads) ;
+  vl_dsift_set_flat_window (dsift, flatWindow) ;
+  vl_dsift_process (dsift, image) ;
+
+  *size = vl_dsift_get_keypoint_num (dsift) *
+    vl_dsift_get_descriptor_size (dsift) ;
+  descriptors = vl_malloc (sizeof(float) * *size) ;
+  memcpy (descriptors, vl_dsift_get_descriptors (dsift), sizeof(float) * *size) ;
+  vl_dsift_delete (dsift) ;
+  return descriptors ;
+}
+
+/* the vectorized and threaded gradient quantization must match the
+   scalar code exactly */
+void
+check_planes (float const * image)
+{
+  VlDsiftFilter * dsift = vl_dsift_new_basic (WIDTH, HEIGHT, 3, 4) ;
+  vl_size size = sizeof(float) * WIDTH * HEIGHT *
+    vl_dsift_get_geometry (dsift)->numBinT ;
+  float * expected = compute_planes (dsift, image, VL_FALSE, 1) ;
+  float * planes = compute_planes (dsift, image, VL_TRUE, 1) ;
+  check (memcmp (planes, expected, size) == 0, "SIMD planes differ") ;
+  vl_free (planes) ;
+  planes = compute_planes (dsift, image, VL_TRUE, 4) ;
+  check (memcmp (planes, expected, size) == 0, "planes differ with 4 threads") ;
+  vl_free (planes) ;
+  vl_free (expected) ;
+  vl_dsift_delete (dsift) ;
+  vl_set_simd_enabled (VL_TRUE) ;
+}
+
+/* the descriptors must not depend on the number of threads */
+void
+check_threads (float const * image, vl_bool flatWindow)
+{
+  vl_size size, expectedSize ;
+  float * expected = compute_descriptors (image, flatWindow, 1, &expectedSize) ;
+  float * descriptors = compute_descriptors (image, flatWindow, 4, &size) ;
+  check (expectedSize > 0, "no descriptors") ;
+  check (size == expectedSize &&
+         memcmp (descriptors, expected, sizeof(float) * size) == 0,
+         "flat window %d: descriptors differ with 4 threads", (int)flatWindow) ;
+  vl_free (descriptors) ;
+  vl_free (expected) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  float * image = make_image () ;
+  check_planes (image) ;
+  check_threads (image, VL_FALSE) ;
+  check_threads (image, VL_TRUE) ;
+  vl_free (image) ;
+  check_signoff () ;
+  return 0 ;
+}
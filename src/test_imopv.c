@@ -9,6 +9,143 @@ the terms of the BSD license (see the COPYING file).
 #include <vl/generic.h>
 #include <vl/pgm.h>
 #include <vl/imopv.h>
+#include <vl/random.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+
+/* not a multiple of the SIMD width nor of the band width, so that
+   the vectorized and threaded convolution have a tail; the size is
+   large enough for the convolution to be split among threads */
+#define CHECK_WIDTH 203
+#define CHECK_HEIGHT 251
+#define CHECK_W 12
+
+float *
+convolve (float const * image, float const * filt, unsigned int flags,
+          vl_bool simd, vl_size numThreads)
+{
+  float * dest = vl_malloc (sizeof(float) * CHECK_WIDTH * CHECK_HEIGHT) ;
+  vl_size stride = (flags & VL_TRANSPOSE) ? CHECK_HEIGHT : CHECK_WIDTH ;
+  vl_set_simd_enabled (simd) ;
+  vl_set_num_threads (numThreads) ;
+  vl_imconvcol_vf (dest, stride,
+                   image, CHECK_WIDTH, CHECK_HEIGHT, CHECK_WIDTH,
+                   filt, -CHECK_W, CHECK_W, 1, flags) ;
+  return dest ;
+}
+
+/* the vectorized convolution must match the scalar one up to
+   rounding, and the threaded convolution must match the
+   single-threaded one exactly */
+void
+check_convcol (float const * image, float const * filt, unsigned int flags)
+{
+  vl_size size = sizeof(float) * CHECK_WIDTH * CHECK_HEIGHT ;
+  float * expected = convolve (image, filt, flags, VL_FALSE, 1) ;
+  float * threaded = convolve (image, filt, flags, VL_FALSE, 4) ;
+  float * simd = convolve (image, filt, flags, VL_TRUE, 1) ;
+  float * simdThreaded = convolve (image, filt, flags, VL_TRUE, 4) ;
+  vl_uindex i ;
+
+  check (memcmp (threaded, expected, size) == 0,
+         "flags %d: the scalar convolution differs with 4 threads", flags) ;
+  check (memcmp (simdThreaded, simd, size) == 0,
+         "flags %d: the SIMD convolution differs with 4 threads", flags) ;
+  for (i = 0 ; i < CHECK_WIDTH * CHECK_HEIGHT ; ++i) {
+    check (fabs (simd[i] - expected[i]) < 1e-5,
+           "flags %d: element %d is %g with SIMD and %g without",
+           flags, (int)i, simd[i], expected[i]) ;
+  }
+
+  vl_set_simd_enabled (VL_TRUE) ;
+  vl_set_num_threads (0) ;
+  vl_free (expected) ;
+  vl_free (threaded) ;
+  vl_free (simd) ;
+  vl_free (simdThreaded) ;
+}
+
+void
+check_convcols (void)
+{
+  float * image = vl_malloc (sizeof(float) * CHECK_WIDTH * CHECK_HEIGHT) ;
+  float filt [2*CHECK_W+1] ;
+  VlRand rand ;
+  vl_uindex i ;
+
+  /* an asymmetric filter, so that flipping it would be noticed */
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (i = 0 ; i < CHECK_WIDTH * CHECK_HEIGHT ; ++i) {
+    image[i] = (float) vl_rand_real1 (&rand) ;
+  }
+  for (i = 0 ; i < 2*CHECK_W+1 ; ++i) {
+    filt[i] = (float) vl_rand_real1 (&rand) / (2*CHECK_W+1) ;
+  }
+
+  check_convcol (image, filt, VL_PAD_BY_ZERO) ;
+  check_convcol (image, filt, VL_PAD_BY_CONTINUITY) ;
+  check_convcol (image, filt, VL_PAD_BY_ZERO | VL_TRANSPOSE) ;
+  check_convcol (image, filt, VL_PAD_BY_CONTINUITY | VL_TRANSPOSE) ;
+  vl_free (image) ;
+}
+
+/* the impulse response of the recursive Gaussian must differ from
+   the direct convolution with the Gaussian by less than 1.3% of its
+   peak; an impulse along a row and along a column tests each pass */
+#define IMPULSE_SIZE 401
+
+void
+check_recursive_gaussian (double sigma, vl_bool alongRows)
+{
+  vl_size width = alongRows ? IMPULSE_SIZE : 1 ;
+  vl_size height = alongRows ? 1 : IMPULSE_SIZE ;
+  vl_index W = (vl_index) ceil (6 * sigma) ;
+  float * image = vl_calloc (IMPULSE_SIZE, sizeof(float)) ;
+  float * smoothed = vl_malloc (sizeof(float) * IMPULSE_SIZE) ;
+  float * expected = vl_malloc (sizeof(float) * IMPULSE_SIZE) ;
+  float * filt = vl_malloc (sizeof(float) * (2*W+1)) ;
+  double mass = 0 ;
+  vl_index i ;
+
+  check (sigma >= VL_IMSMOOTH_RECURSIVE_MIN_SIGMA) ;
+  for (i = -W ; i <= W ; ++i) {
+    filt[i+W] = (float) exp (- 0.5 * i * i / (sigma * sigma)) ;
+    mass += filt[i+W] ;
+  }
+  for (i = -W ; i <= W ; ++i) filt[i+W] /= mass ;
+
+  image[IMPULSE_SIZE/2] = 1 ;
+  vl_imsmooth_f (smoothed, width, image, width, height, width, sigma, sigma) ;
+  vl_imconvcol_vf (expected, 1, image, 1, IMPULSE_SIZE, 1,
+                   filt, -W, W, 1, VL_PAD_BY_CONTINUITY) ;
+
+  for (i = 0 ; i < IMPULSE_SIZE ; ++i) {
+    check (fabs (smoothed[i] - expected[i]) < 0.013 * filt[W],
+           "sigma %g, along %s, element %d: %g instead of %g",
+           sigma, alongRows ? "rows" : "columns", (int)i,
+           smoothed[i], expected[i]) ;
+  }
+
+  vl_free (image) ;
+  vl_free (smoothed) ;
+  vl_free (expected) ;
+  vl_free (filt) ;
+}
+
+void
+check_recursive_gaussians (void)
+{
+  double const sigmas [4] = {VL_IMSMOOTH_RECURSIVE_MIN_SIGMA, 6.5, 12, 30} ;
+  vl_uindex k ;
+  for (k = 0 ; k < 4 ; ++k) {
+    check_recursive_gaussian (sigmas[k], VL_TRUE) ;
+    check_recursive_gaussian (sigmas[k], VL_FALSE) ;
+  }
+}
 
 int
 main (int argc, char** argv)
@@ -24,6 +161,9 @@ main (int argc, char** argv)
 
   int x, y ;
 
+  check_convcols () ;
+  check_recursive_gaussians () ;
+
   if (argc < 2) {
     image = vl_malloc (sizeof(float) * width * height) ;
     for (y = 0 ; y < height ; ++y) {
@@ -102,5 +242,6 @@ main (int argc, char** argv)
   vl_free(dest) ;
   vl_free(dest2) ;
 
+  check_signoff () ;
   return 0 ;
 }
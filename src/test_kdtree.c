@@ -0,0 +1,150 @@
+/** @file   test_kdtree.c
+ ** @brief  Test KD-forest saving and loading
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/kdtree.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+
+#define DIMENSION 8
+#define NUM_DATA 2000
+#define NUM_TREES 3
+#define NUM_QUERIES 100
+#define NUM_NEIGHBORS 5
+#define FILE_NAME "test_kdtree.tmp"
+
+float *
+make_data (VlRand * rand, vl_size numData)
+{
+  float * data = vl_malloc (sizeof(float) * DIMENSION * numData) ;
+  vl_uindex i ;
+  for (i = 0 ; i < DIMENSION * numData ; ++i) {
+    data[i] = (float) vl_rand_real1 (rand) ;
+  }
+  return data ;
+}
+
+/* the two forests must return the same neighbors */
+void
+check_same_neighbors (VlKDForest * forest, VlKDForest * loaded,
+                      float const * queries)
+{
+  VlKDForestNeighbor a [NUM_NEIGHBORS] ;
+  VlKDForestNeighbor b [NUM_NEIGHBORS] ;
+  vl_uindex q, k ;
+  vl_kdforest_set_max_num_comparisons (forest, 50) ;
+  vl_kdforest_set_max_num_comparisons (loaded, 50) ;
+  for (q = 0 ; q < NUM_QUERIES ; ++q) {
+    vl_kdforest_query (forest, a, NUM_NEIGHBORS, queries + q * DIMENSION) ;
+    vl_kdforest_query (loaded, b, NUM_NEIGHBORS, queries + q * DIMENSION) ;
+    for (k = 0 ; k < NUM_NEIGHBORS ; ++k) {
+      check (a[k].index == b[k].index && a[k].distance == b[k].distance,
+             "query %d neighbor %d: %d (%g) before saving, %d (%g) after loading",
+             (int)q, (int)k, (int)a[k].index, a[k].distance,
+             (int)b[k].index, b[k].distance) ;
+    }
+  }
+}
+
+/* overwrite @a size bytes at @a offset of the file */
+void
+patch_file (long offset, void const * bytes, size_t size)
+{
+  FILE * f = fopen (FILE_NAME, "r+b") ;
+  check (f != NULL, "could not open %s", FILE_NAME) ;
+  fseek (f, offset, SEEK_SET) ;
+  fwrite (bytes, 1, size, f) ;
+  fclose (f) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  VlRand rand ;
+  VlKDForest * forest ;
+  VlKDForest * loaded ;
+  float * data ;
+  float * queries ;
+  unsigned char badChild [8] = {0xff, 0xff, 0xff, 0x7f, 0, 0, 0, 0} ;
+  unsigned char badIndex [8] = {0xd0, 0x07, 0, 0, 0, 0, 0, 0} ;
+  unsigned char sharedChild [8] = {0} ;
+  vl_uindex ti, i ;
+  long dataIndexOffset ;
+
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  data = make_data (&rand, NUM_DATA) ;
+  queries = make_data (&rand, NUM_QUERIES) ;
+
+  forest = vl_kdforest_new (VL_TYPE_FLOAT, DIMENSION, NUM_TREES) ;
+  vl_kdforest_build (forest, NUM_DATA, data) ;
+
+  /* round trip without the data */
+  check (vl_kdforest_save (forest, FILE_NAME, VL_FALSE) == VL_ERR_OK) ;
+  check (vl_kdforest_load (FILE_NAME, NULL) == NULL,
+         "loaded a file without data and no data") ;
+  loaded = vl_kdforest_load (FILE_NAME, data) ;
+  check (loaded != NULL, "could not load %s", FILE_NAME) ;
+  for (ti = 0 ; ti < NUM_TREES ; ++ti) {
+    check (loaded->trees[ti]->numUsedNodes == forest->trees[ti]->numUsedNodes) ;
+    check (loaded->trees[ti]->depth == forest->trees[ti]->depth) ;
+    check (loaded->trees[ti]->compactNodes == NULL) ;
+  }
+  check_same_neighbors (forest, loaded, queries) ;
+  vl_kdforest_delete (loaded) ;
+
+  /* round trip of the compact layout, with the data */
+  vl_kdforest_compact (forest) ;
+  check (vl_kdforest_save (forest, FILE_NAME, VL_TRUE) == VL_ERR_OK) ;
+  loaded = vl_kdforest_load (FILE_NAME, NULL) ;
+  check (loaded != NULL, "could not load %s", FILE_NAME) ;
+  check (loaded->trees[0]->compactNodes != NULL,
+         "the compact layout was not restored") ;
+  check (memcmp (loaded->data, data, sizeof(float) * DIMENSION * NUM_DATA) == 0) ;
+  check_same_neighbors (forest, loaded, queries) ;
+  vl_kdforest_delete (loaded) ;
+
+  /* corrupted child and data indexes are rejected */
+  check (vl_kdforest_save (forest, FILE_NAME, VL_FALSE) == VL_ERR_OK) ;
+  patch_file (56 + 16, badChild, sizeof(badChild)) ;
+  check (vl_kdforest_load (FILE_NAME, data) == NULL,
+         "loaded a file with an invalid child index") ;
+
+  /* a node that is the child of two nodes is rejected: here the upper
+     child of the root is replaced by the lower child of node 1 */
+  check (forest->trees[0]->nodes[1].lowerChild > 1) ;
+  for (i = 0 ; i < 8 ; ++i) {
+    sharedChild[i] = (unsigned char) (forest->trees[0]->nodes[1].lowerChild >> (8 * i)) ;
+  }
+  check (vl_kdforest_save (forest, FILE_NAME, VL_FALSE) == VL_ERR_OK) ;
+  patch_file (56 + 16 + 8, sharedChild, sizeof(sharedChild)) ;
+  check (vl_kdforest_load (FILE_NAME, data) == NULL,
+         "loaded a file with a node shared by two parents") ;
+
+  check (vl_kdforest_save (forest, FILE_NAME, VL_FALSE) == VL_ERR_OK) ;
+  dataIndexOffset = 56 + 16 + 28 * (long) forest->trees[0]->numUsedNodes ;
+  patch_file (dataIndexOffset, badIndex, sizeof(badIndex)) ;
+  check (vl_kdforest_load (FILE_NAME, data) == NULL,
+         "loaded a file with an invalid data index") ;
+
+  remove (FILE_NAME) ;
+  vl_kdforest_delete (forest) ;
+  vl_free (data) ;
+  vl_free (queries) ;
+  check_signoff () ;
+  return 0 ;
+}
@@ -0,0 +1,188 @@
+/** @file   test_kmeans.c
+ ** @brief  Test k-means clustering
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/kmeans.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <string.h>
+
+#include "check.h"
+
+#define DIMENSION 16
+#define NUM_CLUSTERS 20
+#define NUM_DATA 5000
+
+/* points around NUM_CLUSTERS well separated means */
+float *
+make_data (VlRand * rand)
+{
+  float * data = vl_malloc (sizeof(float) * DIMENSION * NUM_DATA) ;
+  float means [NUM_CLUSTERS * DIMENSION] ;
+  vl_uindex i, d ;
+  for (i = 0 ; i < NUM_CLUSTERS * DIMENSION ; ++i) {
+    means[i] = 10.0f * (float) vl_rand_real1 (rand) ;
+  }
+  for (i = 0 ; i < NUM_DATA ; ++i) {
+    float const * mean = means + (i % NUM_CLUSTERS) * DIMENSION ;
+    for (d = 0 ; d < DIMENSION ; ++d) {
+      data[i * DIMENSION + d] = mean[d] + 0.1f * (float) vl_rand_real1 (rand) ;
+    }
+  }
+  return data ;
+}
+
+double
+cluster (float const * data, VlKMeansAlgorithm algorithm)
+{
+  VlKMeans * kmeans = vl_kmeans_new (VL_TYPE_FLOAT, VlDistanceL2) ;
+  double energy ;
+  vl_rand_seed (vl_get_rand(), 0) ;
+  vl_kmeans_set_algorithm (kmeans, algorithm) ;
+  vl_kmeans_set_initialization (kmeans, VlKMeansPlusPlus) ;
+  vl_kmeans_set_max_num_iterations (kmeans, 20) ;
+  energy = vl_kmeans_cluster (kmeans, data, DIMENSION, NUM_DATA, NUM_CLUSTERS) ;
+  vl_kmeans_delete (kmeans) ;
+  return energy ;
+}
+
+/* ANN k-means must reach nearly the same energy as Lloyd */
+void
+check_ann (float const * data)
+{
+  double lloyd = cluster (data, VlKMeansLloyd) ;
+  double ann = cluster (data, VlKMeansANN) ;
+  check (ann <= lloyd * 1.05 + 1e-6,
+         "ANN energy %g is much larger than Lloyd energy %g", ann, lloyd) ;
+}
+
+/* cluster the data with the given number of threads, returning the
+   centers and the assignments of the data */
+float *
+cluster_with_threads (float const * data, VlKMeansAlgorithm algorithm,
+                      vl_size numThreads, vl_uint32 * assignments)
+{
+  VlKMeans * kmeans = vl_kmeans_new (VL_TYPE_FLOAT, VlDistanceL2) ;
+  float * centers = vl_malloc (sizeof(float) * DIMENSION * NUM_CLUSTERS) ;
+  vl_set_num_threads (numThreads) ;
+  vl_rand_seed (vl_get_rand(), 0) ;
+  vl_kmeans_set_algorithm (kmeans, algorithm) ;
+  vl_kmeans_set_initialization (kmeans, VlKMeansPlusPlus) ;
+  vl_kmeans_set_max_num_iterations (kmeans, 20) ;
+  vl_kmeans_cluster (kmeans, data, DIMENSION, NUM_DATA, NUM_CLUSTERS) ;
+  vl_kmeans_quantize (kmeans, assignments, NULL, data, NUM_DATA) ;
+  memcpy (centers, vl_kmeans_get_centers (kmeans),
+          sizeof(float) * DIMENSION * NUM_CLUSTERS) ;
+  vl_kmeans_delete (kmeans) ;
+  return centers ;
+}
+
+/* the centers and the assignments must not depend on the number of
+   threads */
+void
+check_threads (float const * data, VlKMeansAlgorithm algorithm)
+{
+  vl_uint32 * expectedAssignments = vl_malloc (sizeof(vl_uint32) * NUM_DATA) ;
+  vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * NUM_DATA) ;
+  float * expected = cluster_with_threads (data, algorithm, 1, expectedAssignments) ;
+  float * centers = cluster_with_threads (data, algorithm, 4, assignments) ;
+  check (memcmp (centers, expected,
+                 sizeof(float) * DIMENSION * NUM_CLUSTERS) == 0,
+         "algorithm %d: the centers differ with 4 threads", (int)algorithm) ;
+  check (memcmp (assignments, expectedAssignments,
+                 sizeof(vl_uint32) * NUM_DATA) == 0,
+         "algorithm %d: the assignments differ with 4 threads", (int)algorithm) ;
+  vl_set_num_threads (0) ;
+  vl_free (centers) ;
+  vl_free (expected) ;
+  vl_free (assignments) ;
+  vl_free (expectedAssignments) ;
+}
+
+/* stream the data three times in batches */
+typedef struct _Stream
+{
+  float const * data ;
+  vl_uindex next ;
+} Stream ;
+
+vl_size
+read_batch (void * userData, void * batch, vl_size maxNumData)
+{
+  Stream * stream = userData ;
+  vl_size n = VL_MIN(maxNumData, 3 * NUM_DATA - stream->next) ;
+  vl_uindex i ;
+  for (i = 0 ; i < n ; ++i) {
+    memcpy ((float*)batch + i * DIMENSION,
+            stream->data + ((stream->next + i) % NUM_DATA) * DIMENSION,
+            sizeof(float) * DIMENSION) ;
+  }
+  stream->next += n ;
+  return n ;
+}
+
+/* mini-batch k-means must get close to the Lloyd energy */
+void
+check_minibatch (float const * data)
+{
+  VlKMeans * kmeans = vl_kmeans_new (VL_TYPE_FLOAT, VlDistanceL2) ;
+  Stream stream ;
+  vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * NUM_DATA) ;
+  float * distances = vl_malloc (sizeof(float) * NUM_DATA) ;
+  double lloyd = cluster (data, VlKMeansLloyd) ;
+  double energy = 0 ;
+  vl_uindex i ;
+
+  stream.data = data ;
+  stream.next = 0 ;
+  vl_rand_seed (vl_get_rand(), 0) ;
+  vl_kmeans_set_initialization (kmeans, VlKMeansPlusPlus) ;
+  vl_kmeans_set_minibatch_reassignment_ratio (kmeans, 0.01) ;
+  vl_kmeans_cluster_minibatch (kmeans, read_batch, &stream,
+                               DIMENSION, NUM_CLUSTERS, 500) ;
+  vl_kmeans_quantize (kmeans, assignments, distances, data, NUM_DATA) ;
+  for (i = 0 ; i < NUM_DATA ; ++i) energy += distances[i] ;
+  check (energy <= lloyd * 1.5 + 1e-6,
+         "mini-batch energy %g is much larger than Lloyd energy %g",
+         energy, lloyd) ;
+
+  /* a ratio above one is rejected by the setter; if it is set anyway,
+     no center is reassigned and the masses stay finite */
+  kmeans->minibatchReassignmentRatio = 2 ;
+  vl_kmeans_update_minibatch (kmeans, data, NUM_DATA) ;
+  for (i = 0 ; i < NUM_CLUSTERS ; ++i) {
+    check (kmeans->centerMasses[i] < VL_INFINITY_D,
+           "center %d has infinite mass", (int)i) ;
+  }
+
+  vl_free (assignments) ;
+  vl_free (distances) ;
+  vl_kmeans_delete (kmeans) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  VlRand rand ;
+  float * data ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  data = make_data (&rand) ;
+  check_threads (data, VlKMeansLloyd) ;
+  check_threads (data, VlKMeansElkan) ;
+  check_ann (data) ;
+  check_minibatch (data) ;
+  vl_free (data) ;
+  check_signoff () ;
+  return 0 ;
+}
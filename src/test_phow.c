@@ -0,0 +1,162 @@
+/** @file   test_phow.c
+ ** @brief  Test PHOW features
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/phow.h>
+#include <vl/dsift.h>
+#include <vl/imopv.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <string.h>
+
+#include "check.h"
+
+#define WIDTH 120
+#define HEIGHT 90
+#define DESCRIPTOR_SIZE 128
+
+float *
+make_image (vl_size numChannels)
+{
+  float * image = vl_malloc (sizeof(float) * WIDTH * HEIGHT * numChannels) ;
+  VlRand rand ;
+  vl_uindex i ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (i = 0 ; i < WIDTH * HEIGHT * numChannels ; ++i) {
+    image[i] = (float) vl_rand_real1 (&rand) ;
+  }
+  return image ;
+}
+
+/* without shared gradients, each bin size must give the descriptors of
+   dense SIFT on the image smoothed as in vl_phow */
+void
+check_dsift (float const * image)
+{
+  vl_size const sizes [2] = {4, 8} ;
+  VlPhow * phow = vl_phow_new (WIDTH, HEIGHT, VL_PHOW_GRAY) ;
+  float * smoothed = vl_malloc (sizeof(float) * WIDTH * HEIGHT) ;
+  VlDsiftKeypoint const * frames ;
+  float const * descrs ;
+  vl_uindex si, i, offset = 0 ;
+
+  vl_phow_set_sizes (phow, sizes, 2) ;
+  vl_phow_set_contrast_threshold (phow, 0) ;
+  vl_phow_set_shared_gradients (phow, VL_FALSE) ;
+  check (vl_phow_process (phow, image) == VL_ERR_OK) ;
+  frames = vl_phow_get_frames (phow) ;
+  descrs = vl_phow_get_descriptors (phow) ;
+
+  for (si = 0 ; si < 2 ; ++si) {
+    VlDsiftFilter * dsift = vl_dsift_new (WIDTH, HEIGHT) ;
+    VlDsiftDescriptorGeometry geom = *vl_dsift_get_geometry (dsift) ;
+    int start = (int) (3 * (sizes[1] - sizes[si]) / 2) ;
+    double sigma = (double) sizes[si] / vl_phow_get_magnif (phow) ;
+    vl_size numFrames ;
+
+    geom.binSizeX = (int) sizes[si] ;
+    geom.binSizeY = (int) sizes[si] ;
+    vl_dsift_set_geometry (dsift, &geom) ;
+    vl_dsift_set_steps (dsift, 2, 2) ;
+    vl_dsift_set_bounds (dsift, start, start, WIDTH - 1, HEIGHT - 1) ;
+    vl_dsift_set_flat_window (dsift, VL_TRUE) ;
+    vl_dsift_set_window_size (dsift, 1.5) ;
+    vl_imsmooth_f (smoothed, WIDTH, image, WIDTH, HEIGHT, WIDTH, sigma, sigma) ;
+    vl_dsift_process (dsift, smoothed) ;
+
+    numFrames = vl_dsift_get_keypoint_num (dsift) ;
+    check (offset + numFrames <= vl_phow_get_num_frames (phow)) ;
+    for (i = 0 ; i < numFrames ; ++i) {
+      VlDsiftKeypoint const * frame = frames + offset + i ;
+      VlDsiftKeypoint const * expected = vl_dsift_get_keypoints (dsift) + i ;
+      check (frame->x == expected->x && frame->y == expected->y &&
+             frame->norm == expected->norm && frame->s == (double) sizes[si],
+             "size %d, frame %d differs", (int)sizes[si], (int)i) ;
+    }
+    check (memcmp (descrs + offset * DESCRIPTOR_SIZE,
+                   vl_dsift_get_descriptors (dsift),
+                   sizeof(float) * DESCRIPTOR_SIZE * numFrames) == 0,
+           "size %d: the descriptors differ from dense SIFT", (int)sizes[si]) ;
+    offset += numFrames ;
+    vl_dsift_delete (dsift) ;
+  }
+  check (offset > 0 && offset == vl_phow_get_num_frames (phow),
+         "%d frames instead of %d",
+         (int)vl_phow_get_num_frames (phow), (int)offset) ;
+
+  vl_free (smoothed) ;
+  vl_phow_delete (phow) ;
+}
+
+/* each channel of an RGB image with equal channels must give the
+   descriptors of the gray-scale image */
+void
+check_color (float const * image)
+{
+  VlPhow * gray = vl_phow_new (WIDTH, HEIGHT, VL_PHOW_GRAY) ;
+  VlPhow * rgb = vl_phow_new (WIDTH, HEIGHT, VL_PHOW_RGB) ;
+  float * color = vl_malloc (sizeof(float) * WIDTH * HEIGHT * 3) ;
+  vl_uindex i, k ;
+
+  for (k = 0 ; k < 3 ; ++k) {
+    memcpy (color + k * WIDTH * HEIGHT, image, sizeof(float) * WIDTH * HEIGHT) ;
+  }
+  vl_phow_set_contrast_threshold (gray, 0) ;
+  vl_phow_set_contrast_threshold (rgb, 0) ;
+  check (vl_phow_process (gray, image) == VL_ERR_OK) ;
+  check (vl_phow_process (rgb, color) == VL_ERR_OK) ;
+  check (vl_phow_get_descriptor_size (rgb) == 3 * DESCRIPTOR_SIZE) ;
+  check (vl_phow_get_num_frames (rgb) == vl_phow_get_num_frames (gray)) ;
+  for (i = 0 ; i < vl_phow_get_num_frames (gray) ; ++i) {
+    for (k = 0 ; k < 3 ; ++k) {
+      check (memcmp (vl_phow_get_descriptors (rgb) + (3 * i + k) * DESCRIPTOR_SIZE,
+                     vl_phow_get_descriptors (gray) + i * DESCRIPTOR_SIZE,
+                     sizeof(float) * DESCRIPTOR_SIZE) == 0,
+             "frame %d, channel %d differs", (int)i, (int)k) ;
+    }
+  }
+
+  vl_free (color) ;
+  vl_phow_delete (gray) ;
+  vl_phow_delete (rgb) ;
+}
+
+/* invalid bin sizes are rejected and leave the sizes unchanged */
+void
+check_sizes (void)
+{
+  VlPhow * phow = vl_phow_new (WIDTH, HEIGHT, VL_PHOW_GRAY) ;
+  vl_size const sizes [2] = {4, 0} ;
+  vl_size numSizes ;
+  vl_size const * current ;
+
+  check (vl_phow_set_sizes (phow, sizes, 2) == VL_ERR_BAD_ARG,
+         "a zero bin size was accepted") ;
+  current = vl_phow_get_sizes (phow, &numSizes) ;
+  check (numSizes == 4 && current[0] == 4 && current[3] == 10,
+         "the sizes were changed") ;
+  vl_phow_delete (phow) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  float * image = make_image (1) ;
+  check_dsift (image) ;
+  check_color (image) ;
+  check_sizes () ;
+  vl_free (image) ;
+  check_signoff () ;
+  return 0 ;
+}
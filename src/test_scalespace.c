@@ -0,0 +1,174 @@
+/** @file   test_scalespace.c
+ ** @brief  Test the lazy mode of the scale space
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/scalespace.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+
+#define WIDTH 131
+#define HEIGHT 97
+
+float *
+make_image (void)
+{
+  float * image = vl_malloc (sizeof(float) * WIDTH * HEIGHT) ;
+  VlRand rand ;
+  vl_uindex i ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (i = 0 ; i < WIDTH * HEIGHT ; ++i) {
+    image[i] = (float) vl_rand_real1 (&rand) ;
+  }
+  return image ;
+}
+
+VlScaleSpace *
+new_scalespace (float const * image, vl_index firstOctave, vl_bool lazy)
+{
+  VlScaleSpace * scalespace = vl_scalespace_new (WIDTH, HEIGHT, -1, firstOctave, 3, -1, 3) ;
+  vl_scalespace_set_lazy (scalespace, lazy) ;
+  check (vl_scalespace_get_lazy (scalespace) == lazy) ;
+  check (vl_scalespace_put_image (scalespace, image) == VL_ERR_OK) ;
+  return scalespace ;
+}
+
+/* the two scale spaces must have identical levels */
+void
+check_same_levels (VlScaleSpace * a, VlScaleSpace * b, char const * what)
+{
+  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry (a) ;
+  vl_index o, s ;
+  for (o = geom.firstOctave ; o <= geom.lastOctave ; ++o) {
+    VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry (a, o) ;
+    for (s = geom.octaveFirstSubdivision ; s <= geom.octaveLastSubdivision ; ++s) {
+      check (memcmp (vl_scalespace_get_level (a, o, s),
+                     vl_scalespace_get_level (b, o, s),
+                     sizeof(float) * ogeom.width * ogeom.height) == 0,
+             "first octave %d: %s, octave %d level %d differs",
+             (int)geom.firstOctave, what, (int)o, (int)s) ;
+    }
+  }
+}
+
+/* the levels must not depend on the order in which they are
+   accessed */
+void
+check_order (float const * image, vl_index firstOctave)
+{
+  VlScaleSpace * forward = new_scalespace (image, firstOctave, VL_TRUE) ;
+  VlScaleSpace * backward = new_scalespace (image, firstOctave, VL_TRUE) ;
+  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry (backward) ;
+  vl_index o, s ;
+
+  /* the coarsest levels first, so that each level is computed
+     together with the levels it depends on */
+  for (o = geom.lastOctave ; o >= geom.firstOctave ; --o) {
+    for (s = geom.octaveLastSubdivision ; s >= geom.octaveFirstSubdivision ; --s) {
+      check (vl_scalespace_get_level (backward, o, s) != NULL) ;
+    }
+  }
+  check_same_levels (forward, backward, "backward access") ;
+  vl_scalespace_delete (forward) ;
+  vl_scalespace_delete (backward) ;
+}
+
+/* without upsampled octaves, the lazy mode must match the normal
+   mode exactly */
+void
+check_normal (float const * image, vl_index firstOctave)
+{
+  VlScaleSpace * normal = new_scalespace (image, firstOctave, VL_FALSE) ;
+  VlScaleSpace * lazy = new_scalespace (image, firstOctave, VL_TRUE) ;
+  check_same_levels (normal, lazy, "lazy mode") ;
+  vl_scalespace_delete (normal) ;
+  vl_scalespace_delete (lazy) ;
+}
+
+/* sampling a coarse level must not allocate the upsampled octave
+   nor the octaves after the sampled one */
+void
+check_allocation (float const * image)
+{
+  VlScaleSpace * scalespace = new_scalespace (image, -1, VL_TRUE) ;
+  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry (scalespace) ;
+  vl_index o ;
+
+  check (geom.lastOctave >= 2) ;
+  for (o = geom.firstOctave ; o <= geom.lastOctave ; ++o) {
+    check (scalespace->octaves[o - geom.firstOctave] == NULL,
+           "octave %d allocated by vl_scalespace_put_image", (int)o) ;
+  }
+  check (vl_scalespace_get_level (scalespace, 1, 0) != NULL) ;
+  for (o = geom.firstOctave ; o <= geom.lastOctave ; ++o) {
+    check ((scalespace->octaves[o - geom.firstOctave] != NULL) == (o == 0 || o == 1),
+           "octave %d is %s", (int)o,
+           scalespace->octaves[o - geom.firstOctave] ? "allocated" : "not allocated") ;
+  }
+  check (scalespace->scratch == NULL, "the scratch buffer was allocated") ;
+  vl_scalespace_delete (scalespace) ;
+}
+
+/* a level that cannot be allocated is reported and not marked as
+   computed, so that it is computed when the memory is available */
+vl_bool failAllocations = VL_FALSE ;
+
+void *
+failing_malloc (size_t size)
+{
+  return failAllocations ? NULL : malloc (size) ;
+}
+
+void
+check_allocation_failure (float const * image)
+{
+  VlScaleSpace * scalespace = new_scalespace (image, -1, VL_TRUE) ;
+  VlScaleSpace * expected = new_scalespace (image, -1, VL_TRUE) ;
+  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry (scalespace) ;
+  vl_size numLevels = (geom.lastOctave - geom.firstOctave + 1) *
+    (geom.octaveLastSubdivision - geom.octaveFirstSubdivision + 1) ;
+  vl_uindex i ;
+
+  vl_set_alloc_func (failing_malloc, realloc, calloc, free) ;
+  failAllocations = VL_TRUE ;
+  check (vl_scalespace_get_level (scalespace, 1, 0) == NULL,
+         "a level was returned without memory") ;
+  failAllocations = VL_FALSE ;
+  for (i = 0 ; i < numLevels ; ++i) {
+    check (! scalespace->computed[i], "level %d marked as computed", (int)i) ;
+  }
+  check_same_levels (expected, scalespace, "after an allocation failure") ;
+  vl_set_alloc_func (malloc, realloc, calloc, free) ;
+  vl_scalespace_delete (scalespace) ;
+  vl_scalespace_delete (expected) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  float * image = make_image () ;
+  check_order (image, -1) ;
+  check_order (image, 0) ;
+  check_order (image, 1) ;
+  check_normal (image, 0) ;
+  check_normal (image, 1) ;
+  check_allocation (image) ;
+  check_allocation_failure (image) ;
+  vl_free (image) ;
+  check_signoff () ;
+  return 0 ;
+}
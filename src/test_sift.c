@@ -0,0 +1,468 @@
+/** @file   test_sift.c
+ ** @brief  Test SIFT extraction
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <vl/sift.h>
+#include <vl/random.h>
+#include <vl/generic.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+
+#define WIDTH 200
+#define HEIGHT 160
+#define NUM_BLOBS 60
+
+/* random Gaussian blobs of various sizes */
+vl_sift_pix *
+make_image (int width, int height, int numBlobs)
+{
+  vl_sift_pix * image = vl_calloc (width * height, sizeof(vl_sift_pix)) ;
+  VlRand rand ;
+  vl_uindex b ;
+  int x, y ;
+  vl_rand_init (&rand) ;
+  vl_rand_seed (&rand, 1) ;
+  for (b = 0 ; b < (vl_uindex) numBlobs ; ++b) {
+    double cx = width * vl_rand_real1 (&rand) ;
+    double cy = height * vl_rand_real1 (&rand) ;
+    double sigma = 1.5 + 8 * vl_rand_real1 (&rand) ;
+    double a = vl_rand_real1 (&rand) - 0.5 ;
+    for (y = 0 ; y < height ; ++y) {
+      for (x = 0 ; x < width ; ++x) {
+        double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy) ;
+        image [x + y * width] += (vl_sift_pix) (a * exp (- 0.5 * r2 / (sigma * sigma))) ;
+      }
+    }
+  }
+  return image ;
+}
+
+/* run the sequential pipeline octave by octave */
+vl_size
+extract_sequentially (VlSiftFilt * f, vl_sift_pix const * image,
+                      double ** frames, vl_sift_pix ** descriptors)
+{
+  vl_size numFrames = 0 ;
+  int err = vl_sift_process_first_octave (f, image) ;
+  *frames = NULL ;
+  *descriptors = NULL ;
+  while (err != VL_ERR_EOF) {
+    VlSiftKeypoint const * keys ;
+    int i, q, numKeys ;
+    vl_sift_detect (f) ;
+    keys = vl_sift_get_keypoints (f) ;
+    numKeys = vl_sift_get_nkeypoints (f) ;
+    for (i = 0 ; i < numKeys ; ++i) {
+      double angles [4] ;
+      int numAngles = vl_sift_calc_keypoint_orientations (f, angles, keys + i) ;
+      *frames = vl_realloc (*frames, sizeof(double) * 4 * (numFrames + numAngles)) ;
+      *descriptors = vl_realloc (*descriptors,
+                                 sizeof(vl_sift_pix) * 128 * (numFrames + numAngles)) ;
+      for (q = 0 ; q < numAngles ; ++q) {
+        double * frame = *frames + 4 * numFrames ;
+        frame[0] = keys[i].x ;
+        frame[1] = keys[i].y ;
+        frame[2] = keys[i].sigma ;
+        frame[3] = angles[q] ;
+        vl_sift_calc_keypoint_descriptor (f, *descriptors + 128 * numFrames,
+                                          keys + i, angles[q]) ;
+        numFrames ++ ;
+      }
+    }
+    err = vl_sift_process_next_octave (f) ;
+  }
+  return numFrames ;
+}
+
+/* vl_sift_extract must match the sequential pipeline exactly */
+void
+check_extract (vl_sift_pix const * image, vl_size numThreads)
+{
+  VlSiftFilt * f = vl_sift_new (WIDTH, HEIGHT, -1, 3, -1) ;
+  double * frames, * expectedFrames ;
+  vl_sift_pix * descriptors, * expectedDescriptors ;
+  vl_size numFrames, numExpectedFrames ;
+
+  vl_set_num_threads (numThreads) ;
+  numExpectedFrames = extract_sequentially (f, image, &expectedFrames,
+                                            &expectedDescriptors) ;
+  numFrames = vl_sift_extract (f, image, &frames, &descriptors) ;
+
+  check (numExpectedFrames > 0, "no frames detected") ;
+  check (numFrames == numExpectedFrames,
+         "%d threads: %d frames instead of %d", (int)numThreads,
+         (int)numFrames, (int)numExpectedFrames) ;
+  check (memcmp (frames, expectedFrames, sizeof(double) * 4 * numFrames) == 0,
+         "%d threads: the frames differ", (int)numThreads) ;
+  check (memcmp (descriptors, expectedDescriptors,
+                 sizeof(vl_sift_pix) * 128 * numFrames) == 0,
+         "%d threads: the descriptors differ", (int)numThreads) ;
+
+  vl_free (frames) ;
+  vl_free (descriptors) ;
+  vl_free (expectedFrames) ;
+  vl_free (expectedDescriptors) ;
+  vl_sift_delete (f) ;
+}
+
+/* the vectorized descriptors must match the scalar ones up to the
+   single precision rounding */
+void
+check_simd (vl_sift_pix const * image)
+{
+  VlSiftFilt * f = vl_sift_new (WIDTH, HEIGHT, -1, 3, -1) ;
+  vl_bool simdEnabled = vl_get_simd_enabled () ;
+  double maxDifference = 0 ;
+  int err = vl_sift_process_first_octave (f, image) ;
+  while (err != VL_ERR_EOF) {
+    VlSiftKeypoint const * keys ;
+    int i, q, j ;
+    vl_sift_detect (f) ;
+    keys = vl_sift_get_keypoints (f) ;
+    for (i = 0 ; i < vl_sift_get_nkeypoints (f) ; ++i) {
+      double angles [4] ;
+      int numAngles = vl_sift_calc_keypoint_orientations (f, angles, keys + i) ;
+      for (q = 0 ; q < numAngles ; ++q) {
+        vl_sift_pix simd [128], scalar [128] ;
+        vl_set_simd_enabled (VL_TRUE) ;
+        vl_sift_calc_keypoint_descriptor (f, simd, keys + i, angles[q]) ;
+        vl_set_simd_enabled (VL_FALSE) ;
+        vl_sift_calc_keypoint_descriptor (f, scalar, keys + i, angles[q]) ;
+        for (j = 0 ; j < 128 ; ++j) {
+          maxDifference = VL_MAX(maxDifference, fabs (simd[j] - scalar[j])) ;
+        }
+      }
+    }
+    err = vl_sift_process_next_octave (f) ;
+  }
+  vl_set_simd_enabled (simdEnabled) ;
+  check (maxDifference < 1e-5,
+         "SIMD and scalar descriptors differ by %g", maxDifference) ;
+  vl_sift_delete (f) ;
+}
+
+/* decode an IEEE half precision number */
+double
+half_to_double (vl_uint16 h)
+{
+  int exponent = (h >> 10) & 0x1f ;
+  double mantissa = h & 0x3ff ;
+  double x ;
+  if (exponent == 0) x = ldexp (mantissa, -24) ;
+  else x = ldexp (mantissa + 1024, exponent - 25) ;
+  return (h & 0x8000) ? - x : x ;
+}
+
+/* the packed formats must follow their definitions */
+void
+check_pack (vl_sift_pix const * image)
+{
+  VlSiftFilt * f = vl_sift_new (WIDTH, HEIGHT, -1, 3, -1) ;
+  VlSiftKeypoint const * keys ;
+  vl_size const stride = 512 ;
+  int const formats [] = {VL_SIFT_DESCR_FLOAT, VL_SIFT_DESCR_UINT8,
+                          VL_SIFT_DESCR_FLOAT16} ;
+  unsigned char * packed ;
+  double * angles ;
+  int numKeys, i, j, k, root ;
+
+  vl_sift_process_first_octave (f, image) ;
+  vl_sift_detect (f) ;
+  keys = vl_sift_get_keypoints (f) ;
+  numKeys = vl_sift_get_nkeypoints (f) ;
+  check (numKeys > 0, "no keypoints detected") ;
+  packed = vl_malloc (stride * numKeys) ;
+  angles = vl_malloc (sizeof(double) * numKeys) ;
+  for (i = 0 ; i < numKeys ; ++i) {
+    double keyAngles [4] = {0, 0, 0, 0} ;
+    vl_sift_calc_keypoint_orientations (f, keyAngles, keys + i) ;
+    angles[i] = keyAngles[0] ;
+  }
+
+  check (vl_sift_get_descriptor_size (VL_SIFT_DESCR_FLOAT) == 128 * sizeof(float)) ;
+  check (vl_sift_get_descriptor_size (VL_SIFT_DESCR_UINT8 | VL_SIFT_DESCR_ROOT) == 128) ;
+  check (vl_sift_get_descriptor_size (VL_SIFT_DESCR_FLOAT16) == 128 * 2) ;
+
+  for (root = 0 ; root < 2 ; ++root) {
+    for (k = 0 ; k < 3 ; ++k) {
+      int format = formats[k] | (root ? VL_SIFT_DESCR_ROOT : 0) ;
+      int maxByte = 0 ;
+      vl_sift_calc_keypoint_descriptors (f, packed, stride, format,
+                                         keys, angles, numKeys) ;
+      for (i = 0 ; i < numKeys ; ++i) {
+        vl_sift_pix descr [128] ;
+        double l1 = 0 ;
+        void const * dst = packed + i * stride ;
+        vl_sift_calc_keypoint_descriptor (f, descr, keys + i, angles[i]) ;
+        for (j = 0 ; j < 128 ; ++j) l1 += descr[j] ;
+        for (j = 0 ; j < 128 ; ++j) {
+          double x = root ? sqrt (descr[j] / l1) : descr[j] ;
+          switch (formats[k]) {
+            case VL_SIFT_DESCR_FLOAT :
+              check (fabs (((float const*)dst)[j] - x) < 1e-6,
+                     "format %d: float component differs", format) ;
+              break ;
+            case VL_SIFT_DESCR_UINT8 :
+            {
+              double y = (root ? 255 : 512) * x ;
+              int b = ((vl_uint8 const*)dst)[j] ;
+              check (b == (int) VL_MIN(y, 255) || fabs (b - y) < 1e-3,
+                     "format %d: byte %d instead of %g", format, b, y) ;
+              maxByte = VL_MAX(maxByte, b) ;
+              break ;
+            }
+            case VL_SIFT_DESCR_FLOAT16 :
+              check (fabs (half_to_double (((vl_uint16 const*)dst)[j]) - x)
+                     <= x * 1e-3 + 1e-7,
+                     "format %d: half component differs", format) ;
+              break ;
+          }
+        }
+      }
+      /* RootSIFT bytes must not saturate */
+      if (root && formats[k] == VL_SIFT_DESCR_UINT8) {
+        check (maxByte > 0 && maxByte < 255,
+               "RootSIFT bytes range up to %d", maxByte) ;
+      }
+    }
+  }
+
+  /* a descriptor concentrated in one bin maps to the largest byte */
+  {
+    vl_sift_pix descr [128] ;
+    vl_uint8 bytes [128] ;
+    memset (descr, 0, sizeof(descr)) ;
+    descr[5] = 1 ;
+    vl_sift_pack_descriptor (bytes, VL_SIFT_DESCR_UINT8 | VL_SIFT_DESCR_ROOT, descr) ;
+    check (bytes[5] == 255 && bytes[4] == 0, "RootSIFT byte %d", bytes[5]) ;
+  }
+
+  vl_free (packed) ;
+  vl_free (angles) ;
+  vl_sift_delete (f) ;
+}
+
+/* read a tile of an image in memory */
+typedef struct _Image
+{
+  vl_sift_pix const * pixels ;
+  vl_size width ;
+} Image ;
+
+void
+read_tile (void * data, vl_sift_pix * tile,
+           vl_index x, vl_index y, vl_size width, vl_size height)
+{
+  Image const * image = data ;
+  vl_uindex i ;
+  for (i = 0 ; i < height ; ++i) {
+    memcpy (tile + i * width, image->pixels + (y + i) * image->width + x,
+            sizeof(vl_sift_pix) * width) ;
+  }
+}
+
+/* sort frames (and their descriptors) by position */
+typedef struct _Frame
+{
+  double const * frame ;
+  vl_sift_pix const * descriptor ;
+} Frame ;
+
+int
+compare_frames (void const * a, void const * b)
+{
+  double const * fa = ((Frame const *) a)->frame ;
+  double const * fb = ((Frame const *) b)->frame ;
+  int i ;
+  for (i = 0 ; i < 4 ; ++i) {
+    /* the tile coordinates are rounded to single precision */
+    if (fabs (fa[i] - fb[i]) > 1e-3) return (fa[i] < fb[i]) ? -1 : 1 ;
+  }
+  return 0 ;
+}
+
+Frame *
+sort_frames (double const * frames, vl_sift_pix const * descriptors, vl_size n)
+{
+  Frame * sorted = vl_malloc (sizeof(Frame) * n) ;
+  vl_uindex i ;
+  for (i = 0 ; i < n ; ++i) {
+    sorted[i].frame = frames + 4 * i ;
+    sorted[i].descriptor = descriptors + 128 * i ;
+  }
+  qsort (sorted, n, sizeof(Frame), compare_frames) ;
+  return sorted ;
+}
+
+/* the tiles must give the same frames as the whole image */
+void
+check_tiled (void)
+{
+  int const width = 500, height = 420 ;
+  vl_sift_pix * pixels = make_image (width, height, 300) ;
+  VlSiftFilt * f = vl_sift_new (width, height, 1, 3, 0) ;
+  VlSiftFilt * tileFilt = vl_sift_new (256, 240, 1, 3, 0) ;
+  Image image ;
+  double * frames, * tileFrames ;
+  vl_sift_pix * descriptors, * tileDescriptors ;
+  vl_size numFrames, numTileFrames ;
+  Frame * sorted, * tileSorted ;
+  vl_uindex i, j ;
+  int err ;
+
+  image.pixels = pixels ;
+  image.width = width ;
+  numFrames = vl_sift_extract (f, pixels, &frames, &descriptors) ;
+  err = vl_sift_extract_tiled (tileFilt, width, height, read_tile, &image,
+                               &tileFrames, &tileDescriptors, &numTileFrames) ;
+  check (err == VL_ERR_OK, "tiled extraction failed (%d)", err) ;
+  check (numFrames > 0, "no frames detected") ;
+  check (numTileFrames == numFrames, "%d tiled frames instead of %d",
+         (int)numTileFrames, (int)numFrames) ;
+  check (tileFilt->width == 256 && tileFilt->height == 240,
+         "the filter size was not restored") ;
+
+  sorted = sort_frames (frames, descriptors, numFrames) ;
+  tileSorted = sort_frames (tileFrames, tileDescriptors, numTileFrames) ;
+  for (i = 0 ; i < numFrames ; ++i) {
+    check (compare_frames (sorted + i, tileSorted + i) == 0,
+           "frame %d differs", (int)i) ;
+    for (j = 0 ; j < 128 ; ++j) {
+      check (fabs (sorted[i].descriptor[j] - tileSorted[i].descriptor[j]) < 1e-3,
+             "descriptor %d differs", (int)i) ;
+    }
+  }
+
+  /* a filter smaller than the halo is rejected */
+  vl_free (tileFrames) ;
+  vl_free (tileDescriptors) ;
+  vl_sift_delete (tileFilt) ;
+  tileFilt = vl_sift_new (150, 150, 1, 3, 0) ;
+  err = vl_sift_extract_tiled (tileFilt, width, height, read_tile, &image,
+                               &tileFrames, &tileDescriptors, &numTileFrames) ;
+  check (err == VL_ERR_BAD_ARG && numTileFrames == 0,
+         "a filter smaller than the halo was accepted") ;
+
+  vl_free (sorted) ;
+  vl_free (tileSorted) ;
+  vl_free (frames) ;
+  vl_free (descriptors) ;
+  vl_sift_delete (f) ;
+  vl_sift_delete (tileFilt) ;
+  vl_free (pixels) ;
+}
+
+/* the keypoint budget must retain the strongest keypoints of the image */
+#define BUDGET 20
+
+int
+compare_scores (void const * a, void const * b)
+{
+  float x = *(float const *) a ;
+  float y = *(float const *) b ;
+  return (x < y) - (x > y) ;
+}
+
+void
+check_budget (vl_sift_pix const * image)
+{
+  VlSiftFilt * f = vl_sift_new (WIDTH, HEIGHT, -1, 3, -1) ;
+  double * keys = NULL ;
+  float * scores = NULL ;
+  double * frames ;
+  vl_size numKeys = 0, numFrames, numRetained = 0 ;
+  vl_uindex i, j ;
+  float threshold ;
+  int err ;
+
+  /* all the keypoints with their DoG scores */
+  err = vl_sift_process_first_octave (f, image) ;
+  while (err != VL_ERR_EOF) {
+    int n ;
+    vl_sift_detect (f) ;
+    n = vl_sift_get_nkeypoints (f) ;
+    keys = vl_realloc (keys, sizeof(double) * 3 * (numKeys + n)) ;
+    scores = vl_realloc (scores, sizeof(float) * (numKeys + n)) ;
+    for (i = 0 ; i < (unsigned) n ; ++i, ++numKeys) {
+      keys[3 * numKeys + 0] = f->keys[i].x ;
+      keys[3 * numKeys + 1] = f->keys[i].y ;
+      keys[3 * numKeys + 2] = f->keys[i].sigma ;
+      scores[numKeys] = (float) fabs (f->keyPeaks[i]) ;
+    }
+    err = vl_sift_process_next_octave (f) ;
+  }
+  check (numKeys > BUDGET, "only %d keypoints detected", (int)numKeys) ;
+
+  /* the frames of the budget must be among the BUDGET strongest */
+  {
+    float * sorted = vl_malloc (sizeof(float) * numKeys) ;
+    memcpy (sorted, scores, sizeof(float) * numKeys) ;
+    qsort (sorted, numKeys, sizeof(float), compare_scores) ;
+    threshold = sorted [BUDGET - 1] ;
+    vl_free (sorted) ;
+  }
+  vl_sift_set_keypoint_budget (f, BUDGET) ;
+  numFrames = vl_sift_extract (f, image, &frames, NULL) ;
+  check (numFrames >= BUDGET, "%d frames for a budget of %d",
+         (int)numFrames, BUDGET) ;
+  for (i = 0 ; i < numFrames ; ++i) {
+    double const * frame = frames + 4 * i ;
+    for (j = 0 ; j < numKeys ; ++j) {
+      if (keys[3*j] == frame[0] && keys[3*j+1] == frame[1] &&
+          keys[3*j+2] == frame[2]) break ;
+    }
+    check (j < numKeys && scores[j] >= threshold,
+           "frame %d is not among the strongest keypoints", (int)i) ;
+    if (i == 0 || memcmp (frame, frame - 4, sizeof(double) * 3)) {
+      numRetained ++ ;
+    }
+  }
+  check (numRetained == BUDGET, "%d keypoints retained instead of %d",
+         (int)numRetained, BUDGET) ;
+  vl_free (frames) ;
+
+  /* raising the budget in the middle of an image takes effect from
+     the next image only */
+  vl_sift_set_keypoint_budget (f, 5) ;
+  err = vl_sift_process_first_octave (f, image) ;
+  vl_sift_set_keypoint_budget (f, 10 * numKeys) ;
+  while (err != VL_ERR_EOF) {
+    vl_sift_detect (f) ;
+    check (vl_sift_get_nkeypoints (f) <= 5, "the budget was exceeded") ;
+    err = vl_sift_process_next_octave (f) ;
+  }
+  check (f->budgetHeapNumNodes == 5, "%d keypoints in the budget",
+         (int)f->budgetHeapNumNodes) ;
+
+  vl_free (keys) ;
+  vl_free (scores) ;
+  vl_sift_delete (f) ;
+}
+
+int
+main (int argc VL_UNUSED, char ** argv VL_UNUSED)
+{
+  vl_sift_pix * image = make_image (WIDTH, HEIGHT, NUM_BLOBS) ;
+  check_extract (image, 1) ;
+  check_extract (image, 4) ;
+  check_simd (image) ;
+  check_pack (image) ;
+  check_budget (image) ;
+  check_tiled () ;
+  vl_free (image) ;
+  check_signoff () ;
+  return 0 ;
+}
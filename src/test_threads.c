@@ -13,8 +13,57 @@ the terms of the BSD license (see the COPYING file).
 
 #include <vl/generic.h>
 #include <vl/random.h>
+#include <vl/threads.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_ELEMENTS 100000
+#define GRAIN_SIZE 1000
+
+typedef struct _TestLoop
+{
+  double * partialSums ;
+  vl_size numSlots ;
+  vl_size maxSlot ;
+} TestLoop ;
+
+void
+testLoopBody (void * data, vl_uindex begin, vl_uindex end, vl_uindex slot)
+{
+  TestLoop * loop = data ;
+  double sum = 0 ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++i) sum += 1.0 / (i + 1) ;
+  loop->partialSums[begin / GRAIN_SIZE] = sum ;
+  if (slot >= loop->numSlots) {
+    printf("Slot %d out of range\n", (int)slot) ;
+    abort() ;
+  }
+}
+
+void
+testTask (void * data)
+{
+  vl_uint32 * counter = data ;
+  *counter = vl_rand_uint32(vl_get_rand()) | 1 ;
+}
+
+double
+testParallelFor (vl_size numThreads)
+{
+  TestLoop loop ;
+  double sum = 0 ;
+  vl_uindex i ;
+  vl_size numChunks = (NUM_ELEMENTS + GRAIN_SIZE - 1) / GRAIN_SIZE ;
+  vl_set_num_threads (numThreads) ;
+  loop.partialSums = vl_calloc(numChunks, sizeof(double)) ;
+  loop.numSlots = vl_get_max_threads() ;
+  vl_parallel_for (NUM_ELEMENTS, GRAIN_SIZE, testLoopBody, &loop) ;
+  for (i = 0 ; i < numChunks ; ++i) sum += loop.partialSums[i] ;
+  vl_free (loop.partialSums) ;
+  return sum ;
+}
 
 #if defined(VL_THREADS_POSIX)
 
@@ -85,6 +134,45 @@ main(int argc VL_UNUSED, char** argv VL_UNUSED)
 #else
   printf("VLFeat was compiled without threading support\n") ;
 #endif
+  {
+    double sum1 = testParallelFor (1) ;
+    double sum4 = testParallelFor (4) ;
+    double sum16 = testParallelFor (16) ;
+    printf("Parallel for: %.17g %.17g %.17g\n", sum1, sum4, sum16) ;
+    if (sum1 != sum4 || sum1 != sum16) {
+      printf("Parallel for: results depend on the number of threads\n") ;
+      abort() ;
+    }
+  }
+  {
+    vl_uint32 values [32] = {0} ;
+    vl_uindex k ;
+    VlTaskGroup * group = vl_task_group_new () ;
+    for (k = 0 ; k < sizeof(values) / sizeof(values[0]) ; ++k) {
+      vl_task_group_run (group, testTask, values + k) ;
+    }
+    vl_task_group_wait (group) ;
+    for (k = 0 ; k < sizeof(values) / sizeof(values[0]) ; ++k) {
+      if (values[k] == 0) {
+        printf("Task group: task %d did not run\n", (int)k) ;
+        abort() ;
+      }
+    }
+    vl_task_group_delete (group) ;
+    printf("Task group: ok\n") ;
+  }
+  {
+    double sum4 = testParallelFor (4) ;
+    double sum4b ;
+    vl_thread_pool_shutdown () ;
+    sum4b = testParallelFor (4) ;
+    vl_thread_pool_shutdown () ;
+    if (sum4 != sum4b) {
+      printf("Shutdown: the pool was not recreated correctly\n") ;
+      abort() ;
+    }
+    printf("Shutdown: ok\n") ;
+  }
   {
     char * string = vl_configuration_to_string_copy() ;
     printf("%s", string) ;
@@ -7,6 +7,12 @@
 
 #include <vl/random.h>
 #include <vl/mathop.h>
+#include <vl/mathop_sse2.h>
+#include <vl/mathop_avx2.h>
+#include <vl/mathop_avx512.h>
+#include <vl/generic.h>
+
+#include <stdlib.h>
 
 void
 init_data (vl_size numDimensions, vl_size numSamples, float ** X, float ** Y)
@@ -21,6 +27,213 @@ init_data (vl_size numDimensions, vl_size numSamples, float ** X, float ** Y)
   }
 }
 
+#define NUM_TYPES 6
+
+VlVectorComparisonType types [NUM_TYPES] = {
+  VlDistanceL2, VlDistanceL1, VlDistanceChi2,
+  VlKernelL2, VlKernelL1, VlKernelChi2} ;
+
+char const * typeNames [NUM_TYPES] = {
+  "L2", "L1", "Chi2", "KL2", "KL1", "KChi2"} ;
+
+/* check a SIMD comparison function against the scalar one */
+void
+check_f (char const * name, VlFloatVectorComparisonFunction f,
+         VlFloatVectorComparisonFunction g,
+         float const * X, float const * Y)
+{
+  vl_uindex dimension ;
+  vl_uindex offset ;
+  for (dimension = 0 ; dimension < 70 ; ++ dimension) {
+    for (offset = 0 ; offset < 4 ; ++ offset) {
+      float a = f(dimension, X + offset, Y) ;
+      float b = g(dimension, X + offset, Y) ;
+      if (vl_abs_f(a - b) > 1e-4f * (1.0f + vl_abs_f(a))) {
+        VL_PRINTF("%s: float mismatch (dimension %d): %g vs %g\n",
+                  name, (int)dimension, a, b) ;
+        abort() ;
+      }
+    }
+  }
+}
+
+void
+check_d (char const * name, VlDoubleVectorComparisonFunction f,
+         VlDoubleVectorComparisonFunction g,
+         double const * X, double const * Y)
+{
+  vl_uindex dimension ;
+  vl_uindex offset ;
+  for (dimension = 0 ; dimension < 70 ; ++ dimension) {
+    for (offset = 0 ; offset < 4 ; ++ offset) {
+      double a = f(dimension, X + offset, Y) ;
+      double b = g(dimension, X + offset, Y) ;
+      if (vl_abs_d(a - b) > 1e-10 * (1.0 + vl_abs_d(a))) {
+        VL_PRINTF("%s: double mismatch (dimension %d): %g vs %g\n",
+                  name, (int)dimension, a, b) ;
+        abort() ;
+      }
+    }
+  }
+}
+
+void
+check_simd ()
+{
+  float Xf [80], Yf [80] ;
+  double Xd [80], Yd [80] ;
+  vl_uindex i ;
+  VlRand * rand = vl_get_rand() ;
+  VlFloatVectorComparisonFunction scalar_f [NUM_TYPES] ;
+  VlDoubleVectorComparisonFunction scalar_d [NUM_TYPES] ;
+
+  for (i = 0 ; i < 80 ; ++i) {
+    /* include some zeros to exercise the chi2 special case */
+    Xd[i] = (i % 7 == 0) ? 0 : vl_rand_real1(rand) - 0.2 ;
+    Yd[i] = (i % 5 == 0) ? 0 : vl_rand_real1(rand) - 0.2 ;
+    Xf[i] = (float) Xd[i] ;
+    Yf[i] = (float) Yd[i] ;
+  }
+
+  vl_set_simd_enabled (VL_FALSE) ;
+  for (i = 0 ; i < NUM_TYPES ; ++i) {
+    scalar_f[i] = vl_get_vector_comparison_function_f (types[i]) ;
+    scalar_d[i] = vl_get_vector_comparison_function_d (types[i]) ;
+  }
+  vl_set_simd_enabled (VL_TRUE) ;
+
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2()) {
+    VlFloatVectorComparisonFunction sse2_f [NUM_TYPES] = {
+      _vl_distance_l2_sse2_f, _vl_distance_l1_sse2_f, _vl_distance_chi2_sse2_f,
+      _vl_kernel_l2_sse2_f, _vl_kernel_l1_sse2_f, _vl_kernel_chi2_sse2_f} ;
+    VlDoubleVectorComparisonFunction sse2_d [NUM_TYPES] = {
+      _vl_distance_l2_sse2_d, _vl_distance_l1_sse2_d, _vl_distance_chi2_sse2_d,
+      _vl_kernel_l2_sse2_d, _vl_kernel_l1_sse2_d, _vl_kernel_chi2_sse2_d} ;
+    for (i = 0 ; i < NUM_TYPES ; ++i) {
+      check_f (typeNames[i], sse2_f[i], scalar_f[i], Xf, Yf) ;
+      check_d (typeNames[i], sse2_d[i], scalar_d[i], Xd, Yd) ;
+    }
+    VL_PRINTF("SSE2 comparison functions: ok\n") ;
+  }
+#endif
+
+#ifndef VL_DISABLE_AVX2
+  if (vl_cpu_has_avx2() && vl_cpu_has_fma()) {
+    VlFloatVectorComparisonFunction avx2_f [NUM_TYPES] = {
+      _vl_distance_l2_avx2_f, _vl_distance_l1_avx2_f, _vl_distance_chi2_avx2_f,
+      _vl_kernel_l2_avx2_f, _vl_kernel_l1_avx2_f, _vl_kernel_chi2_avx2_f} ;
+    VlDoubleVectorComparisonFunction avx2_d [NUM_TYPES] = {
+      _vl_distance_l2_avx2_d, _vl_distance_l1_avx2_d, _vl_distance_chi2_avx2_d,
+      _vl_kernel_l2_avx2_d, _vl_kernel_l1_avx2_d, _vl_kernel_chi2_avx2_d} ;
+    for (i = 0 ; i < NUM_TYPES ; ++i) {
+      check_f (typeNames[i], avx2_f[i], scalar_f[i], Xf, Yf) ;
+      check_d (typeNames[i], avx2_d[i], scalar_d[i], Xd, Yd) ;
+    }
+    VL_PRINTF("AVX2 comparison functions: ok\n") ;
+  }
+#endif
+
+#ifndef VL_DISABLE_AVX512
+  if (vl_cpu_has_avx512f()) {
+    VlFloatVectorComparisonFunction avx512_f [NUM_TYPES] = {
+      _vl_distance_l2_avx512_f, _vl_distance_l1_avx512_f, _vl_distance_chi2_avx512_f,
+      _vl_kernel_l2_avx512_f, _vl_kernel_l1_avx512_f, _vl_kernel_chi2_avx512_f} ;
+    VlDoubleVectorComparisonFunction avx512_d [NUM_TYPES] = {
+      _vl_distance_l2_avx512_d, _vl_distance_l1_avx512_d, _vl_distance_chi2_avx512_d,
+      _vl_kernel_l2_avx512_d, _vl_kernel_l1_avx512_d, _vl_kernel_chi2_avx512_d} ;
+    for (i = 0 ; i < NUM_TYPES ; ++i) {
+      check_f (typeNames[i], avx512_f[i], scalar_f[i], Xf, Yf) ;
+      check_d (typeNames[i], avx512_d[i], scalar_d[i], Xd, Yd) ;
+    }
+    VL_PRINTF("AVX-512 comparison functions: ok\n") ;
+  }
+#endif
+}
+
+/* check the tiled all-pairs evaluation against the pairwise one */
+void
+check_all_pairs ()
+{
+  vl_size const dimension = 300 ;
+  vl_size const numDataX = 130 ;
+  vl_size const numDataY = 70 ;
+  vl_uindex t, i, j, n ;
+  float * X, * Y ;
+  float * result = vl_malloc (sizeof(float) * numDataX * numDataX) ;
+  vl_size numThreads [2] = {1, 3} ;
+
+  init_data (dimension, numDataX, &X, &Y) ;
+
+  for (n = 0 ; n < 2 ; ++n) {
+    vl_set_num_threads (numThreads[n]) ;
+    for (t = 0 ; t < NUM_TYPES ; ++t) {
+      VlFloatVectorComparisonFunction f =
+        vl_get_vector_comparison_function_f (types[t]) ;
+      vl_eval_vector_comparison_on_all_pairs_f
+        (result, dimension, X, numDataX, Y, numDataY, f) ;
+      for (j = 0 ; j < numDataY ; ++j) {
+        for (i = 0 ; i < numDataX ; ++i) {
+          float a = result[j * numDataX + i] ;
+          float b = f(dimension, X + i * dimension, Y + j * dimension) ;
+          if (vl_abs_f(a - b) > 1e-4f * (1.0f + vl_abs_f(b))) {
+            VL_PRINTF("%s: all pairs mismatch (%d,%d): %g vs %g\n",
+                      typeNames[t], (int)i, (int)j, a, b) ;
+            abort() ;
+          }
+        }
+      }
+      vl_eval_vector_comparison_on_all_pairs_f
+        (result, dimension, X, numDataX, NULL, 0, f) ;
+      for (j = 0 ; j < numDataX ; ++j) {
+        for (i = 0 ; i < numDataX ; ++i) {
+          float a = result[j * numDataX + i] ;
+          float b = f(dimension, X + i * dimension, X + j * dimension) ;
+          if (vl_abs_f(a - b) > 1e-4f * (1.0f + vl_abs_f(b))) {
+            VL_PRINTF("%s: all pairs (symmetric) mismatch (%d,%d): %g vs %g\n",
+                      typeNames[t], (int)i, (int)j, a, b) ;
+            abort() ;
+          }
+        }
+      }
+      vl_eval_vector_comparison_on_all_pairs_exact_f
+        (result, dimension, X, numDataX, Y, numDataY, f) ;
+      for (j = 0 ; j < numDataY ; ++j) {
+        for (i = 0 ; i < numDataX ; ++i) {
+          float a = result[j * numDataX + i] ;
+          float b = f(dimension, X + i * dimension, Y + j * dimension) ;
+          if (a != b) {
+            VL_PRINTF("%s: exact all pairs mismatch (%d,%d): %g vs %g\n",
+                      typeNames[t], (int)i, (int)j, a, b) ;
+            abort() ;
+          }
+        }
+      }
+    }
+  }
+  vl_set_num_threads (0) ;
+
+  /* the expanded L2 distance must not go negative for close points */
+  for (i = 0 ; i < numDataY * dimension ; ++i) {
+    Y[i] = X[i] * (1.0f + 1e-6f) + 100.0f ;
+    X[i] = X[i] + 100.0f ;
+  }
+  vl_eval_vector_comparison_on_all_pairs_f
+    (result, dimension, X, numDataY, Y, numDataY,
+     vl_get_vector_comparison_function_f (VlDistanceL2)) ;
+  for (i = 0 ; i < numDataY * numDataY ; ++i) {
+    if (result[i] < 0) {
+      VL_PRINTF("L2: negative all pairs distance %g\n", result[i]) ;
+      abort() ;
+    }
+  }
+  VL_PRINTF("All pairs evaluation: ok\n") ;
+
+  vl_free (X) ;
+  vl_free (Y) ;
+  vl_free (result) ;
+}
+
 int
 main (int argc VL_UNUSED, char** argv VL_UNUSED)
 {
@@ -31,6 +244,9 @@ main (int argc VL_UNUSED, char** argv VL_UNUSED)
   float * result = vl_malloc (sizeof(float) * numSamples * numSamples) ;
   VlFloatVectorComparisonFunction f ;
 
+  check_simd () ;
+  check_all_pairs () ;
+
   init_data (numDimensions, numSamples, &X, &Y) ;
 
   X+=1 ;
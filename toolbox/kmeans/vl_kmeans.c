@@ -21,6 +21,8 @@ enum {
   opt_distance,
   opt_initialization,
   opt_num_repetitions,
+  opt_num_trees,
+  opt_max_num_comparisons,
   opt_verbose
 } ;
 
@@ -37,6 +39,8 @@ vlmxOption  options [] = {
   {"NumRepetitions",    1,   opt_num_repetitions,    },
   {"Initialization",    1,   opt_initialization      },
   {"Initialisation",    1,   opt_initialization      }, /* UK spelling */
+  {"NumTrees",          1,   opt_num_trees           },
+  {"MaxNumComparisons", 1,   opt_max_num_comparisons },
   {0,                   0,   0                       }
 } ;
 
@@ -61,6 +65,8 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   VlVectorComparisonType distance = VlDistanceL2 ;
   vl_size maxNumIterations = 100 ;
   vl_size numRepetitions = 1 ;
+  vl_size numTrees = 3 ;
+  vl_size maxNumComparisons = 100 ;
   double energy ;
   int verbosity = 0 ;
   int initialization = INIT_PLUSPLUS ;
@@ -205,6 +211,22 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
         numRepetitions = (vl_size) mxGetScalar (optarg) ;
         break ;
 
+      case opt_num_trees :
+        if (!vlmxIsPlainScalar (optarg) || mxGetScalar (optarg) < 1) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "NUMTREES must be a scalar larger than or equal to 1.") ;
+        }
+        numTrees = (vl_size) mxGetScalar (optarg) ;
+        break ;
+
+      case opt_max_num_comparisons :
+        if (!vlmxIsPlainScalar (optarg) || mxGetScalar (optarg) < 0) {
+          vlmxError (vlmxErrInvalidArgument,
+                     "MAXNUMCOMPARISONS must be a non-negative integer scalar.") ;
+        }
+        maxNumComparisons = (vl_size) mxGetScalar (optarg) ;
+        break ;
+
       default :
         abort() ;
         break ;
@@ -224,6 +246,8 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
   vl_kmeans_set_algorithm (kmeans, algorithm) ;
   vl_kmeans_set_initialization (kmeans, initialization) ;
   vl_kmeans_set_max_num_iterations (kmeans, maxNumIterations) ;
+  vl_kmeans_set_num_trees (kmeans, numTrees) ;
+  vl_kmeans_set_max_num_comparisons (kmeans, maxNumComparisons) ;
 
   if (verbosity) {
     char const * algorithmName = 0 ;
@@ -244,6 +268,10 @@ mexFunction (int nout, mxArray * out[], int nin, const mxArray * in[])
     mexPrintf("kmeans: Algorithm = %s\n", algorithmName) ;
     mexPrintf("kmeans: MaxNumIterations = %d\n", vl_kmeans_get_max_num_iterations(kmeans)) ;
     mexPrintf("kmeans: NumRepetitions = %d\n", vl_kmeans_get_num_repetitions(kmeans)) ;
+    if (vl_kmeans_get_algorithm(kmeans) == VlKMeansANN) {
+      mexPrintf("kmeans: NumTrees = %d\n", vl_kmeans_get_num_trees(kmeans)) ;
+      mexPrintf("kmeans: MaxNumComparisons = %d\n", vl_kmeans_get_max_num_comparisons(kmeans)) ;
+    }
     mexPrintf("kmeans: data type = %s\n", vl_get_type_name(vl_kmeans_get_data_type(kmeans))) ;
     mexPrintf("kmeans: distance = %s\n", vl_get_vector_comparison_type_name(vl_kmeans_get_distance(kmeans))) ;
     mexPrintf("kmeans: data dimension = %d\n", dimension) ;
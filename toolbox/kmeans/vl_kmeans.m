@@ -25,7 +25,16 @@
 %
 %   Algorithm:: [LLOYD]
 %     Use either the standard LLOYD or the accelerated
-%     ELKAN algorithm for optimization.
+%     ELKAN algorithm for optimization, or the approximated ANN
+%     algorithm, which assigns the data to the centers by means of a
+%     KD-forest. ANN is much faster for a large number of centers.
+%
+%   NumTrees:: [3]
+%     Number of trees of the KD-forest used by the ANN algorithm.
+%
+%   MaxNumComparisons:: [100]
+%     Maximum number of comparisons per data point used by the ANN
+%     algorithm. Set to 0 for exact search.
 %
 %   NumRepetitions:: [1]
 %     Number of time to restart k-means. The solution with minimal
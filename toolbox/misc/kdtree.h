@@ -318,6 +318,9 @@ new_kdforest_from_array (mxArray const * forest_array, mxArray const * data_arra
     tree->numUsedNodes = numUsedNodes ;
     tree->nodes = vl_malloc (sizeof(VlKDTreeNode) * numUsedNodes) ;
     tree->dataIndex = vl_malloc (sizeof(VlKDTreeDataIndexEntry) * numData) ;
+    tree->compactNodes = NULL ;
+    tree->compactDataIndex = NULL ;
+    tree->compactData = NULL ;
 
     {
       vl_uindex ni ;
@@ -369,5 +372,6 @@ new_kdforest_from_array (mxArray const * forest_array, mxArray const * data_arra
 
     forest->trees[ti] = tree ;
   }
+  vl_kdforest_prepare_search (forest) ;
   return forest ;
 }
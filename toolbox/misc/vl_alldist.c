@@ -27,7 +27,9 @@ enum {
   opt_KL1,
   opt_KCHI2,
   opt_KHELL,
-  opt_KJS
+  opt_KJS,
+
+  opt_EXACT
 } ;
 
 vlmxOption  options [] = {
@@ -45,6 +47,8 @@ vlmxOption  options [] = {
 {"khell",        0,   opt_KHELL         },
 {"kjs",          0,   opt_KJS           },
 
+{"exact",        0,   opt_EXACT         },
+
 {0,              0,   0                 }
 } ;
 
@@ -57,6 +61,7 @@ mexFunction(int nout, mxArray *out[],
   typedef int  unsigned data_t ;
 
   vl_bool autoComparison = VL_TRUE ;
+  vl_bool exact = VL_FALSE ;
   VlVectorComparisonType comparisonType = VlDistanceL2 ;
 
   enum {IN_X = 0, IN_Y} ;
@@ -116,6 +121,7 @@ mexFunction(int nout, mxArray *out[],
       case opt_KCHI2 : comparisonType = VlKernelChi2 ; break ;
       case opt_KHELL : comparisonType = VlKernelHellinger ; break ;
       case opt_KJS   : comparisonType = VlKernelJS ; break ;
+      case opt_EXACT : exact = VL_TRUE ; break ;
       default:
         abort() ;
     }
@@ -148,17 +154,21 @@ mexFunction(int nout, mxArray *out[],
     {
       VlFloatVectorComparisonFunction f = vl_get_vector_comparison_function_f (comparisonType) ;
       if (autoComparison) {
-        vl_eval_vector_comparison_on_all_pairs_f ((float*)mxGetData(out[OUT_D]),
-                                                  dimension,
-                                                  (float*)mxGetData(in[IN_X]), numDataX,
-                                                  0, 0,
-                                                  f) ;
+        (exact ? vl_eval_vector_comparison_on_all_pairs_exact_f
+               : vl_eval_vector_comparison_on_all_pairs_f)
+        ((float*)mxGetData(out[OUT_D]),
+         dimension,
+         (float*)mxGetData(in[IN_X]), numDataX,
+         0, 0,
+         f) ;
       } else {
-        vl_eval_vector_comparison_on_all_pairs_f ((float*)mxGetData(out[OUT_D]),
-                                                  dimension,
-                                                  (float*)mxGetData(in[IN_X]), numDataX,
-                                                  (float*)mxGetData(in[IN_Y]), numDataY,
-                                                  f) ;
+        (exact ? vl_eval_vector_comparison_on_all_pairs_exact_f
+               : vl_eval_vector_comparison_on_all_pairs_f)
+        ((float*)mxGetData(out[OUT_D]),
+         dimension,
+         (float*)mxGetData(in[IN_X]), numDataX,
+         (float*)mxGetData(in[IN_Y]), numDataY,
+         f) ;
       }
     }
     break ;
@@ -167,17 +177,21 @@ mexFunction(int nout, mxArray *out[],
     {
       VlDoubleVectorComparisonFunction f = vl_get_vector_comparison_function_d (comparisonType) ;
       if (autoComparison) {
-        vl_eval_vector_comparison_on_all_pairs_d ((double*)mxGetData(out[OUT_D]),
-                                                  dimension,
-                                                  (double*)mxGetData(in[IN_X]), numDataX,
-                                                  0, 0,
-                                                  f) ;
+        (exact ? vl_eval_vector_comparison_on_all_pairs_exact_d
+               : vl_eval_vector_comparison_on_all_pairs_d)
+        ((double*)mxGetData(out[OUT_D]),
+         dimension,
+         (double*)mxGetData(in[IN_X]), numDataX,
+         0, 0,
+         f) ;
       } else {
-        vl_eval_vector_comparison_on_all_pairs_d ((double*)mxGetData(out[OUT_D]),
-                                                  dimension,
-                                                  (double*)mxGetData(in[IN_X]), numDataX,
-                                                  (double*)mxGetData(in[IN_Y]), numDataY,
-                                                  f) ;
+        (exact ? vl_eval_vector_comparison_on_all_pairs_exact_d
+               : vl_eval_vector_comparison_on_all_pairs_d)
+        ((double*)mxGetData(out[OUT_D]),
+         dimension,
+         (double*)mxGetData(in[IN_X]), numDataX,
+         (double*)mxGetData(in[IN_Y]), numDataY,
+         f) ;
       }
     }
     break ;
@@ -61,7 +61,7 @@ mexFunction(int nout, mxArray *out[],
   void * distance ;
   vl_size numNeighbors = 1 ;
   vl_size numQueries ;
-  vl_uindex qi, ni;
+  vl_uindex qi ;
   unsigned int numComparisons = 0 ;
   unsigned int maxNumComparisons = 0 ;
   VlKDForestNeighbor * neighbors ;
@@ -122,11 +122,11 @@ mexFunction(int nout, mxArray *out[],
 
   vl_kdforest_set_max_num_comparisons (forest, maxNumComparisons) ;
 
-  neighbors = vl_malloc (sizeof(VlKDForestNeighbor) * numNeighbors) ;
-
   query = mxGetData (query_array) ;
   numQueries = mxGetN (query_array) ;
 
+  neighbors = vl_malloc (sizeof(VlKDForestNeighbor) * numNeighbors * numQueries) ;
+
   out[OUT_INDEX] = index_array = mxCreateNumericMatrix
     (numNeighbors, numQueries, mxUINT32_CLASS, mxREAL) ;
 
@@ -143,32 +143,18 @@ mexFunction(int nout, mxArray *out[],
                vl_kdforest_get_max_num_comparisons (forest)) ;
   }
 
-  for (qi = 0 ; qi < numQueries ; ++ qi) {
-    numComparisons += vl_kdforest_query (forest, neighbors, numNeighbors,
-                                         query) ;
+  numComparisons = vl_kdforest_query_batch (forest, neighbors, numNeighbors,
+                                            query, numQueries) ;
+
+  for (qi = 0 ; qi < numQueries * numNeighbors ; ++ qi) {
+    index[qi] = neighbors[qi].index + 1 ;
     switch (dataClass) {
       case mxSINGLE_CLASS:
-      {
-        float * distance_ = (float*) distance ;
-        for (ni = 0 ; ni < numNeighbors ; ++ni) {
-          *index++     = neighbors[ni].index + 1 ;
-          *distance_++ = neighbors[ni].distance ;
-        }
-        query = (float*)query + vl_kdforest_get_data_dimension (forest) ;
-        distance = distance_ ;
+        ((float*)distance)[qi] = neighbors[qi].distance ;
         break ;
-      }
       case mxDOUBLE_CLASS:
-      {
-        double * distance_ = (double*) distance ;
-        for (ni = 0 ; ni < numNeighbors ; ++ni) {
-          *index++     = neighbors[ni].index + 1 ;
-          *distance_++ = neighbors[ni].distance ;
-        }
-        query = (double*)query + vl_kdforest_get_data_dimension (forest)  ;
-        distance = distance_ ;
+        ((double*)distance)[qi] = neighbors[qi].distance ;
         break ;
-      }
       default:
         abort() ;
     }
@@ -16,7 +16,6 @@ the terms of the BSD license (see the COPYING file).
 #include <mexutils.h>
 #include <vl/covdet.h>
 #include <vl/mathop.h>
-#include <vl/sift.h>
 
 #include <math.h>
 #include <assert.h>
@@ -134,36 +133,6 @@ _createArrayFromScaleSpace(VlScaleSpace const *ss)
   }
 }
 
-/** ------------------------------------------------------------------
- ** @internal @brief Transpose desriptor
- ** @param dst destination buffer.
- ** @param src source buffer.
- **
- ** The function writes to @a dst the transpose of the SIFT descriptor
- ** @a src. The tranpsose is defined as the descriptor that one
- ** obtains from computing the normal descriptor on the transposed
- ** image.
- **/
-
-static void
-flip_descriptor (float *dst, float const *src)
-{
-  int const BO = 8 ;  /* number of orientation bins */
-  int const BP = 4 ;  /* number of spatial bins     */
-  int i, j, t ;
-
-  for (j = 0 ; j < BP ; ++j) {
-    int jp = BP - 1 - j ;
-    for (i = 0 ; i < BP ; ++i) {
-      int o  = BO * i + BP*BO * j  ;
-      int op = BO * i + BP*BO * jp ;
-      dst [op] = src[o] ;
-      for (t = 1 ; t < BO ; ++t)
-        dst [BO - t + op] = src [t + o] ;
-    }
-  }
-}
-
 /** ------------------------------------------------------------------
  ** @brief MEX entry point
  **/
@@ -197,8 +166,6 @@ mexFunction(int nout, mxArray *out[],
   vl_index patchResolution = -1 ;
   double patchRelativeExtent = -1 ;
   double patchRelativeSmoothing = -1 ;
-  float *patch = NULL ;
-  float *patchXY = NULL ;
 
   double boundaryMargin = 2.0 ;
 
@@ -360,11 +327,6 @@ mexFunction(int nout, mxArray *out[],
 
 
 
-  if (patchResolution > 0) {
-    vl_size w = 2*patchResolution + 1 ;
-    patch = mxMalloc(sizeof(float) * w * w);
-    patchXY = mxMalloc(2 * sizeof(float) * w * w);
-  }
 
   /* -----------------------------------------------------------------
    *                                                          Detector
@@ -604,13 +566,7 @@ mexFunction(int nout, mxArray *out[],
         case VL_COVDET_DESC_SIFT:
         {
           vl_size numFeatures = vl_covdet_get_num_features(covdet) ;
-          VlCovDetFeature const * feature = vl_covdet_get_features(covdet);
-          VlSiftFilt * sift = vl_sift_new(16, 16, 1, 3, 0) ;
-          vl_index i ;
           vl_size dimension = 128 ;
-          vl_size patchSide = 2 * patchResolution + 1 ;
-          double patchStep = (double)patchRelativeExtent / patchResolution ;
-          float tempDesc [128] ;
           float * desc ;
           if (verbose) {
             mexPrintf("vl_covdet: descriptors: type=sift, "
@@ -620,43 +576,12 @@ mexFunction(int nout, mxArray *out[],
           }
           OUT(DESCRIPTORS) = mxCreateNumericMatrix(dimension, numFeatures, mxSINGLE_CLASS, mxREAL) ;
           desc = mxGetData(OUT(DESCRIPTORS)) ;
-          vl_sift_set_magnif(sift, 3.0) ;
-          for (i = 0 ; i < (signed)numFeatures ; ++i) {
-            vl_covdet_extract_patch_for_frame(covdet,
-                                              patch,
-                                              patchResolution,
-                                              patchRelativeExtent,
-                                              patchRelativeSmoothing,
-                                              feature[i].frame) ;
-
-            vl_imgradient_polar_f (patchXY, patchXY +1,
-                                   2, 2 * patchSide,
-                                   patch, patchSide, patchSide, patchSide) ;
-
-
-            /*
-             Note: the patch is transposed, so that x and y are swapped.
-             However, if NBO is not divisible by 4, then the configuration
-             of the SIFT orientations is not symmetric by rotations of pi/2.
-             Hence the only option is to rotate the descriptor further by
-             an angle we need to compute the descriptor rotaed by an additional pi/2
-             angle. In this manner, x concides and y is flipped.
-             */
-            vl_sift_calc_raw_descriptor (sift,
-                                         patchXY,
-                                         tempDesc,
-                                         (int)patchSide, (int)patchSide,
-                                         (double)(patchSide-1) / 2, (double)(patchSide-1) / 2,
-                                         (double)patchRelativeExtent / (3.0 * (4 + 1) / 2) /
-                                         patchStep,
-                                         VL_PI / 2) ;
-
-            //VL_PRINTF("%g\n", (double)patchRelativeExtent / (3.0 * (4 + 1) / 2)) ;
-
-            flip_descriptor (desc, tempDesc) ;
-            desc += dimension ;
+          if (vl_covdet_extract_descriptors(covdet, desc,
+                                            patchResolution,
+                                            patchRelativeExtent,
+                                            patchRelativeSmoothing)) {
+            vlmxError(vlmxErrAlloc, NULL) ;
           }
-          vl_sift_delete(sift) ;
           break ;
         }
         default:
@@ -705,7 +630,4 @@ mexFunction(int nout, mxArray *out[],
     /* cleanup */
     vl_covdet_delete (covdet) ;
   }
-
-  if (patchXY) mxFree(patchXY) ;
-  if (patch) mxFree(patch) ;
 }
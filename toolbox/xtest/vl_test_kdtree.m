@@ -84,3 +84,17 @@ for i=1:size(s.Q,2)
             numel(union(nn(:,i), nn_(:,i))) ;
   assert(overlap > 0.6, 'ANN did not return enough correct nearest neighbors') ;
 end
+
+function test_forest_roundtrip(s)
+% The forest is rebuilt from the MATLAB structure by VL_KDTREEQUERY.
+% Retrieving all the points visits all the nodes of all the trees.
+numTrees = 3 ;
+tree = vl_kdtreebuild(s.X, 'numTrees', numTrees) ;
+[nn, d2] = vl_kdtreequery(tree, s.X, s.Q, ...
+                          'numNeighbors', size(s.X,2)) ;
+
+D2 = vl_alldist2(s.X, s.Q, 'l2') ;
+[d2_, nn_] = sort(D2) ;
+
+vl_assert_almost_equal(d2,d2_) ;
+vl_assert_equal(sort(nn),uint32(repmat((1:size(s.X,2))', 1, size(s.Q,2)))) ;
@@ -25,10 +25,21 @@
 on three cornerness measures (determinant of the Hessian, trace of the Hessian
 (aka Difference of Gaussians, and Harris). It supprots affine adaptation,
 orientation estimation, as well as Laplacian scale detection.
+SIFT descriptors of the detected features can be computed by
+::vl_covdet_extract_descriptors.
+
+Affine adaptation, orientation estimation and Laplacian scale
+detection process the features in parallel (@ref threads). The
+resulting features and their order do not depend on the number of
+threads.
 
 **/
 
 #include "covdet.h"
+#include "sift.h"
+#include "threads.h"
+#include "covdet_sse2.h"
+#include "covdet_avx2.h"
 #include <string.h>
 
 /** @brief Reallocate buffer
@@ -126,32 +137,6 @@ vl_refine_local_extreum_2 (VlCovDetExtremum2 * refined,
                            vl_size width, vl_size height,
                            vl_index x, vl_index y) ;
 
-/** @brief Find extrema in 3D function
- ** @param extrema
- ** @param bufferSize
- ** @param map a 3D array representing the map.
- ** @param width of the map.
- ** @param height of the map.
- ** @param deepth of the map.
- ** @param threshold minumum extremum value.
- ** @return number of extrema found.
- **/
-
-vl_size
-vl_find_local_extrema_3 (vl_index ** extrema, vl_size * bufferSize,
-                         float const * map,
-                         vl_size width, vl_size height, vl_size depth,
-                         double threshold)
-{
-  vl_index x, y, z ;
-  vl_size const xo = 1 ;
-  vl_size const yo = width ;
-  vl_size const zo = width * height ;
-  float const *pt = map + xo + yo + zo ;
-
-  vl_size numExtrema = 0 ;
-  vl_size requiredSize = 0 ;
-
 #define CHECK_NEIGHBORS_3(v,CMP,SGN)     (\
 v CMP ## = SGN threshold &&               \
 v CMP *(pt + xo) &&                       \
@@ -184,28 +169,200 @@ v CMP *(pt + yo - xo - zo) &&             \
 v CMP *(pt - yo + xo - zo) &&             \
 v CMP *(pt - yo - xo - zo) )
 
-  for (z = 1 ; z < (signed)depth - 1 ; ++z) {
-    for (y = 1 ; y < (signed)height - 1 ; ++y) {
-      for (x = 1 ; x < (signed)width - 1 ; ++x) {
-        float value = *pt ;
-        if (CHECK_NEIGHBORS_3(value,>,+) || CHECK_NEIGHBORS_3(value,<,-)) {
-          numExtrema ++ ;
-          requiredSize += sizeof(vl_index) * 3 ;
-          if (*bufferSize < requiredSize) {
-            int err = _vl_resize_buffer((void**)extrema, bufferSize,
-                                        requiredSize + 2000 * 3 * sizeof(vl_index)) ;
-            assert(err == VL_ERR_OK) ;
+#define CHECK_NEIGHBORS_2(v,CMP,SGN)     (\
+v CMP ## = SGN threshold &&               \
+v CMP *(pt + xo) &&                       \
+v CMP *(pt - xo) &&                       \
+v CMP *(pt + yo) &&                       \
+v CMP *(pt - yo) &&                       \
+\
+v CMP *(pt + yo + xo) &&                  \
+v CMP *(pt + yo - xo) &&                  \
+v CMP *(pt - yo + xo) &&                  \
+v CMP *(pt - yo - xo) )
+
+#define VL_COVDET_EXTREMA_GRAIN_SIZE 8
+
+/** @internal @brief Find the local extrema in a row by SIMD instructions
+ ** @return first element of the row that was not processed.
+ **
+ ** The function processes the row in blocks of vector size and
+ ** returns 1 if no vectorized implementation is available. The
+ ** parameters are as in ::_vl_find_local_extrema_row.
+ **/
+
+static vl_index
+_vl_find_local_extrema_row_simd (vl_uint32 * mask, float const * row,
+                                 vl_size width, vl_size yo, vl_size zo,
+                                 double threshold)
+{
+#ifndef VL_DISABLE_AVX2
+  if (vl_cpu_has_avx2() && vl_cpu_has_fma() && vl_get_simd_enabled()) {
+    return _vl_find_local_extrema_row_avx2 (mask, row, width, yo, zo, threshold) ;
+  }
+#endif
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2() && vl_get_simd_enabled()) {
+    return _vl_find_local_extrema_row_sse2 (mask, row, width, yo, zo, threshold) ;
+  }
+#endif
+  return 1 ;
+}
+
+/** @internal @brief Find the local extrema in a row of a map
+ ** @param mask bitmap of the row (bit @c x is set for an extremum at @c x).
+ ** @param row pointer to the first element of the row.
+ ** @param width of the map.
+ ** @param yo offset between two rows.
+ ** @param zo offset between two levels (0 for a 2D map).
+ ** @param threshold minumum extremum value.
+ **
+ ** The bitmap must be cleared by the caller.
+ **/
+
+static void
+_vl_find_local_extrema_row (vl_uint32 * mask, float const * row,
+                            vl_size width, vl_size yo, vl_size zo,
+                            double threshold)
+{
+  vl_size const xo = 1 ;
+  vl_index x = _vl_find_local_extrema_row_simd (mask, row, width, yo, zo, threshold) ;
+  float const * pt = row + x ;
+
+  for ( ; x < (signed)width - 1 ; ++x) {
+    float value = *pt ;
+    vl_bool isExtremum ;
+    if (zo > 0) {
+      isExtremum = CHECK_NEIGHBORS_3(value,>,+) || CHECK_NEIGHBORS_3(value,<,-) ;
+    } else {
+      isExtremum = CHECK_NEIGHBORS_2(value,>,+) || CHECK_NEIGHBORS_2(value,<,-) ;
+    }
+    if (isExtremum) {
+      mask [x >> 5] |= (vl_uint32) 1 << (x & 31) ;
+    }
+    pt += xo ;
+  }
+}
+
+/** @internal @brief Data of a parallel search of local extrema
+ **
+ ** The rows of the map (excluding the border ones) are searched
+ ** in parallel. Each row stores its extrema in its own bitmap, with
+ ** @c maskStride words per row.
+ **/
+
+typedef struct _VlCovDetExtremaTask
+{
+  float const * map ;
+  vl_size width ;
+  vl_size height ;
+  vl_size zo ;           /**< offset between two levels (0 for 2D maps). */
+  double threshold ;
+  vl_uint32 * mask ;
+  vl_size maskStride ;
+} VlCovDetExtremaTask ;
+
+static void
+_vl_find_local_extrema_body (void * data, vl_uindex begin, vl_uindex end,
+                             vl_uindex slot)
+{
+  VlCovDetExtremaTask * task = data ;
+  vl_size const numRows = task->height - 2 ;
+  vl_uindex r ;
+  (void) slot ;
+  for (r = begin ; r < end ; ++r) {
+    vl_size z = (task->zo > 0) ? 1 + r / numRows : 0 ;
+    vl_size y = 1 + r % numRows ;
+    vl_uint32 * mask = task->mask + r * task->maskStride ;
+    memset(mask, 0, sizeof(vl_uint32) * task->maskStride) ;
+    _vl_find_local_extrema_row (mask,
+                                task->map + z * task->zo + y * task->width,
+                                task->width, task->width, task->zo,
+                                task->threshold) ;
+  }
+}
+
+/** @internal @brief Find extrema in a 2D or 3D function
+ ** @param extrema
+ ** @param bufferSize
+ ** @param map a 2D or 3D array representing the map.
+ ** @param width of the map.
+ ** @param height of the map.
+ ** @param depth of the map (1 for a 2D map).
+ ** @param threshold minumum extremum value.
+ ** @return number of extrema found.
+ **
+ ** The rows of the map are searched in parallel (@ref threads) into
+ ** a bitmap, which is then scanned by the calling thread. Hence the
+ ** extrema are returned in the same order as a sequential search.
+ **
+ ** If memory is insufficient, the function sets the last error to
+ ** ::VL_ERR_ALLOC (::vl_get_last_error) and returns the extrema
+ ** stored so far, possibly none.
+ **/
+
+static vl_size
+_vl_find_local_extrema (vl_index ** extrema, vl_size * bufferSize,
+                        float const * map,
+                        vl_size width, vl_size height, vl_size depth,
+                        double threshold)
+{
+  vl_size const dimension = (depth > 1) ? 3 : 2 ;
+  vl_size numExtrema = 0 ;
+  vl_size requiredSize = 0 ;
+  vl_size numRows ;
+  vl_index r, i ;
+  VlCovDetExtremaTask task ;
+
+  if (width < 3 || height < 3) {
+    return 0 ;
+  }
+  numRows = (height - 2) * ((dimension == 3) ? depth - 2 : 1) ;
+
+  task.map = map ;
+  task.width = width ;
+  task.height = height ;
+  task.zo = (dimension == 3) ? width * height : 0 ;
+  task.threshold = threshold ;
+  task.maskStride = (width + 31) / 32 ;
+  task.mask = vl_malloc(sizeof(vl_uint32) * task.maskStride * numRows) ;
+  if (task.mask == NULL) {
+    vl_set_last_error(VL_ERR_ALLOC, "Could not allocate the extrema bitmap.") ;
+    return 0 ;
+  }
+
+  vl_parallel_for(numRows, VL_COVDET_EXTREMA_GRAIN_SIZE,
+                  _vl_find_local_extrema_body, &task) ;
+
+  for (r = 0 ; r < (signed)numRows ; ++r) {
+    vl_uint32 const * mask = task.mask + r * task.maskStride ;
+    vl_index y = 1 + r % (height - 2) ;
+    vl_index z = 1 + r / (height - 2) ;
+    for (i = 0 ; i < (signed)task.maskStride ; ++i) {
+      vl_uint32 word = mask[i] ;
+      vl_index x ;
+      for (x = 32 * i ; word ; word >>= 1, ++x) {
+        if ((word & 1) == 0) continue ;
+        requiredSize += sizeof(vl_index) * dimension ;
+        if (*bufferSize < requiredSize) {
+          int err = _vl_resize_buffer((void**)extrema, bufferSize,
+                                      requiredSize + 2000 * dimension * sizeof(vl_index)) ;
+          if (err) {
+            vl_set_last_error(VL_ERR_ALLOC, "Could not allocate the extrema.") ;
+            vl_free(task.mask) ;
+            return numExtrema ;
           }
-          (*extrema) [3 * (numExtrema - 1) + 0] = x ;
-          (*extrema) [3 * (numExtrema - 1) + 1] = y ;
-          (*extrema) [3 * (numExtrema - 1) + 2] = z ;
         }
-        pt += xo ;
+        numExtrema ++ ;
+        (*extrema) [dimension * (numExtrema - 1) + 0] = x ;
+        (*extrema) [dimension * (numExtrema - 1) + 1] = y ;
+        if (dimension == 3) {
+          (*extrema) [dimension * (numExtrema - 1) + 2] = z ;
+        }
       }
-      pt += 2*xo ;
     }
-    pt += 2*yo ;
   }
+  vl_free(task.mask) ;
   return numExtrema ;
 }
 
@@ -218,6 +375,33 @@ v CMP *(pt - yo - xo - zo) )
  ** @param deepth of the map.
  ** @param threshold minumum extremum value.
  ** @return number of extrema found.
+ **
+ ** The search is vectorized and parallel, see
+ ** ::_vl_find_local_extrema.
+ **/
+
+vl_size
+vl_find_local_extrema_3 (vl_index ** extrema, vl_size * bufferSize,
+                         float const * map,
+                         vl_size width, vl_size height, vl_size depth,
+                         double threshold)
+{
+  if (depth < 3) return 0 ;
+  return _vl_find_local_extrema(extrema, bufferSize, map,
+                                width, height, depth, threshold) ;
+}
+
+/** @brief Find extrema in 2D function
+ ** @param extrema
+ ** @param bufferSize
+ ** @param map a 2D array representing the map.
+ ** @param width of the map.
+ ** @param height of the map.
+ ** @param threshold minumum extremum value.
+ ** @return number of extrema found.
+ **
+ ** The search is vectorized and parallel, see
+ ** ::_vl_find_local_extrema.
  **/
 
 vl_size
@@ -226,44 +410,8 @@ vl_find_local_extrema_2 (vl_index ** extrema, vl_size * bufferSize,
                          vl_size width, vl_size height,
                          double threshold)
 {
-  vl_index x, y ;
-  vl_size const xo = 1 ;
-  vl_size const yo = width ;
-  float const *pt = map + xo + yo ;
-
-  vl_size numExtrema = 0 ;
-  vl_size requiredSize = 0 ;
-#define CHECK_NEIGHBORS_2(v,CMP,SGN)     (\
-v CMP ## = SGN threshold &&               \
-v CMP *(pt + xo) &&                       \
-v CMP *(pt - xo) &&                       \
-v CMP *(pt + yo) &&                       \
-v CMP *(pt - yo) &&                       \
-\
-v CMP *(pt + yo + xo) &&                  \
-v CMP *(pt + yo - xo) &&                  \
-v CMP *(pt - yo + xo) &&                  \
-v CMP *(pt - yo - xo) )
-
-  for (y = 1 ; y < (signed)height - 1 ; ++y) {
-    for (x = 1 ; x < (signed)width - 1 ; ++x) {
-      float value = *pt ;
-      if (CHECK_NEIGHBORS_2(value,>,+) || CHECK_NEIGHBORS_2(value,<,-)) {
-        numExtrema ++ ;
-        requiredSize += sizeof(vl_index) * 2 ;
-        if (*bufferSize < requiredSize) {
-          int err = _vl_resize_buffer((void**)extrema, bufferSize,
-                                      requiredSize + 2000 * 2 * sizeof(vl_index)) ;
-          assert(err == VL_ERR_OK) ;
-        }
-        (*extrema) [2 * (numExtrema - 1) + 0] = x ;
-        (*extrema) [2 * (numExtrema - 1) + 1] = y ;
-      }
-      pt += xo ;
-    }
-    pt += 2*xo ;
-  }
-  return numExtrema ;
+  return _vl_find_local_extrema(extrema, bufferSize, map,
+                                width, height, 1, threshold) ;
 }
 
 /** @brief Refine extrema in 3D function
@@ -517,15 +665,47 @@ vl_refine_local_extreum_2 (VlCovDetExtremum2 * refined,
 #define VL_COVDET_AA_CONVERGENCE_THRESHOLD 1.001
 #define VL_COVDET_AA_ACCURATE_SMOOTHING VL_FALSE
 #define VL_COVDET_AA_PATCH_EXTENT (3*VL_COVDET_AA_RELATIVE_INTEGRATION_SIGMA)
+#define VL_COVDET_AA_MAX_FILTER_SIZE 31
 #define VL_COVDET_OR_ADDITIONAL_PEAKS_RELATIVE_SIZE 0.8
 #define VL_COVDET_LAP_NUM_LEVELS 10
 #define VL_COVDET_LAP_PATCH_RESOLUTION 16
+#define VL_COVDET_DEF_FEATURE_CELL_SIZE 32
 #define VL_COVDET_DOG_DEF_PEAK_THRESHOLD 0.01
 #define VL_COVDET_DOG_DEF_EDGE_THRESHOLD 10.0
 #define VL_COVDET_HARRIS_DEF_PEAK_THRESHOLD 0.000002
 #define VL_COVDET_HARRIS_DEF_EDGE_THRESHOLD 10.0
 #define VL_COVDET_HESSIAN_DEF_PEAK_THRESHOLD 0.003
 #define VL_COVDET_HESSIAN_DEF_EDGE_THRESHOLD 10.0
+#define VL_COVDET_FEATURE_GRAIN_SIZE 16
+
+/** @internal @brief Scratch space for processing one feature
+ **
+ ** The detector keeps one such record for each thread that can
+ ** process features in parallel. The first record is also used by
+ ** the functions that process an individual frame.
+ **
+ ** Parallel bodies cannot allocate memory (see @ref threads). While
+ ** a record is @c locked, a feature that does not fit in its buffers
+ ** sets the @c overflow flag instead, and is processed again by the
+ ** calling thread later.
+ **/
+typedef struct _VlCovDetScratch
+{
+  vl_bool locked ;           /**< buffers cannot be enlarged. */
+  vl_bool overflow ;         /**< a buffer was too small. */
+  float * patch ;            /**< padded image region. */
+  vl_size patchBufferSize ;  /**< size of @c patch in bytes. */
+  VlCovDetFeatureOrientation orientations [VL_COVDET_MAX_NUM_ORIENTATIONS] ;
+  VlCovDetFeatureLaplacianScale scales [VL_COVDET_MAX_NUM_LAPLACIAN_SCALES] ;
+  float aaPatch [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
+  float aaPatchX [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
+  float aaPatchY [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
+  float aaBuffer [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
+  float aaFilter [VL_COVDET_AA_MAX_FILTER_SIZE] ;
+  float lapPatch [(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)*(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)] ;
+  float * descPatch ;            /**< descriptor patch and gradient. */
+  vl_size descPatchBufferSize ;  /**< size of @c descPatch in bytes. */
+} VlCovDetScratch ;
 
 /** @brief Covariant feature detector */
 struct _VlCovDet
@@ -540,25 +720,22 @@ struct _VlCovDet
 
   double nonExtremaSuppression ;
   vl_size numNonExtremaSuppressed ;
+  vl_size maxNumFeaturesPerCell ;
+  double featureCellSize ;
 
   VlCovDetFeature *features ;
   vl_size numFeatures ;
   vl_size numFeatureBufferSize ;
 
-  float * patch ;
-  vl_size patchBufferSize ;
+  VlCovDetScratch * scratch ; /**< per-thread scratch space. */
+  vl_size numScratch ;        /**< number of scratch records. */
+  VlSiftFilt * sift ;         /**< SIFT filter for the descriptors. */
 
   vl_bool transposed ;
-  VlCovDetFeatureOrientation orientations [VL_COVDET_MAX_NUM_ORIENTATIONS] ;
-  VlCovDetFeatureLaplacianScale scales [VL_COVDET_MAX_NUM_LAPLACIAN_SCALES] ;
 
   vl_bool aaAccurateSmoothing ;
-  float aaPatch [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
-  float aaPatchX [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
-  float aaPatchY [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
   float aaMask [(2*VL_COVDET_AA_PATCH_RESOLUTION+1)*(2*VL_COVDET_AA_PATCH_RESOLUTION+1)] ;
 
-  float lapPatch [(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)*(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)] ;
   float laplacians [(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)*(2*VL_COVDET_LAP_PATCH_RESOLUTION+1)*VL_COVDET_LAP_NUM_LEVELS] ;
   vl_size numFeaturesWithNumScales [VL_COVDET_MAX_NUM_LAPLACIAN_SCALES + 1] ;
 }  ;
@@ -606,11 +783,13 @@ vl_covdet_new (VlCovDetMethod method)
   }
 
   self->nonExtremaSuppression = 0.5 ;
+  self->maxNumFeaturesPerCell = 0 ;
+  self->featureCellSize = VL_COVDET_DEF_FEATURE_CELL_SIZE ;
   self->features = NULL ;
   self->numFeatures = 0 ;
   self->numFeatureBufferSize = 0 ;
-  self->patch = NULL ;
-  self->patchBufferSize = 0 ;
+  self->scratch = vl_calloc(sizeof(VlCovDetScratch), 1) ;
+  self->numScratch = 1 ;
   self->transposed = VL_FALSE ;
   self->aaAccurateSmoothing = VL_COVDET_AA_ACCURATE_SMOOTHING ;
 
@@ -703,11 +882,103 @@ vl_covdet_reset (VlCovDet * self)
 void
 vl_covdet_delete (VlCovDet * self)
 {
+  vl_uindex t ;
   vl_covdet_reset(self) ;
-  if (self->patch) vl_free (self->patch) ;
+  for (t = 0 ; t < self->numScratch ; ++t) {
+    if (self->scratch[t].patch) vl_free (self->scratch[t].patch) ;
+    if (self->scratch[t].descPatch) vl_free (self->scratch[t].descPatch) ;
+  }
+  vl_free(self->scratch) ;
+  if (self->sift) vl_sift_delete(self->sift) ;
   vl_free(self) ;
 }
 
+/** @internal @brief Make room for a scratch record per thread
+ ** @param self object.
+ ** @return status.
+ **
+ ** The function must be called before processing features by
+ ** ::vl_parallel_for, as the latter indexes the scratch records by
+ ** the executing slot.
+ **/
+
+static int
+_vl_covdet_reserve_scratch (VlCovDet * self)
+{
+  vl_size numScratch = vl_get_max_threads() ;
+  VlCovDetScratch * scratch ;
+  if (numScratch <= self->numScratch) return VL_ERR_OK ;
+  scratch = vl_realloc(self->scratch, numScratch * sizeof(VlCovDetScratch)) ;
+  if (scratch == NULL) return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+  memset(scratch + self->numScratch, 0,
+         (numScratch - self->numScratch) * sizeof(VlCovDetScratch)) ;
+  self->scratch = scratch ;
+  self->numScratch = numScratch ;
+  return VL_ERR_OK ;
+}
+
+/** @internal @brief Common part of the per-feature parallel tasks */
+typedef struct _VlCovDetFeatureTask
+{
+  VlCovDet * self ;
+  vl_bool * deferred ; /**< features to process again sequentially. */
+} VlCovDetFeatureTask ;
+
+/** @internal @brief Process the stored features in parallel
+ ** @param task task, starting with a ::VlCovDetFeatureTask.
+ ** @param function parallel body.
+ ** @return status.
+ **
+ ** @a function processes the features in a range using the scratch
+ ** record of the executing slot. The records are locked during the
+ ** parallel loop; @a function must set <code>deferred[i]</code> if
+ ** the feature @c i overflowed them. These features are processed
+ ** again by the calling thread, which is allowed to enlarge the
+ ** buffers of the first record. The other records are then
+ ** enlarged as well, so that later calls do not overflow again.
+ **
+ ** Since each feature is processed independently, the result does
+ ** not depend on the number of threads.
+ **/
+
+static int
+_vl_covdet_process_features (VlCovDetFeatureTask * task,
+                             VlParallelForFunction function)
+{
+  VlCovDet * self = task->self ;
+  vl_size numFeatures = self->numFeatures ;
+  vl_bool anyDeferred = VL_FALSE ;
+  vl_uindex i, t ;
+  int err ;
+
+  err = _vl_covdet_reserve_scratch(self) ;
+  if (err) return err ;
+  task->deferred = vl_calloc(numFeatures, sizeof(vl_bool)) ;
+  if (task->deferred == NULL) return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+
+  for (t = 0 ; t < self->numScratch ; ++t) self->scratch[t].locked = VL_TRUE ;
+  vl_parallel_for(numFeatures, VL_COVDET_FEATURE_GRAIN_SIZE, function, task) ;
+  for (t = 0 ; t < self->numScratch ; ++t) self->scratch[t].locked = VL_FALSE ;
+
+  for (i = 0 ; i < numFeatures ; ++i) {
+    if (task->deferred[i]) {
+      function(task, i, i + 1, 0) ;
+      anyDeferred = VL_TRUE ;
+    }
+  }
+  if (anyDeferred) {
+    for (t = 1 ; t < self->numScratch ; ++t) {
+      VlCovDetScratch * scratch = self->scratch + t ;
+      _vl_enlarge_buffer((void**)&scratch->patch, &scratch->patchBufferSize,
+                         self->scratch[0].patchBufferSize) ;
+    }
+  }
+
+  vl_free(task->deferred) ;
+  task->deferred = NULL ;
+  return VL_ERR_OK ;
+}
+
 /** @brief Append a feature to the internal buffer.
  ** @param self object.
  ** @param feature a pointer to the feature to append.
@@ -803,8 +1074,7 @@ vl_covdet_put_image (VlCovDet * self,
                                   octaveFirstSubdivision, octaveLastSubdivision) ;
     if (self->gss == NULL) return VL_ERR_ALLOC ;
   }
-  vl_scalespace_put_image(self->gss, image) ;
-  return VL_ERR_OK ;
+  return vl_scalespace_put_image(self->gss, image) ;
 }
 
 /* ---------------------------------------------------------------- */
@@ -985,72 +1255,326 @@ _vl_dog_response (float * dog,
 }
 
 /* ---------------------------------------------------------------- */
-/*                                                  Detect features */
+/*                                        Non-extrema suppression */
 /* ---------------------------------------------------------------- */
 
-/** @brief Detect scale-space features
- ** @param method
- ** @return new covariant detector.
+/** @internal @brief Cell of a grid of features
+ **
+ ** The cells are indexed by log-scale, vertical and horizontal bin
+ ** (in this order). They are stored as doubles to avoid overflows for
+ ** very small thresholds. The grid is used both by non-extrema
+ ** suppression and by the limit on the number of features per cell.
  **/
 
-void
-vl_covdet_detect (VlCovDet * self)
+typedef struct _VlCovDetCell
 {
-  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry(self->gss) ;
-  VlScaleSpaceGeometry cgeom ;
-  vl_bool cssReady = VL_FALSE ;
-  float * levelxx = NULL ;
-  float * levelyy = NULL ;
-  float * levelxy = NULL ;
-  vl_index o, s ;
+  double s ;        /**< log-scale bin. */
+  double y ;        /**< vertical bin. */
+  double x ;        /**< horizontal bin. */
+  double score ;    /**< absolute peak score of the feature. */
+  vl_index index ;  /**< index of the feature. */
+} VlCovDetCell ;
+
+/** @internal @brief Side of the spatial cells of a log-scale bin
+ ** @param tol non-extrema suppression threshold.
+ ** @param s log-scale bin.
+ ** @return side of the cells.
+ **
+ ** The scale bin @a s contains the features with scale in the interval
+ ** @f$ [(1+\tau)^s, (1+\tau)^{s+1}) @f$, where @f$ \tau @f$ is the
+ ** threshold. A feature of scale @f$ \sigma @f$ can only suppress features
+ ** closer than @f$ \tau\sigma @f$ and with scale larger than
+ ** @f$ \sigma/(1+\tau) @f$. Hence the cells of side @f$
+ ** \tau(1+\tau)^{s+3} @f$ (which includes a margin against rounding)
+ ** are large enough for the neighbours of a feature to be at most one
+ ** cell away from it.
+ **/
 
-  assert (self) ;
-  assert (self->gss) ;
+static double
+_vl_covdet_cell_side (double tol, double s)
+{
+  return tol * pow(1 + tol, s + 3) ;
+}
 
-  /* clear previous detections if any */
-  self->numFeatures = 0 ;
+static int
+_vl_covdet_compare_cells (void const * a_, void const * b_)
+{
+  VlCovDetCell const * a = a_ ;
+  VlCovDetCell const * b = b_ ;
+  if (a->s != b->s) return (a->s < b->s) ? -1 : +1 ;
+  if (a->y != b->y) return (a->y < b->y) ? -1 : +1 ;
+  if (a->x != b->x) return (a->x < b->x) ? -1 : +1 ;
+  /* within a cell, sort by decreasing score */
+  if (a->score != b->score) return (a->score > b->score) ? -1 : +1 ;
+  return (a->index < b->index) ? -1 : (a->index > b->index) ;
+}
 
-  /* prepare buffers ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
-  cgeom = geom ;
-  if (self->method == VL_COVDET_METHOD_DOG) {
-    cgeom.octaveFirstSubdivision = -1 ;
-  }
-  if (self->css) {
-    VlScaleSpaceGeometry cssGeom = vl_scalespace_get_geometry(self->css) ;
-    cssReady =
-    cssGeom.width == cgeom.width &&
-    cssGeom.height == cgeom.height &&
-    cssGeom.firstOctave == cgeom.firstOctave &&
-    cssGeom.lastOctave == cgeom.lastOctave &&
-    cssGeom.octaveResolution == cgeom.octaveResolution &&
-    cssGeom.octaveFirstSubdivision == cgeom.octaveFirstSubdivision &&
-    cssGeom.octaveLastSubdivision == cgeom.octaveLastSubdivision ;
-  }
-  if (! cssReady) {
-    if (self->css) vl_scalespace_delete(self->css) ;
-    self->css = vl_scalespace_new(cgeom.width, cgeom.height,
-                                  cgeom.lastOctave - cgeom.firstOctave + 1,
-                                  cgeom.firstOctave,
-                                  cgeom.octaveResolution,
-                                  cgeom.octaveFirstSubdivision,
-                                  cgeom.octaveLastSubdivision) ;
-  }
-  if (self->method == VL_COVDET_METHOD_HARRIS_LAPLACE ||
-      self->method == VL_COVDET_METHOD_MULTISCALE_HARRIS) {
-    VlScaleSpaceOctaveGeometry oct = vl_scalespace_get_octave_geometry(self->gss, geom.firstOctave) ;
-    levelxx = vl_malloc(oct.width * oct.height * sizeof(float)) ;
-    levelyy = vl_malloc(oct.width * oct.height * sizeof(float)) ;
-    levelxy = vl_malloc(oct.width * oct.height * sizeof(float)) ;
+/** @internal @brief Find the first cell not smaller than a given one
+ ** @param cells sorted cells.
+ ** @param numCells number of cells.
+ ** @param s log-scale bin.
+ ** @param y vertical bin.
+ ** @param x horizontal bin.
+ ** @return index of the cell.
+ **/
+
+static vl_size
+_vl_covdet_find_cell (VlCovDetCell const * cells, vl_size numCells,
+                      double s, double y, double x)
+{
+  vl_size begin = 0 ;
+  vl_size end = numCells ;
+  while (begin < end) {
+    vl_size mid = (begin + end) / 2 ;
+    VlCovDetCell const * c = cells + mid ;
+    if (c->s < s || (c->s == s && (c->y < y || (c->y == y && c->x < x)))) {
+      begin = mid + 1 ;
+    } else {
+      end = mid ;
+    }
   }
+  return begin ;
+}
 
-  /* compute cornerness ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
-  for (o = cgeom.firstOctave ; o <= cgeom.lastOctave ; ++o) {
-    VlScaleSpaceOctaveGeometry oct = vl_scalespace_get_octave_geometry(self->css, o) ;
+/** @internal @brief Test whether a feature suppresses another
+ ** @param feature feature.
+ ** @param other other feature.
+ ** @param tol non-extrema suppression threshold.
+ ** @return whether @a feature suppresses @a other.
+ **/
 
-    for (s = cgeom.octaveFirstSubdivision ; s <= cgeom.octaveLastSubdivision ; ++s) {
-      float * level = vl_scalespace_get_level(self->gss, o, s) ;
-      float * clevel = vl_scalespace_get_level(self->css, o, s) ;
-      double sigma = vl_scalespace_get_level_sigma(self->css, o, s) ;
+static vl_bool
+_vl_covdet_suppresses (VlCovDetFeature const * feature,
+                       VlCovDetFeature const * other,
+                       double tol)
+{
+  double sigma = feature->frame.a11 ;
+  double sigma_ = other->frame.a11 ;
+  return
+    other->peakScore != 0 &&
+    sigma < (1+tol) * sigma_ &&
+    sigma_ < (1+tol) * sigma &&
+    vl_abs_d(other->frame.x - feature->frame.x) < tol * sigma &&
+    vl_abs_d(other->frame.y - feature->frame.y) < tol * sigma &&
+    vl_abs_d(feature->peakScore) > vl_abs_d(other->peakScore) ;
+}
+
+/** @internal @brief Suppress the non-extrema features
+ ** @param self object.
+ **
+ ** A feature is suppressed (its peak score is set to zero) if a
+ ** feature that precedes it and that is not suppressed has a larger
+ ** absolute score, a similar scale and a similar location (see
+ ** ::vl_covdet_set_non_extrema_suppression_threshold). The
+ ** neighbours of a feature are found by looking up the cells of a grid
+ ** indexed by location and log-scale (see ::_vl_covdet_cell_side), so
+ ** that the cost is nearly linear in the number of features. The
+ ** result is the same as comparing all pairs of features, which is
+ ** what the function does if the grid cannot be allocated.
+ **/
+
+static void
+_vl_covdet_suppress_non_extrema (VlCovDet * self)
+{
+  double const tol = self->nonExtremaSuppression ;
+  double logBase ;
+  VlCovDetCell * cells ;
+  vl_size numCells = 0 ;
+  vl_index i, j ;
+
+  self->numNonExtremaSuppressed = 0 ;
+
+  /* Features can suppress each other only if tol > 0 */
+  if (! (tol > 0)) return ;
+  logBase = log(1 + tol) ;
+
+  cells = vl_malloc(sizeof(VlCovDetCell) * self->numFeatures) ;
+  if (cells == NULL) {
+    for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
+      for (j = 0 ; j < (signed)self->numFeatures ; ++j) {
+        if (_vl_covdet_suppresses(self->features + i, self->features + j, tol)) {
+          self->features[j].peakScore = 0 ;
+          self->numNonExtremaSuppressed ++ ;
+        }
+      }
+    }
+    return ;
+  }
+
+  for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
+    VlCovDetFeature const * feature = self->features + i ;
+    double sigma = feature->frame.a11 ;
+    double side ;
+    /* features with non-positive scale never interact */
+    if (! (sigma > 0)) continue ;
+    cells[numCells].s = floor(log(sigma) / logBase) ;
+    side = _vl_covdet_cell_side(tol, cells[numCells].s) ;
+    cells[numCells].y = floor(feature->frame.y / side) ;
+    cells[numCells].x = floor(feature->frame.x / side) ;
+    cells[numCells].score = vl_abs_d(feature->peakScore) ;
+    cells[numCells].index = i ;
+    numCells ++ ;
+  }
+  qsort(cells, numCells, sizeof(VlCovDetCell), _vl_covdet_compare_cells) ;
+
+  for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
+    VlCovDetFeature const * feature = self->features + i ;
+    double x = feature->frame.x ;
+    double y = feature->frame.y ;
+    double sigma = feature->frame.a11 ;
+    double s, cs, dy, side ;
+
+    if (! (sigma > 0) || feature->peakScore == 0) continue ;
+    s = floor(log(sigma) / logBase) ;
+
+    for (cs = s - 2 ; cs <= s + 2 ; ++cs) {
+      side = _vl_covdet_cell_side(tol, cs) ;
+      for (dy = -1 ; dy <= 1 ; ++dy) {
+        double cy = floor(y / side) + dy ;
+        double cx = floor(x / side) ;
+        vl_size begin = _vl_covdet_find_cell(cells, numCells, cs, cy, cx - 1) ;
+        vl_size end = _vl_covdet_find_cell(cells, numCells, cs, cy, cx + 2) ;
+        for ( ; begin < end ; ++begin) {
+          VlCovDetFeature * other = self->features + cells[begin].index ;
+          if (_vl_covdet_suppresses(feature, other, tol)) {
+            other->peakScore = 0 ;
+            self->numNonExtremaSuppressed ++ ;
+          }
+        }
+      }
+    }
+  }
+
+  vl_free(cells) ;
+}
+
+/** @internal @brief Limit the number of features per cell
+ ** @param self object.
+ **
+ ** The features that are not suppressed (non-zero peak score) are
+ ** binned by octave of their scale and by square spatial cells of
+ ** side ::vl_covdet_set_feature_cell_size. In each cell, only the
+ ** ::vl_covdet_set_max_num_features_per_cell features with the
+ ** largest absolute peak score are kept; the others are suppressed
+ ** (their peak score is set to zero).
+ **
+ ** If memory is insufficient, the function sets the last error to
+ ** ::VL_ERR_ALLOC (::vl_get_last_error) and keeps all the features.
+ **/
+
+static void
+_vl_covdet_limit_features_per_cell (VlCovDet * self)
+{
+  double const side = self->featureCellSize ;
+  VlCovDetCell * cells ;
+  vl_size numCells = 0 ;
+  vl_size numKept = 0 ;
+  vl_index i ;
+
+  cells = vl_malloc(sizeof(VlCovDetCell) * self->numFeatures) ;
+  if (cells == NULL) {
+    vl_set_last_error(VL_ERR_ALLOC, "Could not allocate the feature cells.") ;
+    return ;
+  }
+
+  for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
+    VlCovDetFeature const * feature = self->features + i ;
+    double sigma = feature->frame.a11 ;
+    if (feature->peakScore == 0) continue ;
+    cells[numCells].s = (sigma > 0) ? floor(vl_log2_d(sigma)) : 0 ;
+    cells[numCells].y = floor(feature->frame.y / side) ;
+    cells[numCells].x = floor(feature->frame.x / side) ;
+    cells[numCells].score = vl_abs_d(feature->peakScore) ;
+    cells[numCells].index = i ;
+    numCells ++ ;
+  }
+  qsort(cells, numCells, sizeof(VlCovDetCell), _vl_covdet_compare_cells) ;
+
+  /* within a cell, the features are sorted by decreasing score */
+  for (i = 0 ; i < (signed)numCells ; ++i) {
+    if (i == 0 ||
+        cells[i].s != cells[i-1].s ||
+        cells[i].y != cells[i-1].y ||
+        cells[i].x != cells[i-1].x) {
+      numKept = 0 ;
+    }
+    if (numKept < self->maxNumFeaturesPerCell) {
+      numKept ++ ;
+    } else {
+      self->features[cells[i].index].peakScore = 0 ;
+    }
+  }
+
+  vl_free(cells) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                  Detect features */
+/* ---------------------------------------------------------------- */
+
+/** @brief Detect scale-space features
+ ** @param method
+ ** @return new covariant detector.
+ **/
+
+void
+vl_covdet_detect (VlCovDet * self)
+{
+  VlScaleSpaceGeometry geom = vl_scalespace_get_geometry(self->gss) ;
+  VlScaleSpaceGeometry cgeom ;
+  vl_bool cssReady = VL_FALSE ;
+  float * levelxx = NULL ;
+  float * levelyy = NULL ;
+  float * levelxy = NULL ;
+  vl_index o, s ;
+
+  assert (self) ;
+  assert (self->gss) ;
+
+  /* clear previous detections if any */
+  self->numFeatures = 0 ;
+
+  /* prepare buffers ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+  cgeom = geom ;
+  if (self->method == VL_COVDET_METHOD_DOG) {
+    cgeom.octaveFirstSubdivision = -1 ;
+  }
+  if (self->css) {
+    VlScaleSpaceGeometry cssGeom = vl_scalespace_get_geometry(self->css) ;
+    cssReady =
+    cssGeom.width == cgeom.width &&
+    cssGeom.height == cgeom.height &&
+    cssGeom.firstOctave == cgeom.firstOctave &&
+    cssGeom.lastOctave == cgeom.lastOctave &&
+    cssGeom.octaveResolution == cgeom.octaveResolution &&
+    cssGeom.octaveFirstSubdivision == cgeom.octaveFirstSubdivision &&
+    cssGeom.octaveLastSubdivision == cgeom.octaveLastSubdivision ;
+  }
+  if (! cssReady) {
+    if (self->css) vl_scalespace_delete(self->css) ;
+    self->css = vl_scalespace_new(cgeom.width, cgeom.height,
+                                  cgeom.lastOctave - cgeom.firstOctave + 1,
+                                  cgeom.firstOctave,
+                                  cgeom.octaveResolution,
+                                  cgeom.octaveFirstSubdivision,
+                                  cgeom.octaveLastSubdivision) ;
+  }
+  if (self->method == VL_COVDET_METHOD_HARRIS_LAPLACE ||
+      self->method == VL_COVDET_METHOD_MULTISCALE_HARRIS) {
+    VlScaleSpaceOctaveGeometry oct = vl_scalespace_get_octave_geometry(self->gss, geom.firstOctave) ;
+    levelxx = vl_malloc(oct.width * oct.height * sizeof(float)) ;
+    levelyy = vl_malloc(oct.width * oct.height * sizeof(float)) ;
+    levelxy = vl_malloc(oct.width * oct.height * sizeof(float)) ;
+  }
+
+  /* compute cornerness ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+  for (o = cgeom.firstOctave ; o <= cgeom.lastOctave ; ++o) {
+    VlScaleSpaceOctaveGeometry oct = vl_scalespace_get_octave_geometry(self->css, o) ;
+
+    for (s = cgeom.octaveFirstSubdivision ; s <= cgeom.octaveLastSubdivision ; ++s) {
+      float * level = vl_scalespace_get_level(self->gss, o, s) ;
+      float * clevel = vl_scalespace_get_level(self->css, o, s) ;
+      double sigma = vl_scalespace_get_level_sigma(self->css, o, s) ;
       switch (self->method) {
         case VL_COVDET_METHOD_DOG:
           _vl_dog_response(clevel, level,
@@ -1183,31 +1707,13 @@ vl_covdet_detect (VlCovDet * self)
       break ;
   }
 
-  if (self->nonExtremaSuppression) {
+  if (self->nonExtremaSuppression || self->maxNumFeaturesPerCell > 0) {
     vl_index i, j ;
-    double tol = self->nonExtremaSuppression ;
-    self->numNonExtremaSuppressed = 0 ;
-    for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
-      double x = self->features[i].frame.x ;
-      double y = self->features[i].frame.y ;
-      double sigma = self->features[i].frame.a11 ;
-      double score = self->features[i].peakScore ;
-
-      for (j = 0 ; j < (signed)self->numFeatures ; ++j) {
-        double dx_ = self->features[j].frame.x - x ;
-        double dy_ = self->features[j].frame.y - y ;
-        double sigma_ = self->features[j].frame.a11 ;
-        double score_ = self->features[j].peakScore ;
-        if (score_ == 0) continue ;
-        if (sigma < (1+tol) * sigma_ &&
-            sigma_ < (1+tol) * sigma &&
-            vl_abs_d(dx_) < tol * sigma &&
-            vl_abs_d(dy_) < tol * sigma &&
-            vl_abs_d(score) > vl_abs_d(score_)) {
-          self->features[j].peakScore = 0 ;
-          self->numNonExtremaSuppressed ++ ;
-        }
-      }
+    if (self->nonExtremaSuppression) {
+      _vl_covdet_suppress_non_extrema (self) ;
+    }
+    if (self->maxNumFeaturesPerCell > 0) {
+      _vl_covdet_limit_features_per_cell (self) ;
     }
     j = 0 ;
     for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
@@ -1228,31 +1734,25 @@ vl_covdet_detect (VlCovDet * self)
 /*                                                  Extract patches */
 /* ---------------------------------------------------------------- */
 
-/** @brief Helper for extracting patches
+/** @internal @brief Helper for extracting patches
  ** @param self object.
- ** @param sigma1 actual patch smoothing along the first axis (out).
- ** @param sigma2 actual patch smoothing along the second axis (out).
- ** @param patch buffer.
- ** @param resolution patch resolution.
- ** @param extent patch extent.
- ** @param sigma desired smoothing in the patch frame.
- ** @param A linear transfomration from patch to image.
- ** @param T translation from patch to image.
- ** @param d1 first singular value @a A.
- ** @param d2 second singular value of @a A.
+ ** @param scratch scratch space used to pad the image.
+ **
+ ** The other parameters are as in ::vl_covdet_extract_patch_helper.
  **/
 
-vl_bool
-vl_covdet_extract_patch_helper (VlCovDet * self,
-                                double * sigma1,
-                                double * sigma2,
-                                float * patch,
-                                vl_size resolution,
-                                double extent,
-                                double sigma,
-                                double (A_) [4],
-                                double (T_) [2],
-                                double d1, double d2)
+static vl_bool
+_vl_covdet_extract_patch_helper (VlCovDet * self,
+                                 VlCovDetScratch * scratch,
+                                 double * sigma1,
+                                 double * sigma2,
+                                 float * patch,
+                                 vl_size resolution,
+                                 double extent,
+                                 double sigma,
+                                 double (A_) [4],
+                                 double (T_) [2],
+                                 double d1, double d2)
 {
   vl_index o, s ;
   double factor ;
@@ -1394,15 +1894,20 @@ vl_covdet_extract_patch_helper (VlCovDet * self,
       vl_index patchWidth = x1i - x0i + 1 ;
       vl_index patchHeight = y1i - y0i + 1 ;
       vl_size patchBufferSize = patchWidth * patchHeight * sizeof(float) ;
-      if (patchBufferSize > self->patchBufferSize) {
-        int err = _vl_resize_buffer((void**)&self->patch, &self->patchBufferSize, patchBufferSize) ;
+      if (patchBufferSize > scratch->patchBufferSize) {
+        int err ;
+        if (scratch->locked) {
+          scratch->overflow = VL_TRUE ;
+          return VL_ERR_OVERFLOW ;
+        }
+        err = _vl_resize_buffer((void**)&scratch->patch, &scratch->patchBufferSize, patchBufferSize) ;
         if (err) return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
       }
 
       if (pady0 < patchHeight - pady1) {
         /* start by filling the central horizontal band */
         for (yi = y0i + pady0 ; yi < y0i + patchHeight - pady1 ; ++ yi) {
-          float *dst = self->patch + (yi - y0i) * patchWidth ;
+          float *dst = scratch->patch + (yi - y0i) * patchWidth ;
           float const *src = level + yi * width + VL_MIN(VL_MAX(0, x0i),width-1) ;
           for (xi = x0i ; xi < x0i + padx0 ; ++xi) *dst++ = *src ;
           for ( ; xi < x0i + patchWidth - padx1 - 2 ; ++xi) *dst++ = *src++ ;
@@ -1410,18 +1915,18 @@ vl_covdet_extract_patch_helper (VlCovDet * self,
         }
         /* now extend the central band up and down */
         for (yi = 0 ; yi < pady0 ; ++yi) {
-          memcpy(self->patch + yi * patchWidth,
-                 self->patch + pady0 * patchWidth,
+          memcpy(scratch->patch + yi * patchWidth,
+                 scratch->patch + pady0 * patchWidth,
                  patchWidth * sizeof(float)) ;
         }
         for (yi = patchHeight - pady1 ; yi < patchHeight ; ++yi) {
-          memcpy(self->patch + yi * patchWidth,
-                 self->patch + (patchHeight - pady1 - 1) * patchWidth,
+          memcpy(scratch->patch + yi * patchWidth,
+                 scratch->patch + (patchHeight - pady1 - 1) * patchWidth,
                  patchWidth * sizeof(float)) ;
         }
       } else {
         /* should be handled better! */
-        memset(self->patch, 0, self->patchBufferSize) ;
+        memset(scratch->patch, 0, scratch->patchBufferSize) ;
       }
 #if 0
       {
@@ -1431,7 +1936,7 @@ vl_covdet_extract_patch_helper (VlCovDet * self,
       }
 #endif
 
-      level = self->patch ;
+      level = scratch->patch ;
       width = patchWidth ;
       height = patchHeight ;
       T[0] -= x0i ;
@@ -1487,6 +1992,62 @@ vl_covdet_extract_patch_helper (VlCovDet * self,
   return VL_ERR_OK ;
 }
 
+/** @brief Helper for extracting patches
+ ** @param self object.
+ ** @param sigma1 actual patch smoothing along the first axis (out).
+ ** @param sigma2 actual patch smoothing along the second axis (out).
+ ** @param patch buffer.
+ ** @param resolution patch resolution.
+ ** @param extent patch extent.
+ ** @param sigma desired smoothing in the patch frame.
+ ** @param A linear transfomration from patch to image.
+ ** @param T translation from patch to image.
+ ** @param d1 first singular value @a A.
+ ** @param d2 second singular value of @a A.
+ **/
+
+vl_bool
+vl_covdet_extract_patch_helper (VlCovDet * self,
+                                double * sigma1,
+                                double * sigma2,
+                                float * patch,
+                                vl_size resolution,
+                                double extent,
+                                double sigma,
+                                double (A_) [4],
+                                double (T_) [2],
+                                double d1, double d2)
+{
+  return _vl_covdet_extract_patch_helper
+  (self, self->scratch, sigma1, sigma2, patch, resolution, extent, sigma, A_, T_, d1, d2) ;
+}
+
+/** @internal @brief Helper for ::vl_covdet_extract_patch_for_frame
+ ** @param self object.
+ ** @param scratch scratch space.
+ **
+ ** The other parameters are as in ::vl_covdet_extract_patch_for_frame.
+ **/
+
+static vl_bool
+_vl_covdet_extract_patch_for_frame (VlCovDet * self,
+                                    VlCovDetScratch * scratch,
+                                    float * patch,
+                                    vl_size resolution,
+                                    double extent,
+                                    double sigma,
+                                    VlFrameOrientedEllipse frame)
+{
+  double A[2*2] = {frame.a11, frame.a21, frame.a12, frame.a22} ;
+  double T[2] = {frame.x, frame.y} ;
+  double D[4], U[4], V[4] ;
+
+  vl_svd2(D, U, V, A) ;
+
+  return _vl_covdet_extract_patch_helper
+  (self, scratch, NULL, NULL, patch, resolution, extent, sigma, A, T, D[0], D[3]) ;
+}
+
 /** @brief Helper for extracting patches
  ** @param self object.
  ** @param patch buffer.
@@ -1515,34 +2076,78 @@ vl_covdet_extract_patch_for_frame (VlCovDet * self,
                                    double sigma,
                                    VlFrameOrientedEllipse frame)
 {
-  double A[2*2] = {frame.a11, frame.a21, frame.a12, frame.a22} ;
-  double T[2] = {frame.x, frame.y} ;
-  double D[4], U[4], V[4] ;
+  return _vl_covdet_extract_patch_for_frame
+  (self, self->scratch, patch, resolution, extent, sigma, frame) ;
+}
 
-  vl_svd2(D, U, V, A) ;
+/** @internal @brief Smooth an affine adaptation patch
+ ** @param scratch scratch space holding the patch.
+ ** @param patch patch to smooth (in place).
+ ** @param sigmax smoothing along the first axis.
+ ** @param sigmay smoothing along the second axis.
+ **
+ ** The result is the same as ::vl_imsmooth_f, but the function
+ ** uses the buffers in @a scratch and does not allocate memory.
+ **/
+
+static void
+_vl_covdet_smooth_aa_patch (VlCovDetScratch * scratch,
+                            float * patch,
+                            double sigmax, double sigmay)
+{
+  vl_size const side = 2*VL_COVDET_AA_PATCH_RESOLUTION + 1 ;
+  float * filter = scratch->aaFilter ;
+  int pass ;
+
+  for (pass = 0 ; pass < 2 ; ++pass) {
+    double sigma = (pass == 0) ? sigmay : sigmax ;
+    vl_index width = vl_ceil_d(sigma * 3.0) ;
+    float mass = 1.0f ;
+    vl_index i ;
+
+    assert(2 * width + 1 <= VL_COVDET_AA_MAX_FILTER_SIZE) ;
+    assert(sigma < VL_IMSMOOTH_RECURSIVE_MIN_SIGMA) ;
+
+    filter[width] = 1.0f ;
+    for (i = 1 ; i <= width ; ++i) {
+      double x = (double)i / sigma ;
+      double g = exp(-0.5 * x * x) ;
+      mass += g + g ;
+      filter[width-i] = g ;
+      filter[width+i] = g ;
+    }
+    for (i = 0 ; i < 2 * width + 1 ; ++i) {filter[i] /= mass ;}
 
-  return vl_covdet_extract_patch_helper
-  (self, NULL, NULL, patch, resolution, extent, sigma, A, T, D[0], D[3]) ;
+    if (pass == 0) {
+      vl_imconvcol_vf (scratch->aaBuffer, side,
+                       patch, side, side, side,
+                       filter, -width, width,
+                       1, VL_PAD_BY_CONTINUITY | VL_TRANSPOSE) ;
+    } else {
+      vl_imconvcol_vf (patch, side,
+                       scratch->aaBuffer, side, side, side,
+                       filter, -width, width,
+                       1, VL_PAD_BY_CONTINUITY | VL_TRANSPOSE) ;
+    }
+  }
 }
 
 /* ---------------------------------------------------------------- */
 /*                                                     Affine shape */
 /* ---------------------------------------------------------------- */
 
-/** @brief Extract the affine shape for a feature frame
+/** @internal @brief Helper for ::vl_covdet_extract_affine_shape_for_frame
  ** @param self object.
- ** @param adapted the shape-adapted frame.
- ** @param frame the input frame.
- ** @return ::VL_ERR_OK if affine adaptation is successful.
+ ** @param scratch scratch space.
  **
- ** This function may fail if adaptation is unsuccessful or if
- ** memory is insufficient.
+ ** The other parameters are as in ::vl_covdet_extract_affine_shape_for_frame.
  **/
 
-int
-vl_covdet_extract_affine_shape_for_frame (VlCovDet * self,
-                                          VlFrameOrientedEllipse * adapted,
-                                          VlFrameOrientedEllipse frame)
+static int
+_vl_covdet_extract_affine_shape_for_frame (VlCovDet * self,
+                                           VlCovDetScratch * scratch,
+                                           VlFrameOrientedEllipse * adapted,
+                                           VlFrameOrientedEllipse frame)
 {
   vl_index iter = 0 ;
 
@@ -1607,31 +2212,30 @@ vl_covdet_extract_affine_shape_for_frame (VlCovDet * self,
 
     if (++iter >= VL_COVDET_AA_MAX_NUM_ITERATIONS) break ;
 
-    err = vl_covdet_extract_patch_helper(self,
-                                         &sigma1, &sigma2,
-                                         self->aaPatch,
-                                         resolution,
-                                         extent,
-                                         sigmaD,
-                                         A, T, D[0], D[3]) ;
+    err = _vl_covdet_extract_patch_helper(self, scratch,
+                                           &sigma1, &sigma2,
+                                           scratch->aaPatch,
+                                           resolution,
+                                           extent,
+                                           sigmaD,
+                                           A, T, D[0], D[3]) ;
     if (err) return err ;
 
     if (self->aaAccurateSmoothing ) {
       double deltaSigma1 = sqrt(VL_MAX(sigmaD*sigmaD - sigma1*sigma1,0)) ;
       double deltaSigma2 = sqrt(VL_MAX(sigmaD*sigmaD - sigma2*sigma2,0)) ;
       double stephat = extent / resolution ;
-      vl_imsmooth_f(self->aaPatch, side,
-                    self->aaPatch, side, side, side,
-                    deltaSigma1 / stephat, deltaSigma2 / stephat) ;
+      _vl_covdet_smooth_aa_patch(scratch, scratch->aaPatch,
+                                 deltaSigma1 / stephat, deltaSigma2 / stephat) ;
     }
 
     /* compute second moment matrix */
-    vl_imgradient_f (self->aaPatchX, self->aaPatchY, 1, side,
-                     self->aaPatch, side, side, side) ;
+    vl_imgradient_f (scratch->aaPatchX, scratch->aaPatchY, 1, side,
+                     scratch->aaPatch, side, side, side) ;
 
     for (k = 0 ; k < (signed)(side*side) ; ++k) {
-      double lx = self->aaPatchX[k] ;
-      double ly = self->aaPatchY[k] ;
+      double lx = scratch->aaPatchX[k] ;
+      double ly = scratch->aaPatchY[k] ;
       lxx += lx * lx * self->aaMask[k] ;
       lyy += ly * ly * self->aaMask[k] ;
       lxy += lx * ly * self->aaMask[k] ;
@@ -1721,11 +2325,58 @@ vl_covdet_extract_affine_shape_for_frame (VlCovDet * self,
   return VL_ERR_OK ;
 }
 
+/** @brief Extract the affine shape for a feature frame
+ ** @param self object.
+ ** @param adapted the shape-adapted frame.
+ ** @param frame the input frame.
+ ** @return ::VL_ERR_OK if affine adaptation is successful.
+ **
+ ** This function may fail if adaptation is unsuccessful or if
+ ** memory is insufficient.
+ **/
+
+int
+vl_covdet_extract_affine_shape_for_frame (VlCovDet * self,
+                                          VlFrameOrientedEllipse * adapted,
+                                          VlFrameOrientedEllipse frame)
+{
+  return _vl_covdet_extract_affine_shape_for_frame
+  (self, self->scratch, adapted, frame) ;
+}
+
+/** @internal @brief Data of the parallel affine adaptation */
+typedef struct _VlCovDetAffineShapeTask
+{
+  VlCovDetFeatureTask base ;
+  VlCovDetFeature const * features ;
+  VlFrameOrientedEllipse * adapted ;
+  int * status ;
+} VlCovDetAffineShapeTask ;
+
+static void
+_vl_covdet_affine_shape_task (void * data,
+                              vl_uindex begin, vl_uindex end,
+                              vl_uindex slot)
+{
+  VlCovDetAffineShapeTask * task = data ;
+  VlCovDetScratch * scratch = task->base.self->scratch + slot ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++i) {
+    scratch->overflow = VL_FALSE ;
+    task->status[i] = _vl_covdet_extract_affine_shape_for_frame
+    (task->base.self, scratch, task->adapted + i, task->features[i].frame) ;
+    task->base.deferred[i] = scratch->overflow ;
+  }
+}
+
 /** @brief Extract the affine shape for the stored features
  ** @param self object.
  **
  ** This function may discard features for which no affine
  ** shape can reliably be detected.
+ **
+ ** Features are processed in parallel, each thread using its own
+ ** scratch space. The order of the features is preserved.
  **/
 
 void
@@ -1734,17 +2385,34 @@ vl_covdet_extract_affine_shape (VlCovDet * self)
   vl_index i, j = 0 ;
   vl_size numFeatures = vl_covdet_get_num_features(self) ;
   VlCovDetFeature * feature = vl_covdet_get_features(self);
-  for (i = 0 ; i < (signed)numFeatures ; ++i) {
-    int status ;
-    VlFrameOrientedEllipse adapted ;
-    status = vl_covdet_extract_affine_shape_for_frame(self, &adapted, feature[i].frame) ;
-    if (status == VL_ERR_OK) {
-      feature[j] = feature[i] ;
-      feature[j].frame = adapted ;
-      ++ j ;
+  VlCovDetAffineShapeTask task ;
+
+  if (numFeatures == 0) return ;
+
+  task.base.self = self ;
+  task.features = feature ;
+  task.adapted = vl_malloc(sizeof(VlFrameOrientedEllipse) * numFeatures) ;
+  task.status = vl_malloc(sizeof(int) * numFeatures) ;
+  if (task.adapted == NULL || task.status == NULL) {
+    vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    if (task.adapted) vl_free(task.adapted) ;
+    if (task.status) vl_free(task.status) ;
+    return ;
+  }
+
+  if (_vl_covdet_process_features(&task.base, _vl_covdet_affine_shape_task) == VL_ERR_OK) {
+    for (i = 0 ; i < (signed)numFeatures ; ++i) {
+      if (task.status[i] == VL_ERR_OK) {
+        feature[j] = feature[i] ;
+        feature[j].frame = task.adapted[i] ;
+        ++ j ;
+      }
     }
+    self->numFeatures = j ;
   }
-  self->numFeatures = j ;
+
+  vl_free(task.adapted) ;
+  vl_free(task.status) ;
 }
 
 /* ---------------------------------------------------------------- */
@@ -1762,21 +2430,18 @@ _vl_covdet_compare_orientations_descending (void const * a_,
   return 0 ;
 }
 
-/** @brief Extract the orientation(s) for a feature frame
+/** @internal @brief Helper for ::vl_covdet_extract_orientations_for_frame
  ** @param self object.
- ** @param numOrientations the number of detected orientations.
- ** @return an array of detected orientations with their scores.
+ ** @param scratch scratch space.
  **
- ** The returned array is a matrix of size @f$ 2 \times n @f$
- ** where <em>n</em> is the number of detected orientations.
- **
- ** The function returns @c NULL if memory is insufficient.
+ ** The other parameters are as in ::vl_covdet_extract_orientations_for_frame.
  **/
 
-VlCovDetFeatureOrientation *
-vl_covdet_extract_orientations_for_frame (VlCovDet * self,
-                                          vl_size * numOrientations,
-                                          VlFrameOrientedEllipse frame)
+static VlCovDetFeatureOrientation *
+_vl_covdet_extract_orientations_for_frame (VlCovDet * self,
+                                           VlCovDetScratch * scratch,
+                                           vl_size * numOrientations,
+                                           VlFrameOrientedEllipse frame)
 {
   int err ;
   vl_index k, i ;
@@ -1830,13 +2495,13 @@ vl_covdet_extract_orientations_for_frame (VlCovDet * self,
 
   theta0 = atan2(V[1],V[0]) ;
 
-  err = vl_covdet_extract_patch_helper(self,
-                                       &sigma1, &sigma2,
-                                       self->aaPatch,
-                                       resolution,
-                                       extent,
-                                       sigmaD,
-                                       A, T, D[0], D[3]) ;
+  err = _vl_covdet_extract_patch_helper(self, scratch,
+                                        &sigma1, &sigma2,
+                                        scratch->aaPatch,
+                                        resolution,
+                                        extent,
+                                        sigmaD,
+                                        A, T, D[0], D[3]) ;
 
   if (err) {
     *numOrientations = 0 ;
@@ -1847,20 +2512,19 @@ vl_covdet_extract_orientations_for_frame (VlCovDet * self,
     double deltaSigma1 = sqrt(VL_MAX(sigmaD*sigmaD - sigma1*sigma1,0)) ;
     double deltaSigma2 = sqrt(VL_MAX(sigmaD*sigmaD - sigma2*sigma2,0)) ;
     double stephat = extent / resolution ;
-    vl_imsmooth_f(self->aaPatch, side,
-                  self->aaPatch, side, side, side,
-                  deltaSigma1 / stephat, deltaSigma2 / stephat) ;
+    _vl_covdet_smooth_aa_patch(scratch, scratch->aaPatch,
+                               deltaSigma1 / stephat, deltaSigma2 / stephat) ;
   }
 
   /* histogram of oriented gradients */
-  vl_imgradient_polar_f (self->aaPatchX, self->aaPatchY, 1, side,
-                         self->aaPatch, side, side, side) ;
+  vl_imgradient_polar_f (scratch->aaPatchX, scratch->aaPatchY, 1, side,
+                         scratch->aaPatch, side, side, side) ;
 
   memset (hist, 0, sizeof(double) * numBins) ;
 
   for (k = 0 ; k < (signed)(side*side) ; ++k) {
-    double modulus = self->aaPatchX[k] ;
-    double angle = self->aaPatchY[k] ;
+    double modulus = scratch->aaPatchX[k] ;
+    double angle = scratch->aaPatchY[k] ;
     double weight = self->aaMask[k] ;
 
     double x = angle / binExtent ;
@@ -1907,8 +2571,8 @@ vl_covdet_extract_orientations_for_frame (VlCovDet * self,
         /* the axis to the right is y, measure orientations from this */
         th = th - VL_PI/2 ;
       }
-      self->orientations[*numOrientations].angle = th ;
-      self->orientations[*numOrientations].score = h0 ;
+      scratch->orientations[*numOrientations].angle = th ;
+      scratch->orientations[*numOrientations].score = h0 ;
       *numOrientations += 1 ;
       //VL_PRINTF("%d %g\n", *numOrientations, th) ;
 
@@ -1917,12 +2581,65 @@ vl_covdet_extract_orientations_for_frame (VlCovDet * self,
   }
 
   /* sort the oritentations by decreasing scores */
-  qsort(self->orientations,
+  qsort(scratch->orientations,
         *numOrientations,
         sizeof(VlCovDetFeatureOrientation),
         _vl_covdet_compare_orientations_descending) ;
 
-  return self->orientations ;
+  return scratch->orientations ;
+}
+
+/** @brief Extract the orientation(s) for a feature frame
+ ** @param self object.
+ ** @param numOrientations the number of detected orientations.
+ ** @return an array of detected orientations with their scores.
+ **
+ ** The returned array is a matrix of size @f$ 2 \times n @f$
+ ** where <em>n</em> is the number of detected orientations.
+ **
+ ** The function returns @c NULL if memory is insufficient.
+ **/
+
+VlCovDetFeatureOrientation *
+vl_covdet_extract_orientations_for_frame (VlCovDet * self,
+                                          vl_size * numOrientations,
+                                          VlFrameOrientedEllipse frame)
+{
+  return _vl_covdet_extract_orientations_for_frame
+  (self, self->scratch, numOrientations, frame) ;
+}
+
+/** @internal @brief Data of the parallel orientation assignment */
+typedef struct _VlCovDetOrientationsTask
+{
+  VlCovDetFeatureTask base ;
+  VlCovDetFeature const * features ;
+  vl_size * numOrientations ;
+  VlCovDetFeatureOrientation * orientations ;
+} VlCovDetOrientationsTask ;
+
+static void
+_vl_covdet_orientations_task (void * data,
+                              vl_uindex begin, vl_uindex end,
+                              vl_uindex slot)
+{
+  VlCovDetOrientationsTask * task = data ;
+  VlCovDetScratch * scratch = task->base.self->scratch + slot ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++i) {
+    VlCovDetFeatureOrientation const * orientations ;
+    scratch->overflow = VL_FALSE ;
+    orientations =
+    _vl_covdet_extract_orientations_for_frame(task->base.self, scratch,
+                                              task->numOrientations + i,
+                                              task->features[i].frame) ;
+    if (task->numOrientations[i] > 0) {
+      memcpy(task->orientations + i * VL_COVDET_MAX_NUM_ORIENTATIONS,
+             orientations,
+             task->numOrientations[i] * sizeof(VlCovDetFeatureOrientation)) ;
+    }
+    task->base.deferred[i] = scratch->overflow ;
+  }
 }
 
 /** @brief Extract the orientation(s) for the stored features.
@@ -1931,6 +2648,10 @@ vl_covdet_extract_orientations_for_frame (VlCovDet * self,
  ** Note that, since more than one orientation can be detected
  ** for each feature, this function may create copies of them,
  ** one for each orientation.
+ **
+ ** Orientations are computed in parallel; the copies are then
+ ** appended sequentially, so that the output does not depend on the
+ ** number of threads.
  **/
 
 void
@@ -1938,11 +2659,33 @@ vl_covdet_extract_orientations (VlCovDet * self)
 {
   vl_index i, j  ;
   vl_size numFeatures = vl_covdet_get_num_features(self) ;
+  VlCovDetOrientationsTask task ;
+
+  if (numFeatures == 0) return ;
+
+  task.base.self = self ;
+  task.features = self->features ;
+  task.numOrientations = vl_malloc(sizeof(vl_size) * numFeatures) ;
+  task.orientations = vl_malloc(sizeof(VlCovDetFeatureOrientation) *
+                                VL_COVDET_MAX_NUM_ORIENTATIONS * numFeatures) ;
+  if (task.numOrientations == NULL || task.orientations == NULL) {
+    vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    if (task.numOrientations) vl_free(task.numOrientations) ;
+    if (task.orientations) vl_free(task.orientations) ;
+    return ;
+  }
+
+  if (_vl_covdet_process_features(&task.base, _vl_covdet_orientations_task)) {
+    vl_free(task.numOrientations) ;
+    vl_free(task.orientations) ;
+    return ;
+  }
+
   for (i = 0 ; i < (signed)numFeatures ; ++i) {
-    vl_size numOrientations ;
+    vl_size numOrientations = task.numOrientations[i] ;
     VlCovDetFeature feature = self->features[i] ;
-    VlCovDetFeatureOrientation* orientations =
-    vl_covdet_extract_orientations_for_frame(self, &numOrientations, feature.frame) ;
+    VlCovDetFeatureOrientation const * orientations =
+    task.orientations + i * VL_COVDET_MAX_NUM_ORIENTATIONS ;
 
     for (j = 0 ; j < (signed)numOrientations ; ++j) {
       double A [2*2] = {
@@ -1968,24 +2711,27 @@ vl_covdet_extract_orientations (VlCovDet * self)
       oriented->frame.a22 = - A[1] * r2 + A[3] * r1 ;
     }
   }
+
+  vl_free(task.numOrientations) ;
+  vl_free(task.orientations) ;
 }
 
 /* ---------------------------------------------------------------- */
 /*                                                 Laplacian scales */
 /* ---------------------------------------------------------------- */
 
-/** @brief Extract the Laplacian scale(s) for a feature frame.
+/** @internal @brief Helper for ::vl_covdet_extract_laplacian_scales_for_frame
  ** @param self object.
- ** @param numScales the number of detected scales.
- ** @return an array of detected scales.
+ ** @param scratch scratch space.
  **
- ** The function returns @c NULL if memory is insufficient.
+ ** The other parameters are as in ::vl_covdet_extract_laplacian_scales_for_frame.
  **/
 
-VlCovDetFeatureLaplacianScale *
-vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
-                                              vl_size * numScales,
-                                              VlFrameOrientedEllipse frame)
+static VlCovDetFeatureLaplacianScale *
+_vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
+                                               VlCovDetScratch * scratch,
+                                               vl_size * numScales,
+                                               VlFrameOrientedEllipse frame)
 {
   /*
    We try to explore one octave, with the nominal detection scale 1.0
@@ -2024,8 +2770,8 @@ vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
 
   vl_svd2(D, U, V, A) ;
 
-  err = vl_covdet_extract_patch_helper
-  (self, &sigma1, &sigma2, self->lapPatch, resolution, extent, sigmaImage, A, T, D[0], D[3]) ;
+  err = _vl_covdet_extract_patch_helper
+  (self, scratch, &sigma1, &sigma2, scratch->lapPatch, resolution, extent, sigmaImage, A, T, D[0], D[3]) ;
   if (err) return NULL ;
 
   /* the actual smoothing after warping is never the target one */
@@ -2049,7 +2795,7 @@ vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
                     + actualSigmaImage*actualSigmaImage) ;
 
     for (q = 0 ; q < (signed)(num * num) ; ++q) {
-      score += (*pt++) * self->lapPatch[q] ;
+      score += (*pt++) * scratch->lapPatch[q] ;
     }
     scores[k] = score * sigmaLap * sigmaLap ;
   }
@@ -2075,13 +2821,63 @@ vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
        k,s,sigmaLapFilter,sigmaLap,scale,a,b,c) ;
        */
       if (*numScales < VL_COVDET_MAX_NUM_LAPLACIAN_SCALES) {
-        self->scales[*numScales].scale = scale * factor ;
-        self->scales[*numScales].score = b + 0.5 * (c - a) * dk ;
+        scratch->scales[*numScales].scale = scale * factor ;
+        scratch->scales[*numScales].score = b + 0.5 * (c - a) * dk ;
         *numScales += 1 ;
       }
     }
   }
-  return self->scales ;
+  return scratch->scales ;
+}
+
+/** @brief Extract the Laplacian scale(s) for a feature frame.
+ ** @param self object.
+ ** @param numScales the number of detected scales.
+ ** @return an array of detected scales.
+ **
+ ** The function returns @c NULL if memory is insufficient.
+ **/
+
+VlCovDetFeatureLaplacianScale *
+vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
+                                              vl_size * numScales,
+                                              VlFrameOrientedEllipse frame)
+{
+  return _vl_covdet_extract_laplacian_scales_for_frame
+  (self, self->scratch, numScales, frame) ;
+}
+
+/** @internal @brief Data of the parallel Laplacian scale selection */
+typedef struct _VlCovDetLaplacianScalesTask
+{
+  VlCovDetFeatureTask base ;
+  VlCovDetFeature const * features ;
+  vl_size * numScales ;
+  VlCovDetFeatureLaplacianScale * scales ;
+} VlCovDetLaplacianScalesTask ;
+
+static void
+_vl_covdet_laplacian_scales_task (void * data,
+                                  vl_uindex begin, vl_uindex end,
+                                  vl_uindex slot)
+{
+  VlCovDetLaplacianScalesTask * task = data ;
+  VlCovDetScratch * scratch = task->base.self->scratch + slot ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++i) {
+    VlCovDetFeatureLaplacianScale const * scales ;
+    scratch->overflow = VL_FALSE ;
+    scales =
+    _vl_covdet_extract_laplacian_scales_for_frame(task->base.self, scratch,
+                                                  task->numScales + i,
+                                                  task->features[i].frame) ;
+    if (task->numScales[i] > 0) {
+      memcpy(task->scales + i * VL_COVDET_MAX_NUM_LAPLACIAN_SCALES,
+             scales,
+             task->numScales[i] * sizeof(VlCovDetFeatureLaplacianScale)) ;
+    }
+    task->base.deferred[i] = scratch->overflow ;
+  }
 }
 
 /** @brief Extract the Laplacian scales for the stored features
@@ -2090,6 +2886,10 @@ vl_covdet_extract_laplacian_scales_for_frame (VlCovDet * self,
  ** Note that, since more than one orientation can be detected
  ** for each feature, this function may create copies of them,
  ** one for each orientation.
+ **
+ ** As for ::vl_covdet_extract_orientations, the scales are computed
+ ** in parallel and the output does not depend on the number of
+ ** threads.
  **/
 void
 vl_covdet_extract_laplacian_scales (VlCovDet * self)
@@ -2097,14 +2897,35 @@ vl_covdet_extract_laplacian_scales (VlCovDet * self)
   vl_index i, j  ;
   vl_bool dropFeaturesWithoutScale = VL_TRUE ;
   vl_size numFeatures = vl_covdet_get_num_features(self) ;
+  VlCovDetLaplacianScalesTask task ;
   memset(self->numFeaturesWithNumScales, 0,
          sizeof(self->numFeaturesWithNumScales)) ;
 
+  if (numFeatures == 0) return ;
+
+  task.base.self = self ;
+  task.features = self->features ;
+  task.numScales = vl_malloc(sizeof(vl_size) * numFeatures) ;
+  task.scales = vl_malloc(sizeof(VlCovDetFeatureLaplacianScale) *
+                          VL_COVDET_MAX_NUM_LAPLACIAN_SCALES * numFeatures) ;
+  if (task.numScales == NULL || task.scales == NULL) {
+    vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    if (task.numScales) vl_free(task.numScales) ;
+    if (task.scales) vl_free(task.scales) ;
+    return ;
+  }
+
+  if (_vl_covdet_process_features(&task.base, _vl_covdet_laplacian_scales_task)) {
+    vl_free(task.numScales) ;
+    vl_free(task.scales) ;
+    return ;
+  }
+
   for (i = 0 ; i < (signed)numFeatures ; ++i) {
-    vl_size numScales ;
+    vl_size numScales = task.numScales[i] ;
     VlCovDetFeature feature = self->features[i] ;
     VlCovDetFeatureLaplacianScale const * scales =
-    vl_covdet_extract_laplacian_scales_for_frame(self, &numScales, feature.frame) ;
+    task.scales + i * VL_COVDET_MAX_NUM_LAPLACIAN_SCALES ;
 
     self->numFeaturesWithNumScales[numScales] ++ ;
 
@@ -2129,6 +2950,9 @@ vl_covdet_extract_laplacian_scales (VlCovDet * self)
       scaled->frame.a22 *= scales[j].scale ;
     }
   }
+  vl_free(task.numScales) ;
+  vl_free(task.scales) ;
+
   if (dropFeaturesWithoutScale) {
     j = 0 ;
     for (i = 0 ; i < (signed)self->numFeatures ; ++i) {
@@ -2142,6 +2966,193 @@ vl_covdet_extract_laplacian_scales (VlCovDet * self)
 
 }
 
+/* ---------------------------------------------------------------- */
+/*                                                      Descriptors */
+/* ---------------------------------------------------------------- */
+
+#define VL_COVDET_SIFT_DIMENSION 128
+
+/** @internal @brief Transpose a SIFT descriptor
+ ** @param dst destination buffer.
+ ** @param src source buffer.
+ **
+ ** The function writes to @a dst the transpose of the SIFT descriptor
+ ** @a src, i.e. the descriptor that one obtains by computing the
+ ** normal descriptor on the transposed image.
+ **/
+
+static void
+_vl_covdet_flip_sift_descriptor (float * dst, float const * src)
+{
+  int const BO = 8 ;  /* number of orientation bins */
+  int const BP = 4 ;  /* number of spatial bins     */
+  int i, j, t ;
+
+  for (j = 0 ; j < BP ; ++j) {
+    int jp = BP - 1 - j ;
+    for (i = 0 ; i < BP ; ++i) {
+      int o  = BO * i + BP*BO * j  ;
+      int op = BO * i + BP*BO * jp ;
+      dst [op] = src[o] ;
+      for (t = 1 ; t < BO ; ++t)
+        dst [BO - t + op] = src [t + o] ;
+    }
+  }
+}
+
+/** @internal @brief Data of the parallel descriptor computation */
+typedef struct _VlCovDetDescriptorsTask
+{
+  VlCovDetFeatureTask base ;
+  VlSiftFilt const * sift ;
+  float * descriptors ;
+  vl_size resolution ;
+  double extent ;
+  double sigma ;
+  vl_size gradientOffset ;
+} VlCovDetDescriptorsTask ;
+
+static void
+_vl_covdet_descriptors_task (void * data,
+                             vl_uindex begin, vl_uindex end,
+                             vl_uindex slot)
+{
+  VlCovDetDescriptorsTask * task = data ;
+  VlCovDet * self = task->base.self ;
+  VlCovDetScratch * scratch = self->scratch + slot ;
+  vl_size const side = 2 * task->resolution + 1 ;
+  double const step = task->extent / task->resolution ;
+  float * patch = scratch->descPatch ;
+  float * grad = scratch->descPatch + task->gradientOffset ;
+  float temp [VL_COVDET_SIFT_DIMENSION] ;
+  vl_uindex i ;
+
+  /*
+   The SIFT descriptor of a keypoint of scale sigma extends for
+   magnif * sigma * (NBP + 1) / 2 pixels in each direction, where
+   magnif = 3 and NBP = 4. The keypoint scale is chosen so that this
+   matches the patch extent.
+   */
+  double const siftSigma = task->extent / (3.0 * (4 + 1) / 2) / step ;
+
+  for (i = begin ; i < end ; ++i) {
+    float * descr = task->descriptors + i * VL_COVDET_SIFT_DIMENSION ;
+    int err ;
+    scratch->overflow = VL_FALSE ;
+    err = _vl_covdet_extract_patch_for_frame(self, scratch, patch,
+                                             task->resolution,
+                                             task->extent,
+                                             task->sigma,
+                                             self->features[i].frame) ;
+    task->base.deferred[i] = scratch->overflow ;
+    if (err) {
+      memset(descr, 0, sizeof(float) * VL_COVDET_SIFT_DIMENSION) ;
+      continue ;
+    }
+
+    vl_imgradient_polar_f (grad, grad + 1,
+                           2, 2 * side,
+                           patch, side, side, side) ;
+
+    if (self->transposed) {
+      /*
+       The patch is transposed, so that x and y are swapped. Since
+       the SIFT orientation bins are not symmetric under rotations of
+       pi/2 in general, the descriptor is computed rotated by an
+       additional pi/2 angle, so that x coincides and y is flipped,
+       and then flipped back.
+       */
+      vl_sift_calc_raw_descriptor (task->sift, grad, temp,
+                                   (int)side, (int)side,
+                                   (double)(side - 1) / 2, (double)(side - 1) / 2,
+                                   siftSigma, VL_PI / 2) ;
+      _vl_covdet_flip_sift_descriptor (descr, temp) ;
+    } else {
+      vl_sift_calc_raw_descriptor (task->sift, grad, descr,
+                                   (int)side, (int)side,
+                                   (double)(side - 1) / 2, (double)(side - 1) / 2,
+                                   siftSigma, 0) ;
+    }
+  }
+}
+
+/** @brief Extract SIFT descriptors for the stored features
+ ** @param self object.
+ ** @param descriptors descriptors (output).
+ ** @param resolution patch resolution.
+ ** @param extent patch extent.
+ ** @param sigma desired smoothing in the patch frame.
+ ** @return status.
+ **
+ ** For each stored feature, the function warps a patch as
+ ** ::vl_covdet_extract_patch_for_frame does and computes a SIFT
+ ** descriptor on it. The descriptor covers the whole patch. The
+ ** values @a resolution = 15, @a extent = 7.5 and @a sigma = 1
+ ** match the geometry of the standard SIFT descriptor.
+ **
+ ** @a descriptors must have room for 128 floats per feature; the
+ ** descriptors are stored in the same order as the features. If the
+ ** detector uses the transposed convention
+ ** (::vl_covdet_set_transposed), so do the descriptors.
+ **
+ ** Features are processed in parallel. Each thread warps the patches
+ ** and computes their gradients in a buffer of its own. The buffers
+ ** and the SIFT filter that computes the descriptors are kept by the
+ ** detector and reused across calls. The function may fail with ::VL_ERR_ALLOC if
+ ** memory is insufficient.
+ **/
+
+int
+vl_covdet_extract_descriptors (VlCovDet * self,
+                               float * descriptors,
+                               vl_size resolution,
+                               double extent,
+                               double sigma)
+{
+  vl_size numFeatures = vl_covdet_get_num_features(self) ;
+  vl_size const side = 2 * resolution + 1 ;
+  vl_size bufferSize ;
+  VlCovDetDescriptorsTask task ;
+  vl_uindex t ;
+  int err ;
+
+  assert(self) ;
+  assert(resolution > 0) ;
+  assert(descriptors || numFeatures == 0) ;
+
+  if (numFeatures == 0) return VL_ERR_OK ;
+  err = _vl_covdet_reserve_scratch(self) ;
+  if (err) return err ;
+
+  /* the patch is followed by its gradient, starting on a 16-byte boundary */
+  task.gradientOffset = (side * side + 3) & ~ (vl_size)3 ;
+  bufferSize = (task.gradientOffset + 2 * side * side) * sizeof(float) ;
+  for (t = 0 ; t < self->numScratch ; ++t) {
+    VlCovDetScratch * scratch = self->scratch + t ;
+    if (bufferSize > scratch->descPatchBufferSize) {
+      err = _vl_resize_buffer((void**)&scratch->descPatch,
+                              &scratch->descPatchBufferSize, bufferSize) ;
+      if (err) return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    }
+  }
+
+  /* the filter only provides the descriptor parameters */
+  if (self->sift == NULL) {
+    self->sift = vl_sift_new(16, 16, 1, 3, 0) ;
+    if (self->sift == NULL) return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    vl_sift_set_magnif(self->sift, 3.0) ;
+  }
+
+  task.base.self = self ;
+  task.sift = self->sift ;
+  task.descriptors = descriptors ;
+  task.resolution = resolution ;
+  task.extent = extent ;
+  task.sigma = sigma ;
+
+  return _vl_covdet_process_features(&task.base, _vl_covdet_descriptors_task) ;
+}
+
 /* ---------------------------------------------------------------- */
 /*                       Checking that features are inside an image */
 /* ---------------------------------------------------------------- */
@@ -2385,6 +3396,63 @@ vl_covdet_get_num_non_extrema_suppressed (VlCovDet const * self)
   return self->numNonExtremaSuppressed ;
 }
 
+/** @brief Get the maximum number of features per cell
+ ** @param self object.
+ ** @return maximum number of features (0 for no limit).
+ **/
+
+vl_size
+vl_covdet_get_max_num_features_per_cell (VlCovDet const * self)
+{
+  return self->maxNumFeaturesPerCell ;
+}
+
+/** @brief Set the maximum number of features per cell
+ ** @param self object.
+ ** @param n maximum number of features (0 for no limit).
+ **
+ ** If @a n is positive, after non-extrema suppression the features
+ ** are binned by octave of their scale and by square spatial cells
+ ** (see ::vl_covdet_set_feature_cell_size), and only the @a n
+ ** features with the largest absolute peak score are kept in each
+ ** cell. This spreads the features uniformly over the image and the
+ ** scales.
+ **/
+
+void
+vl_covdet_set_max_num_features_per_cell (VlCovDet * self, vl_size n)
+{
+  self->maxNumFeaturesPerCell = n ;
+}
+
+/** @brief Get the side of the feature cells
+ ** @param self object.
+ ** @return side of the cells in pixels.
+ ** @sa ::vl_covdet_set_feature_cell_size
+ **/
+
+double
+vl_covdet_get_feature_cell_size (VlCovDet const * self)
+{
+  return self->featureCellSize ;
+}
+
+/** @brief Set the side of the feature cells
+ ** @param self object.
+ ** @param side side of the cells in pixels (positive).
+ **
+ ** The cells are used to limit the number of features per cell
+ ** (::vl_covdet_set_max_num_features_per_cell). The default is 32
+ ** pixels.
+ **/
+
+void
+vl_covdet_set_feature_cell_size (VlCovDet * self, double side)
+{
+  assert(side > 0) ;
+  self->featureCellSize = side ;
+}
+
 
 /* ---------------------------------------------------------------- */
 /** @brief Get number of stored frames
@@ -208,6 +208,12 @@ vl_covdet_extract_patch_for_frame (VlCovDet * self, float * patch,
                                    double sigma,
                                    VlFrameOrientedEllipse frame) ;
 
+VL_EXPORT int
+vl_covdet_extract_descriptors (VlCovDet * self, float * descriptors,
+                               vl_size resolution,
+                               double extent,
+                               double sigma) ;
+
 VL_EXPORT void
 vl_covdet_drop_features_outside (VlCovDet * self, double margin) ;
 
@@ -229,6 +235,8 @@ VL_EXPORT vl_bool vl_covdet_get_aa_accurate_smoothing (VlCovDet const * self) ;
 VL_EXPORT vl_size const * vl_covdet_get_laplacian_scales_statistics (VlCovDet const * self, vl_size * numScales) ;
 VL_EXPORT double vl_covdet_get_non_extrema_suppression_threshold (VlCovDet const * self) ;
 VL_EXPORT vl_size vl_covdet_get_num_non_extrema_suppressed (VlCovDet const * self) ;
+VL_EXPORT vl_size vl_covdet_get_max_num_features_per_cell (VlCovDet const * self) ;
+VL_EXPORT double vl_covdet_get_feature_cell_size (VlCovDet const * self) ;
 
 /** @} */
 
@@ -242,6 +250,8 @@ VL_EXPORT void vl_covdet_set_edge_threshold (VlCovDet * self, double edgeThresho
 VL_EXPORT void vl_covdet_set_transposed (VlCovDet * self, vl_bool t) ;
 VL_EXPORT void vl_covdet_set_aa_accurate_smoothing (VlCovDet * self, vl_bool x) ;
 VL_EXPORT void vl_covdet_set_non_extrema_suppression_threshold (VlCovDet * self, double x) ;
+VL_EXPORT void vl_covdet_set_max_num_features_per_cell (VlCovDet * self, vl_size n) ;
+VL_EXPORT void vl_covdet_set_feature_cell_size (VlCovDet * self, double side) ;
 /** @} */
 
 /* VL_COVDET_H */
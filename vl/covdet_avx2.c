@@ -0,0 +1,82 @@
+/** @file covdet_avx2.c
+ ** @brief Covariant feature detectors - AVX2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DISABLE_AVX2
+#if ! defined(__AVX2__) || ! defined(__FMA__)
+#  error "covdet_avx2.c must be compiled with AVX2 and FMA intrinsics enabled"
+#endif
+
+#include <immintrin.h>
+#include "mathop.h"
+#include "covdet_avx2.h"
+
+/* See covdet_sse2.c for the description of the function. */
+
+VL_EXPORT vl_index
+_vl_find_local_extrema_row_avx2 (vl_uint32 * mask, float const * row,
+                                 vl_size width, vl_size yo, vl_size zo,
+                                 double threshold)
+{
+  float const thr = (float) threshold ;
+  vl_bool const strict = ((double) thr < threshold) ;
+  __m256 const vthr = _mm256_set1_ps (thr) ;
+  __m256 const vnthr = _mm256_set1_ps (- thr) ;
+  vl_index const dzMax = (zo > 0) ? 1 : 0 ;
+  vl_index x ;
+
+  for (x = 1 ; x + 8 <= (signed)width - 1 ; x += 8) {
+    float const * pt = row + x ;
+    __m256 c = _mm256_loadu_ps (pt) ;
+    __m256 isMax = strict ?
+      _mm256_cmp_ps (c, vthr, _CMP_GT_OQ) :
+      _mm256_cmp_ps (c, vthr, _CMP_GE_OQ) ;
+    __m256 isMin = strict ?
+      _mm256_cmp_ps (c, vnthr, _CMP_LT_OQ) :
+      _mm256_cmp_ps (c, vnthr, _CMP_LE_OQ) ;
+    __m256 nmax = _mm256_set1_ps (- VL_INFINITY_F) ;
+    __m256 nmin = _mm256_set1_ps (VL_INFINITY_F) ;
+    vl_index dz, dy ;
+    int m ;
+
+    if (_mm256_movemask_ps (_mm256_or_ps (isMax, isMin)) == 0) continue ;
+
+    for (dz = - dzMax ; dz <= dzMax ; ++ dz) {
+      for (dy = -1 ; dy <= 1 ; ++ dy) {
+        float const * pn = pt + dz * (signed)zo + dy * (signed)yo ;
+        __m256 l = _mm256_loadu_ps (pn - 1) ;
+        __m256 r = _mm256_loadu_ps (pn + 1) ;
+        nmax = _mm256_max_ps (nmax, _mm256_max_ps (l, r)) ;
+        nmin = _mm256_min_ps (nmin, _mm256_min_ps (l, r)) ;
+        if (dz != 0 || dy != 0) {
+          __m256 v = _mm256_loadu_ps (pn) ;
+          nmax = _mm256_max_ps (nmax, v) ;
+          nmin = _mm256_min_ps (nmin, v) ;
+        }
+      }
+    }
+
+    m = _mm256_movemask_ps
+    (_mm256_or_ps (_mm256_and_ps (isMax, _mm256_cmp_ps (c, nmax, _CMP_GT_OQ)),
+                   _mm256_and_ps (isMin, _mm256_cmp_ps (c, nmin, _CMP_LT_OQ)))) ;
+    for ( ; m ; m >>= 1, ++ pt) {
+      if (m & 1) {
+        vl_index xe = pt - row ;
+        mask [xe >> 5] |= (vl_uint32) 1 << (xe & 31) ;
+      }
+    }
+  }
+  return x ;
+}
+
+/* VL_DISABLE_AVX2 */
+#endif
@@ -0,0 +1,29 @@
+/** @file covdet_avx2.h
+ ** @brief Covariant feature detectors - AVX2
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_COVDET_AVX2_H
+#define VL_COVDET_AVX2_H
+
+#include "generic.h"
+
+#ifndef VL_DISABLE_AVX2
+
+VL_EXPORT vl_index
+_vl_find_local_extrema_row_avx2 (vl_uint32 * mask, float const * row,
+                               vl_size width, vl_size yo, vl_size zo,
+                               double threshold) ;
+
+#endif
+
+/* VL_COVDET_AVX2_H */
+#endif
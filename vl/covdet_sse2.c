@@ -0,0 +1,96 @@
+/** @file covdet_sse2.c
+ ** @brief Covariant feature detectors - SSE2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_SSE2) & ! defined(__SSE2__)
+#error "Compiling with SSE2 enabled, but no __SSE2__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_SSE2)
+
+#include <emmintrin.h>
+#include "mathop.h"
+#include "covdet_sse2.h"
+
+/** @internal @brief Find the local extrema in a row of a map
+ ** @param mask bitmap of the row (bit @c x is set for an extremum at @c x).
+ ** @param row pointer to the first element of the row.
+ ** @param width of the map.
+ ** @param yo offset between two rows.
+ ** @param zo offset between two levels (0 for a 2D map).
+ ** @param threshold minimum extremum value.
+ ** @return first element of the row that was not processed.
+ **
+ ** The function compares four elements at a time with their 8 (2D)
+ ** or 26 (3D) neighbours and stops when fewer than four inner
+ ** elements are left. Elements whose absolute value is below the
+ ** threshold are pruned before loading the neighbours. The results
+ ** are identical to the ones of the scalar code.
+ **/
+
+VL_EXPORT vl_index
+_vl_find_local_extrema_row_sse2 (vl_uint32 * mask, float const * row,
+                                 vl_size width, vl_size yo, vl_size zo,
+                                 double threshold)
+{
+  /* The rounding of the threshold to single precision is compensated
+     by switching to a strict comparison, so that @c v >= threshold
+     has the same outcome in single and double precision. */
+  float const thr = (float) threshold ;
+  vl_bool const strict = ((double) thr < threshold) ;
+  __m128 const vthr = _mm_set1_ps (thr) ;
+  __m128 const vnthr = _mm_set1_ps (- thr) ;
+  vl_index const dzMax = (zo > 0) ? 1 : 0 ;
+  vl_index x ;
+
+  for (x = 1 ; x + 4 <= (signed)width - 1 ; x += 4) {
+    float const * pt = row + x ;
+    __m128 c = _mm_loadu_ps (pt) ;
+    __m128 isMax = strict ? _mm_cmpgt_ps (c, vthr) : _mm_cmpge_ps (c, vthr) ;
+    __m128 isMin = strict ? _mm_cmplt_ps (c, vnthr) : _mm_cmple_ps (c, vnthr) ;
+    __m128 nmax = _mm_set1_ps (- VL_INFINITY_F) ;
+    __m128 nmin = _mm_set1_ps (VL_INFINITY_F) ;
+    vl_index dz, dy ;
+    int m ;
+
+    if (_mm_movemask_ps (_mm_or_ps (isMax, isMin)) == 0) continue ;
+
+    for (dz = - dzMax ; dz <= dzMax ; ++ dz) {
+      for (dy = -1 ; dy <= 1 ; ++ dy) {
+        float const * pn = pt + dz * (signed)zo + dy * (signed)yo ;
+        __m128 l = _mm_loadu_ps (pn - 1) ;
+        __m128 r = _mm_loadu_ps (pn + 1) ;
+        nmax = _mm_max_ps (nmax, _mm_max_ps (l, r)) ;
+        nmin = _mm_min_ps (nmin, _mm_min_ps (l, r)) ;
+        if (dz != 0 || dy != 0) {
+          __m128 v = _mm_loadu_ps (pn) ;
+          nmax = _mm_max_ps (nmax, v) ;
+          nmin = _mm_min_ps (nmin, v) ;
+        }
+      }
+    }
+
+    m = _mm_movemask_ps
+    (_mm_or_ps (_mm_and_ps (isMax, _mm_cmpgt_ps (c, nmax)),
+                _mm_and_ps (isMin, _mm_cmplt_ps (c, nmin)))) ;
+    for ( ; m ; m >>= 1, ++ pt) {
+      if (m & 1) {
+        vl_index xe = pt - row ;
+        mask [xe >> 5] |= (vl_uint32) 1 << (xe & 31) ;
+      }
+    }
+  }
+  return x ;
+}
+
+/* ! VL_DISABLE_SSE2 */
+#endif
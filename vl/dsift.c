@@ -16,6 +16,9 @@ the terms of the BSD license (see the COPYING file).
 #include "pgm.h"
 #include "mathop.h"
 #include "imopv.h"
+#include "threads.h"
+#include "dsift_sse2.h"
+#include "dsift_avx2.h"
 #include <math.h>
 #include <string.h>
 
@@ -371,8 +374,8 @@ _vl_dsift_update_buffers (VlDsiftFilter * self)
  ** @internal @brief Allocate internal buffers
  ** @param self DSIFT filter.
  **
- ** The function (re)allocates the internal buffers in accordance with
- ** the current image and descriptor geometry.
+ ** The function (re)allocates the keypoint and descriptor buffers in
+ ** accordance with the current image and descriptor geometry.
  **/
 
 static void
@@ -382,31 +385,49 @@ _vl_dsift_alloc_buffers (VlDsiftFilter* self)
   {
     int numFrameAlloc = vl_dsift_get_keypoint_num (self) ;
     int numBinAlloc   = vl_dsift_get_descriptor_size (self) ;
-    int numGradAlloc  = self->geom.numBinT ;
 
     /* see if we need to update the buffers */
     if (numBinAlloc != self->numBinAlloc ||
-        numGradAlloc != self->numGradAlloc ||
         numFrameAlloc != self->numFrameAlloc) {
-
-      int t ;
-
-      _vl_dsift_free_buffers(self) ;
-
+      if (self->frames) vl_free(self->frames) ;
+      if (self->descrs) vl_free(self->descrs) ;
       self->frames = vl_malloc(sizeof(VlDsiftKeypoint) * numFrameAlloc) ;
       self->descrs = vl_malloc(sizeof(float) * numBinAlloc * numFrameAlloc) ;
-      self->grads  = vl_malloc(sizeof(float*) * numGradAlloc) ;
-      for (t = 0 ; t < numGradAlloc ; ++t) {
-        self->grads[t] =
-          vl_malloc(sizeof(float) * self->imWidth * self->imHeight) ;
-      }
       self->numBinAlloc = numBinAlloc ;
-      self->numGradAlloc = numGradAlloc ;
       self->numFrameAlloc = numFrameAlloc ;
     }
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @internal @brief Allocate the gradient planes
+ ** @param self DSIFT filter.
+ **
+ ** The planes are needed only by ::vl_dsift_process, and not if the
+ ** caller supplies them to ::vl_dsift_process_planes.
+ **/
+
+static void
+_vl_dsift_alloc_gradients (VlDsiftFilter* self)
+{
+  int numGradAlloc = self->geom.numBinT ;
+  int t ;
+
+  if (numGradAlloc != self->numGradAlloc) {
+    if (self->grads) {
+      for (t = 0 ; t < self->numGradAlloc ; ++t)
+        if (self->grads[t]) vl_free(self->grads[t]) ;
+      vl_free(self->grads) ;
+    }
+    self->grads  = vl_malloc(sizeof(float*) * numGradAlloc) ;
+    for (t = 0 ; t < numGradAlloc ; ++t) {
+      self->grads[t] =
+        vl_malloc(sizeof(float) * self->imWidth * self->imHeight) ;
+    }
+    self->numGradAlloc = numGradAlloc ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Create a new DSIFT filter
  **
@@ -498,10 +519,11 @@ vl_dsift_delete (VlDsiftFilter * self)
 /** ------------------------------------------------------------------
  ** @internal @brief Process with Gaussian window
  ** @param self DSIFT filter.
+ ** @param planes gradient planes.
  **/
 
 VL_INLINE void
-_vl_dsift_with_gaussian_window (VlDsiftFilter * self)
+_vl_dsift_with_gaussian_window (VlDsiftFilter * self, float * const * planes)
 {
   int binx, biny, bint ;
   int framex, framey ;
@@ -527,7 +549,7 @@ _vl_dsift_with_gaussian_window (VlDsiftFilter * self)
       for (bint = 0 ; bint < self->geom.numBinT ; ++bint) {
 
         vl_imconvcol_vf (self->convTmp1, self->imHeight,
-                         self->grads[bint], self->imWidth, self->imHeight,
+                         planes[bint], self->imWidth, self->imHeight,
                          self->imWidth,
                          yker, -Wy, +Wy, 1,
                          VL_PAD_BY_CONTINUITY|VL_TRANSPOSE) ;
@@ -573,10 +595,11 @@ _vl_dsift_with_gaussian_window (VlDsiftFilter * self)
 /** ------------------------------------------------------------------
  ** @internal @brief Process with flat window.
  ** @param self DSIFT filter object.
+ ** @param planes gradient planes.
  **/
 
 VL_INLINE void
-_vl_dsift_with_flat_window (VlDsiftFilter* self)
+_vl_dsift_with_flat_window (VlDsiftFilter* self, float * const * planes)
 {
   int binx, biny, bint ;
   int framex, framey ;
@@ -585,7 +608,7 @@ _vl_dsift_with_flat_window (VlDsiftFilter* self)
   for (bint = 0 ; bint < self->geom.numBinT ; ++bint) {
 
     vl_imconvcoltri_f (self->convTmp1, self->imHeight,
-                       self->grads [bint], self->imWidth, self->imHeight,
+                       planes [bint], self->imWidth, self->imHeight,
                        self->imWidth,
                        self->geom.binSizeY, /* filt size */
                        1, /* subsampling step */
@@ -659,73 +682,234 @@ _vl_dsift_with_flat_window (VlDsiftFilter* self)
   } /* bint */
 }
 
+/** ------------------------------------------------------------------
+ ** @internal @brief Quantize the gradient of a pixel
+ **
+ ** @param grads gradient planes.
+ ** @param numBinT number of orientation bins (and planes).
+ ** @param offset offset of the pixel in the planes.
+ ** @param gx horizontal derivative.
+ ** @param gy vertical derivative.
+ **
+ ** The function writes the pixel in all the planes.
+ **/
+
+VL_INLINE void
+_vl_dsift_quantize_gradient (float * const * grads, int numBinT, vl_size offset,
+                             float gx, float gy)
+{
+  float angle, mod, nt, rbint ;
+  int bint, t ;
+
+  /* angle and modulus */
+  angle = vl_fast_atan2_f (gy,gx) ;
+  mod = vl_fast_sqrt_f (gx*gx + gy*gy) ;
+
+  /* quantize angle */
+  nt = vl_mod_2pi_f (angle) * (numBinT / (2*VL_PI)) ;
+  bint = (int) vl_floor_f (nt) ;
+  rbint = nt - bint ;
+
+  /* write it back */
+  for (t = 0 ; t < numBinT ; ++t) grads [t][offset] = 0 ;
+  grads [(bint    ) % numBinT][offset] = (1 - rbint) * mod ;
+  grads [(bint + 1) % numBinT][offset] = (    rbint) * mod ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Compute and quantize the gradient of a pixel
+ **
+ ** @param self DSIFT filter.
+ ** @param planes gradient planes.
+ ** @param row image row.
+ ** @param above row above (or @a row at the top border).
+ ** @param below row below (or @a row at the bottom border).
+ ** @param scale factor of the vertical derivative.
+ ** @param x pixel column.
+ ** @param y pixel row.
+ **/
+
+VL_INLINE void
+_vl_dsift_quantize_pixel (VlDsiftFilter const * self,
+                          float * const * planes,
+                          float const * row,
+                          float const * above,
+                          float const * below,
+                          float scale,
+                          int x, int y)
+{
+  float gx, gy ;
+
+  /* y derivative */
+  gy = scale * (below[x] - above[x]) ;
+
+  /* x derivative */
+  if (x == 0) {
+    gx = row[x+1] - row[x] ;
+  } else if (x == self->imWidth - 1) {
+    gx = row[x] - row[x-1] ;
+  } else {
+    gx = 0.5F * (row[x+1] - row[x-1]) ;
+  }
+
+  _vl_dsift_quantize_gradient (planes, self->geom.numBinT,
+                               x + y * self->imWidth, gx, gy) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Quantize the gradients of a row by SIMD instructions
+ ** @return first pixel of the row that was not processed.
+ **
+ ** The function returns 1 if no vectorized implementation is
+ ** available. The parameters are as in ::_vl_dsift_quantize_row_sse2.
+ **/
+
+static vl_index
+_vl_dsift_quantize_row_simd (float * const * grads, int numBinT, vl_size offset,
+                             float const * row,
+                             float const * above,
+                             float const * below,
+                             float scale,
+                             vl_size width)
+{
+#ifndef VL_DISABLE_AVX2
+  if (vl_cpu_has_avx2() && vl_cpu_has_fma() && vl_get_simd_enabled()) {
+    return _vl_dsift_quantize_row_avx2 (grads, numBinT, offset,
+                                        row, above, below, scale, width) ;
+  }
+#endif
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2() && vl_get_simd_enabled()) {
+    return _vl_dsift_quantize_row_sse2 (grads, numBinT, offset,
+                                        row, above, below, scale, width) ;
+  }
+#endif
+  return 1 ;
+}
+
+/** @internal @brief Data of the gradient quantization task */
+typedef struct _VlDsiftQuantizeTask
+{
+  VlDsiftFilter const * self ;
+  float * const * planes ;
+  float const * im ;
+} VlDsiftQuantizeTask ;
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Quantize the gradients of a band of rows
+ **
+ ** @param data DSIFT filter and image (::VlDsiftQuantizeTask).
+ ** @param begin first row.
+ ** @param end last row plus one.
+ ** @param slot thread slot (unused).
+ **
+ ** The gradient planes are filled row by row. Since each row writes
+ ** all the planes, the bands can be processed in parallel and the
+ ** planes need not be cleared beforehand.
+ **/
+
+static void
+_vl_dsift_quantize_task (void * data, vl_uindex begin, vl_uindex end,
+                         vl_uindex slot)
+{
+  VlDsiftQuantizeTask * task = data ;
+  VlDsiftFilter const * self = task->self ;
+  float * const * planes = task->planes ;
+  float const * im = task->im ;
+  int const width = self->imWidth ;
+  int const height = self->imHeight ;
+  int x, y ;
+  (void) slot ;
+
+  for (y = (int) begin ; y < (int) end ; ++ y) {
+    float const * row = im + y * width ;
+    float const * above = (y > 0) ? row - width : row ;
+    float const * below = (y < height - 1) ? row + width : row ;
+    float scale = (y > 0 && y < height - 1) ? 0.5F : 1.0F ;
+
+    /* the first pixel, then the inner pixels by SIMD, then the rest */
+    _vl_dsift_quantize_pixel (self, planes, row, above, below, scale, 0, y) ;
+    x = (int) _vl_dsift_quantize_row_simd (planes, self->geom.numBinT,
+                                           y * width, row, above, below,
+                                           scale, width) ;
+    for ( ; x < width ; ++ x) {
+      _vl_dsift_quantize_pixel (self, planes, row, above, below, scale, x, y) ;
+    }
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Compute the gradient orientation planes of an image
+ **
+ ** @param self DSIFT filter.
+ ** @param planes gradient planes.
+ ** @param im image data.
+ **
+ ** The function computes the image gradients and splits them into
+ ** @c numBinT planes (see ::VlDsiftDescriptorGeometry) of the same
+ ** size as the image, one for each orientation bin. @a planes is an
+ ** array of @c numBinT pointers to buffers of the size of the image.
+ **
+ ** The image gradients are computed and quantized in bands of rows
+ ** processed in parallel (see @ref threads), and by SSE2 or AVX2
+ ** instructions if available (see ::vl_set_simd_enabled). The results
+ ** do not depend on either.
+ **
+ ** @sa ::vl_dsift_process_planes.
+ **/
+
+void
+vl_dsift_compute_planes (VlDsiftFilter const * self,
+                         float * const * planes,
+                         float const * im)
+{
+  VlDsiftQuantizeTask task ;
+  task.self = self ;
+  task.planes = planes ;
+  task.im = im ;
+  vl_parallel_for (self->imHeight, 0, _vl_dsift_quantize_task, &task) ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Compute keypoints and descriptors
  **
  ** @param self DSIFT filter.
  ** @param im   image data.
+ **
+ ** The function is equivalent to computing the gradient planes by
+ ** ::vl_dsift_compute_planes and passing them to
+ ** ::vl_dsift_process_planes, using buffers owned by the filter.
  **/
 
 void vl_dsift_process (VlDsiftFilter* self, float const* im)
 {
-  int t, x, y ;
+  _vl_dsift_alloc_gradients (self) ;
+  vl_dsift_compute_planes (self, self->grads, im) ;
+  vl_dsift_process_planes (self, self->grads) ;
+}
 
+/** ------------------------------------------------------------------
+ ** @brief Compute keypoints and descriptors from gradient planes
+ **
+ ** @param self DSIFT filter.
+ ** @param planes gradient planes.
+ **
+ ** The function is like ::vl_dsift_process, but starts from gradient
+ ** planes computed by ::vl_dsift_compute_planes. The planes are not
+ ** modified. Since they do not depend on the sampling steps, bounds
+ ** and spatial bins, the same planes can be used to compute
+ ** descriptors of different geometries.
+ **/
+
+void vl_dsift_process_planes (VlDsiftFilter* self, float * const * planes)
+{
   /* update buffers */
   _vl_dsift_alloc_buffers (self) ;
 
-  /* clear integral images */
-  for (t = 0 ; t < self->geom.numBinT ; ++t)
-    memset (self->grads[t], 0,
-            sizeof(float) * self->imWidth * self->imHeight) ;
-
-#undef at
-#define at(x,y) (im[(y)*self->imWidth+(x)])
-
-  /* Compute gradients, their norm, and their angle */
-
-  for (y = 0 ; y < self->imHeight ; ++ y) {
-    for (x = 0 ; x < self->imWidth ; ++ x) {
-      float gx, gy ;
-      float angle, mod, nt, rbint ;
-      int bint ;
-
-      /* y derivative */
-      if (y == 0) {
-        gy = at(x,y+1) - at(x,y) ;
-      } else if (y == self->imHeight - 1) {
-        gy = at(x,y) - at(x,y-1) ;
-      } else {
-        gy = 0.5F * (at(x,y+1) - at(x,y-1)) ;
-      }
-
-      /* x derivative */
-      if (x == 0) {
-        gx = at(x+1,y) - at(x,y) ;
-      } else if (x == self->imWidth - 1) {
-        gx = at(x,y) - at(x-1,y) ;
-      } else {
-        gx = 0.5F * (at(x+1,y) - at(x-1,y)) ;
-      }
-
-      /* angle and modulus */
-      angle = vl_fast_atan2_f (gy,gx) ;
-      mod = vl_fast_sqrt_f (gx*gx + gy*gy) ;
-
-      /* quantize angle */
-      nt = vl_mod_2pi_f (angle) * (self->geom.numBinT / (2*VL_PI)) ;
-      bint = (int) vl_floor_f (nt) ;
-      rbint = nt - bint ;
-
-      /* write it back */
-      self->grads [(bint    ) % self->geom.numBinT][x + y * self->imWidth] = (1 - rbint) * mod ;
-      self->grads [(bint + 1) % self->geom.numBinT][x + y * self->imWidth] = (    rbint) * mod ;
-    }
-  }
-
   if (self->useFlatWindow) {
-    _vl_dsift_with_flat_window(self) ;
+    _vl_dsift_with_flat_window(self, planes) ;
   } else {
-    _vl_dsift_with_gaussian_window(self) ;
+    _vl_dsift_with_gaussian_window(self, planes) ;
   }
 
   {
@@ -74,6 +74,11 @@ VL_EXPORT VlDsiftFilter *vl_dsift_new (int width, int height) ;
 VL_EXPORT VlDsiftFilter *vl_dsift_new_basic (int width, int height, int step, int binSize) ;
 VL_EXPORT void vl_dsift_delete (VlDsiftFilter *self) ;
 VL_EXPORT void vl_dsift_process (VlDsiftFilter *self, float const* im) ;
+VL_EXPORT void vl_dsift_compute_planes (VlDsiftFilter const *self,
+                                        float * const *planes,
+                                        float const* im) ;
+VL_EXPORT void vl_dsift_process_planes (VlDsiftFilter *self,
+                                        float * const *planes) ;
 VL_INLINE void vl_dsift_transpose_descriptor (float* dst,
                                              float const* src,
                                              int numBinT,
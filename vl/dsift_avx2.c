@@ -0,0 +1,118 @@
+/** @file dsift_avx2.c
+ ** @brief Dense SIFT gradient quantization - AVX2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DISABLE_AVX2
+#if ! defined(__AVX2__) || ! defined(__FMA__)
+#  error "dsift_avx2.c must be compiled with AVX2 and FMA intrinsics enabled"
+#endif
+
+#include <immintrin.h>
+#include "mathop.h"
+#include "dsift_avx2.h"
+
+/* See dsift_sse2.c for the description of the function. Products and
+   sums are not fused, so that the results match the scalar code. */
+
+VL_EXPORT vl_index
+_vl_dsift_quantize_row_avx2 (float * const * grads, int numBinT, vl_size offset,
+                             float const * row,
+                             float const * above,
+                             float const * below,
+                             float scale,
+                             vl_size width)
+{
+  __m256 const zero = _mm256_setzero_ps () ;
+  __m256 const half = _mm256_set1_ps (0.5F) ;
+  __m256 const one = _mm256_set1_ps (1.0F) ;
+  __m256 const threeHalves = _mm256_set1_ps (1.5F) ;
+  __m256 const vscale = _mm256_set1_ps (scale) ;
+  __m256 const signMask = _mm256_set1_ps (-0.0F) ;
+  __m256 const eps = _mm256_set1_ps (VL_EPSILON_F) ;
+  __m256 const c3 = _mm256_set1_ps (0.1821F) ;
+  __m256 const c1 = _mm256_set1_ps (0.9675F) ;
+  __m256 const quarterPi = _mm256_set1_ps ((float) (VL_PI / 4)) ;
+  __m256 const threeQuarterPi = _mm256_set1_ps ((float) (3 * VL_PI / 4)) ;
+  __m256 const twoPi = _mm256_set1_ps ((float) (2 * VL_PI)) ;
+  __m256 const minSqr = _mm256_set1_ps (1e-8F) ;
+  __m256d const binScale = _mm256_set1_pd (numBinT / (2*VL_PI)) ;
+  __m256i const vnumBinT = _mm256_set1_epi32 (numBinT) ;
+  __m256i const ione = _mm256_set1_epi32 (1) ;
+  vl_index x ;
+
+  for (x = 1 ; x + 8 <= (signed)width - 1 ; x += 8) {
+    __m256 gx, gy, absy, pos, r, angle, sqr, u, mod, nt, rbint, w0, w1 ;
+    __m256i bint, b0, b1 ;
+    int t ;
+
+    /* gradient */
+    gy = _mm256_mul_ps (vscale, _mm256_sub_ps (_mm256_loadu_ps (below + x),
+                                               _mm256_loadu_ps (above + x))) ;
+    gx = _mm256_mul_ps (half, _mm256_sub_ps (_mm256_loadu_ps (row + x + 1),
+                                             _mm256_loadu_ps (row + x - 1))) ;
+
+    /* angle (vl_fast_atan2_f) */
+    absy = _mm256_add_ps (_mm256_andnot_ps (signMask, gy), eps) ;
+    pos = _mm256_cmp_ps (gx, zero, _CMP_GE_OQ) ;
+    r = _mm256_blendv_ps
+    (_mm256_div_ps (_mm256_add_ps (gx, absy), _mm256_sub_ps (absy, gx)),
+     _mm256_div_ps (_mm256_sub_ps (gx, absy), _mm256_add_ps (gx, absy)),
+     pos) ;
+    angle = _mm256_blendv_ps (threeQuarterPi, quarterPi, pos) ;
+    angle = _mm256_add_ps
+    (angle, _mm256_mul_ps (_mm256_sub_ps (_mm256_mul_ps (_mm256_mul_ps (c3, r), r), c1), r)) ;
+    angle = _mm256_xor_ps
+    (angle, _mm256_and_ps (_mm256_cmp_ps (gy, zero, _CMP_LT_OQ), signMask)) ;
+
+    /* modulus (vl_fast_sqrt_f) */
+    sqr = _mm256_add_ps (_mm256_mul_ps (gx, gx), _mm256_mul_ps (gy, gy)) ;
+    u = _mm256_castsi256_ps
+    (_mm256_sub_epi32 (_mm256_set1_epi32 (0x5f3759df),
+                       _mm256_srai_epi32 (_mm256_castps_si256 (sqr), 1))) ;
+    {
+      __m256 xhalf = _mm256_mul_ps (half, sqr) ;
+      u = _mm256_mul_ps (u, _mm256_sub_ps (threeHalves, _mm256_mul_ps (_mm256_mul_ps (xhalf, u), u))) ;
+      u = _mm256_mul_ps (u, _mm256_sub_ps (threeHalves, _mm256_mul_ps (_mm256_mul_ps (xhalf, u), u))) ;
+    }
+    mod = _mm256_andnot_ps (_mm256_cmp_ps (sqr, minSqr, _CMP_LE_OQ),
+                            _mm256_mul_ps (sqr, u)) ;
+
+    /* quantize the angle (vl_mod_2pi_f, the scaling is in double) */
+    angle = _mm256_blendv_ps (angle, _mm256_add_ps (angle, twoPi),
+                              _mm256_cmp_ps (angle, zero, _CMP_LT_OQ)) ;
+    nt = _mm256_insertf128_ps
+    (_mm256_castps128_ps256
+     (_mm256_cvtpd_ps (_mm256_mul_pd (_mm256_cvtps_pd (_mm256_castps256_ps128 (angle)), binScale))),
+     _mm256_cvtpd_ps (_mm256_mul_pd (_mm256_cvtps_pd (_mm256_extractf128_ps (angle, 1)), binScale)),
+     1) ;
+    bint = _mm256_cvttps_epi32 (nt) ;
+    rbint = _mm256_sub_ps (nt, _mm256_cvtepi32_ps (bint)) ;
+    w0 = _mm256_mul_ps (_mm256_sub_ps (one, rbint), mod) ;
+    w1 = _mm256_mul_ps (rbint, mod) ;
+    b0 = _mm256_andnot_si256 (_mm256_cmpeq_epi32 (bint, vnumBinT), bint) ;
+    b1 = _mm256_add_epi32 (b0, ione) ;
+    b1 = _mm256_andnot_si256 (_mm256_cmpeq_epi32 (b1, vnumBinT), b1) ;
+
+    /* write the planes (bin b1 overrides b0 as in the scalar code) */
+    for (t = 0 ; t < numBinT ; ++t) {
+      __m256i vt = _mm256_set1_epi32 (t) ;
+      __m256 m0 = _mm256_castsi256_ps (_mm256_cmpeq_epi32 (b0, vt)) ;
+      __m256 m1 = _mm256_castsi256_ps (_mm256_cmpeq_epi32 (b1, vt)) ;
+      _mm256_storeu_ps (grads[t] + offset + x,
+                        _mm256_blendv_ps (_mm256_and_ps (m0, w0), w1, m1)) ;
+    }
+  }
+  return x ;
+}
+
+/* VL_DISABLE_AVX2 */
+#endif
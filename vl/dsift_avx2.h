@@ -0,0 +1,32 @@
+/** @file dsift_avx2.h
+ ** @brief Dense SIFT gradient quantization - AVX2
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DSIFT_AVX2_H
+#define VL_DSIFT_AVX2_H
+
+#include "dsift.h"
+
+#ifndef VL_DISABLE_AVX2
+
+VL_EXPORT vl_index
+_vl_dsift_quantize_row_avx2 (float * const * grads, int numBinT, vl_size offset,
+                           float const * row,
+                           float const * above,
+                           float const * below,
+                           float scale,
+                           vl_size width) ;
+
+#endif
+
+/* VL_DSIFT_AVX2_H */
+#endif
@@ -0,0 +1,140 @@
+/** @file dsift_sse2.c
+ ** @brief Dense SIFT gradient quantization - SSE2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_SSE2) & ! defined(__SSE2__)
+#error "Compiling with SSE2 enabled, but no __SSE2__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_SSE2)
+
+#include <emmintrin.h>
+#include "mathop.h"
+#include "dsift_sse2.h"
+
+/** @internal @brief Select @a a where @a mask is set and @a b elsewhere */
+VL_INLINE __m128
+_vl_select_sse2 (__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps (_mm_and_ps (mask, a), _mm_andnot_ps (mask, b)) ;
+}
+
+/** @internal @brief Quantize the gradient orientations of a row
+ ** @param grads gradient planes.
+ ** @param numBinT number of orientation bins (and planes).
+ ** @param offset offset of the first pixel of the row in the planes.
+ ** @param row image row.
+ ** @param above row above (or @a row at the top border).
+ ** @param below row below (or @a row at the bottom border).
+ ** @param scale factor of the vertical derivative.
+ ** @param width image width.
+ ** @return first pixel of the row that was not processed.
+ **
+ ** The function processes the pixels of the row from the second one
+ ** in blocks of four, and stops when fewer than four inner pixels are
+ ** left. It evaluates ::vl_fast_atan2_f, ::vl_fast_sqrt_f and the
+ ** angle quantization of ::vl_dsift_process on vectors, using the
+ ** same operations in the same order, so that the results are
+ ** identical. Each block writes all the planes, including the zeros,
+ ** so the planes do not need to be cleared.
+ **/
+
+VL_EXPORT vl_index
+_vl_dsift_quantize_row_sse2 (float * const * grads, int numBinT, vl_size offset,
+                             float const * row,
+                             float const * above,
+                             float const * below,
+                             float scale,
+                             vl_size width)
+{
+  __m128 const zero = _mm_setzero_ps () ;
+  __m128 const half = _mm_set1_ps (0.5F) ;
+  __m128 const one = _mm_set1_ps (1.0F) ;
+  __m128 const threeHalves = _mm_set1_ps (1.5F) ;
+  __m128 const vscale = _mm_set1_ps (scale) ;
+  __m128 const signMask = _mm_set1_ps (-0.0F) ;
+  __m128 const eps = _mm_set1_ps (VL_EPSILON_F) ;
+  __m128 const c3 = _mm_set1_ps (0.1821F) ;
+  __m128 const c1 = _mm_set1_ps (0.9675F) ;
+  __m128 const quarterPi = _mm_set1_ps ((float) (VL_PI / 4)) ;
+  __m128 const threeQuarterPi = _mm_set1_ps ((float) (3 * VL_PI / 4)) ;
+  __m128 const twoPi = _mm_set1_ps ((float) (2 * VL_PI)) ;
+  /* (float) 1e-8 < 1e-8, hence x < 1e-8 iff x <= (float) 1e-8 */
+  __m128 const minSqr = _mm_set1_ps (1e-8F) ;
+  __m128d const binScale = _mm_set1_pd (numBinT / (2*VL_PI)) ;
+  __m128i const vnumBinT = _mm_set1_epi32 (numBinT) ;
+  __m128i const ione = _mm_set1_epi32 (1) ;
+  vl_index x ;
+
+  for (x = 1 ; x + 4 <= (signed)width - 1 ; x += 4) {
+    __m128 gx, gy, absy, pos, r, angle, sqr, u, mod, nt, rbint, w0, w1 ;
+    __m128i bint, b0, b1 ;
+    int t ;
+
+    /* gradient */
+    gy = _mm_mul_ps (vscale, _mm_sub_ps (_mm_loadu_ps (below + x),
+                                         _mm_loadu_ps (above + x))) ;
+    gx = _mm_mul_ps (half, _mm_sub_ps (_mm_loadu_ps (row + x + 1),
+                                       _mm_loadu_ps (row + x - 1))) ;
+
+    /* angle (vl_fast_atan2_f) */
+    absy = _mm_add_ps (_mm_andnot_ps (signMask, gy), eps) ;
+    pos = _mm_cmpge_ps (gx, zero) ;
+    r = _vl_select_sse2
+    (pos,
+     _mm_div_ps (_mm_sub_ps (gx, absy), _mm_add_ps (gx, absy)),
+     _mm_div_ps (_mm_add_ps (gx, absy), _mm_sub_ps (absy, gx))) ;
+    angle = _vl_select_sse2 (pos, quarterPi, threeQuarterPi) ;
+    angle = _mm_add_ps
+    (angle, _mm_mul_ps (_mm_sub_ps (_mm_mul_ps (_mm_mul_ps (c3, r), r), c1), r)) ;
+    angle = _mm_xor_ps (angle, _mm_and_ps (_mm_cmplt_ps (gy, zero), signMask)) ;
+
+    /* modulus (vl_fast_sqrt_f) */
+    sqr = _mm_add_ps (_mm_mul_ps (gx, gx), _mm_mul_ps (gy, gy)) ;
+    u = _mm_castsi128_ps
+    (_mm_sub_epi32 (_mm_set1_epi32 (0x5f3759df),
+                    _mm_srai_epi32 (_mm_castps_si128 (sqr), 1))) ;
+    {
+      __m128 xhalf = _mm_mul_ps (half, sqr) ;
+      u = _mm_mul_ps (u, _mm_sub_ps (threeHalves, _mm_mul_ps (_mm_mul_ps (xhalf, u), u))) ;
+      u = _mm_mul_ps (u, _mm_sub_ps (threeHalves, _mm_mul_ps (_mm_mul_ps (xhalf, u), u))) ;
+    }
+    mod = _mm_andnot_ps (_mm_cmple_ps (sqr, minSqr), _mm_mul_ps (sqr, u)) ;
+
+    /* quantize the angle (vl_mod_2pi_f, the scaling is in double) */
+    angle = _vl_select_sse2 (_mm_cmplt_ps (angle, zero),
+                             _mm_add_ps (angle, twoPi), angle) ;
+    nt = _mm_movelh_ps
+    (_mm_cvtpd_ps (_mm_mul_pd (_mm_cvtps_pd (angle), binScale)),
+     _mm_cvtpd_ps (_mm_mul_pd (_mm_cvtps_pd (_mm_movehl_ps (angle, angle)), binScale))) ;
+    bint = _mm_cvttps_epi32 (nt) ;
+    rbint = _mm_sub_ps (nt, _mm_cvtepi32_ps (bint)) ;
+    w0 = _mm_mul_ps (_mm_sub_ps (one, rbint), mod) ;
+    w1 = _mm_mul_ps (rbint, mod) ;
+    b0 = _mm_andnot_si128 (_mm_cmpeq_epi32 (bint, vnumBinT), bint) ;
+    b1 = _mm_add_epi32 (b0, ione) ;
+    b1 = _mm_andnot_si128 (_mm_cmpeq_epi32 (b1, vnumBinT), b1) ;
+
+    /* write the planes (bin b1 overrides b0 as in the scalar code) */
+    for (t = 0 ; t < numBinT ; ++t) {
+      __m128i vt = _mm_set1_epi32 (t) ;
+      __m128 m0 = _mm_castsi128_ps (_mm_cmpeq_epi32 (b0, vt)) ;
+      __m128 m1 = _mm_castsi128_ps (_mm_cmpeq_epi32 (b1, vt)) ;
+      _mm_storeu_ps (grads[t] + offset + x,
+                     _vl_select_sse2 (m1, w1, _mm_and_ps (m0, w0))) ;
+    }
+  }
+  return x ;
+}
+
+/* ! VL_DISABLE_SSE2 */
+#endif
@@ -36,6 +36,7 @@ extraction of code.</em>
 - <b>Algorithms</b>
   - @ref sift
   - @ref dsift
+  - @ref phow
   - @ref mser
   - @ref kmeans
   - @ref ikmeans.h  "Integer K-means (IKM)"
@@ -52,6 +53,7 @@ extraction of code.</em>
   - @ref host.h      "Platform abstraction"
   - @ref generic
   - @ref random.h    "Random number generator"
+  - @ref threads.h   "Thread pool"
   - @ref mathop.h    "Math operations"
   - @ref heap-def.h  "Generic heap object (priority queue)"
   - @ref stringop.h  "String operations"
@@ -169,6 +171,15 @@ different kinds of operations:
   ::vl_set_alloc_func. These operations are <em>not</em> thread safe
   and should be executed before multiple threads are started.
 
+Independently of the above, some VLFeat algorithms use multiple
+threads internally. These threads are taken from a pool shared by the
+whole library (@ref threads). The maximum number of threads used by
+any one computation is set by ::vl_set_num_threads and returned by
+::vl_get_max_threads. By default it is the number of CPUs
+(::vl_get_num_cpus), so these algorithms use all the cores unless
+told otherwise. Setting it to one makes all computations run in
+the calling thread, as in earlier versions of the library.
+
 Some VLFeat algorithms are randomised. Each thread has his own random
 number generator (an instance of ::VlRand) accessed by
 ::vl_get_rand. To make calculations reproducible the random number
@@ -425,7 +436,8 @@ utility. These include stringification (::VL_STRINGIFY,
 VLFeat has some global configuration parameters that can
 changed. Changing the configuration is thread unsave
 (@ref design-threads). Use ::vl_set_simd_enabled to toggle the use of
-a SIMD unit (Intel SSE code), ::vl_set_alloc_func to change
+a SIMD unit (Intel SSE code), ::vl_set_num_threads to set the number
+of threads used by the library, ::vl_set_alloc_func to change
 the memory allocation functions, and ::vl_set_printf_func
 to change the logging function.
 
@@ -475,6 +487,7 @@ elapsed time.
 **/
 
 #include "generic.h"
+#include "threads.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -537,10 +550,12 @@ vl_configuration_to_string_copy ()
                       "VLFeat version %s\n"
                       "    Static config: %s\n"
                       "    %" VL_FMT_SIZE " CPU(s): %s\n"
+                      "    Max threads: %" VL_FMT_SIZE "\n"
                       "    Debug: %s\n",
                       vl_get_version_string (),
                       staticString,
                       vl_get_num_cpus(), cpuString,
+                      vl_get_max_threads(),
                       VL_YESNO(debug)) ;
     length += 1 ;
   }
@@ -713,6 +728,21 @@ vl_unlock_state ()
  ** @return @c true is SIMD instructions are enabled.
  **/
 
+/** @fn ::vl_cpu_has_avx512f()
+ ** @brief Check for AVX-512 Foundation instruction set
+ ** @return @c true if AVX-512F is present and enabled by the OS.
+ **/
+
+/** @fn ::vl_cpu_has_avx2()
+ ** @brief Check for AVX2 instruction set
+ ** @return @c true if AVX2 is present and enabled by the OS.
+ **/
+
+/** @fn ::vl_cpu_has_fma()
+ ** @brief Check for FMA3 instruction set
+ ** @return @c true if FMA3 is present and enabled by the OS.
+ **/
+
 /** @fn ::vl_cpu_has_sse3()
  ** @brief Check for SSE3 instruction set
  ** @return @c true if SSE3 is present.
@@ -723,6 +753,44 @@ vl_unlock_state ()
  ** @return @c true if SSE2 is present.
  **/
 
+/** ------------------------------------------------------------------
+ ** @brief Set the maximum number of threads
+ ** @param numThreads number of threads (0 to use all the CPUs).
+ **
+ ** The function sets the maximum number of threads that VLFeat
+ ** algorithms use for a single computation. All such threads are
+ ** drawn from the library thread pool (@ref threads). If
+ ** @a numThreads is zero, the number of threads is set to the number
+ ** of CPUs (::vl_get_num_cpus), which is also the default. If it is
+ ** one, all computations run in the calling thread.
+ **
+ ** This is a global operation (@ref design-threads).
+ **
+ ** @sa ::vl_get_max_threads
+ **/
+
+VL_EXPORT void
+vl_set_num_threads (vl_size numThreads)
+{
+  VlState * state = vl_get_state() ;
+  if (numThreads == 0) numThreads = state->numCPUs ;
+  vl_lock_state() ;
+  state->maxNumThreads = VL_MAX(numThreads, 1) ;
+  vl_unlock_state() ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Get the maximum number of threads
+ ** @return maximum number of threads.
+ ** @sa ::vl_set_num_threads
+ **/
+
+VL_EXPORT vl_size
+vl_get_max_threads ()
+{
+  return vl_get_state()->maxNumThreads ;
+}
+
 /** ------------------------------------------------------------------
  ** @internal @brief Set last VLFeat error
  **
@@ -1014,7 +1082,8 @@ vl_constructor ()
   state->numCPUs = 1 ;
 #endif
   state->simdEnabled = VL_TRUE ;
-  state->maxNumThreads = 1 ;
+  state->maxNumThreads = state->numCPUs ;
+  state->threadPool = NULL ;
 #if defined(DEBUG)
   printf("VLFeat DEBUG: constructor ends.\n") ;
 #endif
@@ -1031,6 +1100,15 @@ vl_destructor ()
 
   state = vl_get_state() ;
 
+#if defined(VL_THREADS_WIN)
+  /* Under DllMain the workers cannot be joined. They hold a reference
+     to the DLL, so if the pool is still alive the process is
+     terminating and the workers are already gone. */
+  state->threadPool = NULL ;
+#else
+  vl_thread_pool_shutdown () ;
+#endif
+
 #if ! defined(VL_DISABLE_THREADS)
 #if defined(DEBUG)
   printf("VLFeat DEBUG: destroying a thread specific state instance.\n") ;
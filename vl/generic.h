@@ -162,6 +162,7 @@ typedef struct _VlState
 
   vl_bool simdEnabled ;
   vl_size maxNumThreads ;
+  struct _VlThreadPool * threadPool ;
 
 } VlState ;
 
@@ -178,9 +179,14 @@ VL_EXPORT char const * vl_get_version_string () ;
 VL_EXPORT char * vl_configuration_to_string_copy () ;
 VL_INLINE void vl_set_simd_enabled (vl_bool x) ;
 VL_INLINE vl_bool vl_get_simd_enabled () ;
+VL_INLINE vl_bool vl_cpu_has_avx512f () ;
+VL_INLINE vl_bool vl_cpu_has_avx2 () ;
+VL_INLINE vl_bool vl_cpu_has_fma () ;
 VL_INLINE vl_bool vl_cpu_has_sse3 () ;
 VL_INLINE vl_bool vl_cpu_has_sse2 () ;
 VL_INLINE vl_size vl_get_num_cpus () ;
+VL_EXPORT void vl_set_num_threads (vl_size numThreads) ;
+VL_EXPORT vl_size vl_get_max_threads () ;
 VL_EXPORT VlRand * vl_get_rand () ;
 
 /** @} */
@@ -341,6 +347,36 @@ vl_get_simd_enabled ()
   return vl_get_state()->simdEnabled ;
 }
 
+VL_INLINE vl_bool
+vl_cpu_has_avx512f ()
+{
+#if defined(VL_ARCH_IX86) || defined(VL_ARCH_X64) || defined(VL_ARCH_IA64)
+  return vl_get_state()->cpuInfo.hasAVX512F ;
+#else
+  return 0 ;
+#endif
+}
+
+VL_INLINE vl_bool
+vl_cpu_has_avx2 ()
+{
+#if defined(VL_ARCH_IX86) || defined(VL_ARCH_X64) || defined(VL_ARCH_IA64)
+  return vl_get_state()->cpuInfo.hasAVX2 ;
+#else
+  return 0 ;
+#endif
+}
+
+VL_INLINE vl_bool
+vl_cpu_has_fma ()
+{
+#if defined(VL_ARCH_IX86) || defined(VL_ARCH_X64) || defined(VL_ARCH_IA64)
+  return vl_get_state()->cpuInfo.hasFMA ;
+#else
+  return 0 ;
+#endif
+}
+
 VL_INLINE vl_bool
 vl_cpu_has_sse3 ()
 {
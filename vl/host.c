@@ -332,6 +332,20 @@ it supports POSIX threads.
  ** to another project to disable VLFeat SSE2 support.
  **/
 
+/** @def VL_DISABLE_AVX2
+ ** @brief Defined if AVX2 support if disabled
+ **
+ ** Define this symbol during compliation of the library and linking
+ ** to another project to disable VLFeat AVX2 and FMA support.
+ **/
+
+/** @def VL_DISABLE_AVX512
+ ** @brief Defined if AVX-512 support if disabled
+ **
+ ** Define this symbol during compliation of the library and linking
+ ** to another project to disable VLFeat AVX-512 support.
+ **/
+
 /** @def VL_DISABLE_THREADS
  ** @brief Defined if multi-threading support is disabled
  **
@@ -354,6 +368,7 @@ it supports POSIX threads.
 #include "host.h"
 #include "generic.h"
 #include <stdio.h>
+#include <string.h>
 
 #if defined(VL_ARCH_IX86) || defined(VL_ARCH_IA64) || defined(VL_ARCH_X64)
 #define HAS_CPUID
@@ -364,15 +379,25 @@ it supports POSIX threads.
 #if defined(HAS_CPUID) & defined(VL_COMPILER_MSC)
 #include <intrin.h>
 VL_INLINE void
-_vl_cpuid (vl_int32* info, int function)
+_vl_cpuid (vl_int32* info, int function, int subfunction)
+{
+  __cpuidex(info, function, subfunction) ;
+}
+
+VL_INLINE vl_uint64
+_vl_xgetbv (int index)
 {
-  __cpuid(info, function) ;
+#if (_MSC_FULL_VER >= 160040219)
+  return _xgetbv(index) ;
+#else
+  return 0 ;
+#endif
 }
 #endif
 
 #if defined(HAS_CPUID) & defined(VL_COMPILER_GNUC)
 VL_INLINE void
-_vl_cpuid (vl_int32* info, int function)
+_vl_cpuid (vl_int32* info, int function, int subfunction)
 {
 #if defined(VL_ARCH_IX86) && (defined(__PIC__) || defined(__pic__))
   /* This version is compatible with -fPIC on x386 targets. This special
@@ -386,17 +411,29 @@ _vl_cpuid (vl_int32* info, int function)
    "movl %%ebx, %1   \n" /* save what cpuid just put in %ebx */
    "popl %%ebx       \n" /* restore the old %ebx */
    : "=a"(info[0]), "=r"(info[1]), "=c"(info[2]), "=d"(info[3])
-   : "a"(function)
+   : "a"(function), "c"(subfunction)
    : "cc") ; /* clobbered (cc=condition codes) */
 #else /* no -fPIC or -fPIC with a 64-bit target */
   __asm__ __volatile__
   ("cpuid"
    : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3])
-   : "a"(function)
+   : "a"(function), "c"(subfunction)
    : "cc") ;
 #endif
 }
 
+VL_INLINE vl_uint64
+_vl_xgetbv (int index)
+{
+  vl_uint32 eax, edx ;
+  /* xgetbv opcode, for assemblers that do not know the mnemonic */
+  __asm__ __volatile__
+  (".byte 0x0f, 0x01, 0xd0"
+   : "=a"(eax), "=d"(edx)
+   : "c"(index)) ;
+  return ((vl_uint64)edx << 32) | eax ;
+}
+
 #endif
 
 void
@@ -404,20 +441,40 @@ _vl_x86cpu_info_init (VlX86CpuInfo *self)
 {
   vl_int32 info [4] ;
   int max_func = 0 ;
-  _vl_cpuid(info, 0) ;
+  vl_bool osSavesYmm = VL_FALSE ;
+  vl_bool osSavesZmm = VL_FALSE ;
+  memset(self, 0, sizeof(VlX86CpuInfo)) ;
+  _vl_cpuid(info, 0, 0) ;
   max_func = info[0] ;
   self->vendor.words[0] = info[1] ;
   self->vendor.words[1] = info[3] ;
   self->vendor.words[2] = info[2] ;
 
   if (max_func >= 1) {
-    _vl_cpuid(info, 1) ;
+    _vl_cpuid(info, 1, 0) ;
     self->hasMMX   = info[3] & (1 << 23) ;
     self->hasSSE   = info[3] & (1 << 25) ;
     self->hasSSE2  = info[3] & (1 << 26) ;
     self->hasSSE3  = info[2] & (1 <<  0) ;
     self->hasSSE41 = info[2] & (1 << 19) ;
     self->hasSSE42 = info[2] & (1 << 20) ;
+    self->hasFMA   = info[2] & (1 << 12) ;
+
+    /* The AVX registers can be used only if the OS saves them on
+       context switches (OSXSAVE and XCR0 bits). */
+    if (info[2] & (1 << 27)) {
+      vl_uint64 xcr0 = _vl_xgetbv(0) ;
+      osSavesYmm = (xcr0 & 0x06) == 0x06 ;
+      osSavesZmm = (xcr0 & 0xe6) == 0xe6 ;
+    }
+    self->hasAVX = (info[2] & (1 << 28)) && osSavesYmm ;
+    self->hasFMA = self->hasFMA && osSavesYmm ;
+  }
+
+  if (max_func >= 7) {
+    _vl_cpuid(info, 7, 0) ;
+    self->hasAVX2    = (info[1] & (1 <<  5)) && osSavesYmm ;
+    self->hasAVX512F = (info[1] & (1 << 16)) && osSavesZmm ;
   }
 }
 
@@ -431,14 +488,18 @@ _vl_x86cpu_info_to_string_copy (VlX86CpuInfo const *self)
       string = vl_malloc(sizeof(char) * length) ;
       if (string == NULL) break ;
     }
-    length = snprintf(string, length, "%s%s%s%s%s%s%s",
+    length = snprintf(string, length, "%s%s%s%s%s%s%s%s%s%s%s",
                       self->vendor.string,
                       self->hasMMX   ? " MMX" : "",
                       self->hasSSE   ? " SSE" : "",
                       self->hasSSE2  ? " SSE2" : "",
                       self->hasSSE3  ? " SSE3" : "",
                       self->hasSSE41 ? " SSE41" : "",
-                      self->hasSSE42 ? " SSE42" : "") ;
+                      self->hasSSE42 ? " SSE42" : "",
+                      self->hasAVX   ? " AVX" : "",
+                      self->hasAVX2  ? " AVX2" : "",
+                      self->hasFMA   ? " FMA" : "",
+                      self->hasAVX512F ? " AVX512F" : "") ;
     length += 1 ;
   }
   return string ;
@@ -492,6 +553,12 @@ vl_static_configuration_to_string_copy ()
 #endif
 #ifndef VL_DISABLE_SSE2
   ", SSE2"
+#endif
+#ifndef VL_DISABLE_AVX2
+  ", AVX2"
+#endif
+#ifndef VL_DISABLE_AVX512
+  ", AVX512"
 #endif
   ;
 
@@ -21,6 +21,8 @@ the terms of the BSD license (see the COPYING file).
 #if defined(__DOXYGEN__)
 #define VL_DISABLE_THREADS
 #define VL_DISABLE_SSE2
+#define VL_DISABLE_AVX2
+#define VL_DISABLE_AVX512
 #endif
 
 /** @} */
@@ -535,6 +537,10 @@ typedef struct _VlX86CpuInfo
     char string [0x20] ;
     vl_uint32 words [0x20 / 4] ;
   } vendor ;
+  vl_bool hasAVX512F ;
+  vl_bool hasFMA ;
+  vl_bool hasAVX2 ;
+  vl_bool hasAVX ;
   vl_bool hasSSE42 ;
   vl_bool hasSSE41 ;
   vl_bool hasSSE3 ;
@@ -109,6 +109,11 @@ vl_image_distance_transform_f (float const * image,
 /** @name Image smoothing */
 /** @{ */
 
+/** @brief Smallest standard deviation smoothed by a recursive filter
+ ** @see ::vl_imsmooth_f
+ **/
+#define VL_IMSMOOTH_RECURSIVE_MIN_SIGMA 4.0
+
 VL_EXPORT void
 vl_imsmooth_f (float *smoothed, vl_size smoothedStride,
                float const *image, vl_size width, vl_size height, vl_size stride,
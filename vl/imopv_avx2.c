@@ -0,0 +1,177 @@
+/** @file imopv_avx2.c
+ ** @brief Vectorized image operations - AVX2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+/* ---------------------------------------------------------------- */
+#ifndef VL_IMOPV_AVX2_INSTANTIATING
+#define VL_IMOPV_AVX2_INSTANTIATING
+
+#ifndef VL_DISABLE_AVX2
+#if ! defined(__AVX2__) || ! defined(__FMA__)
+#  error "imopv_avx2.c must be compiled with AVX2 and FMA intrinsics enabled"
+#endif
+
+#include <immintrin.h>
+#include "imopv.h"
+#include "imopv_avx2.h"
+
+#undef FLT
+#define FLT VL_TYPE_FLOAT
+#include "imopv_avx2.c"
+
+#undef FLT
+#define FLT VL_TYPE_DOUBLE
+#include "imopv_avx2.c"
+
+/* VL_DISABLE_AVX2 */
+#endif
+
+/* ---------------------------------------------------------------- */
+/* VL_IMOPV_AVX2_INSTANTIATING */
+#else
+
+#include "float.th"
+
+#undef YSIZE
+#undef YTYPE
+#undef YLDU
+#undef YLDM
+#undef YSTU
+#undef YFMA
+#undef YADD
+#undef YSET1
+#undef YSTZ
+#undef YMASK
+#if (FLT == VL_TYPE_FLOAT)
+#  define YSIZE    8
+#  define YTYPE    __m256
+#  define YLDU     _mm256_loadu_ps
+#  define YLDM     _mm256_maskload_ps
+#  define YSTU     _mm256_storeu_ps
+#  define YFMA     _mm256_fmadd_ps
+#  define YADD     _mm256_add_ps
+#  define YSET1    _mm256_set1_ps
+#  define YSTZ     _mm256_setzero_ps
+#  define YMASK(n) _mm256_cmpgt_epi32 (_mm256_set1_epi32 ((int) (n)), \
+                     _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7))
+#else
+#  define YSIZE    4
+#  define YTYPE    __m256d
+#  define YLDU     _mm256_loadu_pd
+#  define YLDM     _mm256_maskload_pd
+#  define YSTU     _mm256_storeu_pd
+#  define YFMA     _mm256_fmadd_pd
+#  define YADD     _mm256_add_pd
+#  define YSET1    _mm256_set1_pd
+#  define YSTZ     _mm256_setzero_pd
+#  define YMASK(n) _mm256_cmpgt_epi64 (_mm256_set1_epi64x ((long long) (n)), \
+                     _mm256_setr_epi64x (0, 1, 2, 3))
+#endif
+
+/* Unlike the SSE2 version, this function has no alignment
+   requirements: the columns are processed YSIZE at a time with
+   unaligned loads, and the last (fewer than YSIZE) columns with
+   masked loads. Hence all the columns undergo the same sequence of
+   operations and the result does not depend on how the image is
+   split into bands (see ::vl_imconvcol_vf). The taps in the interior
+   of the image are accumulated into four partial sums to hide the
+   latency of the FMA instructions. */
+
+VL_EXPORT void
+VL_XCAT3(_vl_imconvcol_v, SFX, _avx2)
+(T* dst, vl_size dst_stride,
+ T const* src,
+ vl_size src_width, vl_size src_height, vl_size src_stride,
+ T const* filt, vl_index filt_begin, vl_index filt_end,
+ int step, unsigned int flags)
+{
+  vl_index x, y, yo ;
+  vl_index height = (vl_index) src_height ;
+  vl_bool transp = flags & VL_TRANSPOSE ;
+  vl_bool zeropad = (flags & VL_PAD_MASK) == VL_PAD_BY_ZERO ;
+
+  /* let filt point to the last sample of the filter */
+  filt += filt_end - filt_begin ;
+
+  for (x = 0 ; x < (signed)src_width ; x += YSIZE) {
+    vl_size n = VL_MIN(YSIZE, src_width - x) ;
+    vl_bool full = (n == YSIZE) ;
+    __m256i mask = YMASK(n) ;
+    T const * column = src + x ;
+    YTYPE first, last ;
+
+#define LOAD(p) (full ? YLDU(p) : YLDM(p, mask))
+
+    first = LOAD(column) ;
+    last = LOAD(column + (height - 1) * src_stride) ;
+    if (zeropad) {
+      first = YSTZ() ;
+      last = YSTZ() ;
+    }
+
+    for (y = 0, yo = 0 ; y < height ; y += step, ++yo) {
+      /* dst[x,y] = sum_p src[x,p] filt[y - p], p = y - fe, ..., y - fb */
+      YTYPE acc0 = YSTZ(), acc1 = YSTZ(), acc2 = YSTZ(), acc3 = YSTZ() ;
+      T const * filti = filt ;
+      T const * srci ;
+      vl_index p = y - filt_end ;
+      vl_index stop ;
+
+      /* samples above the first row */
+      stop = VL_MIN(y - filt_begin + 1, 0) ;
+      for ( ; p < stop ; ++p) {
+        acc0 = YFMA(first, YSET1(*filti--), acc0) ;
+      }
+
+      /* samples inside the image */
+      stop = VL_MIN(y - filt_begin, height - 1) + 1 ;
+      srci = column + p * (vl_index) src_stride ;
+      for ( ; p + 3 < stop ; p += 4) {
+        acc0 = YFMA(LOAD(srci                 ), YSET1(filti[ 0]), acc0) ;
+        acc1 = YFMA(LOAD(srci +     src_stride), YSET1(filti[-1]), acc1) ;
+        acc2 = YFMA(LOAD(srci + 2 * src_stride), YSET1(filti[-2]), acc2) ;
+        acc3 = YFMA(LOAD(srci + 3 * src_stride), YSET1(filti[-3]), acc3) ;
+        srci += 4 * src_stride ;
+        filti -= 4 ;
+      }
+      for ( ; p < stop ; ++p) {
+        acc0 = YFMA(LOAD(srci), YSET1(*filti--), acc0) ;
+        srci += src_stride ;
+      }
+
+      /* samples below the last row */
+      stop = y - filt_begin + 1 ;
+      for ( ; p < stop ; ++p) {
+        acc0 = YFMA(last, YSET1(*filti--), acc0) ;
+      }
+
+      acc0 = YADD(YADD(acc0, acc1), YADD(acc2, acc3)) ;
+
+      if (! transp && full) {
+        YSTU(dst + yo * dst_stride + x, acc0) ;
+      } else {
+        T buffer [YSIZE] ;
+        vl_uindex i ;
+        YSTU(buffer, acc0) ;
+        if (transp) {
+          for (i = 0 ; i < n ; ++i) dst[(x + i) * dst_stride + yo] = buffer[i] ;
+        } else {
+          for (i = 0 ; i < n ; ++i) dst[yo * dst_stride + x + i] = buffer[i] ;
+        }
+      }
+    } /* next y */
+#undef LOAD
+  } /* next x */
+}
+
+/* VL_IMOPV_AVX2_INSTANTIATING */
+#endif
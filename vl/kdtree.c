@@ -48,6 +48,30 @@ To find the N nearest neighbors to a query point use
 and calculate approximate nearest neighbors use
 ::vl_kdforest_set_max_num_comparisons.
 
+::vl_kdforest_query stores the state of the search in the forest
+object and therefore cannot be called concurrently. A built forest can
+however be searched by several threads at once by giving each of them
+a ::VlKDForestSearcher (::vl_kdforestsearcher_new,
+::vl_kdforestsearcher_query). ::vl_kdforest_query_batch does this
+automatically, answering a set of queries in parallel with the
+threads of the VLFeat pool.
+
+For single precision data, ::vl_kdforest_compact switches the forest
+to a compact search layout that halves the size of the nodes and
+stores the data points in the order of the leaves of each tree. This
+reduces cache misses when the forest does not fit in the cache, at
+the cost of a copy of the data per tree.
+
+A built forest can be saved to disk by ::vl_kdforest_save and loaded
+back by ::vl_kdforest_load, which avoids building it again. The file
+is versioned and stores the trees field by field in little endian
+order, so that it does not depend on the memory layout of the build
+that wrote it. Loading therefore copies the trees into memory.
+Optionally the file contains the indexed data too, which the loaded
+forest then uses in place from the memory mapped file; otherwise the
+data must be passed to ::vl_kdforest_load. A forest that used the
+compact search layout is loaded with it.
+
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
 @section kdtree-tech Technical details
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
@@ -82,7 +106,19 @@ trivial to compute because partitions are hyper-rectangles.
 #include "generic.h"
 #include "random.h"
 #include "mathop.h"
+#include "threads.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(VL_OS_WIN)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define VL_HEAP_prefix     vl_kdforest_search_heap
 #define VL_HEAP_type       VlKDForestSearchState
@@ -139,27 +175,69 @@ vl_kdtree_compare_index_entries (void const * a,
   return 0 ;
 }
 
+/** @internal @brief Depth at which trees are split in branches */
+#define VL_KDTREE_BRANCH_DEPTH 5
+
+/** @internal @brief Minimum number of points in a branch */
+#define VL_KDTREE_BRANCH_MIN_SIZE 1024
+
+/** @internal @brief Subtree built by a separate task
+ **
+ ** The nodes of the branch are allocated in the range of the tree
+ ** pool starting at @c nodesBegin, which is large enough for any
+ ** tree over the points of the branch.
+ **/
+typedef struct _VlKDTreeBranch
+{
+  vl_uindex treeIndex ;
+  vl_uindex nodeIndex ;
+  vl_uindex dataBegin ;
+  vl_uindex dataEnd ;
+  unsigned int depth ;
+  vl_uint32 seed ;
+  vl_uindex nodesBegin ;
+  vl_size numUsedNodes ;
+  unsigned int maxDepth ;
+} VlKDTreeBranch ;
+
+/** @internal @brief State of a tree construction */
+typedef struct _VlKDTreeBuilder
+{
+  VlKDForest const * forest ;
+  VlKDTree * tree ;
+  VlRand * rand ;
+  VlKDTreeBranch * branches ; /**< if not NULL, stop at branch depth */
+  vl_size numBranches ;
+} VlKDTreeBuilder ;
+
 /** ------------------------------------------------------------------
  ** @internal
  ** @brief Build KDTree recursively
- ** @param forest forest to which the tree belongs.
- ** @param tree tree being built.
+ ** @param builder tree construction state.
  ** @param nodeIndex node to process.
  ** @param dataBegin begin of data for this node.
  ** @param dataEnd end of data for this node.
  ** @param depth depth of this node.
+ **
+ ** If @c builder->branches is not @c NULL, the nodes at depth
+ ** ::VL_KDTREE_BRANCH_DEPTH with enough points are not expanded, but
+ ** recorded as branches to be built later.
  **/
 
 static void
 vl_kdtree_build_recursively
-(VlKDForest * forest,
- VlKDTree * tree, vl_uindex nodeIndex,
+(VlKDTreeBuilder * builder,
+ vl_uindex nodeIndex,
  vl_uindex dataBegin, vl_uindex dataEnd,
  unsigned int depth)
 {
+  VlKDForest const * forest = builder->forest ;
+  VlKDTree * tree = builder->tree ;
   vl_uindex d, i, medianIndex, splitIndex ;
   VlKDTreeNode * node = tree->nodes + nodeIndex ;
   VlKDTreeSplitDimension * splitDimension ;
+  VlKDTreeSplitDimension splitHeapArray [VL_KDTREE_SPLIT_HEAP_SIZE] ;
+  vl_size splitHeapNumNodes = 0 ;
 
   /* base case: there is only one data point */
   if (dataEnd - dataBegin <= 1) {
@@ -169,8 +247,20 @@ vl_kdtree_build_recursively
     return ;
   }
 
+  /* defer the branch to a separate task */
+  if (builder->branches &&
+      depth == VL_KDTREE_BRANCH_DEPTH &&
+      dataEnd - dataBegin >= VL_KDTREE_BRANCH_MIN_SIZE) {
+    VlKDTreeBranch * branch = builder->branches + builder->numBranches ++ ;
+    branch->nodeIndex = nodeIndex ;
+    branch->dataBegin = dataBegin ;
+    branch->dataEnd = dataEnd ;
+    branch->depth = depth ;
+    branch->seed = vl_rand_uint32(builder->rand) ;
+    return ;
+  }
+
   /* compute the dimension with largest variance > 0 */
-  forest->splitHeapNumNodes = 0 ;
   for (d = 0 ; d < forest->dimension ; ++ d) {
     double mean = 0 ; /* unnormalized */
     double secondMoment = 0 ;
@@ -196,34 +286,34 @@ vl_kdtree_build_recursively
     if (variance == 0) continue ;
 
     /* keep splitHeapSize most varying dimensions */
-    if (forest->splitHeapNumNodes < forest->splitHeapSize) {
+    if (splitHeapNumNodes < forest->splitHeapSize) {
       VlKDTreeSplitDimension * splitDimension
-        = forest->splitHeapArray + forest->splitHeapNumNodes ;
+        = splitHeapArray + splitHeapNumNodes ;
       splitDimension->dimension = (unsigned int)d ;
       splitDimension->mean = mean ;
       splitDimension->variance = variance ;
-      vl_kdtree_split_heap_push (forest->splitHeapArray, &forest->splitHeapNumNodes) ;
+      vl_kdtree_split_heap_push (splitHeapArray, &splitHeapNumNodes) ;
     } else {
-      VlKDTreeSplitDimension * splitDimension = forest->splitHeapArray + 0 ;
+      VlKDTreeSplitDimension * splitDimension = splitHeapArray + 0 ;
       if (splitDimension->variance < variance) {
         splitDimension->dimension = (unsigned int)d ;
         splitDimension->mean = mean ;
         splitDimension->variance = variance ;
-        vl_kdtree_split_heap_update (forest->splitHeapArray, forest->splitHeapNumNodes, 0) ;
+        vl_kdtree_split_heap_update (splitHeapArray, splitHeapNumNodes, 0) ;
       }
     }
   }
 
   /* additional base case: the maximum variance is equal to 0 (overlapping points) */
-  if (forest->splitHeapNumNodes == 0) {
+  if (splitHeapNumNodes == 0) {
     node->lowerChild = - dataBegin - 1 ;
     node->upperChild = - dataEnd - 1 ;
     return ;
   }
 
   /* toss a dice to decide the splitting dimension (variance > 0) */
-  splitDimension = forest->splitHeapArray
-  + (vl_rand_uint32(forest->rand) % VL_MIN(forest->splitHeapSize, forest->splitHeapNumNodes)) ;
+  splitDimension = splitHeapArray
+  + (vl_rand_uint32(builder->rand) % VL_MIN(forest->splitHeapSize, splitHeapNumNodes)) ;
 
   node->splitDimension = splitDimension->dimension ;
 
@@ -276,10 +366,140 @@ vl_kdtree_build_recursively
 
   /* divide subparts */
   node->lowerChild = vl_kdtree_node_new (tree, nodeIndex) ;
-  vl_kdtree_build_recursively (forest, tree, node->lowerChild, dataBegin, splitIndex + 1, depth + 1) ;
+  vl_kdtree_build_recursively (builder, node->lowerChild, dataBegin, splitIndex + 1, depth + 1) ;
 
   node->upperChild = vl_kdtree_node_new (tree, nodeIndex) ;
-  vl_kdtree_build_recursively (forest, tree, node->upperChild, splitIndex + 1, dataEnd, depth + 1) ;
+  vl_kdtree_build_recursively (builder, node->upperChild, splitIndex + 1, dataEnd, depth + 1) ;
+}
+
+/** @internal @brief Forest construction task */
+typedef struct _VlKDForestBuildTask
+{
+  VlKDForest const * forest ;
+  VlRand * rands ;            /**< one generator per slot */
+  vl_uint32 * treeSeeds ;
+  VlKDTreeBranch * branches ; /**< branches of all trees */
+  vl_size * numTreeBranches ; /**< number of branches of each tree */
+  vl_size numBranches ;
+} VlKDForestBuildTask ;
+
+/** @internal @brief Build the top levels of the trees
+ **
+ ** The task builds each tree down to ::VL_KDTREE_BRANCH_DEPTH,
+ ** drawing random numbers from a generator seeded by the tree seed.
+ ** The deeper nodes are recorded as branches in the segment of
+ ** @c task->branches reserved for the tree.
+ **/
+
+static void
+vl_kdforest_build_trees_task (void * data,
+                              vl_uindex begin, vl_uindex end,
+                              vl_uindex slot)
+{
+  VlKDForestBuildTask * task = data ;
+  vl_uindex ti ;
+  for (ti = begin ; ti < end ; ++ti) {
+    VlKDTreeBuilder builder ;
+    VlKDTree * tree = task->forest->trees[ti] ;
+    builder.forest = task->forest ;
+    builder.tree = tree ;
+    builder.rand = task->rands + slot ;
+    builder.branches = task->branches + (ti << VL_KDTREE_BRANCH_DEPTH) ;
+    builder.numBranches = 0 ;
+    vl_rand_seed (builder.rand, task->treeSeeds[ti]) ;
+    vl_kdtree_build_recursively (&builder,
+                                 vl_kdtree_node_new(tree, 0), 0,
+                                 task->forest->numData, 0) ;
+    task->numTreeBranches[ti] = builder.numBranches ;
+  }
+}
+
+/** @internal @brief Build the branches of the trees
+ **
+ ** Each branch is built with its own random seed in the range of
+ ** nodes reserved for it, so that the result does not depend on the
+ ** order in which branches are processed.
+ **/
+
+static void
+vl_kdforest_build_branches_task (void * data,
+                                 vl_uindex begin, vl_uindex end,
+                                 vl_uindex slot)
+{
+  VlKDForestBuildTask * task = data ;
+  vl_uindex bi ;
+  for (bi = begin ; bi < end ; ++bi) {
+    VlKDTreeBranch * branch = task->branches + bi ;
+    VlKDTree const * tree = task->forest->trees[branch->treeIndex] ;
+    VlKDTree branchTree ;
+    VlKDTreeBuilder builder ;
+    branchTree.nodes = tree->nodes ;
+    branchTree.numUsedNodes = branch->nodesBegin ;
+    branchTree.numAllocatedNodes = branch->nodesBegin
+      + 2 * (branch->dataEnd - branch->dataBegin) - 2 ;
+    branchTree.dataIndex = tree->dataIndex ;
+    branchTree.depth = branch->depth ;
+    builder.forest = task->forest ;
+    builder.tree = &branchTree ;
+    builder.rand = task->rands + slot ;
+    builder.branches = NULL ;
+    builder.numBranches = 0 ;
+    vl_rand_seed (builder.rand, branch->seed) ;
+    vl_kdtree_build_recursively (&builder, branch->nodeIndex,
+                                 branch->dataBegin, branch->dataEnd,
+                                 branch->depth) ;
+    branch->numUsedNodes = branchTree.numUsedNodes - branch->nodesBegin ;
+    branch->maxDepth = branchTree.depth ;
+  }
+}
+
+/** @internal @brief Pack the branch nodes of the trees
+ **
+ ** The nodes of a branch generally do not fill the range reserved
+ ** for it. The task moves the branches next to each other and
+ ** updates the node indexes accordingly.
+ **/
+
+static void
+vl_kdforest_pack_trees_task (void * data,
+                             vl_uindex begin, vl_uindex end,
+                             vl_uindex slot VL_UNUSED)
+{
+  VlKDForestBuildTask * task = data ;
+  vl_uindex ti, bi, ni ;
+  vl_uindex branchesBegin = 0 ;
+
+  for (ti = 0 ; ti < begin ; ++ti) branchesBegin += task->numTreeBranches[ti] ;
+
+  for (ti = begin ; ti < end ; ++ti) {
+    VlKDTree * tree = task->forest->trees[ti] ;
+    VlKDTreeBranch * branches = task->branches + branchesBegin ;
+    vl_size numBranches = task->numTreeBranches[ti] ;
+    vl_uindex topNumNodes = tree->numUsedNodes ;
+    vl_uindex nodesEnd = topNumNodes ;
+
+    for (bi = 0 ; bi < numBranches ; ++bi) {
+      VlKDTreeBranch const * branch = branches + bi ;
+      vl_uindex shift = branch->nodesBegin - nodesEnd ;
+      VlKDTreeNode * root = tree->nodes + branch->nodeIndex ;
+      VlKDTreeNode * nodes = tree->nodes + branch->nodesBegin ;
+      if (root->lowerChild > 0) root->lowerChild -= shift ;
+      if (root->upperChild > 0) root->upperChild -= shift ;
+      for (ni = 0 ; ni < branch->numUsedNodes ; ++ni) {
+        if (nodes[ni].lowerChild > 0) nodes[ni].lowerChild -= shift ;
+        if (nodes[ni].upperChild > 0) nodes[ni].upperChild -= shift ;
+        if (nodes[ni].parent >= topNumNodes) nodes[ni].parent -= shift ;
+      }
+      if (shift > 0) {
+        memmove (tree->nodes + nodesEnd, nodes,
+                 sizeof(VlKDTreeNode) * branch->numUsedNodes) ;
+      }
+      nodesEnd += branch->numUsedNodes ;
+      tree->depth = VL_MAX(tree->depth, branch->maxDepth) ;
+    }
+    tree->numUsedNodes = nodesEnd ;
+    branchesBegin += numBranches ;
+  }
 }
 
 /** ------------------------------------------------------------------
@@ -309,14 +529,12 @@ vl_kdforest_new (vl_type dataType,
   self -> trees = 0 ;
   self -> thresholdingMethod = VL_KDTREE_MEDIAN ;
   self -> splitHeapSize = VL_MIN(numTrees, VL_KDTREE_SPLIT_HEAP_SIZE) ;
-  self -> splitHeapNumNodes = 0 ;
-
-  self -> searchHeapArray = 0 ;
-  self -> searchHeapNumNodes = 0 ;
 
   self -> searchMaxNumComparisons = 0 ;
-  self -> searchIdBook = 0 ;
-  self -> searchId = 0 ;
+  self -> maxNumNodes = 0 ;
+  self -> searcher = 0 ;
+  self -> mapping = 0 ;
+  self -> mappingSize = 0 ;
 
   switch (self->dataType) {
     case VL_TYPE_FLOAT:
@@ -344,21 +562,91 @@ VL_EXPORT void
 vl_kdforest_delete (VlKDForest * self)
 {
   vl_uindex ti ;
-  if (self->searchIdBook) vl_free (self->searchIdBook) ;
+  if (self->searcher) vl_kdforestsearcher_delete (self->searcher) ;
   if (self->trees) {
     for (ti = 0 ; ti < self->numTrees ; ++ ti) {
       if (self->trees[ti]) {
         if (self->trees[ti]->nodes) vl_free (self->trees[ti]->nodes) ;
         if (self->trees[ti]->dataIndex) vl_free (self->trees[ti]->dataIndex) ;
+        if (self->trees[ti]->compactNodes) vl_free (self->trees[ti]->compactNodes) ;
+        if (self->trees[ti]->compactDataIndex) vl_free (self->trees[ti]->compactDataIndex) ;
+        if (self->trees[ti]->compactData) vl_free (self->trees[ti]->compactData) ;
         vl_free (self->trees[ti]) ;
       }
     }
     vl_free (self->trees) ;
   }
-  if (self->searchHeapArray) vl_free (self->searchHeapArray) ;
+  if (self->mapping) {
+#if defined(VL_OS_WIN)
+    UnmapViewOfFile (self->mapping) ;
+#else
+    munmap (self->mapping, self->mappingSize) ;
+#endif
+  }
   vl_free (self) ;
 }
 
+/** ------------------------------------------------------------------
+ ** @internal @brief Compute tree bounds recursively
+ ** @param tree KDTree object instance.
+ ** @param nodeIndex node index to start from.
+ ** @param searchBounds 2 x numDimension array of bounds.
+ **/
+
+static void
+vl_kdtree_calc_bounds_recursively (VlKDTree * tree,
+                                   vl_uindex nodeIndex, double * searchBounds)
+{
+  VlKDTreeNode * node = tree->nodes + nodeIndex ;
+  vl_uindex i = node->splitDimension ;
+  double t = node->splitThreshold ;
+
+  node->lowerBound = searchBounds [2 * i + 0] ;
+  node->upperBound = searchBounds [2 * i + 1] ;
+
+  if (node->lowerChild > 0) {
+    searchBounds [2 * i + 1] = t ;
+    vl_kdtree_calc_bounds_recursively (tree, node->lowerChild, searchBounds) ;
+    searchBounds [2 * i + 1] = node->upperBound ;
+  }
+  if (node->upperChild > 0) {
+    searchBounds [2 * i + 0] = t ;
+    vl_kdtree_calc_bounds_recursively (tree, node->upperChild, searchBounds) ;
+    searchBounds [2 * i + 0] = node->lowerBound ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Prepare the forest for searching
+ ** @param self KDForest object instance.
+ **
+ ** The function computes the bounds of the tree nodes and the
+ ** maximum size of the search heap, so that searching never writes
+ ** into the forest. It is called by ::vl_kdforest_build and
+ ** ::vl_kdforest_load; code that fills in the trees directly (such
+ ** as the MATLAB interface) must call it before searching.
+ **/
+
+VL_EXPORT void
+vl_kdforest_prepare_search (VlKDForest * self)
+{
+  vl_uindex ti ;
+  self->maxNumNodes = 0 ;
+
+  for (ti = 0 ; ti < self->numTrees ; ++ti) {
+    double * searchBounds = vl_malloc(sizeof(double) * 2 * self->dimension) ;
+    double * iter = searchBounds  ;
+    double * end = iter + 2 * self->dimension ;
+    while (iter < end) {
+      *iter++ = - VL_INFINITY_F ;
+      *iter++ = + VL_INFINITY_F ;
+    }
+    vl_kdtree_calc_bounds_recursively (self->trees[ti], 0, searchBounds) ;
+    vl_free (searchBounds) ;
+    self->maxNumNodes += self->trees[ti]->numUsedNodes ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Build KDTree from data
  ** @param self KDTree object
@@ -369,12 +657,27 @@ vl_kdforest_delete (VlKDForest * self)
  ** efficiency, KDTree does not copy the data, but retains a pointer to it.
  ** Therefore the data must survive (and not change) until the KDTree
  ** is deleted.
+ **
+ ** The trees, and the branches of each tree, are built in parallel
+ ** by the VLFeat thread pool (::vl_set_num_threads). The random
+ ** choices are drawn from generators seeded by the forest generator,
+ ** one per tree and branch, so that the forest does not depend on the
+ ** number of threads.
+ **
+ ** Below depth ::VL_KDTREE_BRANCH_DEPTH each tree is cut into up to
+ ** 32 independent branches. The branches of all the trees form a
+ ** single ::vl_parallel_for loop with unit grain, so that an idle
+ ** thread claims the next branch as soon as it finishes one. As the
+ ** branches do not spawn further work, this balances the load as a
+ ** work-stealing scheduler would, without per-thread queues.
  **/
 
 VL_EXPORT void
 vl_kdforest_build (VlKDForest * self, vl_size numData, void const * data)
 {
-  vl_uindex di, ti ;
+  vl_uindex di, ti, bi ;
+  VlKDForestBuildTask task ;
+  vl_size numSlots = vl_get_max_threads() ;
 
   /* need to check: if alredy built, clean first */
   self->data = data ;
@@ -392,18 +695,60 @@ vl_kdforest_build (VlKDForest * self, vl_size numData, void const * data)
     self->trees[ti]->numAllocatedNodes = 2 * self->numData - 1 ;
     self->trees[ti]->nodes = vl_malloc (sizeof(VlKDTreeNode) * self->trees[ti]->numAllocatedNodes) ;
     self->trees[ti]->depth = 0 ;
-    vl_kdtree_build_recursively (self, self->trees[ti],
-                                 vl_kdtree_node_new(self->trees[ti], 0), 0,
-                                 self->numData, 0) ;
+    self->trees[ti]->compactNodes = NULL ;
+    self->trees[ti]->compactDataIndex = NULL ;
+    self->trees[ti]->compactData = NULL ;
+  }
+
+  /* The trees are built in three steps. First, the top levels of
+     each tree are built, one tree per task. Then the remaining
+     subtrees (branches) of all the trees are built, one branch per
+     task. Finally, the nodes of each tree are packed. Each tree and
+     branch draws from its own random generator, so that the result
+     does not depend on the number of threads. */
+  task.forest = self ;
+  task.rands = vl_malloc (sizeof(VlRand) * numSlots) ;
+  task.treeSeeds = vl_malloc (sizeof(vl_uint32) * self->numTrees) ;
+  task.branches = vl_malloc (sizeof(VlKDTreeBranch) *
+                             (self->numTrees << VL_KDTREE_BRANCH_DEPTH)) ;
+  task.numTreeBranches = vl_calloc (self->numTrees, sizeof(vl_size)) ;
+  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+    task.treeSeeds[ti] = vl_rand_uint32 (self->rand) ;
   }
+
+  vl_parallel_for (self->numTrees, 1, vl_kdforest_build_trees_task, &task) ;
+
+  /* gather the branches and reserve their nodes */
+  task.numBranches = 0 ;
+  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+    VlKDTreeBranch * branches = task.branches + (ti << VL_KDTREE_BRANCH_DEPTH) ;
+    vl_uindex nodesBegin = self->trees[ti]->numUsedNodes ;
+    for (bi = 0 ; bi < task.numTreeBranches[ti] ; ++ bi) {
+      VlKDTreeBranch * branch = task.branches + task.numBranches ++ ;
+      *branch = branches[bi] ;
+      branch->treeIndex = ti ;
+      branch->nodesBegin = nodesBegin ;
+      nodesBegin += 2 * (branch->dataEnd - branch->dataBegin) - 2 ;
+    }
+  }
+
+  vl_parallel_for (task.numBranches, 1, vl_kdforest_build_branches_task, &task) ;
+  vl_parallel_for (self->numTrees, 1, vl_kdforest_pack_trees_task, &task) ;
+
+  vl_free (task.rands) ;
+  vl_free (task.treeSeeds) ;
+  vl_free (task.branches) ;
+  vl_free (task.numTreeBranches) ;
+
+  vl_kdforest_prepare_search (self) ;
 }
 
 /** ------------------------------------------------------------------
- ** @internal @brief
+ ** @internal @brief Descend a tree, queueing the branches not taken
  **/
 
-VL_EXPORT vl_uindex
-vl_kdforest_query_recursively (VlKDForest  * self,
+static vl_uindex
+vl_kdforest_query_recursively (VlKDForestSearcher * searcher,
                                VlKDTree * tree,
                                vl_uindex nodeIndex,
                                VlKDForestNeighbor * neighbors,
@@ -421,8 +766,9 @@ vl_kdforest_query_recursively (VlKDForest  * self,
   double x2 = node->splitThreshold ;
   double x3 = node->upperBound ;
   VlKDForestSearchState * searchState ;
+  VlKDForest const * self = searcher->forest ;
 
-  self->searchNumRecursions ++ ;
+  searcher->searchNumRecursions ++ ;
 
   switch (self->dataType) {
     case VL_TYPE_FLOAT :
@@ -444,15 +790,15 @@ vl_kdforest_query_recursively (VlKDForest  * self,
     for (iter = begin ;
          iter < end &&
          (self->searchMaxNumComparisons == 0 ||
-          self->searchNumComparisons < self->searchMaxNumComparisons) ;
+          searcher->searchNumComparisons < self->searchMaxNumComparisons) ;
          ++ iter) {
 
       vl_index di = tree->dataIndex [iter].index ;
 
       /* multiple KDTrees share the database points and we must avoid
        * adding the same point twice */
-      if (self->searchIdBook[di] == self->searchId) continue ;
-      self->searchIdBook[di] = self->searchId ;
+      if (searcher->searchIdBook[di] == searcher->searchId) continue ;
+      searcher->searchIdBook[di] = searcher->searchId ;
 
       /* compare the query to this point */
       switch (self->dataType) {
@@ -471,7 +817,7 @@ vl_kdforest_query_recursively (VlKDForest  * self,
         default:
           abort() ;
       }
-      self->searchNumComparisons += 1 ;
+      searcher->searchNumComparisons += 1 ;
 
       /* see if it should be added to the result set */
       if (*numAddedNeighbors < numNeighbors) {
@@ -526,15 +872,15 @@ vl_kdforest_query_recursively (VlKDForest  * self,
   }
 
   if (*numAddedNeighbors < numNeighbors || neighbors[0].distance > saveDist) {
-    searchState = self->searchHeapArray + self->searchHeapNumNodes ;
+    searchState = searcher->searchHeapArray + searcher->searchHeapNumNodes ;
     searchState->tree = tree ;
     searchState->nodeIndex = saveChild ;
     searchState->distanceLowerBound = saveDist ;
-    vl_kdforest_search_heap_push (self->searchHeapArray,
-                                  &self->searchHeapNumNodes) ;
+    vl_kdforest_search_heap_push (searcher->searchHeapArray,
+                                  &searcher->searchHeapNumNodes) ;
   }
 
-  return vl_kdforest_query_recursively (self,
+  return vl_kdforest_query_recursively (searcher,
                                         tree,
                                         nextChild,
                                         neighbors,
@@ -545,57 +891,288 @@ vl_kdforest_query_recursively (VlKDForest  * self,
 }
 
 /** ------------------------------------------------------------------
- ** @internal @brief Compute tree bounds recursively
- ** @param tree KDTree object instance.
- ** @param nodeIndex node index to start from.
- ** @param searchBounds 2 x numDimension array of bounds.
+ ** @internal @brief Descend a tree in the compact layout
+ **
+ ** The function is the same as ::vl_kdforest_query_recursively, but
+ ** it uses the compact layout of the tree (see ::vl_kdforest_compact).
  **/
 
-static void
-vl_kdtree_calc_bounds_recursively (VlKDTree * tree,
-                                   vl_uindex nodeIndex, double * searchBounds)
+static vl_uindex
+vl_kdforest_query_compact_recursively (VlKDForestSearcher * searcher,
+                                       VlKDTree * tree,
+                                       vl_uindex nodeIndex,
+                                       VlKDForestNeighbor * neighbors,
+                                       vl_size numNeighbors,
+                                       vl_size * numAddedNeighbors,
+                                       double dist,
+                                       float const * query)
 {
-  VlKDTreeNode * node = tree->nodes + nodeIndex ;
-  vl_uindex i = node->splitDimension ;
-  double t = node->splitThreshold ;
+  VlKDForest const * self = searcher->forest ;
+  VlFloatVectorComparisonFunction distanceFunction =
+    (VlFloatVectorComparisonFunction) self->distanceFunction ;
+  VlKDForestSearchState * searchState ;
 
-  node->lowerBound = searchBounds [2 * i + 0] ;
-  node->upperBound = searchBounds [2 * i + 1] ;
+  while (1) {
+    VlKDTreeCompactNode const * node = tree->compactNodes + nodeIndex ;
+    vl_index nextChild, saveChild ;
+    double x, delta, saveDist ;
+
+    searcher->searchNumRecursions ++ ;
+
+    /* base case: this is a leaf node */
+    if (node->lowerChild < 0) {
+      vl_index begin = - node->lowerChild - 1 ;
+      vl_index end   = - node->upperChild - 1 ;
+      vl_index iter ;
+      float const * datum = tree->compactData + begin * self->dimension ;
+
+      for (iter = begin ;
+           iter < end &&
+           (self->searchMaxNumComparisons == 0 ||
+            searcher->searchNumComparisons < self->searchMaxNumComparisons) ;
+           ++ iter, datum += self->dimension) {
+
+        vl_index di = tree->compactDataIndex [iter] ;
+
+        if (searcher->searchIdBook[di] == searcher->searchId) continue ;
+        searcher->searchIdBook[di] = searcher->searchId ;
+
+        dist = distanceFunction (self->dimension, query, datum) ;
+        searcher->searchNumComparisons += 1 ;
+
+        if (*numAddedNeighbors < numNeighbors) {
+          VlKDForestNeighbor * newNeighbor = neighbors + *numAddedNeighbors ;
+          newNeighbor->index = di ;
+          newNeighbor->distance = dist ;
+          vl_kdforest_neighbor_heap_push (neighbors, numAddedNeighbors) ;
+        } else {
+          VlKDForestNeighbor * largestNeighbor = neighbors + 0 ;
+          if (largestNeighbor->distance > dist) {
+            largestNeighbor->index = di ;
+            largestNeighbor->distance = dist ;
+            vl_kdforest_neighbor_heap_update (neighbors, *numAddedNeighbors, 0) ;
+          }
+        }
+      }
+      return nodeIndex ;
+    }
 
-  if (node->lowerChild > 0) {
-    searchBounds [2 * i + 1] = t ;
-    vl_kdtree_calc_bounds_recursively (tree, node->lowerChild, searchBounds) ;
-    searchBounds [2 * i + 1] = node->upperBound ;
+    x = query [node->splitDimension] ;
+    delta = x - node->splitThreshold ;
+    saveDist = dist + delta*delta ;
+
+    if (x <= node->splitThreshold) {
+      nextChild = node->lowerChild ;
+      saveChild = node->upperChild ;
+      if (x <= node->lowerBound) {
+        delta = x - node->lowerBound ;
+        saveDist -= delta*delta ;
+      }
+    } else {
+      nextChild = node->upperChild ;
+      saveChild = node->lowerChild ;
+      if (x > node->upperBound) {
+        delta = x - node->upperBound ;
+        saveDist -= delta*delta ;
+      }
+    }
+
+    if (*numAddedNeighbors < numNeighbors || neighbors[0].distance > saveDist) {
+      searchState = searcher->searchHeapArray + searcher->searchHeapNumNodes ;
+      searchState->tree = tree ;
+      searchState->nodeIndex = saveChild ;
+      searchState->distanceLowerBound = saveDist ;
+      vl_kdforest_search_heap_push (searcher->searchHeapArray,
+                                    &searcher->searchHeapNumNodes) ;
+    }
+
+    nodeIndex = nextChild ;
   }
-  if (node->upperChild > 0) {
-    searchBounds [2 * i + 0] = t ;
-    vl_kdtree_calc_bounds_recursively (tree, node->upperChild, searchBounds) ;
-    searchBounds [2 * i + 0] = node->lowerBound ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Copy a tree to the compact layout recursively
+ ** @param forest KDForest object.
+ ** @param tree tree to copy.
+ ** @param nodeIndex node to copy.
+ ** @param numNodes number of compact nodes (in/out).
+ ** @param numLeafData number of data points copied (in/out).
+ ** @return index of the compact node.
+ **
+ ** The nodes are stored in depth-first order, so that the lower child
+ ** of a node immediately follows it, and the data points are copied
+ ** in the order of the leaves.
+ **/
+
+static vl_uindex
+vl_kdtree_compact_recursively (VlKDForest const * forest,
+                               VlKDTree * tree,
+                               vl_uindex nodeIndex,
+                               vl_size * numNodes,
+                               vl_size * numLeafData)
+{
+  VlKDTreeNode const * node = tree->nodes + nodeIndex ;
+  vl_uindex compactIndex = (*numNodes) ++ ;
+  VlKDTreeCompactNode * compactNode = tree->compactNodes + compactIndex ;
+
+  compactNode->splitDimension = node->splitDimension ;
+  compactNode->splitThreshold = (float) node->splitThreshold ;
+  compactNode->lowerBound = (float) node->lowerBound ;
+  compactNode->upperBound = (float) node->upperBound ;
+
+  if (node->lowerChild < 0) {
+    vl_index begin = - node->lowerChild - 1 ;
+    vl_index end   = - node->upperChild - 1 ;
+    vl_index iter ;
+    compactNode->lowerChild = (vl_int32) (- *numLeafData - 1) ;
+    for (iter = begin ; iter < end ; ++ iter) {
+      vl_index di = tree->dataIndex[iter].index ;
+      tree->compactDataIndex[*numLeafData] = (vl_uint32) di ;
+      memcpy (tree->compactData + *numLeafData * forest->dimension,
+              (float const*)forest->data + di * forest->dimension,
+              sizeof(float) * forest->dimension) ;
+      (*numLeafData) ++ ;
+    }
+    compactNode->upperChild = (vl_int32) (- *numLeafData - 1) ;
+  } else {
+    vl_int32 lowerChild = (vl_int32)
+      vl_kdtree_compact_recursively (forest, tree, node->lowerChild,
+                                     numNodes, numLeafData) ;
+    vl_int32 upperChild = (vl_int32)
+      vl_kdtree_compact_recursively (forest, tree, node->upperChild,
+                                     numNodes, numLeafData) ;
+    compactNode->lowerChild = lowerChild ;
+    compactNode->upperChild = upperChild ;
+  }
+  return compactIndex ;
+}
+
+/** @internal @brief Compact layout task */
+static void
+vl_kdforest_compact_task (void * data,
+                          vl_uindex begin, vl_uindex end,
+                          vl_uindex slot VL_UNUSED)
+{
+  VlKDForest const * forest = data ;
+  vl_uindex ti ;
+  for (ti = begin ; ti < end ; ++ti) {
+    vl_size numNodes = 0 ;
+    vl_size numLeafData = 0 ;
+    vl_kdtree_compact_recursively (forest, forest->trees[ti], 0,
+                                   &numNodes, &numLeafData) ;
   }
 }
 
 /** ------------------------------------------------------------------
- ** @brief Query operation
- ** @param self KDTree object instance.
+ ** @brief Switch a KDForest to the compact search layout
+ ** @param self KDForest object.
+ **
+ ** The function stores a second copy of each tree in a layout
+ ** tailored to searching. A node takes 24 bytes instead of 48, as
+ ** thresholds and bounds are stored in single precision and indexes
+ ** in 32 bits, and nodes are sorted in depth-first order. Moreover,
+ ** each tree stores a copy of the data points in the order of its
+ ** leaves, so that scanning a leaf reads memory sequentially.
+ **
+ ** The compact layout is used by all subsequent queries. It costs one
+ ** copy of the data per tree, and it is supported only for
+ ** ::VL_TYPE_FLOAT data (thresholds are data values or means and are
+ ** exactly separated by their single precision approximation only
+ ** for single precision data). The original trees are retained,
+ ** so that the forest can still be saved by ::vl_kdforest_save.
+ **/
+
+VL_EXPORT void
+vl_kdforest_compact (VlKDForest * self)
+{
+  vl_uindex ti ;
+
+  assert (self->trees) ;
+  assert (self->dataType == VL_TYPE_FLOAT) ;
+  assert (self->numData < 0x7fffffff) ;
+
+  if (self->trees[0]->compactNodes) return ;
+
+  for (ti = 0 ; ti < self->numTrees ; ++ti) {
+    VlKDTree * tree = self->trees[ti] ;
+    tree->compactNodes = vl_malloc (sizeof(VlKDTreeCompactNode) * tree->numUsedNodes) ;
+    tree->compactDataIndex = vl_malloc (sizeof(vl_uint32) * self->numData) ;
+    tree->compactData = vl_malloc (sizeof(float) * self->dimension * self->numData) ;
+  }
+
+  vl_parallel_for (self->numTrees, 1, vl_kdforest_compact_task, self) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Create a new KDForest searcher
+ ** @param forest KDForest to search.
+ ** @return new searcher.
+ **
+ ** The searcher holds the search heap and the book-keeping required
+ ** by ::vl_kdforestsearcher_query. The forest must be built before
+ ** calling this function, and must survive the searcher. Creating a
+ ** searcher does not modify the forest, so searchers of the same
+ ** forest can be created and used concurrently from different
+ ** threads.
+ **
+ ** @sa ::vl_kdforestsearcher_delete
+ **/
+
+VL_EXPORT VlKDForestSearcher *
+vl_kdforestsearcher_new (VlKDForest * forest)
+{
+  VlKDForestSearcher * self = vl_malloc (sizeof(VlKDForestSearcher)) ;
+
+  assert (forest) ;
+  assert (forest->trees) ;
+
+  self -> forest = forest ;
+  self -> searchHeapArray = vl_malloc (sizeof(VlKDForestSearchState) * forest->maxNumNodes) ;
+  self -> searchHeapNumNodes = 0 ;
+  self -> searchIdBook = vl_calloc (forest->numData, sizeof(vl_uindex)) ;
+  self -> searchId = 0 ;
+  self -> searchNumComparisons = 0 ;
+  self -> searchNumRecursions = 0 ;
+  self -> searchNumSimplifications = 0 ;
+  return self ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Delete KDForest searcher
+ ** @param self searcher to delete.
+ ** @sa ::vl_kdforestsearcher_new
+ **/
+
+VL_EXPORT void
+vl_kdforestsearcher_delete (VlKDForestSearcher * self)
+{
+  if (self->searchIdBook) vl_free (self->searchIdBook) ;
+  if (self->searchHeapArray) vl_free (self->searchHeapArray) ;
+  vl_free (self) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Query operation using a searcher
+ ** @param self KDForest searcher.
  ** @param neighbors list of nearest neighbors found (output).
  ** @param numNeighbors number of nearest neighbors to find.
  ** @param query query point.
- ** @return number of tree leaves visited.
+ ** @return number of comparisons performed.
  **
- ** A neighbor is represented by an instance of the structure
- ** ::VlKDForestNeighbor. Each entry contains the index of the
- ** neighbor (this is an index into the KDTree data) and its distance
- ** to the query point. Neighbors are sorted by increasing distance.
+ ** The function is the same as ::vl_kdforest_query, except that the
+ ** search state is stored in the searcher @a self. The forest is
+ ** only read.
  **/
 
 VL_EXPORT vl_size
-vl_kdforest_query (VlKDForest * self,
-                   VlKDForestNeighbor * neighbors,
-                   vl_size numNeighbors,
-                   void const * query)
+vl_kdforestsearcher_query (VlKDForestSearcher * self,
+                           VlKDForestNeighbor * neighbors,
+                           vl_size numNeighbors,
+                           void const * query)
 {
+  VlKDForest const * forest = self->forest ;
   vl_uindex i, ti ;
-  vl_bool exactSearch = (self->searchMaxNumComparisons == 0) ;
+  vl_bool exactSearch = (forest->searchMaxNumComparisons == 0) ;
   VlKDForestSearchState * searchState  ;
   vl_size numAddedNeighbors = 0 ;
 
@@ -606,45 +1183,21 @@ vl_kdforest_query (VlKDForest * self,
   /* this number is used to differentiate a query from the next */
   self -> searchId += 1 ;
   self -> searchNumRecursions = 0 ;
-
-  if (! self -> searchHeapArray) {
-    /* count number of tree nodes */
-    /* add support structures */
-    vl_size maxNumNodes = 0 ;
-    for (ti = 0 ; ti < self->numTrees ; ++ti) {
-      maxNumNodes += self->trees[ti]->numUsedNodes ;
-    }
-    self -> searchHeapArray = vl_malloc (sizeof(VlKDForestSearchState) * maxNumNodes) ;
-    self -> searchIdBook = vl_calloc (sizeof(vl_uindex), self->numData) ;
-
-    for (ti = 0 ; ti < self->numTrees ; ++ti) {
-      double * searchBounds = vl_malloc(sizeof(double) * 2 * self->dimension) ;
-      double * iter = searchBounds  ;
-      double * end = iter + 2 * self->dimension ;
-      while (iter < end) {
-        *iter++ = - VL_INFINITY_F ;
-        *iter++ = + VL_INFINITY_F ;
-      }
-      vl_kdtree_calc_bounds_recursively (self->trees[ti], 0, searchBounds) ;
-      vl_free (searchBounds) ;
-    }
-  }
-
-  self->searchNumComparisons = 0 ;
-  self->searchNumSimplifications = 0 ;
+  self -> searchNumComparisons = 0 ;
+  self -> searchNumSimplifications = 0 ;
 
   /* put the root node into the search heap */
   self->searchHeapNumNodes = 0 ;
-  for (ti = 0 ; ti < self->numTrees ; ++ ti) {
+  for (ti = 0 ; ti < forest->numTrees ; ++ ti) {
     searchState = self->searchHeapArray + self->searchHeapNumNodes ;
-    searchState -> tree = self->trees[ti] ;
+    searchState -> tree = forest->trees[ti] ;
     searchState -> nodeIndex = 0 ;
     searchState -> distanceLowerBound = 0 ;
     vl_kdforest_search_heap_push (self->searchHeapArray, &self->searchHeapNumNodes) ;
   }
 
   /* branch and bound */
-  while (exactSearch || self->searchNumComparisons < self->searchMaxNumComparisons)
+  while (exactSearch || self->searchNumComparisons < forest->searchMaxNumComparisons)
   {
     /* pop the next optimal search node */
     VlKDForestSearchState * searchState ;
@@ -664,14 +1217,25 @@ vl_kdforest_query (VlKDForest * self,
       break ;
     }
 
-    vl_kdforest_query_recursively (self,
-                                   searchState->tree,
-                                   searchState->nodeIndex,
-                                   neighbors,
-                                   numNeighbors,
-                                   &numAddedNeighbors,
-                                   searchState->distanceLowerBound,
-                                   query) ;
+    if (searchState->tree->compactNodes) {
+      vl_kdforest_query_compact_recursively (self,
+                                             searchState->tree,
+                                             searchState->nodeIndex,
+                                             neighbors,
+                                             numNeighbors,
+                                             &numAddedNeighbors,
+                                             searchState->distanceLowerBound,
+                                             query) ;
+    } else {
+      vl_kdforest_query_recursively (self,
+                                     searchState->tree,
+                                     searchState->nodeIndex,
+                                     neighbors,
+                                     numNeighbors,
+                                     &numAddedNeighbors,
+                                     searchState->distanceLowerBound,
+                                     query) ;
+    }
   }
 
   /* sort neighbors by increasing distance */
@@ -685,3 +1249,623 @@ vl_kdforest_query (VlKDForest * self,
 
   return self->searchNumComparisons ;
 }
+
+/** ------------------------------------------------------------------
+ ** @brief Query operation
+ ** @param self KDTree object instance.
+ ** @param neighbors list of nearest neighbors found (output).
+ ** @param numNeighbors number of nearest neighbors to find.
+ ** @param query query point.
+ ** @return number of comparisons performed.
+ **
+ ** A neighbor is represented by an instance of the structure
+ ** ::VlKDForestNeighbor. Each entry contains the index of the
+ ** neighbor (this is an index into the KDTree data) and its distance
+ ** to the query point. Neighbors are sorted by increasing distance.
+ **
+ ** The function uses a searcher owned by the forest and is therefore
+ ** not reentrant. Use ::vl_kdforest_query_batch or one
+ ** ::VlKDForestSearcher per thread to search concurrently.
+ **/
+
+VL_EXPORT vl_size
+vl_kdforest_query (VlKDForest * self,
+                   VlKDForestNeighbor * neighbors,
+                   vl_size numNeighbors,
+                   void const * query)
+{
+  if (! self->searcher) {
+    self->searcher = vl_kdforestsearcher_new (self) ;
+  }
+  return vl_kdforestsearcher_query (self->searcher,
+                                    neighbors, numNeighbors, query) ;
+}
+
+/** @internal @brief Batch query task */
+typedef struct _VlKDForestQueryBatchTask
+{
+  VlKDForest const * forest ;
+  VlKDForestSearcher ** searchers ;
+  VlKDForestNeighbor * neighbors ;
+  vl_size numNeighbors ;
+  void const * queries ;
+  vl_size * numComparisons ;
+} VlKDForestQueryBatchTask ;
+
+/** @internal @brief Batch query task body */
+static void
+vl_kdforest_query_batch_task (void * data,
+                              vl_uindex begin, vl_uindex end,
+                              vl_uindex slot)
+{
+  VlKDForestQueryBatchTask * task = data ;
+  VlKDForest const * forest = task->forest ;
+  VlKDForestSearcher * searcher = task->searchers[slot] ;
+  vl_size querySize = forest->dimension * vl_get_type_size(forest->dataType) ;
+  vl_uindex qi ;
+
+  for (qi = begin ; qi < end ; ++ qi) {
+    task->numComparisons[slot] +=
+      vl_kdforestsearcher_query (searcher,
+                                 task->neighbors + qi * task->numNeighbors,
+                                 task->numNeighbors,
+                                 (char const*)task->queries + qi * querySize) ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Answer multiple queries in parallel
+ ** @param self KDForest object instance.
+ ** @param neighbors nearest neighbors found (output).
+ ** @param numNeighbors number of nearest neighbors to find per query.
+ ** @param queries query points.
+ ** @param numQueries number of query points.
+ ** @return total number of comparisons performed.
+ **
+ ** @a queries is an array of @a numQueries points stored
+ ** contiguously. @a neighbors must have space for @a numNeighbors x
+ ** @a numQueries entries; the neighbors of the query @c q are stored
+ ** starting at @c neighbors + @c q * @a numNeighbors and are sorted as
+ ** in ::vl_kdforest_query.
+ **
+ ** Queries are distributed among the threads of the pool
+ ** (::vl_set_num_threads), each thread using its own
+ ** ::VlKDForestSearcher.
+ **/
+
+VL_EXPORT vl_size
+vl_kdforest_query_batch (VlKDForest * self,
+                         VlKDForestNeighbor * neighbors,
+                         vl_size numNeighbors,
+                         void const * queries,
+                         vl_size numQueries)
+{
+  VlKDForestQueryBatchTask task ;
+  vl_size numSlots = vl_get_max_threads() ;
+  vl_size numComparisons = 0 ;
+  vl_uindex i ;
+
+  assert (neighbors) ;
+  assert (numNeighbors > 0) ;
+  assert (queries || numQueries == 0) ;
+
+  if (numQueries == 0) return 0 ;
+
+  /* the searchers are allocated here as vl_malloc may not be
+     thread safe */
+  task.forest = self ;
+  task.searchers = vl_malloc (sizeof(VlKDForestSearcher*) * numSlots) ;
+  task.numComparisons = vl_calloc (numSlots, sizeof(vl_size)) ;
+  task.neighbors = neighbors ;
+  task.numNeighbors = numNeighbors ;
+  task.queries = queries ;
+  for (i = 0 ; i < numSlots ; ++i) {
+    task.searchers[i] = vl_kdforestsearcher_new (self) ;
+  }
+
+  vl_parallel_for (numQueries, 0, vl_kdforest_query_batch_task, &task) ;
+
+  for (i = 0 ; i < numSlots ; ++i) {
+    numComparisons += task.numComparisons[i] ;
+    vl_kdforestsearcher_delete (task.searchers[i]) ;
+  }
+  vl_free (task.searchers) ;
+  vl_free (task.numComparisons) ;
+  return numComparisons ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                Saving and loading */
+/* ---------------------------------------------------------------- */
+
+/* A KDForest file is a sequence of fields in little endian order:
+
+   magic              8 bytes "VLKDFRST"
+   version            uint32
+   byte order         uint32, 0x01020304 in the order of the data section
+   data type          uint32
+   thresholding       uint32
+   dimension          uint64
+   num. data          uint64
+   num. trees         uint64
+   flags              uint32 (VL_KDFOREST_FILE_COMPACT, VL_KDFOREST_FILE_DATA)
+   reserved           uint32
+
+   followed, for each tree, by
+
+   num. nodes         uint64
+   depth              uint64
+   nodes              num. nodes x (int64 lower child, int64 upper child,
+                                    uint32 split dimension,
+                                    float64 split threshold)
+   data index         num. data x uint64
+
+   and, if VL_KDFOREST_FILE_DATA is set, by zero padding to a multiple
+   of VL_KDFOREST_FILE_ALIGN bytes and by the indexed data in the
+   byte order of the host that saved it. The node bounds, the parent
+   links and the compact layout are not stored, as they are computed
+   from the other fields when the file is loaded.
+*/
+
+#define VL_KDFOREST_FILE_MAGIC "VLKDFRST"
+#define VL_KDFOREST_FILE_VERSION 2
+#define VL_KDFOREST_FILE_BYTE_ORDER 0x01020304
+#define VL_KDFOREST_FILE_ALIGN 64
+#define VL_KDFOREST_FILE_COMPACT 0x1
+#define VL_KDFOREST_FILE_DATA 0x2
+#define VL_KDFOREST_FILE_TREE_SIZE 16
+#define VL_KDFOREST_FILE_NODE_SIZE 28
+#define VL_KDFOREST_FILE_DATA_INDEX_ENTRY_SIZE 8
+
+/** @internal @brief KDForest file writer */
+typedef struct _VlKDForestFileWriter
+{
+  FILE * file ;
+  vl_uint64 offset ;
+  vl_bool ok ;
+} VlKDForestFileWriter ;
+
+/** @internal @brief KDForest file reader */
+typedef struct _VlKDForestFileReader
+{
+  unsigned char const * bytes ;
+  vl_uint64 size ;
+  vl_uint64 offset ;
+  vl_bool ok ;
+} VlKDForestFileReader ;
+
+/** @internal @brief Round a file offset to the data alignment */
+static vl_uint64
+vl_kdforest_file_align (vl_uint64 offset)
+{
+  return (offset + VL_KDFOREST_FILE_ALIGN - 1) &
+    ~ (vl_uint64) (VL_KDFOREST_FILE_ALIGN - 1) ;
+}
+
+/** @internal @brief Write bytes to a KDForest file */
+static void
+vl_kdforest_file_write (VlKDForestFileWriter * writer,
+                        void const * bytes, vl_size size)
+{
+  if (writer->ok && size > 0) {
+    writer->ok = (fwrite (bytes, 1, size, writer->file) == size) ;
+  }
+  writer->offset += size ;
+}
+
+/** @internal @brief Write a little endian integer to a KDForest file */
+static void
+vl_kdforest_file_write_uint (VlKDForestFileWriter * writer,
+                             vl_uint64 value, vl_size size)
+{
+  unsigned char bytes [8] ;
+  vl_uindex i ;
+  for (i = 0 ; i < size ; ++i) {
+    bytes[i] = (unsigned char) (value >> (8 * i)) ;
+  }
+  vl_kdforest_file_write (writer, bytes, size) ;
+}
+
+/** @internal @brief Write a double to a KDForest file */
+static void
+vl_kdforest_file_write_double (VlKDForestFileWriter * writer, double value)
+{
+  vl_uint64 bits ;
+  memcpy (&bits, &value, sizeof(bits)) ;
+  vl_kdforest_file_write_uint (writer, bits, 8) ;
+}
+
+/** @internal @brief Skip @a size bytes of a KDForest file
+ ** @return pointer to the skipped bytes, or @c NULL if the file is too short.
+ **/
+static unsigned char const *
+vl_kdforest_file_read (VlKDForestFileReader * reader, vl_uint64 size)
+{
+  unsigned char const * bytes = reader->bytes + reader->offset ;
+  if (! reader->ok || size > reader->size - reader->offset) {
+    reader->ok = VL_FALSE ;
+    return NULL ;
+  }
+  reader->offset += size ;
+  return bytes ;
+}
+
+/** @internal @brief Read a little endian integer from a KDForest file */
+static vl_uint64
+vl_kdforest_file_read_uint (VlKDForestFileReader * reader, vl_size size)
+{
+  unsigned char const * bytes = vl_kdforest_file_read (reader, size) ;
+  vl_uint64 value = 0 ;
+  vl_uindex i ;
+  if (! bytes) return 0 ;
+  for (i = 0 ; i < size ; ++i) {
+    value |= (vl_uint64) bytes[i] << (8 * i) ;
+  }
+  return value ;
+}
+
+/** @internal @brief Read a double from a KDForest file */
+static double
+vl_kdforest_file_read_double (VlKDForestFileReader * reader)
+{
+  vl_uint64 bits = vl_kdforest_file_read_uint (reader, 8) ;
+  double value ;
+  memcpy (&value, &bits, sizeof(value)) ;
+  return value ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Save a KDForest to a file
+ ** @param self KDForest object.
+ ** @param fileName name of the file.
+ ** @param saveData whether to save the indexed data as well.
+ ** @return error code.
+ **
+ ** The function saves the trees of the built forest @a self, and the
+ ** data if @a saveData is true, to the file @a fileName. The forest
+ ** can be loaded back by ::vl_kdforest_load. The function returns
+ ** ::VL_ERR_OK on success, and sets and returns the last error
+ ** (::vl_get_last_error) otherwise.
+ **/
+
+VL_EXPORT int
+vl_kdforest_save (VlKDForest * self, char const * fileName, vl_bool saveData)
+{
+  static unsigned char const zeros [VL_KDFOREST_FILE_ALIGN] = {0} ;
+  VlKDForestFileWriter writer ;
+  vl_uint32 byteOrder = VL_KDFOREST_FILE_BYTE_ORDER ;
+  vl_uint32 flags = 0 ;
+  vl_uindex ti, ni, di ;
+
+  assert (self->trees) ;
+
+  if (self->trees[0]->compactNodes) flags |= VL_KDFOREST_FILE_COMPACT ;
+  if (saveData) flags |= VL_KDFOREST_FILE_DATA ;
+
+  writer.file = fopen (fileName, "wb") ;
+  writer.offset = 0 ;
+  writer.ok = VL_TRUE ;
+  if (! writer.file) {
+    return vl_set_last_error (VL_ERR_IO, "Could not open '%s' for writing.", fileName) ;
+  }
+
+  vl_kdforest_file_write (&writer, VL_KDFOREST_FILE_MAGIC, 8) ;
+  vl_kdforest_file_write_uint (&writer, VL_KDFOREST_FILE_VERSION, 4) ;
+  vl_kdforest_file_write (&writer, &byteOrder, 4) ;
+  vl_kdforest_file_write_uint (&writer, self->dataType, 4) ;
+  vl_kdforest_file_write_uint (&writer, self->thresholdingMethod, 4) ;
+  vl_kdforest_file_write_uint (&writer, self->dimension, 8) ;
+  vl_kdforest_file_write_uint (&writer, self->numData, 8) ;
+  vl_kdforest_file_write_uint (&writer, self->numTrees, 8) ;
+  vl_kdforest_file_write_uint (&writer, flags, 4) ;
+  vl_kdforest_file_write_uint (&writer, 0, 4) ;
+
+  for (ti = 0 ; writer.ok && ti < self->numTrees ; ++ti) {
+    VlKDTree const * tree = self->trees[ti] ;
+    vl_kdforest_file_write_uint (&writer, tree->numUsedNodes, 8) ;
+    vl_kdforest_file_write_uint (&writer, tree->depth, 8) ;
+    for (ni = 0 ; ni < tree->numUsedNodes ; ++ni) {
+      VlKDTreeNode const * node = tree->nodes + ni ;
+      vl_kdforest_file_write_uint (&writer, (vl_uint64) node->lowerChild, 8) ;
+      vl_kdforest_file_write_uint (&writer, (vl_uint64) node->upperChild, 8) ;
+      vl_kdforest_file_write_uint (&writer, node->splitDimension, 4) ;
+      vl_kdforest_file_write_double (&writer, node->splitThreshold) ;
+    }
+    for (di = 0 ; di < self->numData ; ++di) {
+      vl_kdforest_file_write_uint (&writer, (vl_uint64) tree->dataIndex[di].index, 8) ;
+    }
+  }
+
+  if (saveData) {
+    vl_kdforest_file_write (&writer, zeros,
+                            vl_kdforest_file_align(writer.offset) - writer.offset) ;
+    vl_kdforest_file_write (&writer, self->data, self->numData * self->dimension *
+                            vl_get_type_size(self->dataType)) ;
+  }
+
+  writer.ok &= (fclose (writer.file) == 0) ;
+  if (! writer.ok) {
+    return vl_set_last_error (VL_ERR_IO, "Error writing '%s'.", fileName) ;
+  }
+  return VL_ERR_OK ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Read a tree of a KDForest file
+ ** @param self KDForest being loaded.
+ ** @param tree tree to fill.
+ ** @param reader file reader.
+ ** @return error code.
+ **
+ ** The function checks that the children of each node come after it
+ ** and within the tree, that each node but the root is the child of
+ ** exactly one node (so that a visit from the root reaches every node
+ ** once), that the leaves and the data index refer to existing data
+ ** points, and that the split dimensions are valid, so that a
+ ** corrupted file cannot make a search read out of bounds or make
+ ** the computation of the node bounds explode.
+ **/
+
+static int
+vl_kdforest_load_tree (VlKDForest * self, VlKDTree * tree,
+                       VlKDForestFileReader * reader)
+{
+  vl_uint64 numNodes = vl_kdforest_file_read_uint (reader, 8) ;
+  vl_uint64 depth = vl_kdforest_file_read_uint (reader, 8) ;
+  vl_uindex ni, di ;
+
+  if (! reader->ok || numNodes == 0 || numNodes > 2 * self->numData - 1 ||
+      depth > numNodes ||
+      numNodes * VL_KDFOREST_FILE_NODE_SIZE +
+      self->numData * VL_KDFOREST_FILE_DATA_INDEX_ENTRY_SIZE
+      > reader->size - reader->offset) {
+    return VL_ERR_BAD_ARG ;
+  }
+
+  tree->nodes = vl_calloc (numNodes, sizeof(VlKDTreeNode)) ;
+  tree->dataIndex = vl_malloc (sizeof(VlKDTreeDataIndexEntry) * self->numData) ;
+  if (! tree->nodes || ! tree->dataIndex) return VL_ERR_ALLOC ;
+  tree->numUsedNodes = numNodes ;
+  tree->numAllocatedNodes = numNodes ;
+  tree->depth = (unsigned int) depth ;
+
+  /* a node without a parent yet is marked by an invalid parent index */
+  for (ni = 0 ; ni < numNodes ; ++ni) {
+    tree->nodes[ni].parent = numNodes ;
+  }
+
+  for (ni = 0 ; ni < numNodes ; ++ni) {
+    VlKDTreeNode * node = tree->nodes + ni ;
+    node->lowerChild = (vl_index) vl_kdforest_file_read_uint (reader, 8) ;
+    node->upperChild = (vl_index) vl_kdforest_file_read_uint (reader, 8) ;
+    node->splitDimension = (unsigned int) vl_kdforest_file_read_uint (reader, 4) ;
+    node->splitThreshold = vl_kdforest_file_read_double (reader) ;
+    if (node->splitDimension >= self->dimension) return VL_ERR_BAD_ARG ;
+    if (node->lowerChild < 0 && node->upperChild < 0) {
+      /* leaf: data index range [-lowerChild-1, -upperChild-1) */
+      if (node->upperChild > node->lowerChild ||
+          - node->upperChild - 1 > (vl_index) self->numData) {
+        return VL_ERR_BAD_ARG ;
+      }
+    } else {
+      if (node->lowerChild <= (vl_index) ni ||
+          node->upperChild <= (vl_index) ni ||
+          node->lowerChild >= (vl_index) numNodes ||
+          node->upperChild >= (vl_index) numNodes) {
+        return VL_ERR_BAD_ARG ;
+      }
+      if (tree->nodes[node->lowerChild].parent != numNodes) return VL_ERR_BAD_ARG ;
+      tree->nodes[node->lowerChild].parent = ni ;
+      if (tree->nodes[node->upperChild].parent != numNodes) return VL_ERR_BAD_ARG ;
+      tree->nodes[node->upperChild].parent = ni ;
+    }
+  }
+
+  /* as each parent comes before its children, the nodes are all
+     reached from the root if all of them but the root have a parent */
+  for (ni = 1 ; ni < numNodes ; ++ni) {
+    if (tree->nodes[ni].parent == numNodes) return VL_ERR_BAD_ARG ;
+  }
+  tree->nodes[0].parent = 0 ;
+
+  for (di = 0 ; di < self->numData ; ++di) {
+    vl_uint64 index = vl_kdforest_file_read_uint (reader, 8) ;
+    if (index >= self->numData) return VL_ERR_BAD_ARG ;
+    tree->dataIndex[di].index = (vl_index) index ;
+    tree->dataIndex[di].value = 0 ;
+  }
+  return VL_ERR_OK ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Load a KDForest from a file
+ ** @param fileName name of the file.
+ ** @param data indexed data (or @c NULL).
+ ** @return new KDForest object, or @c NULL on error.
+ **
+ ** The function maps the file @a fileName, written by
+ ** ::vl_kdforest_save, in memory and reads the trees from it. The
+ ** trees are not searched in place: since the file stores them field
+ ** by field, independently of the memory layout, they are copied
+ ** into newly allocated nodes, which take about as much memory as
+ ** the trees of the built forest. The node bounds are then
+ ** recomputed and, if the saved forest used the compact search
+ ** layout (::vl_kdforest_compact), the layout is built again, which
+ ** copies the data once per tree.
+ **
+ ** @a data is the indexed data, as it was passed to
+ ** ::vl_kdforest_build. If @a data is @c NULL, the data saved in the
+ ** file is used instead; in this case, the file must contain it,
+ ** and the data (but not the trees) is used in place without a
+ ** copy: the file remains mapped read-only until the forest is
+ ** deleted by ::vl_kdforest_delete.
+ **
+ ** On error, the function returns @c NULL and sets the last error
+ ** (::vl_get_last_error).
+ **/
+
+VL_EXPORT VlKDForest *
+vl_kdforest_load (char const * fileName, void const * data)
+{
+  VlKDForest * self = NULL ;
+  VlKDForestFileReader reader ;
+  unsigned char const * magic ;
+  unsigned char const * byteOrderBytes ;
+  vl_uint32 version, byteOrder, dataType, thresholdingMethod, flags ;
+  vl_uint64 dimension, numData, numTrees ;
+  char * mapping ;
+  vl_size mappingSize ;
+  vl_uindex ti ;
+  int error = VL_ERR_OK ;
+
+#if defined(VL_OS_WIN)
+  HANDLE file, fileMapping ;
+  LARGE_INTEGER fileSize ;
+  file = CreateFileA (fileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL) ;
+  if (file == INVALID_HANDLE_VALUE) {
+    vl_set_last_error (VL_ERR_IO, "Could not open '%s'.", fileName) ;
+    return NULL ;
+  }
+  if (! GetFileSizeEx (file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle (file) ;
+    vl_set_last_error (VL_ERR_IO, "Could not read '%s'.", fileName) ;
+    return NULL ;
+  }
+  mappingSize = (vl_size) fileSize.QuadPart ;
+  fileMapping = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL) ;
+  mapping = NULL ;
+  if (fileMapping) {
+    mapping = MapViewOfFile (fileMapping, FILE_MAP_READ, 0, 0, 0) ;
+    CloseHandle (fileMapping) ;
+  }
+  CloseHandle (file) ;
+  if (! mapping) {
+    vl_set_last_error (VL_ERR_IO, "Could not map '%s'.", fileName) ;
+    return NULL ;
+  }
+#else
+  struct stat fileStat ;
+  int file = open (fileName, O_RDONLY) ;
+  if (file < 0) {
+    vl_set_last_error (VL_ERR_IO, "Could not open '%s'.", fileName) ;
+    return NULL ;
+  }
+  if (fstat (file, &fileStat) < 0 || fileStat.st_size == 0) {
+    close (file) ;
+    vl_set_last_error (VL_ERR_IO, "Could not read '%s'.", fileName) ;
+    return NULL ;
+  }
+  mappingSize = (vl_size) fileStat.st_size ;
+  mapping = mmap (NULL, mappingSize, PROT_READ, MAP_SHARED, file, 0) ;
+  close (file) ;
+  if (mapping == MAP_FAILED) {
+    vl_set_last_error (VL_ERR_IO, "Could not map '%s'.", fileName) ;
+    return NULL ;
+  }
+#endif
+
+  reader.bytes = (unsigned char const *) mapping ;
+  reader.size = mappingSize ;
+  reader.offset = 0 ;
+  reader.ok = VL_TRUE ;
+
+  /* check the header */
+  magic = vl_kdforest_file_read (&reader, 8) ;
+  version = (vl_uint32) vl_kdforest_file_read_uint (&reader, 4) ;
+  if (! reader.ok || memcmp (magic, VL_KDFOREST_FILE_MAGIC, 8) ||
+      version != VL_KDFOREST_FILE_VERSION) {
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is not a KDForest file.", fileName) ;
+    goto fail ;
+  }
+  byteOrderBytes = vl_kdforest_file_read (&reader, 4) ;
+  dataType = (vl_uint32) vl_kdforest_file_read_uint (&reader, 4) ;
+  thresholdingMethod = (vl_uint32) vl_kdforest_file_read_uint (&reader, 4) ;
+  dimension = vl_kdforest_file_read_uint (&reader, 8) ;
+  numData = vl_kdforest_file_read_uint (&reader, 8) ;
+  numTrees = vl_kdforest_file_read_uint (&reader, 8) ;
+  flags = (vl_uint32) vl_kdforest_file_read_uint (&reader, 4) ;
+  vl_kdforest_file_read_uint (&reader, 4) ;
+
+  if (! reader.ok ||
+      (dataType != VL_TYPE_FLOAT && dataType != VL_TYPE_DOUBLE) ||
+      (thresholdingMethod != VL_KDTREE_MEDIAN && thresholdingMethod != VL_KDTREE_MEAN) ||
+      dimension == 0 || dimension > 0xffffffff ||
+      numData == 0 || numTrees == 0 ||
+      numTrees > mappingSize / VL_KDFOREST_FILE_TREE_SIZE ||
+      numData > mappingSize / VL_KDFOREST_FILE_DATA_INDEX_ENTRY_SIZE ||
+      ((flags & VL_KDFOREST_FILE_COMPACT) &&
+       (dataType != VL_TYPE_FLOAT || numData >= 0x7fffffff))) {
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is corrupted.", fileName) ;
+    goto fail ;
+  }
+  memcpy (&byteOrder, byteOrderBytes, 4) ;
+  if (! data) {
+    if (! (flags & VL_KDFOREST_FILE_DATA)) {
+      vl_set_last_error (VL_ERR_BAD_ARG, "'%s' does not contain the data.", fileName) ;
+      goto fail ;
+    }
+    if (byteOrder != VL_KDFOREST_FILE_BYTE_ORDER) {
+      vl_set_last_error (VL_ERR_BAD_ARG, "The data in '%s' was saved with a different byte order.", fileName) ;
+      goto fail ;
+    }
+  }
+
+  self = vl_kdforest_new (dataType, dimension, numTrees) ;
+  self->thresholdingMethod = (VlKDTreeThresholdingMethod) thresholdingMethod ;
+  self->numData = numData ;
+  self->trees = vl_calloc (numTrees, sizeof(VlKDTree*)) ;
+  if (! self->trees) {
+    error = VL_ERR_ALLOC ;
+    goto fail_trees ;
+  }
+  for (ti = 0 ; ti < numTrees ; ++ti) {
+    VlKDTree * tree = vl_calloc (1, sizeof(VlKDTree)) ;
+    if (! tree) {
+      error = VL_ERR_ALLOC ;
+      goto fail_trees ;
+    }
+    self->trees[ti] = tree ;
+    error = vl_kdforest_load_tree (self, tree, &reader) ;
+    if (error) goto fail_trees ;
+  }
+
+  if (! data) {
+    vl_uint64 dataOffset = vl_kdforest_file_align(reader.offset) ;
+    if (dataOffset > mappingSize ||
+        dimension > (mappingSize - dataOffset) /
+        (numData * vl_get_type_size(dataType))) {
+      error = VL_ERR_BAD_ARG ;
+      goto fail_trees ;
+    }
+    data = mapping + dataOffset ;
+    self->mapping = mapping ;
+    self->mappingSize = mappingSize ;
+  } else {
+#if defined(VL_OS_WIN)
+    UnmapViewOfFile (mapping) ;
+#else
+    munmap (mapping, mappingSize) ;
+#endif
+  }
+  self->data = data ;
+
+  vl_kdforest_prepare_search (self) ;
+  if (flags & VL_KDFOREST_FILE_COMPACT) vl_kdforest_compact (self) ;
+  return self ;
+
+fail_trees:
+  vl_kdforest_delete (self) ;
+  if (error == VL_ERR_ALLOC) {
+    vl_set_last_error (VL_ERR_ALLOC, "Could not allocate the trees of '%s'.", fileName) ;
+  } else {
+    vl_set_last_error (VL_ERR_BAD_ARG, "'%s' is corrupted.", fileName) ;
+  }
+fail:
+#if defined(VL_OS_WIN)
+  UnmapViewOfFile (mapping) ;
+#else
+  munmap (mapping, mappingSize) ;
+#endif
+  return NULL ;
+}
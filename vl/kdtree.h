@@ -20,9 +20,11 @@ the terms of the BSD license (see the COPYING file).
 #define VL_KDTREE_SPLIT_HEAP_SIZE 5
 
 typedef struct _VlKDTreeNode VlKDTreeNode ;
+typedef struct _VlKDTreeCompactNode VlKDTreeCompactNode ;
 typedef struct _VlKDTreeSplitDimension VlKDTreeSplitDimension ;
 typedef struct _VlKDTreeDataIndexEntry VlKDTreeDataIndexEntry ;
 typedef struct _VlKDForestSearchState VlKDForestSearchState ;
+typedef struct _VlKDForestSearcher VlKDForestSearcher ;
 
 struct _VlKDTreeNode
 {
@@ -35,6 +37,17 @@ struct _VlKDTreeNode
   double upperBound ;
 } ;
 
+/** @brief Node of the compact search layout (see ::vl_kdforest_compact) */
+struct _VlKDTreeCompactNode
+{
+  vl_int32 lowerChild ;
+  vl_int32 upperChild ;
+  vl_uint32 splitDimension ;
+  float splitThreshold ;
+  float lowerBound ;
+  float upperBound ;
+} ;
+
 struct _VlKDTreeSplitDimension
 {
   unsigned int dimension ;
@@ -68,6 +81,11 @@ typedef struct _VlKDTree
   vl_size numAllocatedNodes ;
   VlKDTreeDataIndexEntry * dataIndex ;
   unsigned int depth ;
+
+  /* compact search layout */
+  VlKDTreeCompactNode * compactNodes ;
+  vl_uint32 * compactDataIndex ;
+  float * compactData ;
 } VlKDTree ;
 
 struct _VlKDForestSearchState
@@ -97,21 +115,36 @@ typedef struct _VlKDForest
 
   /* build */
   VlKDTreeThresholdingMethod thresholdingMethod ;
-  VlKDTreeSplitDimension splitHeapArray [VL_KDTREE_SPLIT_HEAP_SIZE] ;
-  vl_size splitHeapNumNodes ;
   vl_size splitHeapSize ;
 
   /* querying */
+  vl_size searchMaxNumComparisons ;
+  vl_size maxNumNodes ;
+  VlKDForestSearcher * searcher ;
+
+  /* memory mapped file with the data (see vl_kdforest_load) */
+  void * mapping ;
+  vl_size mappingSize ;
+} VlKDForest ;
+
+/** @brief KDForest searcher object
+ **
+ ** A searcher holds the state of a search in a ::VlKDForest. Several
+ ** searchers can query the same forest concurrently.
+ **/
+struct _VlKDForestSearcher
+{
+  VlKDForest const * forest ;
+
   VlKDForestSearchState * searchHeapArray ;
   vl_size searchHeapNumNodes ;
   vl_uindex searchId ;
   vl_uindex * searchIdBook ;
 
-  vl_size searchMaxNumComparisons ;
   vl_size searchNumComparisons;
   vl_size searchNumRecursions ;
   vl_size searchNumSimplifications ;
-} VlKDForest ;
+} ;
 
 /** @name Creatind and disposing
  ** @{ */
@@ -120,15 +153,41 @@ VL_EXPORT VlKDForest * vl_kdforest_new (vl_type dataType,
 VL_EXPORT void vl_kdforest_delete (VlKDForest * self) ;
 /** @} */
 
+/** @name Saving and loading
+ ** @{ */
+VL_EXPORT int vl_kdforest_save (VlKDForest * self,
+                                char const * fileName,
+                                vl_bool saveData) ;
+VL_EXPORT VlKDForest * vl_kdforest_load (char const * fileName,
+                                         void const * data) ;
+/** @} */
+
 /** @name Building and querying
  ** @{ */
 VL_EXPORT void vl_kdforest_build (VlKDForest * self,
                                   vl_size numData,
                                   void const * data) ;
+VL_EXPORT void vl_kdforest_compact (VlKDForest * self) ;
+VL_EXPORT void vl_kdforest_prepare_search (VlKDForest * self) ;
 VL_EXPORT vl_size vl_kdforest_query (VlKDForest * self,
                                      VlKDForestNeighbor * neighbors,
                                      vl_size numNeighbors,
                                      void const * query) ;
+VL_EXPORT vl_size vl_kdforest_query_batch (VlKDForest * self,
+                                           VlKDForestNeighbor * neighbors,
+                                           vl_size numNeighbors,
+                                           void const * queries,
+                                           vl_size numQueries) ;
+/** @} */
+
+/** @name Searching concurrently
+ ** @{ */
+VL_EXPORT VlKDForestSearcher * vl_kdforestsearcher_new (VlKDForest * forest) ;
+VL_EXPORT void vl_kdforestsearcher_delete (VlKDForestSearcher * self) ;
+VL_EXPORT vl_size vl_kdforestsearcher_query (VlKDForestSearcher * self,
+                                             VlKDForestNeighbor * neighbors,
+                                             vl_size numNeighbors,
+                                             void const * query) ;
 /** @} */
 
 /** @name Retrieving and setting parameters
@@ -25,7 +25,8 @@ It supports
 - random selection and <code>k-means++</code> @cite{arthur07k-means}
   initialization methods;
 - the basic Lloyd @cite{lloyd82least} and the accelerated Elkan
-  @cite{elkan03using} optimization methods.
+  @cite{elkan03using} optimization methods, as well as an approximate
+  variant of Lloyd using KD-trees (@ref kdtree).
 
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
 @section kmeans-usage Usage
@@ -88,6 +89,53 @@ quantize new data points.
   square of the number of clusters, which makes it unpractical for a
   very large number of clusters.
 
+- <b>ANN</b> (::VlKMeansANN). This is a variation of
+  @cite{lloyd82least} that assigns points to clusters by an
+  approximate nearest neighbor search. At each iteration, the
+  centers are indexed by a randomized KD-forest (@ref kdtree) and
+  each point is compared to at most a given number of centers
+  (::vl_kmeans_set_max_num_comparisons,
+  ::vl_kmeans_set_num_trees). A point is moved to the new center only
+  if this is closer than its current one, so that the energy does not
+  increase. This is much faster than the exact algorithms when the
+  number of clusters is very large. The KD-forest uses the @e l2
+  distance to search for the centers; with the @e l1 distance, the
+  assignments are therefore only a coarse approximation.
+
+The Lloyd and Elkan algorithms distribute the assignment of the points to the
+clusters, the update of the bounds and the computation of the centers
+among the threads (see @ref threads). The result does not depend on
+the number of threads.
+
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@subsection kmeans-usage-minibatch Mini-batch k-means
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+The optimization algorithms above need all the data in memory. For
+larger datasets, ::vl_kmeans_update_minibatch updates the centers from
+a small batch of data at a time, in the manner of
+stochastic gradient descent. Each point of the batch is assigned to
+the closest center, which is then moved towards the point with a
+learning rate equal to the inverse of the number of points assigned to
+that center so far. Hence each center is the running mean of the
+points assigned to it (this is also the case for the @e l1 distance,
+for which the result is only an approximation). Since the centers
+that do not attract any point are never updated, they can optionally
+be moved to random data points (see
+::vl_kmeans_set_minibatch_reassignment_ratio).
+
+::vl_kmeans_cluster_minibatch reads the data from a callback, which
+can for example load the data from disk:
+
+@code
+vl_size read (void * file, void * batch, vl_size maxNumData)
+{
+  return fread (batch, sizeof(float) * dimension, maxNumData, file) ;
+}
+
+vl_kmeans_cluster_minibatch (kmeans, read, file, dimension, numCenters, 10000) ;
+@endcode
+
 @section kmeans-tech Technical details
 
 Given data points @f$ x_1, \dots, x_n \in \mathbb{R}^d @f$, k-means
@@ -174,6 +222,8 @@ then a point need not to be reassigned. See [3] for details.
 #include "kmeans.h"
 #include "generic.h"
 #include "mathop.h"
+#include "threads.h"
+#include "kdtree.h"
 #include <string.h>
 
 /* ================================================================ */
@@ -197,8 +247,10 @@ vl_kmeans_reset (VlKMeans * self)
 
   if (self->centers) vl_free(self->centers) ;
   if (self->centerDistances) vl_free(self->centerDistances) ;
+  if (self->centerMasses) vl_free(self->centerMasses) ;
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 }
 
 /** ------------------------------------------------------------------
@@ -221,9 +273,13 @@ vl_kmeans_new (vl_type dataType,
   self->verbosity = 0 ;
   self->maxNumIterations = 100 ;
   self->numRepetitions = 1 ;
+  self->numTrees = 3 ;
+  self->maxNumComparisons = 100 ;
+  self->minibatchReassignmentRatio = 0 ;
 
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 
   vl_kmeans_reset (self) ;
 
@@ -248,11 +304,15 @@ vl_kmeans_new_copy (VlKMeans const * kmeans)
   self->verbosity = kmeans->verbosity ;
   self->maxNumIterations = kmeans->maxNumIterations ;
   self->numRepetitions = kmeans->numRepetitions ;
+  self->numTrees = kmeans->numTrees ;
+  self->maxNumComparisons = kmeans->maxNumComparisons ;
+  self->minibatchReassignmentRatio = kmeans->minibatchReassignmentRatio ;
 
   self->dimension = kmeans->dimension ;
   self->numCenters = kmeans->numCenters ;
   self->centers = NULL ;
   self->centerDistances = NULL ;
+  self->centerMasses = NULL ;
 
   if (kmeans->centers) {
     vl_size dataSize = vl_get_type_size(self->dataType) * self->dimension * self->numCenters ;
@@ -266,6 +326,12 @@ vl_kmeans_new_copy (VlKMeans const * kmeans)
     memcpy (self->centerDistances, kmeans->centerDistances, dataSize) ;
   }
 
+  if (kmeans->centerMasses) {
+    vl_size dataSize = sizeof(double) * self->numCenters ;
+    self->centerMasses = vl_malloc(dataSize) ;
+    memcpy (self->centerMasses, kmeans->centerMasses, dataSize) ;
+  }
+
   return self ;
 }
 
@@ -449,10 +515,134 @@ VL_XCAT(_vl_kmeans_seed_centers_plus_plus_, SFX)
   vl_free(minDistances) ;
 }
 
+/* ---------------------------------------------------------------- */
+/*                                                   Parallel tasks */
+/* ---------------------------------------------------------------- */
+
+/* The loops over the data points and over the centers are executed
+   by ::vl_parallel_for. The data shared by the loop bodies is stored
+   in the following structure. The bodies write disjoint parts of the
+   output arrays; the counters are indexed by the executing slot and
+   are summed after the loop completes. Since each body is
+   independent of the way the loop is split into chunks, the result
+   does not depend on the number of threads. */
+
+typedef struct VL_XCAT(_VlKMeansTask_, SFX)
+{
+  VlKMeans * self ;
+  TYPE const * data ;
+  vl_size numData ;
+#if (FLT == VL_TYPE_FLOAT)
+  VlFloatVectorComparisonFunction distFn ;
+#else
+  VlDoubleVectorComparisonFunction distFn ;
+#endif
+
+  /* assignments and center updates */
+  TYPE * centers ;
+  vl_uint32 * assignments ;
+  TYPE * distances ;
+  vl_size * clusterMasses ;
+  vl_uindex * members ;
+  vl_uindex * membersBegin ;
+  vl_uint32 * permutations ;
+  vl_size * numSeenSoFar ;
+
+  /* Elkan bounds */
+  TYPE * pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict ;
+  TYPE * pointToCenterLB ;
+  TYPE * centerToNewCenterDistances ;
+  TYPE * nextCenterDistances ;
+
+  /* per-slot counters */
+  vl_size numSlots ;
+  vl_size * numDistanceComputations ;
+  vl_size * numDistanceComputationsToRefreshUB ;
+  vl_size * numReassignments ;
+} VL_XCAT(_VlKMeansTask_, SFX) ;
+
+/** @internal @brief Initialize the parallel task data
+ ** @param task task data (output).
+ ** @param self KMeans object.
+ ** @param data data points.
+ ** @param numData number of data points.
+ **
+ ** The function allocates the per-slot counters, which must be
+ ** disposed by ::_vl_kmeans_task_done_f (or @c _d).
+ **/
+
+static void
+VL_XCAT(_vl_kmeans_task_init_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task,
+ VlKMeans * self, TYPE const * data, vl_size numData)
+{
+  memset(task, 0, sizeof(*task)) ;
+  task->self = self ;
+  task->data = data ;
+  task->numData = numData ;
+#if (FLT == VL_TYPE_FLOAT)
+  task->distFn = vl_get_vector_comparison_function_f(self->distance) ;
+#else
+  task->distFn = vl_get_vector_comparison_function_d(self->distance) ;
+#endif
+  task->numSlots = vl_get_max_threads() ;
+  task->numDistanceComputations = vl_calloc (3 * task->numSlots, sizeof(vl_size)) ;
+  task->numDistanceComputationsToRefreshUB = task->numDistanceComputations + task->numSlots ;
+  task->numReassignments = task->numDistanceComputations + 2 * task->numSlots ;
+}
+
+static void
+VL_XCAT(_vl_kmeans_task_done_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task)
+{
+  vl_free (task->numDistanceComputations) ;
+}
+
+/** @internal @brief Sum and reset a per-slot counter */
+
+static vl_size
+VL_XCAT(_vl_kmeans_task_collect_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) const * task, vl_size * counter)
+{
+  vl_size total = 0 ;
+  vl_uindex slot ;
+  for (slot = 0 ; slot < task->numSlots ; ++slot) {
+    total += counter[slot] ;
+    counter[slot] = 0 ;
+  }
+  return total ;
+}
+
 /* ---------------------------------------------------------------- */
 /*                                                     Quantization */
 /* ---------------------------------------------------------------- */
 
+static void
+VL_XCAT(_vl_kmeans_quantize_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  vl_uindex i, k ;
+
+  for (i = begin ; i < end ; ++i) {
+    TYPE const * x = task->data + self->dimension * i ;
+    TYPE bestDistance = (TYPE) VL_INFINITY_D ;
+    vl_uint32 bestCenter = 0 ;
+    for (k = 0 ; k < self->numCenters ; ++k) {
+      TYPE distance = task->distFn(self->dimension, x,
+                                   (TYPE*)self->centers + self->dimension * k) ;
+      if (distance < bestDistance) {
+        bestDistance = distance ;
+        bestCenter = (vl_uint32)k ;
+      }
+    }
+    task->assignments[i] = bestCenter ;
+    if (task->distances) task->distances[i] = bestDistance ;
+  }
+}
+
 static void
 VL_XCAT(_vl_kmeans_quantize_, SFX)
 (VlKMeans * self,
@@ -461,32 +651,77 @@ VL_XCAT(_vl_kmeans_quantize_, SFX)
  TYPE const * data,
  vl_size numData)
 {
-  vl_uindex i ;
+  VL_XCAT(_VlKMeansTask_, SFX) task ;
+  VL_XCAT(_vl_kmeans_task_init_, SFX)(&task, self, data, numData) ;
+  task.assignments = assignments ;
+  task.distances = distances ;
+  vl_parallel_for (numData, 0, VL_XCAT(_vl_kmeans_quantize_task_, SFX), &task) ;
+  VL_XCAT(_vl_kmeans_task_done_, SFX)(&task) ;
+}
+
+/** @internal @brief Quantize data approximately using a KD-forest
+ ** @param self KMeans object.
+ ** @param assignments data to centers assignments (in/out).
+ ** @param distances data to assigned center distances (output).
+ ** @param data data to quantize.
+ ** @param numData number of data points.
+ ** @param update whether @a assignments contains a previous assignment.
+ **
+ ** If @a update is true, a point is reassigned only if the center
+ ** found by the approximate search is closer than the current one.
+ **/
+
+static void
+VL_XCAT(_vl_kmeans_quantize_ann_, SFX)
+(VlKMeans * self,
+ vl_uint32 * assignments,
+ TYPE * distances,
+ TYPE const * data,
+ vl_size numData,
+ vl_bool update)
+{
+  vl_uindex x ;
+  VlKDForest * forest ;
+  VlKDForestNeighbor * neighbors = vl_malloc (sizeof(VlKDForestNeighbor) * numData) ;
 #if (FLT == VL_TYPE_FLOAT)
   VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
 #else
   VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
 #endif
-  TYPE * distanceToCenters = vl_malloc (sizeof(TYPE) * self->numCenters) ;
 
-  for (i = 0 ; i < numData ; ++i) {
-    vl_size k ;
-    TYPE bestDistance = (TYPE) VL_INFINITY_D ;
-    VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)(distanceToCenters,
-                                                          self->dimension,
-                                                          data + self->dimension * i, 1,
-                                                          (TYPE*)self->centers, self->numCenters,
-                                                          distFn) ;
-    for (k = 0 ; k < self->numCenters ; ++k) {
-      if (distanceToCenters[k] < bestDistance) {
-        bestDistance = distanceToCenters[k] ;
-        assignments[i] = (vl_uint32)k ;
+  /* index the centers; the forest retains a pointer to them, so it
+     must be rebuilt every time they are updated */
+  forest = vl_kdforest_new (self->dataType, self->dimension, self->numTrees) ;
+  vl_kdforest_set_max_num_comparisons (forest, self->maxNumComparisons) ;
+  vl_kdforest_build (forest, self->numCenters, self->centers) ;
+  vl_kdforest_query_batch (forest, neighbors, 1, data, numData) ;
+
+  for (x = 0 ; x < numData ; ++x) {
+    TYPE const * xpt = data + x * self->dimension ;
+    VlKDForestNeighbor const * neighbor = neighbors + x ;
+    TYPE distance ;
+    if (self->distance == VlDistanceL2) {
+      distance = (TYPE) neighbor->distance ;
+    } else {
+      distance = distFn(self->dimension, xpt,
+                        (TYPE*)self->centers + neighbor->index * self->dimension) ;
+    }
+    /* the search is approximate: keep the current center if closer */
+    if (update) {
+      TYPE currentDistance =
+      distFn(self->dimension, xpt,
+             (TYPE*)self->centers + assignments[x] * self->dimension) ;
+      if (currentDistance <= distance) {
+        distances[x] = currentDistance ;
+        continue ;
       }
     }
-
-    if (distances) distances[i] = bestDistance ;
+    assignments[x] = (vl_uint32) neighbor->index ;
+    distances[x] = distance ;
   }
-  vl_free(distanceToCenters) ;
+
+  vl_free (neighbors) ;
+  vl_kdforest_delete (forest) ;
 }
 
 /* ---------------------------------------------------------------- */
@@ -523,77 +758,244 @@ VL_XCAT3(_vl_kmeans_, SFX, _qsort_swap)
 #include "qsort-def.h"
 
 static void
-VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)
-(VlKMeans * self, vl_uint32 * permutations, TYPE const * data, vl_size numData)
+VL_XCAT(_vl_kmeans_sort_data_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
 {
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
   vl_uindex d, x ;
 
-  for (d = 0 ; d < self->dimension ; ++d) {
+  for (d = begin ; d < end ; ++d) {
     VlKMeansSortWrapper array ;
-    array.permutation = permutations + d * numData ;
-    array.data = data + d ;
-    array.stride = self->dimension ;
-    for (x = 0 ; x < numData ; ++x) { array.permutation[x] = (vl_uint32)x ; }
-    VL_XCAT3(_vl_kmeans_, SFX, _qsort_sort)(&array, numData) ;
+    array.permutation = task->permutations + d * task->numData ;
+    array.data = task->data + d ;
+    array.stride = task->self->dimension ;
+    for (x = 0 ; x < task->numData ; ++x) { array.permutation[x] = (vl_uint32)x ; }
+    VL_XCAT3(_vl_kmeans_, SFX, _qsort_sort)(&array, task->numData) ;
+  }
+}
+
+static void
+VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task)
+{
+  vl_parallel_for (task->self->dimension, 1,
+                   VL_XCAT(_vl_kmeans_sort_data_task_, SFX), task) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                  Center update */
+/* ---------------------------------------------------------------- */
+
+/* For the l2 distance, each center is the average of the points
+   assigned to it. These are enumerated from the list of members
+   of the cluster, which is sorted by data index. The summation order
+   is therefore fixed and each center can be computed independently,
+   without per-thread copies of the centers. */
+
+static void
+VL_XCAT(_vl_kmeans_update_centers_l2_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  vl_size const dimension = task->self->dimension ;
+  vl_uindex c, i, d ;
+
+  for (c = begin ; c < end ; ++c) {
+    TYPE * cpt = task->centers + c * dimension ;
+    vl_uindex const * members = task->members + task->membersBegin[c] ;
+    vl_size mass = task->clusterMasses[c] ;
+    if (mass == 0) continue ;
+    memset(cpt, 0, sizeof(TYPE) * dimension) ;
+    for (i = 0 ; i < mass ; ++i) {
+      TYPE const * xpt = task->data + members[i] * dimension ;
+      for (d = 0 ; d < dimension ; ++d) { cpt[d] += xpt[d] ; }
+    }
+    for (d = 0 ; d < dimension ; ++d) { cpt[d] /= (TYPE)mass ; }
+  }
+}
+
+/* For the l1 distance, each center component is the median of the
+   corresponding components of the points assigned to it. These are
+   found by scanning the data sorted along each dimension, which
+   can be done independently for each dimension. */
+
+static void
+VL_XCAT(_vl_kmeans_update_centers_l1_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  vl_size const dimension = task->self->dimension ;
+  vl_size const numCenters = task->self->numCenters ;
+  vl_size * numSeenSoFar = task->numSeenSoFar + slot * numCenters ;
+  vl_uindex c, d, x ;
+
+  for (d = begin ; d < end ; ++d) {
+    vl_uint32 const * perm = task->permutations + d * task->numData ;
+    memset(numSeenSoFar, 0, sizeof(vl_size) * numCenters) ;
+    for (x = 0 ; x < task->numData ; ++x) {
+      c = task->assignments[perm[x]] ;
+      if (2 * numSeenSoFar[c] < task->clusterMasses[c]) {
+        task->centers [d + c * dimension] =
+        task->data [d + perm[x] * dimension] ;
+      }
+      numSeenSoFar[c] ++ ;
+    }
+  }
+}
+
+/** @internal @brief Compute the centers from the assignments
+ ** @param task task data.
+ ** @param centers centers (output).
+ ** @return number of restarted centers.
+ **
+ ** Clusters with no points are restarted from a random data point.
+ **/
+
+static vl_size
+VL_XCAT(_vl_kmeans_update_centers_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task, TYPE * centers)
+{
+  VlKMeans const * self = task->self ;
+  VlRand * rand = vl_get_rand () ;
+  vl_size numRestartedCenters = 0 ;
+  vl_uindex c, x, d ;
+
+  task->centers = centers ;
+
+  memset(task->clusterMasses, 0, sizeof(vl_size) * self->numCenters) ;
+  for (x = 0 ; x < task->numData ; ++x) {
+    task->clusterMasses[task->assignments[x]] ++ ;
+  }
+
+  switch (self->distance) {
+    case VlDistanceL2:
+      /* list the members of each cluster */
+      for (x = 0, c = 0 ; c < self->numCenters ; ++c) {
+        task->membersBegin[c] = x ;
+        x += task->clusterMasses[c] ;
+      }
+      for (x = 0 ; x < task->numData ; ++x) {
+        task->members[task->membersBegin[task->assignments[x]]++] = x ;
+      }
+      for (c = 0 ; c < self->numCenters ; ++c) {
+        task->membersBegin[c] -= task->clusterMasses[c] ;
+      }
+      vl_parallel_for (self->numCenters, 0,
+                       VL_XCAT(_vl_kmeans_update_centers_l2_task_, SFX), task) ;
+      break ;
+    case VlDistanceL1:
+      vl_parallel_for (self->dimension, 1,
+                       VL_XCAT(_vl_kmeans_update_centers_l1_task_, SFX), task) ;
+      break ;
+    default:
+      abort();
+  }
+
+  /* restart the centers as required */
+  for (c = 0 ; c < self->numCenters ; ++c) {
+    if (task->clusterMasses[c] == 0) {
+      TYPE * cpt = centers + c * self->dimension ;
+      vl_uindex x = vl_rand_uindex(rand, task->numData) ;
+      numRestartedCenters ++ ;
+      for (d = 0 ; d < self->dimension ; ++d) {
+        cpt[d] = task->data[x * self->dimension + d] ;
+      }
+    }
   }
+  return numRestartedCenters ;
 }
 
 /* ---------------------------------------------------------------- */
-/*                                                 Lloyd refinement */
+/*                                         Lloyd and ANN refinement */
 /* ---------------------------------------------------------------- */
 
+/* Lloyd and ANN k-means alternate the same center update with an
+   assignment step, which is exact for Lloyd and uses a KD-forest
+   for ANN. The assignment step fills task->assignments and
+   task->distances. */
+
+static void
+VL_XCAT(_vl_kmeans_assign_lloyd_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task, vl_size iteration VL_UNUSED)
+{
+  vl_parallel_for (task->numData, 0, VL_XCAT(_vl_kmeans_quantize_task_, SFX), task) ;
+}
+
+static void
+VL_XCAT(_vl_kmeans_assign_ann_, SFX)
+(VL_XCAT(_VlKMeansTask_, SFX) * task, vl_size iteration)
+{
+  VL_XCAT(_vl_kmeans_quantize_ann_, SFX)(task->self, task->assignments, task->distances,
+                                         task->data, task->numData,
+                                         iteration > 0) ;
+}
+
 static double
-VL_XCAT(_vl_kmeans_refine_centers_lloyd_, SFX)
+VL_XCAT(_vl_kmeans_refine_centers_iteratively_, SFX)
 (VlKMeans * self,
  TYPE const * data,
- vl_size numData)
+ vl_size numData,
+ char const * name,
+ void (*assign) (VL_XCAT(_VlKMeansTask_, SFX) * task, vl_size iteration))
 {
-  vl_size c, d, x, iteration ;
-  vl_bool allDone ;
+  vl_size x, iteration ;
   double previousEnergy = VL_INFINITY_D ;
   double energy ;
+  VL_XCAT(_VlKMeansTask_, SFX) task ;
   TYPE * distances = vl_malloc (sizeof(TYPE) * numData) ;
   vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * numData) ;
-  vl_size * clusterMasses = vl_malloc (sizeof(vl_size) * numData) ;
+  vl_size * clusterMasses = vl_malloc (sizeof(vl_size) * self->numCenters) ;
   vl_uint32 * permutations = NULL ;
   vl_size * numSeenSoFar = NULL ;
-  VlRand * rand = vl_get_rand () ;
+  vl_uindex * members = NULL ;
+  vl_uindex * membersBegin = NULL ;
   vl_size totNumRestartedCenters = 0 ;
   vl_size numRestartedCenters = 0 ;
 
+  VL_XCAT(_vl_kmeans_task_init_, SFX)(&task, self, data, numData) ;
+  task.assignments = assignments ;
+  task.distances = distances ;
+  task.clusterMasses = clusterMasses ;
+
   if (self->distance == VlDistanceL1) {
     permutations = vl_malloc(sizeof(vl_uint32) * numData * self->dimension) ;
-    numSeenSoFar = vl_malloc(sizeof(vl_size) * self->numCenters) ;
-    VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)(self, permutations, data, numData) ;
+    numSeenSoFar = vl_malloc(sizeof(vl_size) * self->numCenters * task.numSlots) ;
+    task.permutations = permutations ;
+    task.numSeenSoFar = numSeenSoFar ;
+    VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)(&task) ;
+  } else {
+    members = vl_malloc(sizeof(vl_uindex) * numData) ;
+    membersBegin = vl_malloc(sizeof(vl_uindex) * self->numCenters) ;
+    task.members = members ;
+    task.membersBegin = membersBegin ;
   }
 
   for (energy = VL_INFINITY_D,
-       iteration = 0,
-       allDone = VL_FALSE ;
+       iteration = 0 ;
        1 ;
        ++ iteration) {
 
     /* assign data to cluters */
-    VL_XCAT(_vl_kmeans_quantize_, SFX)(self, assignments, distances, data, numData) ;
+    assign (&task, iteration) ;
 
     /* compute energy */
     energy = 0 ;
     for (x = 0 ; x < numData ; ++x) energy += distances[x] ;
     if (self->verbosity) {
-      VL_PRINTF("kmeans: Lloyd iter %d: energy = %g\n", iteration,
+      VL_PRINTF("kmeans: %s iter %d: energy = %g\n", name, iteration,
                 energy) ;
     }
 
     /* check termination conditions */
     if (iteration >= self->maxNumIterations) {
       if (self->verbosity) {
-        VL_PRINTF("kmeans: Lloyd terminating because maximum number of iterations reached\n") ;
+        VL_PRINTF("kmeans: %s terminating because maximum number of iterations reached\n", name) ;
       }
       break ;
     }
     if (energy == previousEnergy) {
       if (self->verbosity) {
-        VL_PRINTF("kmeans: Lloyd terminating because the algorithm fully converged\n") ;
+        VL_PRINTF("kmeans: %s terminating because the algorithm fully converged\n", name) ;
       }
       break ;
     }
@@ -602,72 +1004,21 @@ VL_XCAT(_vl_kmeans_refine_centers_lloyd_, SFX)
     previousEnergy = energy ;
 
     /* update clusters */
-    memset(clusterMasses, 0, sizeof(vl_size) * numData) ;
-    for (x = 0 ; x < numData ; ++x) {
-      clusterMasses[assignments[x]] ++ ;
-    }
-
-    numRestartedCenters = 0 ;
-    switch (self->distance) {
-      case VlDistanceL2:
-        memset(self->centers, 0, sizeof(TYPE) * self->dimension * self->numCenters) ;
-        for (x = 0 ; x < numData ; ++x) {
-          TYPE * cpt = (TYPE*)self->centers + assignments[x] * self->dimension ;
-          TYPE const * xpt = data + x * self->dimension ;
-          for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += xpt[d] ; }
-        }
-        for (c = 0 ; c < self->numCenters ; ++c) {
-          TYPE * cpt = (TYPE*)self->centers + c * self->dimension ;
-          if (clusterMasses[c] > 0) {
-            TYPE mass = clusterMasses[c] ;
-            for (d = 0 ; d < self->dimension ; ++d) { cpt[d] /= mass ; }
-          } else {
-            vl_uindex x = vl_rand_uindex(rand, numData) ;
-            numRestartedCenters ++ ;
-            for (d = 0 ; d < self->dimension ; ++d) {
-              cpt[d] = data[x * self->dimension + d] ;
-            }
-          }
-        }
-        break ;
-      case VlDistanceL1:
-        for (d = 0 ; d < self->dimension ; ++d) {
-          vl_uint32 * perm = permutations + d * numData ;
-          memset(numSeenSoFar, 0, sizeof(vl_size) * self->numCenters) ;
-          for (x = 0; x < numData ; ++x) {
-            c = assignments[perm[x]] ;
-            if (2 * numSeenSoFar[c] < clusterMasses[c]) {
-              ((TYPE*)self->centers) [d + c * self->dimension] =
-              data [d + perm[x] * self->dimension] ;
-            }
-            numSeenSoFar[c] ++ ;
-          }
-          /* restart the centers as required  */
-          for (c = 0 ; c < self->numCenters ; ++c) {
-            if (clusterMasses[c] == 0) {
-              TYPE * cpt = (TYPE*)self->centers + c * self->dimension ;
-              vl_uindex x = vl_rand_uindex(rand, numData) ;
-              numRestartedCenters ++ ;
-              for (d = 0 ; d < self->dimension ; ++d) {
-                cpt[d] = data[x * self->dimension + d] ;
-              }
-            }
-          }
-        }
-        break ;
-      default:
-        abort();
-    } /* done compute centers */
+    numRestartedCenters =
+    VL_XCAT(_vl_kmeans_update_centers_, SFX)(&task, (TYPE*)self->centers) ;
 
     totNumRestartedCenters += numRestartedCenters ;
     if (self->verbosity && numRestartedCenters) {
-      VL_PRINTF("kmeans: Lloyd iter %d: restarted %d centers\n", iteration,
+      VL_PRINTF("kmeans: %s iter %d: restarted %d centers\n", name, iteration,
                 numRestartedCenters) ;
     }
-  } /* next Lloyd iteration */
+  } /* next iteration */
 
+  VL_XCAT(_vl_kmeans_task_done_, SFX)(&task) ;
   if (permutations) { vl_free(permutations) ; }
   if (numSeenSoFar) { vl_free(numSeenSoFar) ; }
+  if (members) { vl_free(members) ; }
+  if (membersBegin) { vl_free(membersBegin) ; }
   vl_free(distances) ;
   vl_free(assignments) ;
   vl_free(clusterMasses) ;
@@ -693,15 +1044,269 @@ VL_XCAT(_vl_kmeans_update_center_distances_, SFX)
                                        self->numCenters *
                                        self->numCenters) ;
   }
-  VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)(self->centerDistances,
-                                                        self->dimension,
-                                                        self->centers, self->numCenters,
-                                                        NULL, 0,
-                                                        distFn) ;
+  VL_XCAT(vl_eval_vector_comparison_on_all_pairs_exact_, SFX)(self->centerDistances,
+                                                              self->dimension,
+                                                              self->centers, self->numCenters,
+                                                              NULL, 0,
+                                                              distFn) ;
   return self->numCenters * (self->numCenters - 1) / 2 ;
 }
 
 
+/* Assign the points to the initial centers and initialize the bounds. */
+
+static void
+VL_XCAT(_vl_kmeans_elkan_init_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  TYPE const * centerDistances = self->centerDistances ;
+  vl_size numDistanceComputations = 0 ;
+  vl_uindex x ;
+  vl_uint32 c ;
+
+  for (x = begin ; x < end ; ++x) {
+    TYPE distance ;
+
+    /* do the first center */
+    task->assignments[x] = 0 ;
+    distance = task->distFn(self->dimension,
+                            task->data + x * self->dimension,
+                            (TYPE*)self->centers + 0) ;
+    task->pointToClosestCenterUB[x] = distance ;
+    task->pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
+    task->pointToCenterLB[0 + x * self->numCenters] = distance ;
+    numDistanceComputations += 1 ;
+
+    /* do other centers */
+    for (c = 1 ; c < self->numCenters ; ++c) {
+
+      /* Can skip if the center assigned so far is twice as close
+         as its distance to the center under consideration */
+
+      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+          task->pointToClosestCenterUB[x] <=
+          centerDistances[c + task->assignments[x] * self->numCenters]) {
+        continue ;
+      }
+
+      distance = task->distFn(self->dimension,
+                              task->data + x * self->dimension,
+                              (TYPE*)self->centers + c * self->dimension) ;
+      task->pointToCenterLB[c + x * self->numCenters] = distance ;
+      numDistanceComputations += 1 ;
+      if (distance < task->pointToClosestCenterUB[x]) {
+        task->pointToClosestCenterUB[x] = distance ;
+        task->assignments[x] = c ;
+      }
+    }
+  }
+  task->numDistanceComputations[slot] += numDistanceComputations ;
+}
+
+/* Compute the distance from the old to the new centers
+   (task->centers) and, once the new centers are current,
+   the distance from each center to the closest other center. */
+
+static void
+VL_XCAT(_vl_kmeans_elkan_center_shift_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  vl_uindex c ;
+  for (c = begin ; c < end ; ++c) {
+    task->centerToNewCenterDistances[c] =
+    task->distFn(self->dimension,
+                 task->centers + c * self->dimension,
+                 (TYPE*)self->centers + c * self->dimension) ;
+  }
+}
+
+static void
+VL_XCAT(_vl_kmeans_elkan_next_center_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  TYPE const * centerDistances = self->centerDistances ;
+  vl_uindex c, j ;
+  for (c = begin ; c < end ; ++c) {
+    TYPE distance = (TYPE) VL_INFINITY_D ;
+    for (j = 0 ; j < self->numCenters ; ++j) {
+      if (j == c) continue ;
+      distance = VL_MIN(distance, centerDistances[j + c * self->numCenters]) ;
+    }
+    task->nextCenterDistances[c] = distance ;
+  }
+}
+
+/* Update the upper and lower bounds on the point-to-center
+   distances based on the center variation. */
+
+static void
+VL_XCAT(_vl_kmeans_elkan_update_bounds_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  vl_uindex x, c ;
+
+  for (x = begin ; x < end ; ++x) {
+    TYPE a = task->pointToClosestCenterUB[x] ;
+    TYPE b = task->centerToNewCenterDistances[task->assignments[x]] ;
+    TYPE * pointToCenterLB = task->pointToCenterLB + x * self->numCenters ;
+    if (self->distance == VlDistanceL1) {
+      task->pointToClosestCenterUB[x] = a + b ;
+    } else {
+#if (FLT == VL_TYPE_FLOAT)
+      TYPE sqrtab =  sqrtf (a * b) ;
+#else
+      TYPE sqrtab =  sqrt (a * b) ;
+#endif
+      task->pointToClosestCenterUB[x] = a + b + 2.0 * sqrtab ;
+    }
+    task->pointToClosestCenterUBIsStrict[x] = VL_FALSE ;
+
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      TYPE a = pointToCenterLB[c] ;
+      TYPE b = task->centerToNewCenterDistances[c] ;
+      if (a < b) {
+        pointToCenterLB[c] = 0 ;
+      } else {
+        if (self->distance == VlDistanceL1) {
+          pointToCenterLB[c] = a - b ;
+        } else {
+#if (FLT == VL_TYPE_FLOAT)
+          TYPE sqrtab =  sqrtf (a * b) ;
+#else
+          TYPE sqrtab =  sqrt (a * b) ;
+#endif
+          pointToCenterLB[c] = a + b - 2.0 * sqrtab ;
+        }
+      }
+    }
+  }
+}
+
+/* Scan the data and do the reassignments. Use the bounds to skip
+   as many point-to-center distance calculations as possible. */
+
+static void
+VL_XCAT(_vl_kmeans_elkan_reassign_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  TYPE const * centerDistances = self->centerDistances ;
+  TYPE * pointToClosestCenterUB = task->pointToClosestCenterUB ;
+  vl_bool * pointToClosestCenterUBIsStrict = task->pointToClosestCenterUBIsStrict ;
+  vl_uint32 * assignments = task->assignments ;
+  vl_size numDistanceComputationsToRefreshUB = 0 ;
+  vl_size numDistanceComputationsToRefreshLB = 0 ;
+  vl_size numReassignments = 0 ;
+  vl_uindex x ;
+  vl_uint32 c ;
+
+  for (x = begin ; x < end ; ++x) {
+    TYPE * pointToCenterLB = task->pointToCenterLB + x * self->numCenters ;
+    TYPE const * xpt = task->data + x * self->dimension ;
+
+    /*
+     A point x sticks with its current center assignmets[x]
+     the UB to d(x, c[assigmnets[x]]) is not larger than half
+     the distance of c[assigments[x]] to any other center c.
+     */
+    if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+        pointToClosestCenterUB[x] <= task->nextCenterDistances[assignments[x]]) {
+      continue ;
+    }
+
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      vl_uint32 cx = assignments[x] ;
+      TYPE distance ;
+
+      /* The point is not reassigned to a given center c
+       if either:
+
+       0 - c is already the assigned center
+       1 - The UB of d(x, c[assignments[x]]) is smaller than half
+           the distance of c[assigments[x]] to c, OR
+       2 - The UB of d(x, c[assignmets[x]]) is smaller than the
+           LB of the distance of x to c.
+       */
+      if (cx == c) {
+        continue ;
+      }
+      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+          pointToClosestCenterUB[x] <= centerDistances[c + cx * self->numCenters]) {
+        continue ;
+      }
+      if (pointToClosestCenterUB[x] <= pointToCenterLB[c]) {
+        continue ;
+      }
+
+      /* If the UB is loose, try recomputing it and test again */
+      if (! pointToClosestCenterUBIsStrict[x]) {
+        distance = task->distFn(self->dimension, xpt,
+                                (TYPE*)self->centers + self->dimension * cx) ;
+        pointToClosestCenterUB[x] = distance ;
+        pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
+        pointToCenterLB[cx] = distance ;
+        numDistanceComputationsToRefreshUB += 1 ;
+
+        if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
+            pointToClosestCenterUB[x] <= centerDistances[c + cx * self->numCenters]) {
+          continue ;
+        }
+        if (pointToClosestCenterUB[x] <= pointToCenterLB[c]) {
+          continue ;
+        }
+      }
+
+      /*
+       Now the UB is strict (equal to d(x, assignments[x])), but
+       we still could not exclude that x should be reassigned to
+       c. We therefore compute the distance, update the LB,
+       and check if a reassigmnet must be made
+       */
+      distance = task->distFn(self->dimension, xpt,
+                              (TYPE*)self->centers + c *  self->dimension) ;
+      numDistanceComputationsToRefreshLB += 1 ;
+      pointToCenterLB[c] = distance ;
+
+      if (distance < pointToClosestCenterUB[x]) {
+        assignments[x] = c ;
+        pointToClosestCenterUB[x] = distance ;
+        numReassignments += 1 ;
+        /* the UB strict flag is already set here */
+      }
+
+    } /* assign center */
+  } /* next data point */
+
+  task->numDistanceComputationsToRefreshUB[slot] += numDistanceComputationsToRefreshUB ;
+  task->numDistanceComputations[slot] += numDistanceComputationsToRefreshLB ;
+  task->numReassignments[slot] += numReassignments ;
+}
+
+/* Compute the distance of each point to its assigned center. */
+
+static void
+VL_XCAT(_vl_kmeans_elkan_finalize_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot VL_UNUSED)
+{
+  VL_XCAT(_VlKMeansTask_, SFX) const * task = data ;
+  VlKMeans const * self = task->self ;
+  vl_uindex x ;
+  for (x = begin ; x < end ; ++x) {
+    task->distances[x] =
+    task->distFn(self->dimension,
+                 task->data + self->dimension * x,
+                 (TYPE*)self->centers + self->dimension * task->assignments[x]) ;
+  }
+}
 
 static double
 VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
@@ -709,19 +1314,12 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
  TYPE const * data,
  vl_size numData)
 {
-  vl_size d, iteration, x ;
-  vl_uint32 c, j ;
+  vl_size iteration, x ;
   vl_bool allDone ;
+  VL_XCAT(_VlKMeansTask_, SFX) task ;
   TYPE * distances = vl_malloc (sizeof(TYPE) * numData) ;
   vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * numData) ;
-  vl_size * clusterMasses = vl_malloc (sizeof(vl_size) * numData) ;
-  VlRand * rand = vl_get_rand () ;
-
-#if (FLT == VL_TYPE_FLOAT)
-    VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
-#else
-    VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
-#endif
+  vl_size * clusterMasses = vl_malloc (sizeof(vl_size) * self->numCenters) ;
 
   TYPE * nextCenterDistances = vl_malloc (sizeof(TYPE) * self->numCenters) ;
   TYPE * pointToClosestCenterUB = vl_malloc (sizeof(TYPE) * numData) ;
@@ -732,6 +1330,8 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
   vl_uint32 * permutations = NULL ;
   vl_size * numSeenSoFar = NULL ;
+  vl_uindex * members = NULL ;
+  vl_uindex * membersBegin = NULL ;
 
   double energy ;
 
@@ -743,10 +1343,36 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
   vl_size totDistanceComputationsToFinalize = 0 ;
   vl_size totNumRestartedCenters = 0 ;
 
+/* #define SANITY*/
+#ifdef SANITY
+#if (FLT == VL_TYPE_FLOAT)
+  VlFloatVectorComparisonFunction distFn = vl_get_vector_comparison_function_f(self->distance) ;
+#else
+  VlDoubleVectorComparisonFunction distFn = vl_get_vector_comparison_function_d(self->distance) ;
+#endif
+#endif
+
+  VL_XCAT(_vl_kmeans_task_init_, SFX)(&task, self, data, numData) ;
+  task.assignments = assignments ;
+  task.distances = distances ;
+  task.clusterMasses = clusterMasses ;
+  task.nextCenterDistances = nextCenterDistances ;
+  task.pointToClosestCenterUB = pointToClosestCenterUB ;
+  task.pointToClosestCenterUBIsStrict = pointToClosestCenterUBIsStrict ;
+  task.pointToCenterLB = pointToCenterLB ;
+  task.centerToNewCenterDistances = centerToNewCenterDistances ;
+
   if (self->distance == VlDistanceL1) {
     permutations = vl_malloc(sizeof(vl_uint32) * numData * self->dimension) ;
-    numSeenSoFar = vl_malloc(sizeof(vl_size) * self->numCenters) ;
-    VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)(self, permutations, data, numData) ;
+    numSeenSoFar = vl_malloc(sizeof(vl_size) * self->numCenters * task.numSlots) ;
+    task.permutations = permutations ;
+    task.numSeenSoFar = numSeenSoFar ;
+    VL_XCAT(_vl_kmeans_sort_data_helper_, SFX)(&task) ;
+  } else {
+    members = vl_malloc(sizeof(vl_uindex) * numData) ;
+    membersBegin = vl_malloc(sizeof(vl_uindex) * self->numCenters) ;
+    task.members = members ;
+    task.membersBegin = membersBegin ;
   }
 
   /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -764,43 +1390,9 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
   /* assigmen points to the initial centers and initialize bounds */
   memset(pointToCenterLB, 0, sizeof(TYPE) * self->numCenters *  numData) ;
-  for (x = 0 ; x < numData ; ++x) {
-    TYPE distance ;
-
-    /* do the first center */
-    assignments[x] = 0 ;
-    distance = distFn(self->dimension,
-                      data + x * self->dimension,
-                      (TYPE*)self->centers + 0) ;
-    pointToClosestCenterUB[x] = distance ;
-    pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
-    pointToCenterLB[0 + x * self->numCenters] = distance ;
-    totDistanceComputationsToInit += 1 ;
-
-    /* do other centers */
-    for (c = 1 ; c < self->numCenters ; ++c) {
-
-      /* Can skip if the center assigned so far is twice as close
-         as its distance to the center under consideration */
-
-      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-          pointToClosestCenterUB[x] <=
-          ((TYPE*)self->centerDistances)
-          [c + assignments[x] * self->numCenters]) {
-        continue ;
-      }
-
-      distance = distFn(self->dimension,
-                        data + x * self->dimension,
-                        (TYPE*)self->centers + c * self->dimension) ;
-      pointToCenterLB[c + x * self->numCenters] = distance ;
-      totDistanceComputationsToInit += 1 ;
-      if (distance < pointToClosestCenterUB[x]) {
-        pointToClosestCenterUB[x] = distance ;
-        assignments[x] = c ;
-      }
-    }
-  }
+  vl_parallel_for (numData, 0, VL_XCAT(_vl_kmeans_elkan_init_task_, SFX), &task) ;
+  totDistanceComputationsToInit +=
+  VL_XCAT(_vl_kmeans_task_collect_, SFX)(&task, task.numDistanceComputations) ;
 
   /* compute UB on energy */
   energy = 0 ;
@@ -813,7 +1405,6 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
               energy, totDistanceComputationsToInit) ;
   }
 
-/* #define SANITY*/
 #ifdef SANITY
   {
     int xx ; int cc ;
@@ -853,71 +1444,13 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
     /*                         Compute new centers                  */
     /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-    memset(clusterMasses, 0, sizeof(vl_size) * numData) ;
-    for (x = 0 ; x < numData ; ++x) {
-      clusterMasses[assignments[x]] ++ ;
-    }
-
-    switch (self->distance) {
-      case VlDistanceL2:
-        memset(newCenters, 0, sizeof(TYPE) * self->dimension * self->numCenters) ;
-        for (x = 0 ; x < numData ; ++x) {
-          TYPE * cpt = newCenters + assignments[x] * self->dimension ;
-          TYPE const * xpt = data + x * self->dimension ;
-          for (d = 0 ; d < self->dimension ; ++d) { cpt[d] += xpt[d] ; }
-        }
-        for (c = 0 ; c < self->numCenters ; ++c) {
-          TYPE * cpt = newCenters + c * self->dimension ;
-          if (clusterMasses[c] > 0) {
-            TYPE mass = clusterMasses[c] ;
-            for (d = 0 ; d < self->dimension ; ++d) { cpt[d] /= mass ; }
-          } else {
-            /* restart the center */
-            vl_uindex x = vl_rand_uindex(rand, numData) ;
-			numRestartedCenters ++ ;
-            for (d = 0 ; d < self->dimension ; ++d) {
-              cpt[d] = data[x * self->dimension + d] ;
-            }
-          }
-        }
-        break ;
-      case VlDistanceL1:
-        for (d = 0 ; d < self->dimension ; ++d) {
-          vl_uint32 * perm = permutations + d * numData ;
-          memset(numSeenSoFar, 0, sizeof(vl_size) * self->numCenters) ;
-          for (x = 0; x < numData ; ++x) {
-            c = assignments[perm[x]] ;
-            if (2 * numSeenSoFar[c] < clusterMasses[c]) {
-              newCenters [d + c * self->dimension] =
-              data [d + perm[x] * self->dimension] ;
-            }
-            numSeenSoFar[c] ++ ;
-          }
-        }
-        /* restart the centers as required  */
-        for (c = 0 ; c < self->numCenters ; ++c) {
-          if (clusterMasses[c] == 0) {
-            TYPE * cpt = newCenters + c * self->dimension ;
-            vl_uindex x = vl_rand_uindex(rand, numData) ;
-			numRestartedCenters ++ ;
-            for (d = 0 ; d < self->dimension ; ++d) {
-              cpt[d] = data[x * self->dimension + d] ;
-            }
-          }
-        }
-        break ;
-      default:
-        abort();
-    } /* done compute centers */
+    numRestartedCenters =
+    VL_XCAT(_vl_kmeans_update_centers_, SFX)(&task, newCenters) ;
 
     /* compute the distance from the old centers to the new centers */
-    for (c = 0 ; c < self->numCenters ; ++c) {
-      TYPE distance = distFn(self->dimension,
-                             newCenters + c * self->dimension,
-                             (TYPE*)self->centers + c * self->dimension) ;
-      centerToNewCenterDistances[c] = distance ;
-      numDistanceComputationsToNewCenters += 1 ;
-    }
+    vl_parallel_for (self->numCenters, 0,
+                     VL_XCAT(_vl_kmeans_elkan_center_shift_task_, SFX), &task) ;
+    numDistanceComputationsToNewCenters += self->numCenters ;
 
     /* make the new centers current */
     {
@@ -936,60 +1469,16 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
     numDistanceComputationsToRefreshCenterDistances
     += VL_XCAT(_vl_kmeans_update_center_distances_, SFX)(self) ;
 
-    for (c = 0 ; c < self->numCenters ; ++c) {
-      nextCenterDistances[c] = (TYPE) VL_INFINITY_D ;
-      for (j = 0 ; j < self->numCenters ; ++j) {
-        if (j == c) continue ;
-        nextCenterDistances[c] = VL_MIN(nextCenterDistances[c],
-                                        ((TYPE*)self->centerDistances)
-                                        [j + c * self->numCenters]) ;
-      }
-    }
+    vl_parallel_for (self->numCenters, 0,
+                     VL_XCAT(_vl_kmeans_elkan_next_center_task_, SFX), &task) ;
 
     /*
      Update upper bounds on point-to-closest-center distances
+     and lower bounds on point-to-center distances
      based on the center variation.
      */
-    for (x = 0 ; x < numData ; ++x) {
-      TYPE a = pointToClosestCenterUB[x] ;
-      TYPE b = centerToNewCenterDistances[assignments[x]] ;
-      if (self->distance == VlDistanceL1) {
-        pointToClosestCenterUB[x] = a + b ;
-      } else {
-#if (FLT == VL_TYPE_FLOAT)
-        TYPE sqrtab =  sqrtf (a * b) ;
-#else
-        TYPE sqrtab =  sqrt (a * b) ;
-#endif
-        pointToClosestCenterUB[x] = a + b + 2.0 * sqrtab ;
-      }
-      pointToClosestCenterUBIsStrict[x] = VL_FALSE ;
-    }
-
-    /*
-     Update lower bounds on point-to-center distances
-     based on the center variation.
-     */
-    for (x = 0 ; x < numData ; ++x) {
-      for (c = 0 ; c < self->numCenters ; ++c) {
-        TYPE a = pointToCenterLB[c + x * self->numCenters] ;
-        TYPE b = centerToNewCenterDistances[c] ;
-        if (a < b) {
-          pointToCenterLB[c + x * self->numCenters] = 0 ;
-        } else {
-          if (self->distance == VlDistanceL1) {
-             pointToCenterLB[c + x * self->numCenters]  = a - b ;
-          } else {
-#if (FLT == VL_TYPE_FLOAT)
-            TYPE sqrtab =  sqrtf (a * b) ;
-#else
-            TYPE sqrtab =  sqrt (a * b) ;
-#endif
-             pointToCenterLB[c + x * self->numCenters]  = a + b - 2.0 * sqrtab ;
-          }
-        }
-      }
-    }
+    vl_parallel_for (numData, 0,
+                     VL_XCAT(_vl_kmeans_elkan_update_bounds_task_, SFX), &task) ;
 
    #ifdef SANITY
     {
@@ -1015,88 +1504,17 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 #endif
 
     /*
-     Scan the data and to the reassignments. Use the bounds to
-     skip as many point-to-center distance calculations as possible.
+     Scan the data and to the reassignments.
      */
-    for (allDone = VL_TRUE, x = 0 ; x < numData ; ++x) {
-      /*
-       A point x sticks with its current center assignmets[x]
-       the UB to d(x, c[assigmnets[x]]) is not larger than half
-       the distance of c[assigments[x]] to any other center c.
-       */
-      if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-          pointToClosestCenterUB[x] <= nextCenterDistances[assignments[x]]) {
-        continue ;
-      }
+    vl_parallel_for (numData, 0,
+                     VL_XCAT(_vl_kmeans_elkan_reassign_task_, SFX), &task) ;
 
-      for (c = 0 ; c < self->numCenters ; ++c) {
-        vl_uint32 cx = assignments[x] ;
-        TYPE distance ;
-
-        /* The point is not reassigned to a given center c
-         if either:
-
-         0 - c is already the assigned center
-         1 - The UB of d(x, c[assignments[x]]) is smaller than half
-             the distance of c[assigments[x]] to c, OR
-         2 - The UB of d(x, c[assignmets[x]]) is smaller than the
-             LB of the distance of x to c.
-         */
-        if (cx == c) {
-          continue ;
-        }
-        if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-            pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
-            [c + cx * self->numCenters]) {
-          continue ;
-        }
-        if (pointToClosestCenterUB[x] <= pointToCenterLB
-            [c + x * self->numCenters]) {
-          continue ;
-        }
-
-        /* If the UB is loose, try recomputing it and test again */
-        if (! pointToClosestCenterUBIsStrict[x]) {
-          distance = distFn(self->dimension,
-                            data + self->dimension * x,
-                            (TYPE*)self->centers + self->dimension * cx) ;
-          pointToClosestCenterUB[x] = distance ;
-          pointToClosestCenterUBIsStrict[x] = VL_TRUE ;
-          pointToCenterLB[cx + x * self->numCenters] = distance ;
-          numDistanceComputationsToRefreshUB += 1 ;
-
-          if (((self->distance == VlDistanceL1) ? 2.0 : 4.0) *
-              pointToClosestCenterUB[x] <= ((TYPE*)self->centerDistances)
-              [c + cx * self->numCenters]) {
-            continue ;
-          }
-          if (pointToClosestCenterUB[x] <= pointToCenterLB
-              [c + x * self->numCenters]) {
-            continue ;
-          }
-        }
-
-        /*
-         Now the UB is strict (equal to d(x, assignments[x])), but
-         we still could not exclude that x should be reassigned to
-         c. We therefore compute the distance, update the LB,
-         and check if a reassigmnet must be made
-         */
-        distance = distFn(self->dimension,
-                          data + x * self->dimension,
-                          (TYPE*)self->centers + c *  self->dimension) ;
-        numDistanceComputationsToRefreshLB += 1 ;
-        pointToCenterLB[c + x * self->numCenters] = distance ;
-
-        if (distance < pointToClosestCenterUB[x]) {
-          assignments[x] = c ;
-          pointToClosestCenterUB[x] = distance ;
-          allDone = VL_FALSE ;
-          /* the UB strict flag is already set here */
-        }
-
-      } /* assign center */
-    } /* next data point */
+    numDistanceComputationsToRefreshUB =
+    VL_XCAT(_vl_kmeans_task_collect_, SFX)(&task, task.numDistanceComputationsToRefreshUB) ;
+    numDistanceComputationsToRefreshLB =
+    VL_XCAT(_vl_kmeans_task_collect_, SFX)(&task, task.numDistanceComputations) ;
+    allDone =
+    (VL_XCAT(_vl_kmeans_task_collect_, SFX)(&task, task.numReassignments) == 0) ;
 
     totDistanceComputationsToRefreshUB
     += numDistanceComputationsToRefreshUB ;
@@ -1193,13 +1611,11 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
 
 
   /* compute true energy */
+  vl_parallel_for (numData, 0, VL_XCAT(_vl_kmeans_elkan_finalize_task_, SFX), &task) ;
+  totDistanceComputationsToFinalize += numData ;
   energy = 0 ;
   for (x = 0 ; x < numData ; ++ x) {
-    vl_uindex cx = assignments [x] ;
-    energy += distFn(self->dimension,
-                     data + self->dimension * x,
-                     (TYPE*)self->centers + self->dimension * cx) ;
-    totDistanceComputationsToFinalize += 1 ;
+    energy += distances[x] ;
   }
 
   {
@@ -1244,8 +1660,11 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
     }
   }
 
+  VL_XCAT(_vl_kmeans_task_done_, SFX)(&task) ;
   if (permutations) { vl_free(permutations) ; }
   if (numSeenSoFar) { vl_free(numSeenSoFar) ; }
+  if (members) { vl_free(members) ; }
+  if (membersBegin) { vl_free(membersBegin) ; }
 
   vl_free(distances) ;
   vl_free(assignments) ;
@@ -1261,6 +1680,87 @@ VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)
   return energy ;
 }
 
+/* ---------------------------------------------------------------- */
+/*                                              Mini-batch update */
+/* ---------------------------------------------------------------- */
+
+static double
+VL_XCAT(_vl_kmeans_update_minibatch_, SFX)
+(VlKMeans * self,
+ TYPE const * data,
+ vl_size numData)
+{
+  vl_uindex x, c, d ;
+  double energy = 0 ;
+  TYPE * distances = vl_malloc (sizeof(TYPE) * numData) ;
+  vl_uint32 * assignments = vl_malloc (sizeof(vl_uint32) * numData) ;
+
+  if (! self->centerMasses) {
+    self->centerMasses = vl_calloc (self->numCenters, sizeof(double)) ;
+  }
+
+  /* assign the batch to the current centers */
+  if (self->algorithm == VlKMeansANN) {
+    VL_XCAT(_vl_kmeans_quantize_ann_, SFX)(self, assignments, distances, data, numData,
+                                           VL_FALSE) ;
+  } else {
+    VL_XCAT(_vl_kmeans_quantize_, SFX)(self, assignments, distances, data, numData) ;
+  }
+  for (x = 0 ; x < numData ; ++x) energy += distances[x] ;
+
+  /* move each center towards its points with learning rate equal to
+     the inverse of the number of points it has been assigned so far,
+     so that each center is the running mean of its points */
+  for (x = 0 ; x < numData ; ++x) {
+    TYPE * cpt = (TYPE*)self->centers + assignments[x] * self->dimension ;
+    TYPE const * xpt = data + x * self->dimension ;
+    TYPE rate = (TYPE) (1.0 / (self->centerMasses[assignments[x]] += 1)) ;
+    for (d = 0 ; d < self->dimension ; ++d) {
+      cpt[d] += rate * (xpt[d] - cpt[d]) ;
+    }
+  }
+
+  /* reassign the centers that received too few points */
+  if (self->minibatchReassignmentRatio > 0) {
+    VlRand * rand = vl_get_rand () ;
+    double maxMass = 0 ;
+    double minMass = VL_INFINITY_D ;
+    double threshold ;
+    vl_size numReassignedCenters = 0 ;
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      maxMass = VL_MAX(maxMass, self->centerMasses[c]) ;
+    }
+    threshold = self->minibatchReassignmentRatio * maxMass ;
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      if (self->centerMasses[c] >= threshold) {
+        minMass = VL_MIN(minMass, self->centerMasses[c]) ;
+      }
+    }
+    /* no center is kept (ratio above one): there is no mass to give
+       to the reassigned centers, so keep them all */
+    if (minMass == VL_INFINITY_D) threshold = 0 ;
+    for (c = 0 ; c < self->numCenters ; ++c) {
+      if (self->centerMasses[c] < threshold) {
+        x = vl_rand_uindex (rand, numData) ;
+        memcpy ((TYPE*)self->centers + c * self->dimension,
+                data + x * self->dimension,
+                sizeof(TYPE) * self->dimension) ;
+        /* give the center the same weight as the lightest one kept */
+        self->centerMasses[c] = minMass ;
+        numReassignedCenters ++ ;
+      }
+    }
+    if (self->verbosity && numReassignedCenters) {
+      VL_PRINTF("kmeans: mini-batch: reassigned %d centers\n",
+                numReassignedCenters) ;
+    }
+  }
+
+  vl_free (distances) ;
+  vl_free (assignments) ;
+  return energy ;
+}
+
 /* ---------------------------------------------------------------- */
 static double
 VL_XCAT(_vl_kmeans_refine_centers_, SFX)
@@ -1271,12 +1771,18 @@ VL_XCAT(_vl_kmeans_refine_centers_, SFX)
   switch (self->algorithm) {
     case VlKMeansLloyd:
       return
-      VL_XCAT(_vl_kmeans_refine_centers_lloyd_, SFX)(self, data, numData) ;
+      VL_XCAT(_vl_kmeans_refine_centers_iteratively_, SFX)
+      (self, data, numData, "Lloyd", VL_XCAT(_vl_kmeans_assign_lloyd_, SFX)) ;
       break ;
     case VlKMeansElkan:
       return
       VL_XCAT(_vl_kmeans_refine_centers_elkan_, SFX)(self, data, numData) ;
       break ;
+    case VlKMeansANN:
+      return
+      VL_XCAT(_vl_kmeans_refine_centers_iteratively_, SFX)
+      (self, data, numData, "ANN", VL_XCAT(_vl_kmeans_assign_ann_, SFX)) ;
+      break ;
     default:
       abort() ;
   }
@@ -1562,6 +2068,110 @@ vl_kmeans_cluster (VlKMeans * self,
   return bestEnergy ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Update the centers with a mini-batch of data
+ ** @param self KMeans object.
+ ** @param batch data points.
+ ** @param numData number of data points.
+ ** @return energy of the batch before the update.
+ **
+ ** The function assigns the data points in @a batch to the current
+ ** centers and moves each center towards the points assigned to it
+ ** (see @ref kmeans-usage-minibatch). The centers must have been
+ ** initialized by one of the seeding functions or by
+ ** ::vl_kmeans_set_centers. The assignment uses the KD-forest if
+ ** the algorithm is ::VlKMeansANN, and exact search otherwise.
+ **
+ ** The energy returned is computed with respect to the centers
+ ** before the update and is therefore an estimate of the quality
+ ** of the current solution on new data.
+ **/
+
+VL_EXPORT double
+vl_kmeans_update_minibatch (VlKMeans * self,
+                            void const * batch,
+                            vl_size numData)
+{
+  assert (self->centers) ;
+
+  switch (self->dataType) {
+    case VL_TYPE_FLOAT :
+      return
+      _vl_kmeans_update_minibatch_f
+      (self, (float const *)batch, numData) ;
+    case VL_TYPE_DOUBLE :
+      return
+      _vl_kmeans_update_minibatch_d
+      (self, (double const *)batch, numData) ;
+    default:
+      abort() ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Cluster a stream of data by mini-batch k-means
+ ** @param self KMeans object.
+ ** @param source data source.
+ ** @param userData data source user data.
+ ** @param dimension data dimension.
+ ** @param numCenters number of clusters.
+ ** @param batchSize number of data points in a batch.
+ ** @return energy of the last batch.
+ **
+ ** The function reads the data in batches of @a batchSize points by
+ ** calling @a source until this returns zero. The centers are
+ ** initialized from the first batch by using the initialization
+ ** algorithm set by ::vl_kmeans_set_initialization; therefore
+ ** the first batch must contain at least @a numCenters points. Then
+ ** each batch, including the first one, is processed by
+ ** ::vl_kmeans_update_minibatch.
+ **
+ ** The data source can read the data from disk, so that the data does
+ ** not need to fit in memory. Several passes over the data can be made
+ ** by letting @a source restart from the beginning.
+ **/
+
+VL_EXPORT double
+vl_kmeans_cluster_minibatch (VlKMeans * self,
+                             VlKMeansDataSource source,
+                             void * userData,
+                             vl_size dimension,
+                             vl_size numCenters,
+                             vl_size batchSize)
+{
+  vl_uindex iteration ;
+  double energy = VL_NAN_D ;
+  void * batch = vl_malloc(vl_get_type_size(self->dataType) * dimension * batchSize) ;
+  vl_size numData = source (userData, batch, batchSize) ;
+
+  assert (numData >= numCenters) ;
+
+  switch (self->initialization) {
+    case VlKMeansRandomSelection :
+      vl_kmeans_seed_centers_with_rand_data (self, batch, dimension, numData,
+                                             numCenters) ;
+      break ;
+    case VlKMeansPlusPlus :
+      vl_kmeans_seed_centers_plus_plus (self, batch, dimension, numData,
+                                        numCenters) ;
+      break ;
+    default:
+      abort() ;
+  }
+
+  for (iteration = 0 ; numData > 0 ; ++ iteration) {
+    energy = vl_kmeans_update_minibatch (self, batch, numData) ;
+    if (self->verbosity) {
+      VL_PRINTF("kmeans: mini-batch %d: %d points, energy per point = %g\n",
+                iteration, numData, energy / numData) ;
+    }
+    numData = source (userData, batch, batchSize) ;
+  }
+
+  vl_free (batch) ;
+  return energy ;
+}
+
 /* VL_KMEANS_INSTANTIATING */
 #endif
 
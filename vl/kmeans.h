@@ -36,6 +36,20 @@ typedef enum _VlKMeansInitialization {
 } VlKMeansInitialization ;
 
 
+/** @brief Mini-batch data source
+ ** @param userData user data.
+ ** @param batch buffer to fill with data points.
+ ** @param maxNumData maximum number of data points to read.
+ ** @return number of data points read (0 to end).
+ **
+ ** The function fills the buffer @a batch with up to @a maxNumData
+ ** data points of the dimension and type of the KMeans object.
+ **/
+
+typedef vl_size (*VlKMeansDataSource) (void * userData,
+                                       void * batch,
+                                       vl_size maxNumData) ;
+
 /** ------------------------------------------------------------------
  ** @brief K-means quantizer
  **/
@@ -51,10 +65,14 @@ typedef struct _VlKMeans
   VlVectorComparisonType distance ;    /**< Distance */
   vl_size maxNumIterations ;           /**< Maximum number of refinement iterations */
   vl_size numRepetitions   ;           /**< Number of clustering repetitions */
+  vl_size numTrees ;                   /**< Number of trees for ANN */
+  vl_size maxNumComparisons ;          /**< Maximum number of comparisons for ANN */
+  double minibatchReassignmentRatio ;  /**< Mini-batch center reassignment ratio */
   int verbosity ;                      /**< verbosity level */
 
   void * centers ;                     /**< centers */
   void * centerDistances ;             /**< centers inter-distances */
+  double * centerMasses ;              /**< number of points seen by each center (mini-batch) */
 
   double energy ;                      /**< current solution energy */
   VlFloatVectorComparisonFunction floatVectorComparisonFn ;
@@ -115,6 +133,21 @@ VL_EXPORT double vl_kmeans_refine_centers (VlKMeans * self,
 
 /** @} */
 
+/** @name Mini-batch data processing
+ ** @{
+ **/
+VL_EXPORT double vl_kmeans_update_minibatch (VlKMeans * self,
+                                             void const * batch,
+                                             vl_size numData) ;
+
+VL_EXPORT double vl_kmeans_cluster_minibatch (VlKMeans * self,
+                                              VlKMeansDataSource source,
+                                              void * userData,
+                                              vl_size dimension,
+                                              vl_size numCenters,
+                                              vl_size batchSize) ;
+/** @} */
+
 /** @name Retrieve data and parameters
  ** @{
  **/
@@ -130,6 +163,9 @@ VL_INLINE vl_size vl_kmeans_get_num_centers (VlKMeans const * self) ;
 
 VL_INLINE int vl_kmeans_get_verbosity (VlKMeans const * self) ;
 VL_INLINE vl_size vl_kmeans_get_max_num_iterations (VlKMeans const * self) ;
+VL_INLINE vl_size vl_kmeans_get_num_trees (VlKMeans const * self) ;
+VL_INLINE vl_size vl_kmeans_get_max_num_comparisons (VlKMeans const * self) ;
+VL_INLINE double vl_kmeans_get_minibatch_reassignment_ratio (VlKMeans const * self) ;
 VL_INLINE double vl_kmeans_get_energy (VlKMeans const * self) ;
 VL_INLINE void const * vl_kmeans_get_centers (VlKMeans const * self) ;
 /** @} */
@@ -142,6 +178,9 @@ VL_INLINE void vl_kmeans_set_initialization (VlKMeans * self, VlKMeansInitializa
 VL_INLINE void vl_kmeans_set_num_repetitions (VlKMeans * self, vl_size numRepetitions) ;
 VL_INLINE void vl_kmeans_set_max_num_iterations (VlKMeans * self, vl_size maxNumIterations) ;
 VL_INLINE void vl_kmeans_set_verbosity (VlKMeans * self, int verbosity) ;
+VL_INLINE void vl_kmeans_set_num_trees (VlKMeans * self, vl_size numTrees) ;
+VL_INLINE void vl_kmeans_set_max_num_comparisons (VlKMeans * self, vl_size maxNumComparisons) ;
+VL_INLINE void vl_kmeans_set_minibatch_reassignment_ratio (VlKMeans * self, double ratio) ;
 /** @} */
 
 /** ------------------------------------------------------------------
@@ -258,6 +297,91 @@ vl_kmeans_set_max_num_iterations (VlKMeans * self, vl_size maxNumIterations)
   self->maxNumIterations = maxNumIterations ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Get the number of trees for the ANN algorithm
+ ** @param self KMeans object instance.
+ ** @return number of trees.
+ **/
+
+VL_INLINE vl_size
+vl_kmeans_get_num_trees (VlKMeans const * self)
+{
+  return self->numTrees ;
+}
+
+/** @brief Set the number of trees for the ANN algorithm
+ ** @param self KMeans object instance.
+ ** @param numTrees number of trees.
+ **
+ ** This is the number of trees of the KD-forest used by
+ ** ::VlKMeansANN to index the centers. It cannot be smaller than 1.
+ **/
+
+VL_INLINE void
+vl_kmeans_set_num_trees (VlKMeans * self, vl_size numTrees)
+{
+  assert (numTrees >= 1) ;
+  self->numTrees = numTrees ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Get the maximum number of comparisons for the ANN algorithm
+ ** @param self KMeans object instance.
+ ** @return maximum number of comparisons.
+ **/
+
+VL_INLINE vl_size
+vl_kmeans_get_max_num_comparisons (VlKMeans const * self)
+{
+  return self->maxNumComparisons ;
+}
+
+/** @brief Set the maximum number of comparisons for the ANN algorithm
+ ** @param self KMeans object instance.
+ ** @param maxNumComparisons maximum number of comparisons.
+ **
+ ** This is the maximum number of point-to-center comparisons that
+ ** ::VlKMeansANN performs when searching the KD-forest for the
+ ** center closest to a data point. Setting it to 0 makes the search
+ ** exact (see ::vl_kdforest_set_max_num_comparisons).
+ **/
+
+VL_INLINE void
+vl_kmeans_set_max_num_comparisons (VlKMeans * self, vl_size maxNumComparisons)
+{
+  self->maxNumComparisons = maxNumComparisons ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Get the mini-batch center reassignment ratio
+ ** @param self KMeans object instance.
+ ** @return reassignment ratio.
+ **/
+
+VL_INLINE double
+vl_kmeans_get_minibatch_reassignment_ratio (VlKMeans const * self)
+{
+  return self->minibatchReassignmentRatio ;
+}
+
+/** @brief Set the mini-batch center reassignment ratio
+ ** @param self KMeans object instance.
+ ** @param ratio reassignment ratio.
+ **
+ ** After each mini-batch, ::vl_kmeans_update_minibatch moves the
+ ** centers that were assigned less than @a ratio times the
+ ** points of the most popular center to random points of the batch.
+ ** Set to zero (default) to disable the reassignment. @a ratio must
+ ** be in the range [0, 1]; small values such as 0.01 are typical.
+ **/
+
+VL_INLINE void
+vl_kmeans_set_minibatch_reassignment_ratio (VlKMeans * self, double ratio)
+{
+  assert (0 <= ratio && ratio <= 1) ;
+  self->minibatchReassignmentRatio = ratio ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Get maximum number of repetitions.
  ** @param self KMeans object instance.
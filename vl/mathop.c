@@ -23,7 +23,8 @@ the terms of the BSD license (see the COPYING file).
  ::vl_get_vector_comparison_function_d obtain an approprite function
  to comprare vectors of floats or doubles, respectively.  Such
  functions are usually optimized (for instance, on X86 platforms they
- use the SSE vector extension) and are several times faster than a
+ use the SSE, AVX2 or AVX-512 vector extensions, selected at run time
+ based on the CPU capabilities) and are several times faster than a
  naive implementation.  ::vl_eval_vector_comparison_on_all_pairs_f and
  ::vl_eval_vector_comparison_on_all_pairs_d can be used to evaluate
  the comparison function on all pairs of one or two sequences of
@@ -156,7 +157,21 @@ the terms of the BSD license (see the COPYING file).
  ** matrix.
  **
  ** If @a Y is a null pointer the function compares all columns from
- ** @a X with themselves.
+ ** @a X with themselves. In this case only half of the comparisons
+ ** are evaluated and the result is filled by symmetry.
+ **
+ ** The comparisons are evaluated in cache-sized tiles, which are
+ ** distributed among the threads (see @ref threads). If @a function
+ ** is the ::VlDistanceL2 or ::VlKernelL2 comparison function (as
+ ** returned by ::vl_get_vector_comparison_function_f), the function
+ ** computes the inner products by a blocked matrix product and
+ ** obtains the distances as @f$ \|x\|^2 + \|y\|^2 - 2\langle x,y
+ ** \rangle @f$. This is much faster, but also less accurate for
+ ** nearby points than evaluating @a function directly, as it is
+ ** subject to cancellation; negative values due to rounding are
+ ** clamped to zero. The results therefore differ slightly from those
+ ** of @a function. Use ::vl_eval_vector_comparison_on_all_pairs_exact_f
+ ** when this matters.
  **/
 
 /** @fn vl_eval_vector_comparison_on_all_pairs_d(double*,vl_size,
@@ -165,13 +180,45 @@ the terms of the BSD license (see the COPYING file).
  ** @sa vl_eval_vector_comparison_on_all_pairs_f
  **/
 
+/** @fn vl_eval_vector_comparison_on_all_pairs_exact_f(float*,vl_size,
+ **     float const*,vl_size,float const*,vl_size,VlFloatVectorComparisonFunction)
+ ** @brief Evaluate vector comparison function on all vector pairs exactly
+ **
+ ** The function is the same as ::vl_eval_vector_comparison_on_all_pairs_f,
+ ** except that @a function is always evaluated on each pair, also for
+ ** the L2 distance and kernel. The result is the same as calling
+ ** @a function in a loop.
+ **/
+
+/** @fn vl_eval_vector_comparison_on_all_pairs_exact_d(double*,vl_size,
+ **     double const*,vl_size,double const*,vl_size,VlDoubleVectorComparisonFunction)
+ ** @brief Evaluate vector comparison function on all vector pairs exactly
+ ** @sa vl_eval_vector_comparison_on_all_pairs_exact_f
+ **/
+
 /* ---------------------------------------------------------------- */
 #ifndef VL_MATHOP_INSTANTIATING
 
 #include "mathop.h"
 #include "mathop_sse2.h"
+#include "mathop_avx2.h"
+#include "mathop_avx512.h"
+#include "threads.h"
 #include <math.h>
 
+/* all-pairs evaluation: tile sizes (in vectors and components) */
+#define VL_ALLPAIRS_MR 8
+#define VL_ALLPAIRS_NR 4
+#define VL_ALLPAIRS_BLOCK_Y 64
+#define VL_ALLPAIRS_BLOCK_X 64
+#define VL_ALLPAIRS_BLOCK_DIM 128
+#define VL_ALLPAIRS_CACHE_SIZE (128 * 1024)
+
+/* all-pairs evaluation: special cases */
+#define VL_ALLPAIRS_GENERIC 0
+#define VL_ALLPAIRS_L2_DISTANCE 1
+#define VL_ALLPAIRS_L2_KERNEL 2
+
 #undef FLT
 #define FLT VL_TYPE_FLOAT
 #define VL_MATHOP_INSTANTIATING
@@ -392,53 +439,396 @@ VL_XCAT(vl_get_vector_comparison_function_, SFX)(VlVectorComparisonType type)
   }
 #endif
 
+#ifndef VL_DISABLE_AVX2
+  /* if the CPU supports AVX2 and FMA, prefer the 256-bit version */
+  if (vl_cpu_has_avx2() && vl_cpu_has_fma() && vl_get_simd_enabled()) {
+    switch (type) {
+      case VlDistanceL2   : function = VL_XCAT(_vl_distance_l2_avx2_,   SFX) ; break ;
+      case VlDistanceL1   : function = VL_XCAT(_vl_distance_l1_avx2_,   SFX) ; break ;
+      case VlDistanceChi2 : function = VL_XCAT(_vl_distance_chi2_avx2_, SFX) ; break ;
+      case VlKernelL2     : function = VL_XCAT(_vl_kernel_l2_avx2_,     SFX) ; break ;
+      case VlKernelL1     : function = VL_XCAT(_vl_kernel_l1_avx2_,     SFX) ; break ;
+      case VlKernelChi2   : function = VL_XCAT(_vl_kernel_chi2_avx2_,   SFX) ; break ;
+      default: break ;
+    }
+  }
+#endif
+
+#ifndef VL_DISABLE_AVX512
+  /* if the CPU supports AVX-512, prefer the 512-bit version */
+  if (vl_cpu_has_avx512f() && vl_get_simd_enabled()) {
+    switch (type) {
+      case VlDistanceL2   : function = VL_XCAT(_vl_distance_l2_avx512_,   SFX) ; break ;
+      case VlDistanceL1   : function = VL_XCAT(_vl_distance_l1_avx512_,   SFX) ; break ;
+      case VlDistanceChi2 : function = VL_XCAT(_vl_distance_chi2_avx512_, SFX) ; break ;
+      case VlKernelL2     : function = VL_XCAT(_vl_kernel_l2_avx512_,     SFX) ; break ;
+      case VlKernelL1     : function = VL_XCAT(_vl_kernel_l1_avx512_,     SFX) ; break ;
+      case VlKernelChi2   : function = VL_XCAT(_vl_kernel_chi2_avx512_,   SFX) ; break ;
+      default: break ;
+    }
+  }
+#endif
+
   return function ;
 }
 
+/* ---------------------------------------------------------------- */
+/*                                       Evaluating on all the pairs */
 /* ---------------------------------------------------------------- */
 
-VL_EXPORT void
-VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)
+/* The pairs are processed in tiles of VL_ALLPAIRS_BLOCK_Y vectors of
+   Y by a number of vectors of X that fits in the cache. Each tile of
+   Y is processed by a different thread; since a tile of Y corresponds
+   to a contiguous range of columns of the result, threads never write
+   to the same elements.
+
+   The L2 distance and kernel are computed as dot products by a
+   register-blocked micro-kernel operating on vectors packed in
+   groups of VL_ALLPAIRS_MR (X) and VL_ALLPAIRS_NR (Y) (as in GEMM),
+   further blocked
+   along the dimension by VL_ALLPAIRS_BLOCK_DIM. The L2 distance
+   is then obtained as ||x||^2 + ||y||^2 - 2 <x,y>. */
+
+typedef struct VL_XCAT(_VlAllPairs_, SFX)
+{
+  T * result ;
+  vl_size dimension ;
+  T const * X ;
+  vl_size numDataX ;
+  T const * Y ;
+  vl_size numDataY ;
+  vl_bool symmetric ;
+  COMPARISONFUNCTION_TYPE function ;
+  int mode ;
+  T const * normsX ;
+  T const * normsY ;
+  T * scratch ;
+  vl_size blockSizeX ;
+} VL_XCAT(_VlAllPairs_, SFX) ;
+
+/** @internal @brief Pack vectors into micro-kernel panels
+ ** @param panel output panel.
+ ** @param X vectors.
+ ** @param numData number of vectors to pack.
+ ** @param dimension dimension of the vectors.
+ ** @param begin first component to pack.
+ ** @param end one past the last component to pack.
+ ** @param groupSize number of vectors in a group.
+ **
+ ** Vectors are packed in groups of @a groupSize, interleaving their
+ ** components. Groups are padded with zeros.
+ **/
+
+static void
+VL_XCAT(_vl_allpairs_pack_, SFX)
+(T * panel, T const * X, vl_size numData, vl_size dimension,
+ vl_uindex begin, vl_uindex end, vl_size groupSize)
+{
+  vl_uindex i, k, g ;
+  for (g = 0 ; g < numData ; g += groupSize) {
+    for (i = 0 ; i < groupSize ; ++i) {
+      if (g + i < numData) {
+        T const * x = X + (g + i) * dimension + begin ;
+        for (k = 0 ; k < end - begin ; ++k) {
+          panel[k * groupSize + i] = x[k] ;
+        }
+      } else {
+        for (k = 0 ; k < end - begin ; ++k) {
+          panel[k * groupSize + i] = 0 ;
+        }
+      }
+    }
+    panel += (end - begin) * groupSize ;
+  }
+}
+
+/** @internal @brief Dot products micro-kernel
+ ** @param acc VL_ALLPAIRS_NR x VL_ALLPAIRS_MR accumulator (in/out).
+ ** @param xp packed group of X.
+ ** @param yp packed group of Y.
+ ** @param length number of components.
+ **
+ ** The inner loops have a fixed length so that the compiler can keep
+ ** @a acc in registers and vectorize them.
+ **/
+
+VL_INLINE void
+VL_XCAT(_vl_allpairs_kernel_, SFX)
+(T * acc, T const * xp, T const * yp, vl_size length)
+{
+  vl_uindex i, k ;
+  T a0 [VL_ALLPAIRS_MR], a1 [VL_ALLPAIRS_MR],
+    a2 [VL_ALLPAIRS_MR], a3 [VL_ALLPAIRS_MR] ;
+  for (i = 0 ; i < VL_ALLPAIRS_MR ; ++i) {
+    a0[i] = acc[0 * VL_ALLPAIRS_MR + i] ;
+    a1[i] = acc[1 * VL_ALLPAIRS_MR + i] ;
+    a2[i] = acc[2 * VL_ALLPAIRS_MR + i] ;
+    a3[i] = acc[3 * VL_ALLPAIRS_MR + i] ;
+  }
+  for (k = 0 ; k < length ; ++k) {
+    T y0 = yp[0], y1 = yp[1], y2 = yp[2], y3 = yp[3] ;
+    for (i = 0 ; i < VL_ALLPAIRS_MR ; ++i) {
+      T x = xp[i] ;
+      a0[i] += x * y0 ;
+      a1[i] += x * y1 ;
+      a2[i] += x * y2 ;
+      a3[i] += x * y3 ;
+    }
+    xp += VL_ALLPAIRS_MR ;
+    yp += VL_ALLPAIRS_NR ;
+  }
+  for (i = 0 ; i < VL_ALLPAIRS_MR ; ++i) {
+    acc[0 * VL_ALLPAIRS_MR + i] = a0[i] ;
+    acc[1 * VL_ALLPAIRS_MR + i] = a1[i] ;
+    acc[2 * VL_ALLPAIRS_MR + i] = a2[i] ;
+    acc[3 * VL_ALLPAIRS_MR + i] = a3[i] ;
+  }
+}
+
+/** @internal @brief Process a tile of the L2 distance or kernel
+ ** @param self all-pairs problem.
+ ** @param y0 first vector of the Y tile.
+ ** @param y1 one past the last vector of the Y tile.
+ ** @param x0 first vector of the X tile.
+ ** @param x1 one past the last vector of the X tile.
+ ** @param scratch packing space.
+ **/
+
+static void
+VL_XCAT(_vl_allpairs_tile_l2_, SFX)
+(VL_XCAT(_VlAllPairs_, SFX) const * self,
+ vl_uindex y0, vl_uindex y1, vl_uindex x0, vl_uindex x1, T * scratch)
+{
+  vl_size const numDataX = self->numDataX ;
+  vl_size const dimension = self->dimension ;
+  T * Yp = scratch ;
+  T * Xp = scratch + VL_ALLPAIRS_BLOCK_Y * VL_ALLPAIRS_BLOCK_DIM ;
+  vl_uindex k0, k1, xg, yg, i, j ;
+
+  for (j = y0 ; j < y1 ; ++j) {
+    for (i = x0 ; i < x1 ; ++i) self->result[j * numDataX + i] = 0 ;
+  }
+
+  for (k0 = 0 ; k0 < dimension ; k0 = k1) {
+    k1 = VL_MIN(k0 + VL_ALLPAIRS_BLOCK_DIM, dimension) ;
+    VL_XCAT(_vl_allpairs_pack_, SFX)(Yp, self->Y + y0 * dimension, y1 - y0,
+                                     dimension, k0, k1, VL_ALLPAIRS_NR) ;
+    VL_XCAT(_vl_allpairs_pack_, SFX)(Xp, self->X + x0 * dimension, x1 - x0,
+                                     dimension, k0, k1, VL_ALLPAIRS_MR) ;
+    for (yg = y0 ; yg < y1 ; yg += VL_ALLPAIRS_NR) {
+      T const * yp = Yp + (yg - y0) * (k1 - k0) ;
+      for (xg = x0 ; xg < x1 ; xg += VL_ALLPAIRS_MR) {
+        T const * xp = Xp + (xg - x0) * (k1 - k0) ;
+        T acc [VL_ALLPAIRS_NR * VL_ALLPAIRS_MR] = {0} ;
+        VL_XCAT(_vl_allpairs_kernel_, SFX)(acc, xp, yp, k1 - k0) ;
+        for (j = 0 ; j < VL_ALLPAIRS_NR && yg + j < y1 ; ++j) {
+          T * r = self->result + (yg + j) * numDataX + xg ;
+          for (i = 0 ; i < VL_ALLPAIRS_MR && xg + i < x1 ; ++i) {
+            r[i] += acc[j * VL_ALLPAIRS_MR + i] ;
+          }
+        }
+      }
+    }
+  }
+
+  if (self->mode == VL_ALLPAIRS_L2_DISTANCE) {
+    for (j = y0 ; j < y1 ; ++j) {
+      T * r = self->result + j * numDataX ;
+      for (i = x0 ; i < x1 ; ++i) {
+        T z = self->normsX[i] + self->normsY[j] - 2 * r[i] ;
+        r[i] = VL_MAX(z, 0) ;
+      }
+      if (self->symmetric && x0 <= j && j < x1) r[j] = 0 ;
+    }
+  }
+}
+
+/** @internal @brief Process a tile with a generic comparison function */
+
+static void
+VL_XCAT(_vl_allpairs_tile_generic_, SFX)
+(VL_XCAT(_VlAllPairs_, SFX) const * self,
+ vl_uindex y0, vl_uindex y1, vl_uindex x0, vl_uindex x1)
+{
+  vl_uindex i, j ;
+  for (j = y0 ; j < y1 ; ++j) {
+    T const * y = self->Y + j * self->dimension ;
+    T * r = self->result + j * self->numDataX ;
+    for (i = x0 ; i < x1 ; ++i) {
+      r[i] = (*self->function)(self->dimension, self->X + i * self->dimension, y) ;
+    }
+  }
+}
+
+/** @internal @brief Process a tile of Y against all of X */
+
+static void
+VL_XCAT(_vl_allpairs_task_, SFX)
+(void * data, vl_uindex begin, vl_uindex end, vl_uindex slot)
+{
+  VL_XCAT(_VlAllPairs_, SFX) const * self = data ;
+  T * scratch = self->scratch +
+    slot * (VL_ALLPAIRS_BLOCK_Y + self->blockSizeX) * VL_ALLPAIRS_BLOCK_DIM ;
+  vl_uindex block ;
+
+  for (block = begin ; block < end ; ++block) {
+    vl_uindex y0 = block * VL_ALLPAIRS_BLOCK_Y ;
+    vl_uindex y1 = VL_MIN(y0 + VL_ALLPAIRS_BLOCK_Y, self->numDataY) ;
+    /* in the symmetric case only the tiles up to the diagonal are
+       computed; the others are obtained by transposition */
+    vl_size numDataX = self->symmetric ? y1 : self->numDataX ;
+    vl_uindex x0, x1, i, j ;
+    for (x0 = 0 ; x0 < numDataX ; x0 = x1) {
+      x1 = VL_MIN(x0 + self->blockSizeX, numDataX) ;
+      if (self->mode == VL_ALLPAIRS_GENERIC) {
+        VL_XCAT(_vl_allpairs_tile_generic_, SFX)(self, y0, y1, x0, x1) ;
+      } else {
+        VL_XCAT(_vl_allpairs_tile_l2_, SFX)(self, y0, y1, x0, x1, scratch) ;
+      }
+    }
+    if (self->symmetric) {
+      for (j = y0 ; j < y1 ; ++j) {
+        for (i = 0 ; i < VL_MIN(j, y0) ; ++i) {
+          self->result[i * self->numDataX + j] = self->result[j * self->numDataX + i] ;
+        }
+      }
+    }
+  }
+}
+
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Evaluate a comparison function on all pairs
+ ** @param exact evaluate @a function directly even for the L2 comparisons.
+ **
+ ** The other parameters are as in ::vl_eval_vector_comparison_on_all_pairs_f.
+ **/
+
+static void
+VL_XCAT(_vl_eval_vector_comparison_on_all_pairs_, SFX)
 (T * result, vl_size dimension,
  T const * X, vl_size numDataX,
  T const * Y, vl_size numDataY,
- COMPARISONFUNCTION_TYPE function)
+ COMPARISONFUNCTION_TYPE function,
+ vl_bool exact)
 {
-  vl_uindex xi ;
-  vl_uindex yi ;
+  VL_XCAT(_VlAllPairs_, SFX) self ;
+  T * norms = NULL ;
+  vl_uindex i ;
+  vl_size numBlocks ;
 
   if (dimension == 0) return ;
   if (numDataX == 0) return ;
   assert (X) ;
 
-  if (Y) {
+  self.result = result ;
+  self.dimension = dimension ;
+  self.X = X ;
+  self.numDataX = numDataX ;
+  self.symmetric = (Y == NULL) ;
+  if (self.symmetric) {
+    self.Y = X ;
+    self.numDataY = numDataX ;
+  } else {
     if (numDataY == 0) return ;
-    for (yi = 0 ; yi < numDataY ; ++ yi) {
-      for (xi = 0 ; xi < numDataX ; ++ xi) {
-        *result++ = (*function)(dimension, X, Y) ;
-        X += dimension ;
-      }
-      X -= dimension * numDataX ;
-      Y += dimension ;
-    }
+    self.Y = Y ;
+    self.numDataY = numDataY ;
+  }
+  self.function = function ;
+  self.scratch = NULL ;
+  self.normsX = NULL ;
+  self.normsY = NULL ;
+
+  /* recognize the L2 comparisons, which use the dot-product kernel */
+  self.mode = VL_ALLPAIRS_GENERIC ;
+  if (function == VL_XCAT(_vl_distance_l2_, SFX)
+#ifndef VL_DISABLE_SSE2
+      || function == VL_XCAT(_vl_distance_l2_sse2_, SFX)
+#endif
+#ifndef VL_DISABLE_AVX2
+      || function == VL_XCAT(_vl_distance_l2_avx2_, SFX)
+#endif
+#ifndef VL_DISABLE_AVX512
+      || function == VL_XCAT(_vl_distance_l2_avx512_, SFX)
+#endif
+    ) {
+    self.mode = VL_ALLPAIRS_L2_DISTANCE ;
+  }
+  if (function == VL_XCAT(_vl_kernel_l2_, SFX)
+#ifndef VL_DISABLE_SSE2
+      || function == VL_XCAT(_vl_kernel_l2_sse2_, SFX)
+#endif
+#ifndef VL_DISABLE_AVX2
+      || function == VL_XCAT(_vl_kernel_l2_avx2_, SFX)
+#endif
+#ifndef VL_DISABLE_AVX512
+      || function == VL_XCAT(_vl_kernel_l2_avx512_, SFX)
+#endif
+    ) {
+    self.mode = VL_ALLPAIRS_L2_KERNEL ;
+  }
+  /* packing does not pay off if there are only a few vectors */
+  if (exact || numDataX < VL_ALLPAIRS_MR || self.numDataY < VL_ALLPAIRS_NR) {
+    self.mode = VL_ALLPAIRS_GENERIC ;
+  }
+
+  if (self.mode == VL_ALLPAIRS_GENERIC) {
+    /* as many vectors of X as it fits in the cache */
+    self.blockSizeX = VL_ALLPAIRS_CACHE_SIZE / (dimension * sizeof(T)) ;
+    self.blockSizeX = VL_MAX(self.blockSizeX, 1) ;
   } else {
-    T * resultTransp = result ;
-    Y = X ;
-    for (yi = 0 ; yi < numDataX ; ++ yi) {
-      for (xi = 0 ; xi <= yi ; ++ xi) {
-        T z = (*function)(dimension, X, Y) ;
-        X += dimension ;
-        *result       = z ;
-        *resultTransp = z ;
-        result        += 1 ;
-        resultTransp  += numDataX ;
+    self.blockSizeX = VL_ALLPAIRS_BLOCK_X ;
+    self.scratch = vl_malloc(sizeof(T) * vl_get_max_threads() *
+                             (VL_ALLPAIRS_BLOCK_Y + self.blockSizeX) *
+                             VL_ALLPAIRS_BLOCK_DIM) ;
+  }
+
+  if (self.mode == VL_ALLPAIRS_L2_DISTANCE) {
+    COMPARISONFUNCTION_TYPE dot =
+      VL_XCAT(vl_get_vector_comparison_function_, SFX)(VlKernelL2) ;
+    norms = vl_malloc(sizeof(T) * (numDataX + (self.symmetric ? 0 : numDataY))) ;
+    for (i = 0 ; i < numDataX ; ++i) {
+      T const * x = X + i * dimension ;
+      norms[i] = dot(dimension, x, x) ;
+    }
+    self.normsX = norms ;
+    self.normsY = norms ;
+    if (! self.symmetric) {
+      self.normsY = norms + numDataX ;
+      for (i = 0 ; i < numDataY ; ++i) {
+        T const * y = Y + i * dimension ;
+        norms[numDataX + i] = dot(dimension, y, y) ;
       }
-      X -= dimension * (yi + 1) ;
-      Y += dimension ;
-      result       += numDataX - (yi + 1) ;
-      resultTransp += 1        - (yi + 1) * numDataX ;
     }
   }
+
+  numBlocks = (self.numDataY + VL_ALLPAIRS_BLOCK_Y - 1) / VL_ALLPAIRS_BLOCK_Y ;
+  vl_parallel_for (numBlocks, 1, VL_XCAT(_vl_allpairs_task_, SFX), &self) ;
+
+  if (norms) vl_free (norms) ;
+  if (self.scratch) vl_free (self.scratch) ;
+}
+
+VL_EXPORT void
+VL_XCAT(vl_eval_vector_comparison_on_all_pairs_, SFX)
+(T * result, vl_size dimension,
+ T const * X, vl_size numDataX,
+ T const * Y, vl_size numDataY,
+ COMPARISONFUNCTION_TYPE function)
+{
+  VL_XCAT(_vl_eval_vector_comparison_on_all_pairs_, SFX)
+  (result, dimension, X, numDataX, Y, numDataY, function, VL_FALSE) ;
+}
+
+VL_EXPORT void
+VL_XCAT(vl_eval_vector_comparison_on_all_pairs_exact_, SFX)
+(T * result, vl_size dimension,
+ T const * X, vl_size numDataX,
+ T const * Y, vl_size numDataY,
+ COMPARISONFUNCTION_TYPE function)
+{
+  VL_XCAT(_vl_eval_vector_comparison_on_all_pairs_, SFX)
+  (result, dimension, X, numDataX, Y, numDataY, function, VL_TRUE) ;
 }
 
 /* VL_MATHOP_INSTANTIATING */
@@ -608,6 +608,18 @@ vl_eval_vector_comparison_on_all_pairs_d (double * result, vl_size dimension,
                                           double const * Y, vl_size numDataY,
                                           VlDoubleVectorComparisonFunction function) ;
 
+VL_EXPORT void
+vl_eval_vector_comparison_on_all_pairs_exact_f (float * result, vl_size dimension,
+                                                float const * X, vl_size numDataX,
+                                                float const * Y, vl_size numDataY,
+                                                VlFloatVectorComparisonFunction function) ;
+
+VL_EXPORT void
+vl_eval_vector_comparison_on_all_pairs_exact_d (double * result, vl_size dimension,
+                                                double const * X, vl_size numDataX,
+                                                double const * Y, vl_size numDataY,
+                                                VlDoubleVectorComparisonFunction function) ;
+
 /* ---------------------------------------------------------------- */
 /*                                               Numerical analysis */
 /* ---------------------------------------------------------------- */
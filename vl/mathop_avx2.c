@@ -0,0 +1,378 @@
+/** @file mathop_avx2.c
+ ** @brief mathop for AVX2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+/* ---------------------------------------------------------------- */
+#ifndef VL_MATHOP_AVX2_INSTANTIATING
+#define VL_MATHOP_AVX2_INSTANTIATING
+
+#ifndef VL_DISABLE_AVX2
+#if ! defined(__AVX2__) || ! defined(__FMA__)
+#  error "mathop_avx2.c must be compiled with AVX2 and FMA intrinsics enabled"
+#endif
+
+#include "generic.h"
+#include "mathop.h"
+#include "mathop_avx2.h"
+#include <immintrin.h>
+
+/* 256-bit counterparts of the SSE2 macros of float.th */
+#define WMUL   VL_XCAT(_mm256_mul_p,     VSFX)
+#define WDIV   VL_XCAT(_mm256_div_p,     VSFX)
+#define WADD   VL_XCAT(_mm256_add_p,     VSFX)
+#define WSUB   VL_XCAT(_mm256_sub_p,     VSFX)
+#define WFMA   VL_XCAT(_mm256_fmadd_p,   VSFX)
+#define WSTZ   VL_XCAT(_mm256_setzero_p, VSFX)
+#define WLDU   VL_XCAT(_mm256_loadu_p,   VSFX)
+#define WLDA   VL_XCAT(_mm256_load_p,    VSFX)
+#define WSET1  VL_XCAT(_mm256_set1_p,    VSFX)
+#define WAND   VL_XCAT(_mm256_and_p,     VSFX)
+#define WANDN  VL_XCAT(_mm256_andnot_p,  VSFX)
+#define WNEQ(a,b) VL_XCAT(_mm256_cmp_p,  VSFX)(a,b,_CMP_NEQ_UQ)
+#define WALIGNED(x) (! (((vl_uintptr)(x)) & 0x1F))
+
+#undef FLT
+#define FLT VL_TYPE_DOUBLE
+#include "mathop_avx2.c"
+
+#undef FLT
+#define FLT VL_TYPE_FLOAT
+#include "mathop_avx2.c"
+
+/* VL_DISABLE_AVX2 */
+#endif
+
+/* ---------------------------------------------------------------- */
+/* VL_MATHOP_AVX2_INSTANTIATING */
+#else
+
+#include "float.th"
+
+#undef WSIZE
+#undef WTYPE
+#if (FLT == VL_TYPE_FLOAT)
+#  define WSIZE 8
+#  define WTYPE __m256
+#else
+#  define WSIZE 4
+#  define WTYPE __m256d
+#endif
+
+VL_INLINE T
+VL_XCAT(_vl_vhsum_avx2_, SFX)(WTYPE x)
+{
+  T acc ;
+#if (WSIZE == 8)
+  {
+    __m128 lo = _mm256_castps256_ps128 (x) ;
+    __m128 hi = _mm256_extractf128_ps (x, 1) ;
+    lo = _mm_add_ps (lo, hi) ;
+    hi = _mm_movehl_ps (hi, lo) ;
+    lo = _mm_add_ps (lo, hi) ;
+    hi = _mm_shuffle_ps (lo, lo, _MM_SHUFFLE(1, 1, 1, 1)) ;
+    lo = _mm_add_ss (lo, hi) ;
+    acc = _mm_cvtss_f32 (lo) ;
+  }
+#else
+  {
+    __m128d lo = _mm256_castpd256_pd128 (x) ;
+    __m128d hi = _mm256_extractf128_pd (x, 1) ;
+    lo = _mm_add_pd (lo, hi) ;
+    hi = _mm_unpackhi_pd (lo, lo) ;
+    lo = _mm_add_sd (lo, hi) ;
+    acc = _mm_cvtsd_f64 (lo) ;
+  }
+#endif
+  return acc ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_l2_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      vacc = WFMA(delta, delta, vacc) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      vacc = WFMA(delta, delta, vacc) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    T delta = a - b ;
+    acc += delta * delta ;
+  }
+
+  return acc ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_l1_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  WTYPE vminus = WSET1((T) -0.0) ; /* sign bit */
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      vacc = WADD(vacc, WANDN(vminus, delta)) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      vacc = WADD(vacc, WANDN(vminus, delta)) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    T delta = a - b ;
+    acc += VL_MAX(delta, - delta) ;
+  }
+
+  return acc ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_chi2_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      WTYPE denom = WADD(a, b) ;
+      WTYPE numer = WMUL(delta, delta) ;
+      WTYPE ratio = WDIV(numer, denom) ;
+      ratio = WAND(ratio, WNEQ(denom, WSTZ())) ;
+      vacc = WADD(vacc, ratio) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      WTYPE delta = WSUB(a, b) ;
+      WTYPE denom = WADD(a, b) ;
+      WTYPE numer = WMUL(delta, delta) ;
+      WTYPE ratio = WDIV(numer, denom) ;
+      ratio = WAND(ratio, WNEQ(denom, WSTZ())) ;
+      vacc = WADD(vacc, ratio) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    T delta = a - b ;
+    T denom = a + b ;
+    T numer = delta * delta ;
+    if (denom) {
+      T ratio = numer / denom ;
+      acc += ratio ;
+    }
+  }
+  return acc ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_l2_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      vacc = WFMA(a, b, vacc) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      vacc = WFMA(a, b, vacc) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    acc += a * b ;
+  }
+  return acc ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_l1_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  WTYPE vminus = WSET1((T) -0.0) ;
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      WTYPE a_ = WANDN(vminus, a) ;
+      WTYPE b_ = WANDN(vminus, b) ;
+      WTYPE sum = WADD(a_,b_) ;
+      WTYPE diff = WSUB(a, b) ;
+      WTYPE diff_ = WANDN(vminus, diff) ;
+      vacc = WADD(vacc, WSUB(sum, diff_)) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      WTYPE a_ = WANDN(vminus, a) ;
+      WTYPE b_ = WANDN(vminus, b) ;
+      WTYPE sum = WADD(a_,b_) ;
+      WTYPE diff = WSUB(a, b) ;
+      WTYPE diff_ = WANDN(vminus, diff) ;
+      vacc = WADD(vacc, WSUB(sum, diff_)) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    T a_ = VL_XCAT(vl_abs_, SFX) (a) ;
+    T b_ = VL_XCAT(vl_abs_, SFX) (b) ;
+    acc += a_ + b_ - VL_XCAT(vl_abs_, SFX) (a - b) ;
+  }
+
+  return acc / ((T)2) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_chi2_avx2_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_end = X + dimension ;
+  T const * X_vec_end = X_end - WSIZE + 1 ;
+  T acc ;
+  WTYPE vacc = WSTZ() ;
+  vl_bool dataAligned = WALIGNED(X) & WALIGNED(Y) ;
+
+  if (dataAligned) {
+    while (X < X_vec_end) {
+      WTYPE a = WLDA(X) ;
+      WTYPE b = WLDA(Y) ;
+      WTYPE denom = WADD(a, b) ;
+      WTYPE numer = WMUL(a,b) ;
+      WTYPE ratio = WDIV(numer, denom) ;
+      ratio = WAND(ratio, WNEQ(denom, WSTZ())) ;
+      vacc = WADD(vacc, ratio) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  } else {
+    while (X < X_vec_end) {
+      WTYPE a = WLDU(X) ;
+      WTYPE b = WLDU(Y) ;
+      WTYPE denom = WADD(a, b) ;
+      WTYPE numer = WMUL(a,b) ;
+      WTYPE ratio = WDIV(numer, denom) ;
+      ratio = WAND(ratio, WNEQ(denom, WSTZ())) ;
+      vacc = WADD(vacc, ratio) ;
+      X += WSIZE ;
+      Y += WSIZE ;
+    }
+  }
+
+  acc = VL_XCAT(_vl_vhsum_avx2_, SFX)(vacc) ;
+
+  while (X < X_end) {
+    T a = *X++ ;
+    T b = *Y++ ;
+    T denom = a + b ;
+    if (denom) {
+      T ratio = a * b / denom ;
+      acc += ratio ;
+    }
+  }
+  return ((T)2) * acc ;
+}
+
+/* VL_MATHOP_AVX2_INSTANTIATING */
+#endif
@@ -0,0 +1,232 @@
+/** @file mathop_avx512.c
+ ** @brief mathop for AVX-512 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+/* ---------------------------------------------------------------- */
+#ifndef VL_MATHOP_AVX512_INSTANTIATING
+#define VL_MATHOP_AVX512_INSTANTIATING
+
+#ifndef VL_DISABLE_AVX512
+#ifndef __AVX512F__
+#  error "mathop_avx512.c must be compiled with AVX-512F intrinsics enabled"
+#endif
+
+#include "generic.h"
+#include "mathop.h"
+#include "mathop_avx512.h"
+#include <immintrin.h>
+
+/* 512-bit counterparts of the SSE2 macros of float.th. Only AVX-512F
+   instructions are used. The vector tails are processed by masked
+   loads, so there is no scalar remainder loop. */
+#define ZMUL   VL_XCAT(_mm512_mul_p,        VSFX)
+#define ZADD   VL_XCAT(_mm512_add_p,        VSFX)
+#define ZSUB   VL_XCAT(_mm512_sub_p,        VSFX)
+#define ZFMA   VL_XCAT(_mm512_fmadd_p,      VSFX)
+#define ZABS   VL_XCAT(_mm512_abs_p,        VSFX)
+#define ZSTZ   VL_XCAT(_mm512_setzero_p,    VSFX)
+#define ZLDU   VL_XCAT(_mm512_loadu_p,      VSFX)
+#define ZLDM   VL_XCAT(_mm512_maskz_loadu_p, VSFX)
+#define ZMDIV  VL_XCAT(_mm512_maskz_div_p,  VSFX)
+#define ZHSUM  VL_XCAT(_mm512_reduce_add_p, VSFX)
+#define ZNEQZ(a) VL_XCAT(_mm512_cmp_p, VL_XCAT(VSFX, _mask))(a,ZSTZ(),_CMP_NEQ_UQ)
+
+#undef FLT
+#define FLT VL_TYPE_DOUBLE
+#include "mathop_avx512.c"
+
+#undef FLT
+#define FLT VL_TYPE_FLOAT
+#include "mathop_avx512.c"
+
+/* VL_DISABLE_AVX512 */
+#endif
+
+/* ---------------------------------------------------------------- */
+/* VL_MATHOP_AVX512_INSTANTIATING */
+#else
+
+#include "float.th"
+
+#undef ZSIZE
+#undef ZTYPE
+#undef ZMASK
+#if (FLT == VL_TYPE_FLOAT)
+#  define ZSIZE 16
+#  define ZTYPE __m512
+#  define ZMASK __mmask16
+#else
+#  define ZSIZE 8
+#  define ZTYPE __m512d
+#  define ZMASK __mmask8
+#endif
+
+/** @internal @brief Mask selecting the first @a n < ZSIZE lanes */
+VL_INLINE ZMASK
+VL_XCAT(_vl_tail_mask_avx512_, SFX)(vl_size n)
+{
+  return (ZMASK) ((1u << n) - 1) ;
+}
+
+/* Each function below has a main loop over whole vectors and a
+   final step that loads the remaining (fewer than ZSIZE) elements
+   with a mask, setting the other lanes to zero. All the expressions
+   evaluate to zero on zero lanes. */
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_l2_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    ZTYPE delta = ZSUB(ZLDU(X), ZLDU(Y)) ;
+    vacc = ZFMA(delta, delta, vacc) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    ZTYPE delta = ZSUB(ZLDM(mask, X), ZLDM(mask, Y)) ;
+    vacc = ZFMA(delta, delta, vacc) ;
+  }
+  return ZHSUM(vacc) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_l1_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    vacc = ZADD(vacc, ZABS(ZSUB(ZLDU(X), ZLDU(Y)))) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    vacc = ZADD(vacc, ZABS(ZSUB(ZLDM(mask, X), ZLDM(mask, Y)))) ;
+  }
+  return ZHSUM(vacc) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_distance_chi2_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    ZTYPE a = ZLDU(X) ;
+    ZTYPE b = ZLDU(Y) ;
+    ZTYPE delta = ZSUB(a, b) ;
+    ZTYPE denom = ZADD(a, b) ;
+    ZTYPE numer = ZMUL(delta, delta) ;
+    vacc = ZADD(vacc, ZMDIV(ZNEQZ(denom), numer, denom)) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    ZTYPE a = ZLDM(mask, X) ;
+    ZTYPE b = ZLDM(mask, Y) ;
+    ZTYPE delta = ZSUB(a, b) ;
+    ZTYPE denom = ZADD(a, b) ;
+    ZTYPE numer = ZMUL(delta, delta) ;
+    vacc = ZADD(vacc, ZMDIV(ZNEQZ(denom), numer, denom)) ;
+  }
+  return ZHSUM(vacc) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_l2_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    vacc = ZFMA(ZLDU(X), ZLDU(Y), vacc) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    vacc = ZFMA(ZLDM(mask, X), ZLDM(mask, Y), vacc) ;
+  }
+  return ZHSUM(vacc) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_l1_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    ZTYPE a = ZLDU(X) ;
+    ZTYPE b = ZLDU(Y) ;
+    ZTYPE sum = ZADD(ZABS(a), ZABS(b)) ;
+    vacc = ZADD(vacc, ZSUB(sum, ZABS(ZSUB(a, b)))) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    ZTYPE a = ZLDM(mask, X) ;
+    ZTYPE b = ZLDM(mask, Y) ;
+    ZTYPE sum = ZADD(ZABS(a), ZABS(b)) ;
+    vacc = ZADD(vacc, ZSUB(sum, ZABS(ZSUB(a, b)))) ;
+  }
+  return ZHSUM(vacc) / ((T)2) ;
+}
+
+VL_EXPORT T
+VL_XCAT(_vl_kernel_chi2_avx512_, SFX)
+(vl_size dimension, T const * X, T const * Y)
+{
+  T const * X_vec_end = X + dimension - (dimension % ZSIZE) ;
+  vl_size rest = dimension % ZSIZE ;
+  ZTYPE vacc = ZSTZ() ;
+
+  while (X < X_vec_end) {
+    ZTYPE a = ZLDU(X) ;
+    ZTYPE b = ZLDU(Y) ;
+    ZTYPE denom = ZADD(a, b) ;
+    ZTYPE numer = ZMUL(a, b) ;
+    vacc = ZADD(vacc, ZMDIV(ZNEQZ(denom), numer, denom)) ;
+    X += ZSIZE ;
+    Y += ZSIZE ;
+  }
+  if (rest) {
+    ZMASK mask = VL_XCAT(_vl_tail_mask_avx512_, SFX)(rest) ;
+    ZTYPE a = ZLDM(mask, X) ;
+    ZTYPE b = ZLDM(mask, Y) ;
+    ZTYPE denom = ZADD(a, b) ;
+    ZTYPE numer = ZMUL(a, b) ;
+    vacc = ZADD(vacc, ZMDIV(ZNEQZ(denom), numer, denom)) ;
+  }
+  return ((T)2) * ZHSUM(vacc) ;
+}
+
+/* VL_MATHOP_AVX512_INSTANTIATING */
+#endif
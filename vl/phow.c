@@ -0,0 +1,678 @@
+/** @file phow.c
+ ** @brief Pyramid histogram of visual words features - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+/**
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ -->
+@page phow PHOW features
+@author Andrea Vedaldi
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ -->
+
+@ref phow.h computes the PHOW (Pyramid Histogram Of visual Words)
+features, i.e. @ref dsift "dense SIFT" descriptors extracted at
+several scales, possibly from colour channels. It is the C counterpart
+of the MATLAB function @c vl_phow.
+
+The descriptors are extracted on a regular grid of step
+::vl_phow_set_step for each bin size of ::vl_phow_set_sizes. For a
+bin size @c size, the image is smoothed by a Gaussian of standard
+deviation @c size / ::vl_phow_get_magnif and the grid starts @c
+floor(3/2 (maxSize - size)) pixels from the top-left corner, so that
+the features of all the sizes have the same support. For colour
+images (::VlPhowColor), a descriptor is computed for each channel and
+the descriptors are stacked. The descriptors of the features whose
+contrast (the norm of the descriptor as returned by dense SIFT, see
+::VlDsiftKeypoint) is below ::vl_phow_set_contrast_threshold are set
+to zero. The contrast is the one of the first channel for gray-scale
+and opponent images, the average of the channels for RGB images, and
+the one of the V channel for HSV images.
+
+By default the gradient orientation planes (see
+::vl_dsift_compute_planes) are computed only once for each channel,
+from the image smoothed for the smallest bin size, and the descriptors
+of all the bin sizes are pooled from them. This saves the smoothing
+and gradient computation of the other bin sizes. The larger bin sizes
+are still averaged over correspondingly larger windows, but the
+gradients are computed at a finer scale than in @c vl_phow. Set
+::vl_phow_set_shared_gradients to @c false to smooth the image and
+compute the gradients for each bin size, which gives exactly the
+descriptors of @c vl_phow.
+
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ -->
+@section phow-usage Usage
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ -->
+
+- Create a ::VlPhow object by ::vl_phow_new, specifying the image
+  size and colour space.
+- Optionally change the parameters (e.g. ::vl_phow_set_sizes).
+- Process an image by ::vl_phow_process. Gray-scale images have
+  one channel and colour images three (red, green and blue) stored
+  one after the other. The values should be in the range [0, 1].
+- Retrieve the frames (::vl_phow_get_frames) and descriptors
+  (::vl_phow_get_descriptors). The features of all the bin sizes are
+  stored in a single buffer, ordered by bin size. The field @c s of
+  a frame is its bin size and the field @c norm is the norm of the
+  descriptor of the first channel.
+- Delete the object by ::vl_phow_delete.
+
+The descriptors are normalized as in dense SIFT (::vl_dsift_process).
+Unlike @c vl_phow, they are not scaled to the range [0, 255].
+**/
+
+#include "phow.h"
+#include "imopv.h"
+#include "mathop.h"
+
+#include <math.h>
+#include <string.h>
+
+#define VL_PHOW_NUM_BIN_T 8
+#define VL_PHOW_DESCRIPTOR_SIZE (4*4*VL_PHOW_NUM_BIN_T)
+#define VL_PHOW_OPPONENT_ALPHA 0.01
+
+/** @brief PHOW feature extractor */
+struct _VlPhow
+{
+  vl_size width ;              /**< image width. */
+  vl_size height ;             /**< image height. */
+  VlPhowColor color ;          /**< colour space. */
+  vl_size numChannels ;        /**< number of channels. */
+
+  vl_size * sizes ;            /**< bin sizes. */
+  vl_size numSizes ;           /**< number of bin sizes. */
+  vl_size step ;               /**< sampling step. */
+  double magnif ;              /**< bin size to smoothing ratio. */
+  double windowSize ;          /**< size of the Gaussian window. */
+  double contrastThreshold ;   /**< contrast threshold. */
+  vl_bool flatWindow ;         /**< use a flat window. */
+  vl_bool sharedGradients ;    /**< compute the gradients once. */
+
+  VlDsiftFilter * dsift ;      /**< dense SIFT filter. */
+  float * channels ;           /**< colour channels. */
+  float * smoothed ;           /**< smoothed channel. */
+  float * planeBuffer ;        /**< gradient planes. */
+  float * planes [VL_PHOW_NUM_BIN_T] ;
+
+  VlDsiftKeypoint * frames ;   /**< frames. */
+  float * descrs ;             /**< descriptors. */
+  double * contrasts ;         /**< contrast of each frame and channel. */
+  vl_size numFrames ;          /**< number of frames. */
+  vl_size numFrameAlloc ;      /**< size of the frame buffers. */
+} ;
+
+/** @brief Create a new PHOW extractor
+ ** @param width image width.
+ ** @param height image height.
+ ** @param color colour space.
+ ** @return new object or @c NULL if out of memory.
+ **
+ ** The parameters are initialized to the defaults of @c vl_phow:
+ ** bin sizes 4, 6, 8 and 10, step 2, magnification factor 6, window
+ ** size 1.5, contrast threshold 0.005, and flat window.
+ **/
+
+VlPhow *
+vl_phow_new (vl_size width, vl_size height, VlPhowColor color)
+{
+  static vl_size const defaultSizes [] = {4, 6, 8, 10} ;
+  VlPhow * self = vl_calloc(sizeof(VlPhow), 1) ;
+  vl_size t ;
+  if (self == NULL) return NULL ;
+
+  assert(color >= VL_PHOW_GRAY && color < VL_PHOW_COLOR_NUM) ;
+
+  self->width = width ;
+  self->height = height ;
+  self->color = color ;
+  self->numChannels = (color == VL_PHOW_GRAY) ? 1 : 3 ;
+  self->step = 2 ;
+  self->magnif = 6 ;
+  self->windowSize = 1.5 ;
+  self->contrastThreshold = 0.005 ;
+  self->flatWindow = VL_TRUE ;
+  self->sharedGradients = VL_TRUE ;
+
+  self->dsift = vl_dsift_new ((int)width, (int)height) ;
+  self->smoothed = vl_malloc(sizeof(float) * width * height) ;
+  self->planeBuffer = vl_malloc(sizeof(float) * width * height * VL_PHOW_NUM_BIN_T) ;
+  if (color != VL_PHOW_GRAY) {
+    self->channels = vl_malloc(sizeof(float) * width * height * 3) ;
+  }
+  if (self->dsift == NULL || self->smoothed == NULL || self->planeBuffer == NULL ||
+      (color != VL_PHOW_GRAY && self->channels == NULL) ||
+      vl_phow_set_sizes(self, defaultSizes, 4)) {
+    vl_phow_delete(self) ;
+    return NULL ;
+  }
+  for (t = 0 ; t < VL_PHOW_NUM_BIN_T ; ++t) {
+    self->planes[t] = self->planeBuffer + t * width * height ;
+  }
+  return self ;
+}
+
+/** @brief Delete a PHOW extractor
+ ** @param self object.
+ **/
+
+void
+vl_phow_delete (VlPhow * self)
+{
+  if (self->dsift) vl_dsift_delete(self->dsift) ;
+  if (self->channels) vl_free(self->channels) ;
+  if (self->smoothed) vl_free(self->smoothed) ;
+  if (self->planeBuffer) vl_free(self->planeBuffer) ;
+  if (self->sizes) vl_free(self->sizes) ;
+  if (self->frames) vl_free(self->frames) ;
+  if (self->descrs) vl_free(self->descrs) ;
+  if (self->contrasts) vl_free(self->contrasts) ;
+  vl_free(self) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                    Colour spaces */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Convert an RGB image to HSV
+ ** @param hsv output channels.
+ ** @param rgb input channels.
+ ** @param numPixels number of pixels of a channel.
+ **
+ ** The conversion is the same as MATLAB @c rgb2hsv.
+ **/
+
+static void
+_vl_phow_rgb_to_hsv (float * hsv, float const * rgb, vl_size numPixels)
+{
+  vl_uindex i ;
+  for (i = 0 ; i < numPixels ; ++i) {
+    float r = rgb[i] ;
+    float g = rgb[i + numPixels] ;
+    float b = rgb[i + 2 * numPixels] ;
+    float v = VL_MAX(VL_MAX(r, g), b) ;
+    float delta = v - VL_MIN(VL_MIN(r, g), b) ;
+    float h = 0 ;
+    float s = 0 ;
+    if (delta > 0) {
+      /* later tests take precedence as in rgb2hsv */
+      if (b == v) {
+        h = 4 + (r - g) / delta ;
+      } else if (g == v) {
+        h = 2 + (b - r) / delta ;
+      } else {
+        h = (g - b) / delta ;
+      }
+      h /= 6 ;
+      if (h < 0) h += 1 ;
+      s = delta / v ;
+    }
+    hsv[i] = h ;
+    hsv[i + numPixels] = s ;
+    hsv[i + 2 * numPixels] = v ;
+  }
+}
+
+/** @internal @brief Convert an RGB image to opponent colours
+ ** @param opp output channels.
+ ** @param rgb input channels.
+ ** @param numPixels number of pixels of a channel.
+ **/
+
+static void
+_vl_phow_rgb_to_opponent (float * opp, float const * rgb, vl_size numPixels)
+{
+  float const alpha = (float) VL_PHOW_OPPONENT_ALPHA ;
+  float const c1 = (float) (1.0 / sqrt(2.0)) ;
+  float const c2 = (float) (1.0 / sqrt(6.0)) ;
+  vl_uindex i ;
+  for (i = 0 ; i < numPixels ; ++i) {
+    float r = rgb[i] ;
+    float g = rgb[i + numPixels] ;
+    float b = rgb[i + 2 * numPixels] ;
+    float mu = 0.3F * r + 0.59F * g + 0.11F * b ;
+    opp[i] = mu ;
+    opp[i + numPixels] = (r - g) * c1 + alpha * mu ;
+    opp[i + 2 * numPixels] = (r + g - 2 * b) * c2 + alpha * mu ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                          Process */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Set up the dense SIFT filter for a bin size
+ ** @param self object.
+ ** @param size bin size.
+ ** @param maxSize largest bin size.
+ **/
+
+static void
+_vl_phow_setup_dsift (VlPhow * self, vl_size size, vl_size maxSize)
+{
+  VlDsiftDescriptorGeometry geom = *vl_dsift_get_geometry(self->dsift) ;
+  int offset = (int) ((3 * (maxSize - size)) / 2) ;
+  geom.numBinT = VL_PHOW_NUM_BIN_T ;
+  geom.numBinX = 4 ;
+  geom.numBinY = 4 ;
+  geom.binSizeX = (int) size ;
+  geom.binSizeY = (int) size ;
+  vl_dsift_set_geometry(self->dsift, &geom) ;
+  vl_dsift_set_steps(self->dsift, (int) self->step, (int) self->step) ;
+  vl_dsift_set_bounds(self->dsift, offset, offset,
+                      (int) self->width - 1, (int) self->height - 1) ;
+  vl_dsift_set_flat_window(self->dsift, self->flatWindow) ;
+  vl_dsift_set_window_size(self->dsift, self->windowSize) ;
+}
+
+/** @internal @brief Compute the gradient planes of a channel
+ ** @param self object.
+ ** @param channel image channel.
+ ** @param size bin size (determines the smoothing).
+ **/
+
+static void
+_vl_phow_compute_planes (VlPhow * self, float const * channel, vl_size size)
+{
+  double sigma = (double) size / self->magnif ;
+  vl_imsmooth_f (self->smoothed, self->width,
+                 channel, self->width, self->height, self->width,
+                 sigma, sigma) ;
+  vl_dsift_compute_planes (self->dsift, self->planes, self->smoothed) ;
+}
+
+/** @brief Extract PHOW features
+ ** @param self object.
+ ** @param image image.
+ ** @return error code.
+ **
+ ** @a image has one channel for gray-scale images and three (red,
+ ** green and blue) for colour images, each of size @c width x @c
+ ** height (see @ref phow-usage). The function returns
+ ** ::VL_ERR_ALLOC if the feature buffers cannot be allocated.
+ **/
+
+int
+vl_phow_process (VlPhow * self, float const * image)
+{
+  vl_size const numPixels = self->width * self->height ;
+  vl_size const numChannels = self->numChannels ;
+  vl_size const descrSize = vl_phow_get_descriptor_size(self) ;
+  vl_size maxSize = 0 ;
+  vl_size minSize = (vl_size) -1 ;
+  vl_size numFrames = 0 ;
+  vl_uindex i, k, si ;
+
+  for (si = 0 ; si < self->numSizes ; ++si) {
+    maxSize = VL_MAX(maxSize, self->sizes[si]) ;
+    minSize = VL_MIN(minSize, self->sizes[si]) ;
+  }
+
+  /* count the frames and make room for them */
+  for (si = 0 ; si < self->numSizes ; ++si) {
+    _vl_phow_setup_dsift (self, self->sizes[si], maxSize) ;
+    numFrames += vl_dsift_get_keypoint_num(self->dsift) ;
+  }
+  if (numFrames > self->numFrameAlloc) {
+    if (self->frames) vl_free(self->frames) ;
+    if (self->descrs) vl_free(self->descrs) ;
+    if (self->contrasts) vl_free(self->contrasts) ;
+    self->frames = vl_malloc(sizeof(VlDsiftKeypoint) * numFrames) ;
+    self->descrs = vl_malloc(sizeof(float) * descrSize * numFrames) ;
+    self->contrasts = vl_malloc(sizeof(double) * numChannels * numFrames) ;
+    if (self->frames == NULL || self->descrs == NULL || self->contrasts == NULL) {
+      self->numFrameAlloc = 0 ;
+      self->numFrames = 0 ;
+      return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+    }
+    self->numFrameAlloc = numFrames ;
+  }
+  self->numFrames = numFrames ;
+
+  /* colour conversion */
+  switch (self->color) {
+    case VL_PHOW_GRAY :
+    case VL_PHOW_RGB :
+      break ;
+    case VL_PHOW_HSV :
+      _vl_phow_rgb_to_hsv (self->channels, image, numPixels) ;
+      image = self->channels ;
+      break ;
+    case VL_PHOW_OPPONENT :
+      _vl_phow_rgb_to_opponent (self->channels, image, numPixels) ;
+      image = self->channels ;
+      break ;
+    default:
+      assert(0) ;
+  }
+
+  /* extract the descriptors of each channel and bin size */
+  for (k = 0 ; k < numChannels ; ++k) {
+    float const * channel = image + k * numPixels ;
+    vl_size frameOffset = 0 ;
+
+    if (self->sharedGradients) {
+      _vl_phow_compute_planes (self, channel, minSize) ;
+    }
+
+    for (si = 0 ; si < self->numSizes ; ++si) {
+      vl_size size = self->sizes[si] ;
+      vl_size numSizeFrames ;
+      VlDsiftKeypoint const * frames ;
+      float const * descrs ;
+
+      if (! self->sharedGradients) {
+        _vl_phow_compute_planes (self, channel, size) ;
+      }
+      _vl_phow_setup_dsift (self, size, maxSize) ;
+      vl_dsift_process_planes (self->dsift, self->planes) ;
+
+      numSizeFrames = vl_dsift_get_keypoint_num(self->dsift) ;
+      frames = vl_dsift_get_keypoints(self->dsift) ;
+      descrs = vl_dsift_get_descriptors(self->dsift) ;
+      for (i = 0 ; i < numSizeFrames ; ++i) {
+        vl_uindex j = frameOffset + i ;
+        if (k == 0) {
+          self->frames[j] = frames[i] ;
+          self->frames[j].s = (double) size ;
+        }
+        self->contrasts[j * numChannels + k] = frames[i].norm ;
+        memcpy(self->descrs + j * descrSize + k * VL_PHOW_DESCRIPTOR_SIZE,
+               descrs + i * VL_PHOW_DESCRIPTOR_SIZE,
+               sizeof(float) * VL_PHOW_DESCRIPTOR_SIZE) ;
+      }
+      frameOffset += numSizeFrames ;
+    }
+  }
+
+  /* zero the descriptors of the low contrast features */
+  for (i = 0 ; i < numFrames ; ++i) {
+    double const * contrasts = self->contrasts + i * numChannels ;
+    double contrast ;
+    switch (self->color) {
+      case VL_PHOW_RGB :
+        contrast = (contrasts[0] + contrasts[1] + contrasts[2]) / 3 ;
+        break ;
+      case VL_PHOW_HSV :
+        contrast = contrasts[2] ;
+        break ;
+      default :
+        contrast = contrasts[0] ;
+        break ;
+    }
+    if (contrast < self->contrastThreshold) {
+      memset(self->descrs + i * descrSize, 0, sizeof(float) * descrSize) ;
+    }
+  }
+  return VL_ERR_OK ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                     Retrieve data and parameters */
+/* ---------------------------------------------------------------- */
+
+/** @brief Get the number of frames
+ ** @param self object.
+ ** @return number of frames extracted by the last ::vl_phow_process.
+ **/
+
+vl_size
+vl_phow_get_num_frames (VlPhow const * self)
+{
+  return self->numFrames ;
+}
+
+/** @brief Get the frames
+ ** @param self object.
+ ** @return frames extracted by the last ::vl_phow_process.
+ **/
+
+VlDsiftKeypoint const *
+vl_phow_get_frames (VlPhow const * self)
+{
+  return self->frames ;
+}
+
+/** @brief Get the descriptors
+ ** @param self object.
+ ** @return descriptors extracted by the last ::vl_phow_process.
+ **
+ ** The descriptors are stored one after the other, each of
+ ** ::vl_phow_get_descriptor_size elements.
+ **/
+
+float const *
+vl_phow_get_descriptors (VlPhow const * self)
+{
+  return self->descrs ;
+}
+
+/** @brief Get the size of a descriptor
+ ** @param self object.
+ ** @return size of a descriptor (128 times the number of channels).
+ **/
+
+vl_size
+vl_phow_get_descriptor_size (VlPhow const * self)
+{
+  return VL_PHOW_DESCRIPTOR_SIZE * self->numChannels ;
+}
+
+/** @brief Get the number of channels
+ ** @param self object.
+ ** @return number of channels.
+ **/
+
+vl_size
+vl_phow_get_num_channels (VlPhow const * self)
+{
+  return self->numChannels ;
+}
+
+/** @brief Get the colour space
+ ** @param self object.
+ ** @return colour space.
+ **/
+
+VlPhowColor
+vl_phow_get_color (VlPhow const * self)
+{
+  return self->color ;
+}
+
+/** @brief Get the bin sizes
+ ** @param self object.
+ ** @param numSizes number of bin sizes (output).
+ ** @return bin sizes.
+ **/
+
+vl_size const *
+vl_phow_get_sizes (VlPhow const * self, vl_size * numSizes)
+{
+  *numSizes = self->numSizes ;
+  return self->sizes ;
+}
+
+/** @brief Get the sampling step
+ ** @param self object.
+ ** @return step.
+ **/
+
+vl_size
+vl_phow_get_step (VlPhow const * self)
+{
+  return self->step ;
+}
+
+/** @brief Get the magnification factor
+ ** @param self object.
+ ** @return ratio of the bin size to the smoothing.
+ **/
+
+double
+vl_phow_get_magnif (VlPhow const * self)
+{
+  return self->magnif ;
+}
+
+/** @brief Get the window size
+ ** @param self object.
+ ** @return window size.
+ **/
+
+double
+vl_phow_get_window_size (VlPhow const * self)
+{
+  return self->windowSize ;
+}
+
+/** @brief Get the contrast threshold
+ ** @param self object.
+ ** @return threshold.
+ **/
+
+double
+vl_phow_get_contrast_threshold (VlPhow const * self)
+{
+  return self->contrastThreshold ;
+}
+
+/** @brief Get whether a flat window is used
+ ** @param self object.
+ ** @return @c true if a flat window is used.
+ **/
+
+vl_bool
+vl_phow_get_flat_window (VlPhow const * self)
+{
+  return self->flatWindow ;
+}
+
+/** @brief Get whether the gradients are shared across the bin sizes
+ ** @param self object.
+ ** @return @c true if the gradients are shared.
+ **/
+
+vl_bool
+vl_phow_get_shared_gradients (VlPhow const * self)
+{
+  return self->sharedGradients ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                   Set parameters */
+/* ---------------------------------------------------------------- */
+
+/** @brief Set the bin sizes
+ ** @param self object.
+ ** @param sizes bin sizes.
+ ** @param numSizes number of bin sizes.
+ ** @return error code.
+ **
+ ** The bin sizes must be positive. The function returns
+ ** ::VL_ERR_BAD_ARG if one of them is zero, and ::VL_ERR_ALLOC if the
+ ** sizes cannot be stored. In both cases the sizes are not changed.
+ **/
+
+int
+vl_phow_set_sizes (VlPhow * self, vl_size const * sizes, vl_size numSizes)
+{
+  vl_size * newSizes ;
+  vl_uindex i ;
+  assert(numSizes > 0) ;
+  for (i = 0 ; i < numSizes ; ++i) {
+    if (sizes[i] == 0) {
+      return vl_set_last_error(VL_ERR_BAD_ARG, "The bin sizes must be positive.") ;
+    }
+  }
+  newSizes = vl_malloc(sizeof(vl_size) * numSizes) ;
+  if (newSizes == NULL) {
+    return vl_set_last_error(VL_ERR_ALLOC, NULL) ;
+  }
+  memcpy(newSizes, sizes, sizeof(vl_size) * numSizes) ;
+  if (self->sizes) vl_free(self->sizes) ;
+  self->sizes = newSizes ;
+  self->numSizes = numSizes ;
+  return VL_ERR_OK ;
+}
+
+/** @brief Set the sampling step
+ ** @param self object.
+ ** @param step step.
+ **/
+
+void
+vl_phow_set_step (VlPhow * self, vl_size step)
+{
+  assert(step > 0) ;
+  self->step = step ;
+}
+
+/** @brief Set the magnification factor
+ ** @param self object.
+ ** @param magnif ratio of the bin size to the smoothing.
+ **/
+
+void
+vl_phow_set_magnif (VlPhow * self, double magnif)
+{
+  assert(magnif > 0) ;
+  self->magnif = magnif ;
+}
+
+/** @brief Set the window size
+ ** @param self object.
+ ** @param windowSize size of the Gaussian window in spatial bins.
+ **
+ ** @sa ::vl_dsift_set_window_size.
+ **/
+
+void
+vl_phow_set_window_size (VlPhow * self, double windowSize)
+{
+  self->windowSize = windowSize ;
+}
+
+/** @brief Set the contrast threshold
+ ** @param self object.
+ ** @param threshold threshold.
+ **/
+
+void
+vl_phow_set_contrast_threshold (VlPhow * self, double threshold)
+{
+  self->contrastThreshold = threshold ;
+}
+
+/** @brief Set whether a flat window is used
+ ** @param self object.
+ ** @param flatWindow @c true to use a flat window.
+ **
+ ** @sa ::vl_dsift_set_flat_window.
+ **/
+
+void
+vl_phow_set_flat_window (VlPhow * self, vl_bool flatWindow)
+{
+  self->flatWindow = flatWindow ;
+}
+
+/** @brief Set whether the gradients are shared across the bin sizes
+ ** @param self object.
+ ** @param sharedGradients @c true to share the gradients.
+ **
+ ** See @ref phow for the details.
+ **/
+
+void
+vl_phow_set_shared_gradients (VlPhow * self, vl_bool sharedGradients)
+{
+  self->sharedGradients = sharedGradients ;
+}
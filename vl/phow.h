@@ -0,0 +1,76 @@
+/** @file phow.h
+ ** @brief Pyramid histogram of visual words features (@ref phow)
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_PHOW_H
+#define VL_PHOW_H
+
+#include "generic.h"
+#include "dsift.h"
+
+/** @brief PHOW colour space */
+typedef enum _VlPhowColor
+{
+  VL_PHOW_GRAY = 1,   /**< gray-scale image (one channel). */
+  VL_PHOW_RGB,        /**< RGB channels. */
+  VL_PHOW_HSV,        /**< HSV channels. */
+  VL_PHOW_OPPONENT,   /**< opponent colour channels. */
+  VL_PHOW_COLOR_NUM
+} VlPhowColor ;
+
+typedef struct _VlPhow VlPhow ;
+
+/** @name Create and destroy
+ ** @{
+ **/
+VL_EXPORT VlPhow * vl_phow_new (vl_size width, vl_size height, VlPhowColor color) ;
+VL_EXPORT void vl_phow_delete (VlPhow * self) ;
+/** @} */
+
+/** @name Process data
+ ** @{
+ **/
+VL_EXPORT int vl_phow_process (VlPhow * self, float const * image) ;
+/** @} */
+
+/** @name Retrieve data and parameters
+ ** @{
+ **/
+VL_EXPORT vl_size vl_phow_get_num_frames (VlPhow const * self) ;
+VL_EXPORT VlDsiftKeypoint const * vl_phow_get_frames (VlPhow const * self) ;
+VL_EXPORT float const * vl_phow_get_descriptors (VlPhow const * self) ;
+VL_EXPORT vl_size vl_phow_get_descriptor_size (VlPhow const * self) ;
+VL_EXPORT vl_size vl_phow_get_num_channels (VlPhow const * self) ;
+VL_EXPORT VlPhowColor vl_phow_get_color (VlPhow const * self) ;
+VL_EXPORT vl_size const * vl_phow_get_sizes (VlPhow const * self, vl_size * numSizes) ;
+VL_EXPORT vl_size vl_phow_get_step (VlPhow const * self) ;
+VL_EXPORT double vl_phow_get_magnif (VlPhow const * self) ;
+VL_EXPORT double vl_phow_get_window_size (VlPhow const * self) ;
+VL_EXPORT double vl_phow_get_contrast_threshold (VlPhow const * self) ;
+VL_EXPORT vl_bool vl_phow_get_flat_window (VlPhow const * self) ;
+VL_EXPORT vl_bool vl_phow_get_shared_gradients (VlPhow const * self) ;
+/** @} */
+
+/** @name Set parameters
+ ** @{
+ **/
+VL_EXPORT int vl_phow_set_sizes (VlPhow * self, vl_size const * sizes, vl_size numSizes) ;
+VL_EXPORT void vl_phow_set_step (VlPhow * self, vl_size step) ;
+VL_EXPORT void vl_phow_set_magnif (VlPhow * self, double magnif) ;
+VL_EXPORT void vl_phow_set_window_size (VlPhow * self, double windowSize) ;
+VL_EXPORT void vl_phow_set_contrast_threshold (VlPhow * self, double threshold) ;
+VL_EXPORT void vl_phow_set_flat_window (VlPhow * self, vl_bool flatWindow) ;
+VL_EXPORT void vl_phow_set_shared_gradients (VlPhow * self, vl_bool sharedGradients) ;
+/** @} */
+
+/* VL_PHOW_H */
+#endif
@@ -198,6 +198,46 @@ vl_scalespace_get_octave_geometry (VlScaleSpace const * self, vl_index o)
 }
 
 
+/** @internal @brief Get the index of a level in ::VlScaleSpace::computed
+ ** @param self object.
+ ** @param o octave index.
+ ** @param s level index.
+ ** @return linear index of the level.
+ **/
+
+static vl_uindex
+_vl_scalespace_get_level_index (VlScaleSpace const *self, vl_index o, vl_index s)
+{
+  vl_size numLevels = self->geom.octaveLastSubdivision - self->geom.octaveFirstSubdivision + 1 ;
+  return (o - self->geom.firstOctave) * numLevels + (s - self->geom.octaveFirstSubdivision) ;
+}
+
+/** @internal @brief Get the data of a scale space level
+ ** @param self object.
+ ** @param o octave index.
+ ** @param s level index.
+ ** @return pointer to the data for octave @a o, level @a s.
+ **
+ ** The function allocates the octave if needed, but does not compute
+ ** the level in lazy mode (see ::vl_scalespace_get_level).
+ **/
+
+static float *
+_vl_scalespace_get_level_data (VlScaleSpace *self, vl_index o, vl_index s)
+{
+  VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self,o) ;
+  float ** octave = self->octaves + (o - self->geom.firstOctave) ;
+  if (*octave == NULL) {
+    vl_size numLevels = self->geom.octaveLastSubdivision - self->geom.octaveFirstSubdivision + 1 ;
+    *octave = vl_malloc(ogeom.width * ogeom.height * numLevels * sizeof(float)) ;
+    if (*octave == NULL) return NULL ;
+  }
+  return *octave + ogeom.width * ogeom.height * (s - self->geom.octaveFirstSubdivision) ;
+}
+
+static int
+_vl_scalespace_compute_level (VlScaleSpace *self, vl_index o, vl_index s) ;
+
 /** @brief Get the const data of a scale space level
  ** @param self object.
  ** @param o octave index.
@@ -207,21 +247,33 @@ vl_scalespace_get_octave_geometry (VlScaleSpace const * self, vl_index o)
  ** The octave index @a o must be in the range @c firstOctave
  ** to @c lastOctave and the scale index @a s must be in the
  ** range @c octaveFirstSubdivision to @c octaveLastSubdivision.
+ **
+ ** In lazy mode (::vl_scalespace_set_lazy), the level is computed
+ ** the first time it is accessed after ::vl_scalespace_put_image.
+ ** Despite the @c const qualifier, this modifies the object, so in
+ ** lazy mode the function must not be called concurrently on the
+ ** same object; access all the levels needed from one thread first,
+ ** or use the normal mode, to share the scale space among threads.
+ ** In lazy mode, the function returns @c NULL if the memory to
+ ** compute the level cannot be allocated.
  **/
 
 float *
 vl_scalespace_get_level (VlScaleSpace const *self, vl_index o, vl_index s)
 {
-  VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self,o) ;
-  float * octave ;
+  /* computing a level on demand does not change the logical state
+     of the object */
+  VlScaleSpace * mutableSelf = (VlScaleSpace *) self ;
   assert(self) ;
   assert(o >= self->geom.firstOctave) ;
   assert(o <= self->geom.lastOctave) ;
   assert(s >= self->geom.octaveFirstSubdivision) ;
   assert(s <= self->geom.octaveLastSubdivision) ;
 
-  octave = self->octaves[o - self->geom.firstOctave] ;
-  return octave + ogeom.width * ogeom.height * (s - self->geom.octaveFirstSubdivision) ;
+  if (self->image && ! self->computed[_vl_scalespace_get_level_index(self,o,s)]) {
+    if (_vl_scalespace_compute_level (mutableSelf, o, s) != VL_ERR_OK) return NULL ;
+  }
+  return _vl_scalespace_get_level_data (mutableSelf, o, s) ;
 }
 
 /** ------------------------------------------------------------------
@@ -314,29 +366,21 @@ copy_and_downsample
 VlScaleSpace *
 vl_scalespace_new_with_geometry (VlScaleSpaceGeometry geom)
 {
-  vl_index o ;
+  vl_size numOctaves = geom.lastOctave - geom.firstOctave + 1 ;
   vl_size totalNumLevels = geom.octaveLastSubdivision - geom.octaveFirstSubdivision + 1 ;
   VlScaleSpace *self = vl_calloc(1, sizeof(VlScaleSpace)) ;
   if (self == NULL) goto err_alloc_self ;
 
+  /* the octaves are allocated the first time they are used */
   self->geom = geom ;
-  self->octaves = vl_calloc(geom.lastOctave - geom.firstOctave + 1, sizeof(float*)) ;
+  self->octaves = vl_calloc(numOctaves, sizeof(float*)) ;
   if (self->octaves == NULL) goto err_alloc_octaves ;
-  for (o = self->geom.firstOctave ; o <= self->geom.lastOctave ; ++o) {
-    VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self,o) ;
-    vl_size octaveSize = ogeom.width * ogeom.height * totalNumLevels ;
-    self->octaves[o - self->geom.firstOctave] = vl_malloc(octaveSize * sizeof(float)) ;
-    if (self->octaves[o - self->geom.firstOctave] == NULL) goto err_alloc_octaves_o ;
-  }
+  self->computed = vl_calloc(numOctaves * totalNumLevels, sizeof(vl_bool)) ;
+  if (self->computed == NULL) goto err_alloc_computed ;
   return self ;
 
-err_alloc_smoother: ;
-err_alloc_octaves_o:
-  for (o = self->geom.firstOctave ; o <= self->geom.lastOctave ; ++o) {
-    if (self->octaves[o - self->geom.firstOctave]) {
-      vl_free(self->octaves[o - self->geom.firstOctave]) ;
-    }
-  }
+err_alloc_computed:
+  vl_free(self->octaves) ;
 err_alloc_octaves:
   vl_free(self) ;
 err_alloc_self:
@@ -434,6 +478,9 @@ vl_scalespace_delete (VlScaleSpace *self)
       }
       vl_free(self->octaves) ;
     }
+    if (self->computed) vl_free(self->computed) ;
+    if (self->image) vl_free(self->image) ;
+    if (self->scratch) vl_free(self->scratch) ;
     vl_free(self) ;
   }
 }
@@ -449,17 +496,33 @@ VlScaleSpace *
 vl_scalespace_clone (VlScaleSpace* self)
 {
   vl_index o  ;
+  vl_size numOctaves = self->geom.lastOctave - self->geom.firstOctave + 1 ;
+  vl_size totalNumLevels = self->geom.octaveLastSubdivision - self->geom.octaveFirstSubdivision + 1;
   VlScaleSpace *copy = vl_scalespace_clone_structure(self) ;
   if (copy == NULL) goto err_alloc_copy ;
   for (o = self->geom.firstOctave ; o <= self->geom.lastOctave ; ++o) {
     VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self,o) ;
-    vl_size totalNumLevels = self->geom.octaveLastSubdivision - self->geom.octaveFirstSubdivision + 1;
+    float * octave = self->octaves[o - self->geom.firstOctave] ;
+    if (octave == NULL) continue ;
+    if (_vl_scalespace_get_level_data(copy, o, self->geom.octaveFirstSubdivision) == NULL) {
+      goto err_alloc_data ;
+    }
     memcpy(copy->octaves[o - self->geom.firstOctave],
-           self->octaves[o - self->geom.firstOctave],
+           octave,
            ogeom.width * ogeom.height * totalNumLevels * sizeof(float)) ;
   }
+  memcpy(copy->computed, self->computed,
+         numOctaves * totalNumLevels * sizeof(vl_bool)) ;
+  if (self->image) {
+    copy->image = vl_malloc(self->geom.width * self->geom.height * sizeof(float)) ;
+    if (copy->image == NULL) goto err_alloc_data ;
+    memcpy(copy->image, self->image,
+           self->geom.width * self->geom.height * sizeof(float)) ;
+  }
   return copy ;
 
+err_alloc_data:
+  vl_scalespace_delete(copy) ;
 err_alloc_copy:
   /* todo: flag error */
   return NULL ;
@@ -476,7 +539,9 @@ err_alloc_copy:
 VlScaleSpace *
 vl_scalespace_clone_structure (VlScaleSpace* self)
 {
-  return vl_scalespace_new_with_geometry (self->geom) ;
+  VlScaleSpace *copy = vl_scalespace_new_with_geometry (self->geom) ;
+  if (copy) copy->lazy = self->lazy ;
+  return copy ;
 }
 
 double
@@ -485,34 +550,107 @@ vl_scalespace_get_level_sigma (VlScaleSpace const *self, vl_index o, vl_index s)
   return self->geom.sigma0 * pow(2.0, o + (double) s / self->geom.octaveResolution) ;
 }
 
+/** @brief Set the lazy mode
+ ** @param self ::VlScaleSpace object instance.
+ ** @param lazy whether to compute the levels on demand.
+ **
+ ** In lazy mode, ::vl_scalespace_put_image only stores a copy of the
+ ** image, and each level is computed the first time it is accessed
+ ** by ::vl_scalespace_get_level, together with the levels it depends
+ ** on that were not computed yet. A level is obtained by smoothing the
+ ** previous level of the same octave. The first level of octaves up
+ ** to 0 is obtained from the image, and the first level of the other
+ ** octaves from the previous octave. The octaves are allocated only
+ ** when one of their levels is computed.
+ **
+ ** Hence, for example, sampling a few coarse scales of a scale space
+ ** with @c firstOctave equal to -1 does not compute (nor allocate)
+ ** the upsampled octave. The result does not depend on the order in
+ ** which the levels are accessed. It is identical to the one of the
+ ** normal mode if @c firstOctave is not negative. Otherwise, the
+ ** octaves after the first one up to octave 0 are started from the
+ ** image rather than from the previous octave, and their levels and
+ ** the ones of the following octaves differ from the normal mode.
+ ** For @c firstOctave equal to -1, three levels per octave and
+ ** uniform noise with values in [0,1], the difference was measured
+ ** to be up to about 1e-2 at more than four pixels from the image
+ ** border and up to about 0.1 within four pixels of it (3.4e-3 and
+ ** 3.1e-2 for a smooth sinusoidal image). It is larger for finer
+ ** first octaves.
+ **
+ ** The mode affects the images passed to ::vl_scalespace_put_image
+ ** after this call.
+ **/
+
+void
+vl_scalespace_set_lazy (VlScaleSpace *self, vl_bool lazy)
+{
+  self->lazy = lazy ;
+}
+
+/** @brief Get the lazy mode
+ ** @param self ::VlScaleSpace object instance.
+ ** @return whether the levels are computed on demand.
+ ** @sa ::vl_scalespace_set_lazy
+ **/
+
+vl_bool
+vl_scalespace_get_lazy (VlScaleSpace const *self)
+{
+  return self->lazy ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Compute a level by smoothing a previous level
+ ** @param self ::VlScaleSpace object instance.
+ ** @param o octave.
+ ** @param s level to compute.
+ ** @param sp level to smooth (smaller than @a s).
+ ** @return error code.
+ **
+ ** The function fails with ::VL_ERR_ALLOC if the octave cannot be
+ ** allocated.
+ **/
+
+static int
+_vl_scalespace_smooth_level (VlScaleSpace *self, vl_index o, vl_index s, vl_index sp)
+{
+  VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, o) ;
+  double sigma = vl_scalespace_get_level_sigma(self, o, s) ;
+  double previousSigma = vl_scalespace_get_level_sigma(self, o, sp) ;
+  double deltaSigma = sqrtf(sigma*sigma - previousSigma*previousSigma) ;
+
+  float* level = _vl_scalespace_get_level_data (self, o, s) ;
+  float* previous = _vl_scalespace_get_level_data (self, o, sp) ;
+  if (level == NULL || previous == NULL) return VL_ERR_ALLOC ;
+  vl_imsmooth_f (level, ogeom.width,
+                 previous, ogeom.width, ogeom.height, ogeom.width,
+                 deltaSigma / ogeom.step, deltaSigma / ogeom.step) ;
+  self->computed[_vl_scalespace_get_level_index(self, o, s)] = VL_TRUE ;
+  return VL_ERR_OK ;
+}
 
 /** ------------------------------------------------------------------
  ** @internal @brief Fill octave startinf from first level
  ** @param self ::VlScaleSpace object instance.
  ** @param o octave to process.
  **
+ ** @return error code.
+ **
  ** The function takes the first level of octave @a o and iteratively
  ** smoothes it to obtain the other octave levels.
  **/
 
-void
+static int
 _vl_scalespace_fill_octave (VlScaleSpace *self, vl_index o)
 {
   vl_index s ;
-  VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, o) ;
-
   for(s = self->geom.octaveFirstSubdivision + 1 ;
       s <= self->geom.octaveLastSubdivision ; ++s) {
-    double sigma = vl_scalespace_get_level_sigma(self, o, s) ;
-    double previousSigma = vl_scalespace_get_level_sigma(self, o, s - 1) ;
-    double deltaSigma = sqrtf(sigma*sigma - previousSigma*previousSigma) ;
-
-    float* level = vl_scalespace_get_level (self, o, s) ;
-    float* previous = vl_scalespace_get_level (self, o, s-1) ;
-    vl_imsmooth_f (level, ogeom.width,
-                   previous, ogeom.width, ogeom.height, ogeom.width,
-                   deltaSigma / ogeom.step, deltaSigma / ogeom.step) ;
+    int err = _vl_scalespace_smooth_level (self, o, s, s - 1) ;
+    if (err) return err ;
   }
+  return VL_ERR_OK ;
 }
 
 /** ------------------------------------------------------------------
@@ -520,13 +658,16 @@ _vl_scalespace_fill_octave (VlScaleSpace *self, vl_index o)
  ** @param self ::VlScaleSpace object instance.
  ** @param image image data.
  ** @param o octave to start.
+ ** @return error code.
  **
  ** The function initializes the first level of octave @a o from
  ** image @a image. The dimensions of the image are the ones set
- ** during the creation of the ::VlScaleSpace object instance.
+ ** during the creation of the ::VlScaleSpace object instance. It
+ ** fails with ::VL_ERR_ALLOC if the octave or the scratch buffer
+ ** cannot be allocated.
  **/
 
-static void
+static int
 _vl_scalespace_start_octave_from_image (VlScaleSpace *self,
                                         float const *image,
                                         vl_index o)
@@ -542,17 +683,31 @@ _vl_scalespace_start_octave_from_image (VlScaleSpace *self,
 
   /*
    * Copy the image to self->geom.octaveFirstSubdivision of octave o, upscaling or
-   * downscaling as needed.
+   * downscaling as needed. When upscaling more than once, the
+   * intermediate images alternate between the level and a scratch
+   * buffer, so that the other octaves are not touched.
    */
 
-  level = vl_scalespace_get_level(self, VL_MAX(0, o), self->geom.octaveFirstSubdivision) ;
-  copy_and_downsample(level, image, self->geom.width, self->geom.height, VL_MAX(0, o)) ;
+  level = _vl_scalespace_get_level_data(self, o, self->geom.octaveFirstSubdivision) ;
+  if (level == NULL) return VL_ERR_ALLOC ;
 
-  for (op = -1 ; op >= o ; --op) {
-    VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, op + 1) ;
-    float *succLevel = vl_scalespace_get_level(self, op + 1, self->geom.octaveFirstSubdivision) ;
-    level = vl_scalespace_get_level(self, op, self->geom.octaveFirstSubdivision) ;
-    copy_and_upsample(level, succLevel, ogeom.width, ogeom.height) ;
+  if (o >= 0) {
+    copy_and_downsample(level, image, self->geom.width, self->geom.height, o) ;
+  } else {
+    float const * source = image ;
+    if (o < -1 && self->scratch == NULL) {
+      /* large enough for all the intermediate images */
+      VlScaleSpaceOctaveGeometry tgeom =
+        vl_scalespace_get_octave_geometry(self, self->geom.firstOctave + 1) ;
+      self->scratch = vl_malloc(tgeom.width * tgeom.height * sizeof(float)) ;
+      if (self->scratch == NULL) return VL_ERR_ALLOC ;
+    }
+    for (op = -1 ; op >= o ; --op) {
+      VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, op + 1) ;
+      float * destination = ((op - o) % 2 == 0) ? level : self->scratch ;
+      copy_and_upsample(destination, source, ogeom.width, ogeom.height) ;
+      source = destination ;
+    }
   }
 
   /*
@@ -567,23 +722,46 @@ _vl_scalespace_start_octave_from_image (VlScaleSpace *self,
   if (sigma > imageSigma) {
     VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, o) ;
     double deltaSigma = sqrt (sigma*sigma - imageSigma*imageSigma) ;
-    level = vl_scalespace_get_level (self, o, self->geom.octaveFirstSubdivision) ;
     vl_imsmooth_f (level, ogeom.width,
                    level, ogeom.width, ogeom.height, ogeom.width,
                    deltaSigma / ogeom.step, deltaSigma / ogeom.step) ;
   }
+  self->computed[_vl_scalespace_get_level_index(self, o, self->geom.octaveFirstSubdivision)] = VL_TRUE ;
+  return VL_ERR_OK ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Get the level of the previous octave used to start an octave
+ ** @param self ::VlScaleSpace object instance.
+ ** @return level index.
+ **
+ ** From the previous octave pick the level which is closer to
+ ** self->geom.octaveFirstSubdivision in this octave.
+ ** The is self->geom.octaveFirstSubdivision + self->numLevels since there are
+ ** self->numLevels levels in an octave, provided that
+ ** this value does not exceed self->geom.octaveLastSubdivision.
+ **/
+
+static vl_index
+_vl_scalespace_get_previous_level_index (VlScaleSpace const *self)
+{
+  return VL_MIN(self->geom.octaveFirstSubdivision
+                + (signed)self->geom.octaveResolution,
+                self->geom.octaveLastSubdivision) ;
 }
 
 /** ------------------------------------------------------------------
  ** @internal @brief Initialize the first level of an octave from the previous octave
  ** @param ::VlScaleSpace objet instance.
  ** @param o octave to initialize.
+ ** @return error code.
  **
  ** The function initializes the first level of octave @a o from the
- ** content of octave <code>o - 1</code>.
+ ** content of octave <code>o - 1</code>. It fails with
+ ** ::VL_ERR_ALLOC if an octave cannot be allocated.
  **/
 
-static void
+static int
 _vl_scalespace_start_octave_from_previous_octave (VlScaleSpace *self, vl_index o)
 {
   double sigma, prevSigma ;
@@ -595,19 +773,10 @@ _vl_scalespace_start_octave_from_previous_octave (VlScaleSpace *self, vl_index o
   assert(o > self->geom.firstOctave) ; /* must not be the first octave */
   assert(o <= self->geom.lastOctave) ;
 
-  /*
-   * From the previous octave pick the level which is closer to
-   * self->geom.octaveFirstSubdivision in this octave.
-   * The is self->geom.octaveFirstSubdivision + self->numLevels since there are
-   * self->numLevels levels in an octave, provided that
-   * this value does not exceed self->geom.octaveLastSubdivision.
-   */
-
-  prevLevelIndex = VL_MIN(self->geom.octaveFirstSubdivision
-                          + (signed)self->geom.octaveResolution,
-                          self->geom.octaveLastSubdivision) ;
-  prevLevel = vl_scalespace_get_level (self, o - 1, prevLevelIndex) ;
-  level = vl_scalespace_get_level (self, o, self->geom.octaveFirstSubdivision) ;
+  prevLevelIndex = _vl_scalespace_get_previous_level_index(self) ;
+  prevLevel = _vl_scalespace_get_level_data (self, o - 1, prevLevelIndex) ;
+  level = _vl_scalespace_get_level_data (self, o, self->geom.octaveFirstSubdivision) ;
+  if (prevLevel == NULL || level == NULL) return VL_ERR_ALLOC ;
   ogeom = vl_scalespace_get_octave_geometry(self, o - 1) ;
 
   copy_and_downsample (level, prevLevel, ogeom.width, ogeom.height, 1) ;
@@ -623,30 +792,105 @@ _vl_scalespace_start_octave_from_previous_octave (VlScaleSpace *self, vl_index o
   if (sigma > prevSigma) {
     VlScaleSpaceOctaveGeometry ogeom = vl_scalespace_get_octave_geometry(self, o) ;
     double deltaSigma = sqrt (sigma*sigma - prevSigma*prevSigma) ;
-    level = vl_scalespace_get_level (self, o, self->geom.octaveFirstSubdivision) ;
     vl_imsmooth_f (level, ogeom.width,
                    level, ogeom.width, ogeom.height, ogeom.width,
                    deltaSigma / ogeom.step, deltaSigma / ogeom.step) ;
   }
+  self->computed[_vl_scalespace_get_level_index(self, o, self->geom.octaveFirstSubdivision)] = VL_TRUE ;
+  return VL_ERR_OK ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal @brief Compute a level on demand
+ ** @param self ::VlScaleSpace object instance.
+ ** @param o octave.
+ ** @param s level.
+ ** @return error code.
+ **
+ ** The function computes the level (@a o, @a s) in lazy mode,
+ ** computing first the levels it depends on if needed (see
+ ** ::vl_scalespace_set_lazy). It fails with ::VL_ERR_ALLOC if the
+ ** memory is insufficient, in which case the level is not marked as
+ ** computed.
+ **/
+
+static int
+_vl_scalespace_compute_level (VlScaleSpace *self, vl_index o, vl_index s)
+{
+  vl_index firstLevel = self->geom.octaveFirstSubdivision ;
+  int err ;
+
+  assert(self->image) ;
+
+  if (s > firstLevel) {
+    /* smooth the previous level of the same octave */
+    if (! self->computed[_vl_scalespace_get_level_index(self, o, s - 1)]) {
+      err = _vl_scalespace_compute_level (self, o, s - 1) ;
+      if (err) return err ;
+    }
+    return _vl_scalespace_smooth_level (self, o, s, s - 1) ;
+  } else if (o == self->geom.firstOctave || o <= 0) {
+    /* start the octave from the image, without computing the
+       upsampled octaves that precede it */
+    return _vl_scalespace_start_octave_from_image (self, self->image, o) ;
+  } else {
+    /* start the octave from the previous one */
+    vl_index prevLevelIndex = _vl_scalespace_get_previous_level_index(self) ;
+    if (! self->computed[_vl_scalespace_get_level_index(self, o - 1, prevLevelIndex)]) {
+      err = _vl_scalespace_compute_level (self, o - 1, prevLevelIndex) ;
+      if (err) return err ;
+    }
+    return _vl_scalespace_start_octave_from_previous_octave (self, o) ;
+  }
 }
 
 /** ------------------------------------------------------------------
  ** @brief Initialise Scale space with new image
  ** @param self ::VlScaleSpace object instance.
  ** @param image image to process.
+ ** @return error code.
  **
  ** Compute the data of all the defined octaves and scales of the scale
- ** space @a self.
+ ** space @a self. In lazy mode (::vl_scalespace_set_lazy), the
+ ** function only copies the image and the levels are computed on
+ ** demand by ::vl_scalespace_get_level.
+ **
+ ** The function fails with ::VL_ERR_ALLOC if the memory to store the
+ ** octaves (or the copy of the image) cannot be allocated.
  **/
 
-void
+int
 vl_scalespace_put_image (VlScaleSpace *self, float const *image)
 {
   vl_index o ;
-  _vl_scalespace_start_octave_from_image(self, image, self->geom.firstOctave) ;
-  _vl_scalespace_fill_octave(self, self->geom.firstOctave) ;
+  int err ;
+  vl_size numLevels = (self->geom.lastOctave - self->geom.firstOctave + 1) *
+    (self->geom.octaveLastSubdivision - self->geom.octaveFirstSubdivision + 1) ;
+  memset(self->computed, 0, numLevels * sizeof(vl_bool)) ;
+
+  if (self->lazy) {
+    vl_size numPixels = self->geom.width * self->geom.height ;
+    if (self->image == NULL) {
+      self->image = vl_malloc(numPixels * sizeof(float)) ;
+      if (self->image == NULL) return VL_ERR_ALLOC ;
+    }
+    memcpy(self->image, image, numPixels * sizeof(float)) ;
+    return VL_ERR_OK ;
+  }
+
+  if (self->image) {
+    vl_free(self->image) ;
+    self->image = NULL ;
+  }
+  err = _vl_scalespace_start_octave_from_image(self, image, self->geom.firstOctave) ;
+  if (err) return err ;
+  err = _vl_scalespace_fill_octave(self, self->geom.firstOctave) ;
+  if (err) return err ;
   for (o = self->geom.firstOctave + 1 ; o <= self->geom.lastOctave ; ++o) {
-    _vl_scalespace_start_octave_from_previous_octave(self, o) ;
-    _vl_scalespace_fill_octave(self, o) ;
+    err = _vl_scalespace_start_octave_from_previous_octave(self, o) ;
+    if (err) return err ;
+    err = _vl_scalespace_fill_octave(self, o) ;
+    if (err) return err ;
   }
+  return VL_ERR_OK ;
 }
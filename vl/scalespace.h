@@ -45,7 +45,11 @@ typedef struct _VlScaleSpaceOctaveGeometry
 typedef struct _VlScaleSpace
 {
   VlScaleSpaceGeometry geom ; /**< Geometry of the scale space */
-  float **octaves ; /**< Data */
+  float **octaves ; /**< Data (allocated on first use) */
+  vl_bool *computed ; /**< Whether each level is up to date */
+  vl_bool lazy ; /**< Compute the levels on demand */
+  float *image ; /**< Copy of the input image (lazy mode) */
+  float *scratch ; /**< Buffer to upsample the image (allocated on first use) */
 } VlScaleSpace ;
 
 
@@ -70,10 +74,16 @@ VL_EXPORT VlScaleSpace *vl_scalespace_clone (VlScaleSpace* src);
 /** @name Process data
  ** @{
  **/
-VL_EXPORT void
+VL_EXPORT int
 vl_scalespace_put_image (VlScaleSpace *self, float const* image);
 /** @} */
 
+/** @name Set parameters
+ ** @{
+ **/
+VL_EXPORT void vl_scalespace_set_lazy (VlScaleSpace *self, vl_bool lazy) ;
+/** @} */
+
 /** @name Retrieve data and parameters
  ** @{
  **/
@@ -83,6 +93,7 @@ VL_EXPORT float *
 vl_scalespace_get_level (VlScaleSpace const *self, vl_index o, vl_index s) ;
 VL_EXPORT double
 vl_scalespace_get_level_sigma (VlScaleSpace const *self, vl_index o, vl_index s) ;
+VL_EXPORT vl_bool vl_scalespace_get_lazy (VlScaleSpace const *self) ;
 /** @} */
 
 /* VL_SCALESPACE_H */
@@ -261,7 +261,9 @@ To use a <b>SIFT filter</b> object:
 
 - Initialize a SIFT filter object with ::vl_sift_new(). The filter can
   be reused for multiple images of the same size (e.g. for an entire
-  video sequence).
+  video sequence). For images of different sizes, use
+  ::vl_sift_reset_size() to resize the filter rather than creating a
+  new one: the buffers are reallocated only when they need to grow.
 - For each octave in the scale space:
   - Compute the next octave of the DOG scale space using either
    ::vl_sift_process_first_octave() or ::vl_sift_process_next_octave()
@@ -273,6 +275,34 @@ To use a <b>SIFT filter</b> object:
       - Use ::vl_sift_calc_keypoint_descriptor() to get the keypoint descriptor.
 - Delete the SIFT filter by ::vl_sift_delete().
 
+Alternatively, ::vl_sift_extract() runs all the steps above for an
+image and returns all the frames and descriptors at once. This
+function uses multiple threads (@ref threads): the next octave is
+computed while the keypoints of the current one are detected, and
+orientations and descriptors are computed in parallel over
+keypoints. The result is identical to the one obtained by the loop
+above. For images too large to be processed at once,
+::vl_sift_extract_tiled() runs the same computation on overlapping
+tiles read on demand, with memory bounded by the tile size.
+
+To retain only the @c n strongest keypoints of each image (by
+absolute DoG response), set a <b>keypoint budget</b> with
+::vl_sift_set_keypoint_budget(). The filter keeps a bounded heap of
+the strongest keypoints found in the octaves processed so far, and
+::vl_sift_detect() discards the keypoints that do not make it into the
+heap, so that their orientations and descriptors are never computed.
+A keypoint returned for an octave can still be superseded by a
+stronger one in a later octave. ::vl_sift_extract() takes care of
+this and returns exactly the frames of the @c n strongest keypoints.
+
+Descriptors can also be produced in compact formats (8-bit and half
+precision) and with the RootSIFT normalization, written directly to
+a caller buffer. ::vl_sift_calc_keypoint_descriptor_format() computes
+one descriptor in a given format and
+::vl_sift_calc_keypoint_descriptors() computes several of them in
+parallel, storing them with an arbitrary stride (see
+::vl_sift_pack_descriptor() for the formats).
+
 To compute SIFT descriptors of custom keypoints, use
 ::vl_sift_calc_raw_descriptor().
 
@@ -515,6 +545,12 @@ then given by
 In post processing, the histogram is @f$ l^2 @f$ normalized, then
 clamped at 0.2, and @f$ l^2 @f$ normalized again.
 
+If the CPU supports them (and SIMD is enabled, see
+::vl_set_simd_enabled), the histogram is accumulated by SSE2 or AVX2
+instructions, processing several samples at once in single
+precision. The result equals the one of the scalar code up to
+rounding.
+
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
 @subsubsection sift-tech-descriptor-image Calculation in the image frame
 <!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
@@ -672,6 +708,9 @@ Gaussian window size is set to have standard deviation
 #include "sift.h"
 #include "imopv.h"
 #include "mathop.h"
+#include "threads.h"
+#include "sift_sse2.h"
+#include "sift_avx2.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -685,6 +724,7 @@ Gaussian window size is set to have standard deviation
 #define EXPN_SZ  256          /**< ::fast_expn table size @internal */
 #define EXPN_MAX 25.0         /**< ::fast_expn table max  @internal */
 double expn_tab [EXPN_SZ+1] ; /**< ::fast_expn table      @internal */
+static float expn_tab_f [EXPN_SZ+1] ; /**< ::fast_expn table (single precision) @internal */
 
 #define NBO 8
 #define NBP 4
@@ -730,6 +770,7 @@ fast_expn_init ()
   int k  ;
   for(k = 0 ; k < EXPN_SZ + 1 ; ++ k) {
     expn_tab [k] = exp (- (double) k * (EXPN_MAX / EXPN_SZ)) ;
+    expn_tab_f [k] = (float) expn_tab [k] ;
   }
 }
 
@@ -771,6 +812,51 @@ copy_and_upsample_rows
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Get a Gaussian filter from the cache
+ ** @param self  SIFT filter.
+ ** @param sigma standard deviation.
+ ** @return the cached filter.
+ **
+ ** The filter is computed and added to the cache the first time it is
+ ** requested. ::vl_sift_new fills the cache with all the filters used
+ ** to compute the scale space, so that no allocation takes place
+ ** while processing an image.
+ **/
+
+static VlSiftGaussFilter const *
+_vl_sift_get_gauss_filter (VlSiftFilt * self, double sigma)
+{
+  VlSiftGaussFilter * g ;
+  vl_uindex i, j ;
+  vl_sift_pix acc = 0 ;
+
+  for (i = 0 ; i < self->numGaussFilters ; ++i) {
+    if (self->gaussFilters[i].sigma == sigma) {
+      return self->gaussFilters + i ;
+    }
+  }
+
+  self->gaussFilters = vl_realloc (self->gaussFilters,
+                                   sizeof(VlSiftGaussFilter) *
+                                   (self->numGaussFilters + 1)) ;
+  g = self->gaussFilters + self->numGaussFilters ++ ;
+  g->sigma = sigma ;
+  g->width = VL_MAX(ceil(4.0 * sigma), 1) ;
+  g->filter = vl_malloc (sizeof(vl_sift_pix) * (2 * g->width + 1)) ;
+
+  for (j = 0 ; j < 2 * g->width + 1 ; ++j) {
+    vl_sift_pix d = ((vl_sift_pix)((signed)j - (signed)g->width)) / ((vl_sift_pix)sigma) ;
+    g->filter[j] = (vl_sift_pix) exp (- 0.5 * (d*d)) ;
+    acc += g->filter[j] ;
+  }
+  for (j = 0 ; j < 2 * g->width + 1 ; ++j) {
+    g->filter[j] /= acc ;
+  }
+  return g ;
+}
+
 /** ------------------------------------------------------------------
  ** @internal
  ** @brief Smooth an image
@@ -792,40 +878,18 @@ _vl_sift_smooth (VlSiftFilt * self,
                  vl_size height,
                  double sigma)
 {
-  /* prepare Gaussian filter */
-  if (self->gaussFilterSigma != sigma) {
-    vl_uindex j ;
-    vl_sift_pix acc = 0 ;
-    if (self->gaussFilter) vl_free (self->gaussFilter) ;
-    self->gaussFilterWidth = VL_MAX(ceil(4.0 * sigma), 1) ;
-    self->gaussFilterSigma = sigma ;
-    self->gaussFilter = vl_malloc (sizeof(vl_sift_pix) * (2 * self->gaussFilterWidth + 1)) ;
-
-    for (j = 0 ; j < 2 * self->gaussFilterWidth + 1 ; ++j) {
-      vl_sift_pix d = ((vl_sift_pix)((signed)j - (signed)self->gaussFilterWidth)) / ((vl_sift_pix)sigma) ;
-      self->gaussFilter[j] = (vl_sift_pix) exp (- 0.5 * (d*d)) ;
-      acc += self->gaussFilter[j] ;
-    }
-    for (j = 0 ; j < 2 * self->gaussFilterWidth + 1 ; ++j) {
-      self->gaussFilter[j] /= acc ;
-    }
-  }
-
-  if (self->gaussFilterWidth == 0) {
-    memcpy (outputImage, inputImage, sizeof(vl_sift_pix) * width * height) ;
-    return ;
-  }
+  VlSiftGaussFilter const * g = _vl_sift_get_gauss_filter (self, sigma) ;
 
   vl_imconvcol_vf (tempImage, height,
                    inputImage, width, height, width,
-                   self->gaussFilter,
-                   - self->gaussFilterWidth, self->gaussFilterWidth,
+                   g->filter,
+                   - g->width, g->width,
                    1, VL_PAD_BY_CONTINUITY | VL_TRANSPOSE) ;
 
   vl_imconvcol_vf (outputImage, width,
                    tempImage, height, width, height,
-                   self->gaussFilter,
-                   - self->gaussFilterWidth, self->gaussFilterWidth,
+                   g->filter,
+                   - g->width, g->width,
                    1, VL_PAD_BY_CONTINUITY | VL_TRANSPOSE) ;
 }
 
@@ -864,6 +928,110 @@ copy_and_downsample
   }
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute the levels of an octave
+ **
+ ** @param f      SIFT filter.
+ ** @param octave octave buffer.
+ ** @param temp   temporary buffer.
+ ** @param w      octave width.
+ ** @param h      octave height.
+ **
+ ** The function smooths level @c s_min of the octave @a octave
+ ** incrementally to obtain the levels from @c s_min+1 to @c s_max.
+ **/
+
+static void
+_vl_sift_fill_octave (VlSiftFilt * f,
+                      vl_sift_pix * octave,
+                      vl_sift_pix * temp,
+                      int w, int h)
+{
+  int s ;
+  for(s = f->s_min + 1 ; s <= f->s_max ; ++s) {
+    double sd = f->dsigma0 * pow (f->sigmak, s) ;
+    _vl_sift_smooth (f,
+                     octave + w * h * (s - f->s_min), temp,
+                     octave + w * h * (s - 1 - f->s_min), w, h, sd) ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute the first level of an octave from the previous one
+ **
+ ** @param f        SIFT filter.
+ ** @param octave   octave buffer (output).
+ ** @param temp     temporary buffer.
+ ** @param previous previous octave buffer.
+ ** @param w        previous octave width.
+ ** @param h        previous octave height.
+ **
+ ** @a octave and @a previous can be the same buffer.
+ **/
+
+static void
+_vl_sift_start_next_octave (VlSiftFilt * f,
+                            vl_sift_pix * octave,
+                            vl_sift_pix * temp,
+                            vl_sift_pix const * previous,
+                            int w, int h)
+{
+  int S = f->S ;
+  int s_min = f->s_min ;
+  int s_best = VL_MIN(s_min + S, f->s_max) ;
+  double sa, sb ;
+
+  copy_and_downsample (octave, previous + w * h * (s_best - s_min), w, h, 1) ;
+
+  sa = f->sigma0 * powf (f->sigmak, s_min     ) ;
+  sb = f->sigma0 * powf (f->sigmak, s_best - S) ;
+
+  if (sa > sb) {
+    double sd = sqrt (sa*sa - sb*sb) ;
+    _vl_sift_smooth (f, octave, temp, octave, w / 2, h / 2, sd) ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Fill the Gaussian filter cache
+ ** @param f SIFT filter.
+ **
+ ** The function computes the filters used by
+ ** ::vl_sift_process_first_octave, ::_vl_sift_fill_octave and
+ ** ::_vl_sift_start_next_octave. These depend only on the scale
+ ** space geometry, not on the image size.
+ **/
+
+static void
+_vl_sift_init_gauss_filters (VlSiftFilt * f)
+{
+  int s ;
+  int s_best = VL_MIN(f->s_min + f->S, f->s_max) ;
+  double sa, sb ;
+
+  /* first level of the first octave */
+  sa = f->sigma0 * pow (f->sigmak,   f->s_min) ;
+  sb = f->sigman * pow (2.0,       - f->o_min) ;
+  if (sa > sb) {
+    _vl_sift_get_gauss_filter (f, sqrt (sa*sa - sb*sb)) ;
+  }
+
+  /* first level of the other octaves */
+  sa = f->sigma0 * powf (f->sigmak, f->s_min     ) ;
+  sb = f->sigma0 * powf (f->sigmak, s_best - f->S) ;
+  if (sa > sb) {
+    _vl_sift_get_gauss_filter (f, sqrt (sa*sa - sb*sb)) ;
+  }
+
+  /* other levels */
+  for(s = f->s_min + 1 ; s <= f->s_max ; ++s) {
+    _vl_sift_get_gauss_filter (f, f->dsigma0 * pow (f->sigmak, s)) ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Create a new SIFT filter
  **
@@ -880,7 +1048,7 @@ copy_and_downsample
  ** maximum possible value depending on the size of the image.
  **
  ** @return the new SIFT filter.
- ** @sa ::vl_sift_delete().
+ ** @sa ::vl_sift_delete(), ::vl_sift_reset_size().
  **/
 
 VL_EXPORT
@@ -891,40 +1059,27 @@ vl_sift_new (int width, int height,
 {
   VlSiftFilt *f = vl_malloc (sizeof(VlSiftFilt)) ;
 
-  int w   = VL_SHIFT_LEFT (width,  -o_min) ;
-  int h   = VL_SHIFT_LEFT (height, -o_min) ;
-  int nel = w * h ;
-
-  /* negative value O => calculate max. value */
-  if (noctaves < 0) {
-    noctaves = VL_MAX (floor (log2 (VL_MIN(width, height))) - o_min - 3, 1) ;
-  }
-
-  f-> width   = width ;
-  f-> height  = height ;
   f-> O       = noctaves ;
+  f-> autoO   = (noctaves < 0) ;
   f-> S       = nlevels ;
   f-> o_min   = o_min ;
   f-> s_min   = -1 ;
   f-> s_max   = nlevels + 1 ;
   f-> o_cur   = o_min ;
 
-  f-> temp    = vl_malloc (sizeof(vl_sift_pix) * nel    ) ;
-  f-> octave  = vl_malloc (sizeof(vl_sift_pix) * nel
-                        * (f->s_max - f->s_min + 1)  ) ;
-  f-> dog     = vl_malloc (sizeof(vl_sift_pix) * nel
-                        * (f->s_max - f->s_min    )  ) ;
-  f-> grad    = vl_malloc (sizeof(vl_sift_pix) * nel * 2
-                        * (f->s_max - f->s_min    )  ) ;
+  f-> temp    = NULL ;
+  f-> octave  = NULL ;
+  f-> dog     = NULL ;
+  f-> grad    = NULL ;
+  f-> numAllocatedPixels = 0 ;
 
   f-> sigman  = 0.5 ;
   f-> sigmak  = pow (2.0, 1.0 / nlevels) ;
   f-> sigma0  = 1.6 * f->sigmak ;
   f-> dsigma0 = f->sigma0 * sqrt (1.0 - 1.0 / (f->sigmak*f->sigmak)) ;
 
-  f-> gaussFilter = NULL ;
-  f-> gaussFilterSigma = 0 ;
-  f-> gaussFilterWidth = 0 ;
+  f-> gaussFilters = NULL ;
+  f-> numGaussFilters = 0 ;
 
   f-> octave_width  = 0 ;
   f-> octave_height = 0 ;
@@ -932,6 +1087,8 @@ vl_sift_new (int width, int height,
   f-> keys     = 0 ;
   f-> nkeys    = 0 ;
   f-> keys_res = 0 ;
+  f-> keyPeaks = NULL ;
+  f-> keyRemap = NULL ;
 
   f-> peak_thresh = 0.0 ;
   f-> edge_thresh = 10.0 ;
@@ -941,6 +1098,16 @@ vl_sift_new (int width, int height,
 
   f-> grad_o  = o_min - 1 ;
 
+  f-> keypointBudget = 0 ;
+  f-> imageKeypointBudget = 0 ;
+  f-> budgetHeap = NULL ;
+  f-> budgetHeapNumNodes = 0 ;
+  f-> budgetHeapSize = 0 ;
+  f-> budgetNumKeys = 0 ;
+
+  vl_sift_reset_size (f, width, height) ;
+  _vl_sift_init_gauss_filters (f) ;
+
   /* initialize fast_expn stuff */
   fast_expn_init () ;
 
@@ -960,16 +1127,81 @@ void
 vl_sift_delete (VlSiftFilt* f)
 {
   if (f) {
+    vl_uindex i ;
     if (f->keys) vl_free (f->keys) ;
+    if (f->keyPeaks) vl_free (f->keyPeaks) ;
+    if (f->keyRemap) vl_free (f->keyRemap) ;
     if (f->grad) vl_free (f->grad) ;
     if (f->dog) vl_free (f->dog) ;
     if (f->octave) vl_free (f->octave) ;
     if (f->temp) vl_free (f->temp) ;
-    if (f->gaussFilter) vl_free (f->gaussFilter) ;
+    for (i = 0 ; i < f->numGaussFilters ; ++i) {
+      vl_free (f->gaussFilters[i].filter) ;
+    }
+    if (f->gaussFilters) vl_free (f->gaussFilters) ;
+    if (f->budgetHeap) vl_free (f->budgetHeap) ;
     vl_free (f) ;
   }
 }
 
+/** -------------------------------------------------------------------
+ ** @brief Change the image size of a SIFT filter
+ **
+ ** @param f      SIFT filter.
+ ** @param width  new image width.
+ ** @param height new image height.
+ **
+ ** The function prepares @a f to process images of the specified
+ ** size, as if it had been created by ::vl_sift_new with the same
+ ** scale space geometry and parameters. The scale space buffers are
+ ** reallocated only if they are too small for the new size and the
+ ** Gaussian filters are preserved. This makes processing a stream of
+ ** images of varying size cheaper than creating a new filter for
+ ** each of them.
+ **
+ ** If the filter was created with a negative number of octaves, the
+ ** number of octaves is recomputed for the new size. The keypoints
+ ** and the gradient of the current octave are discarded.
+ **/
+
+VL_EXPORT
+void
+vl_sift_reset_size (VlSiftFilt *f, int width, int height)
+{
+  vl_size w   = VL_SHIFT_LEFT (width,  - f->o_min) ;
+  vl_size h   = VL_SHIFT_LEFT (height, - f->o_min) ;
+  vl_size nel = w * h ;
+
+  f-> width   = width ;
+  f-> height  = height ;
+
+  /* negative value O => calculate max. value */
+  if (f->autoO) {
+    f-> O = VL_MAX (floor (log2 (VL_MIN(width, height))) - f->o_min - 3, 1) ;
+  }
+
+  if (nel > f->numAllocatedPixels) {
+    if (f->temp) vl_free (f->temp) ;
+    if (f->octave) vl_free (f->octave) ;
+    if (f->dog) vl_free (f->dog) ;
+    if (f->grad) vl_free (f->grad) ;
+    f-> temp    = vl_malloc (sizeof(vl_sift_pix) * nel    ) ;
+    f-> octave  = vl_malloc (sizeof(vl_sift_pix) * nel
+                          * (f->s_max - f->s_min + 1)  ) ;
+    f-> dog     = vl_malloc (sizeof(vl_sift_pix) * nel
+                          * (f->s_max - f->s_min    )  ) ;
+    f-> grad    = vl_malloc (sizeof(vl_sift_pix) * nel * 2
+                          * (f->s_max - f->s_min    )  ) ;
+    f-> numAllocatedPixels = nel ;
+  }
+
+  f-> o_cur         = f->o_min ;
+  f-> octave_width  = 0 ;
+  f-> octave_height = 0 ;
+  f-> nkeys         = 0 ;
+  f-> grad_o        = f->o_min - 1 ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Start processing a new image
  **
@@ -978,10 +1210,13 @@ vl_sift_delete (VlSiftFilt* f)
  **
  ** The function starts processing a new image by computing its
  ** Gaussian scale space at the lower octave. It also empties the
- ** internal keypoint buffer.
+ ** internal keypoint buffer. The keypoint budget
+ ** (::vl_sift_set_keypoint_budget) in effect for the image is fixed
+ ** here.
  **
  ** @return error code. The function returns ::VL_ERR_EOF if there are
- ** no more octaves to process.
+ ** no more octaves to process and ::VL_ERR_ALLOC if the keypoint
+ ** budget cannot be allocated.
  **
  ** @sa ::vl_sift_process_next_octave().
  **/
@@ -990,7 +1225,7 @@ VL_EXPORT
 int
 vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
 {
-  int o, s, h, w ;
+  int o, h, w ;
   double sa, sb ;
   vl_sift_pix *octave ;
 
@@ -1000,15 +1235,32 @@ vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
   int height          = f-> height ;
   int o_min           = f-> o_min ;
   int s_min           = f-> s_min ;
-  int s_max           = f-> s_max ;
   double sigma0       = f-> sigma0 ;
   double sigmak       = f-> sigmak ;
   double sigman       = f-> sigman ;
-  double dsigma0      = f-> dsigma0 ;
 
-  /* restart from the first */
+  /* restart from the first; the gradient of the previous image is
+     stale even if it was computed for the same octave */
   f->o_cur = o_min ;
   f->nkeys = 0 ;
+  f->grad_o = o_min - 1 ;
+
+  /* reset the keypoint budget; the budget is fixed for the whole
+     image, so that the heap cannot be outgrown by later octaves */
+  if (f->budgetHeapSize < f->keypointBudget) {
+    if (f->budgetHeap) vl_free (f->budgetHeap) ;
+    f->budgetHeap = vl_malloc (sizeof(VlSiftBudgetEntry) * f->keypointBudget) ;
+    if (f->budgetHeap == NULL) {
+      f->budgetHeapSize = 0 ;
+      f->imageKeypointBudget = 0 ;
+      return vl_set_last_error (VL_ERR_ALLOC,
+                                "Could not allocate the keypoint budget.") ;
+    }
+    f->budgetHeapSize = f->keypointBudget ;
+  }
+  f->imageKeypointBudget = f->keypointBudget ;
+  f->budgetHeapNumNodes = 0 ;
+  f->budgetNumKeys = 0 ;
   w = f-> octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
   h = f-> octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
 
@@ -1068,12 +1320,7 @@ vl_sift_process_first_octave (VlSiftFilt *f, vl_sift_pix const *im)
    *                                          Compute the first octave
    * -------------------------------------------------------------- */
 
-  for(s = s_min + 1 ; s <= s_max ; ++s) {
-    double sd = dsigma0 * pow (sigmak, s) ;
-    _vl_sift_smooth (f, vl_sift_get_octave(f, s), temp,
-                     vl_sift_get_octave(f, s - 1), w, h, sd) ;
-  }
-
+  _vl_sift_fill_octave (f, octave, temp, w, h) ;
   return VL_ERR_OK ;
 }
 
@@ -1097,59 +1344,100 @@ int
 vl_sift_process_next_octave (VlSiftFilt *f)
 {
 
-  int s, h, w, s_best ;
-  double sa, sb ;
-  vl_sift_pix *octave, *pt ;
-
-  /* shortcuts */
-  vl_sift_pix *temp   = f-> temp ;
-  int O               = f-> O ;
-  int S               = f-> S ;
-  int o_min           = f-> o_min ;
-  int s_min           = f-> s_min ;
-  int s_max           = f-> s_max ;
-  double sigma0       = f-> sigma0 ;
-  double sigmak       = f-> sigmak ;
-  double dsigma0      = f-> dsigma0 ;
+  int h, w ;
+  vl_sift_pix *octave ;
 
   /* is there another octave ? */
-  if (f->o_cur == o_min + O - 1)
+  if (f->o_cur == f->o_min + f->O - 1)
     return VL_ERR_EOF ;
 
-  /* retrieve base */
-  s_best = VL_MIN(s_min + S, s_max) ;
+  /* next octave */
   w      = vl_sift_get_octave_width  (f) ;
   h      = vl_sift_get_octave_height (f) ;
-  pt     = vl_sift_get_octave        (f, s_best) ;
-  octave = vl_sift_get_octave        (f, s_min) ;
-
-  /* next octave */
-  copy_and_downsample (octave, pt, w, h, 1) ;
+  octave = vl_sift_get_octave        (f, f->s_min) ;
+  _vl_sift_start_next_octave (f, octave, f->temp, octave, w, h) ;
 
   f-> o_cur            += 1 ;
   f-> nkeys             = 0 ;
   w = f-> octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
   h = f-> octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
 
-  sa = sigma0 * powf (sigmak, s_min     ) ;
-  sb = sigma0 * powf (sigmak, s_best - S) ;
-
-  if (sa > sb) {
-    double sd = sqrt (sa*sa - sb*sb) ;
-    _vl_sift_smooth (f, octave, temp, octave, w, h, sd) ;
-  }
-
   /* ------------------------------------------------------------------
    *                                                        Fill octave
    * --------------------------------------------------------------- */
 
-  for(s = s_min + 1 ; s <= s_max ; ++s) {
-    double sd = dsigma0 * pow (sigmak, s) ;
-    _vl_sift_smooth (f, vl_sift_get_octave(f, s), temp,
-                     vl_sift_get_octave(f, s - 1), w, h, sd) ;
+  _vl_sift_fill_octave (f, octave, f->temp, w, h) ;
+  return VL_ERR_OK ;
+}
+
+/** @internal @brief Compare budget entries (weaker entries come first) */
+
+VL_INLINE float
+_vl_sift_budget_cmp (VlSiftBudgetEntry const *a, VlSiftBudgetEntry const *b)
+{
+  if (a->score != b->score) return a->score - b->score ;
+  /* break ties in favor of the keypoints found first */
+  return (a->id > b->id) ? -1.0F : ((a->id < b->id) ? 1.0F : 0.0F) ;
+}
+
+#define VL_HEAP_prefix     vl_sift_budget_heap
+#define VL_HEAP_type       VlSiftBudgetEntry
+#define VL_HEAP_cmp(v,x,y) _vl_sift_budget_cmp((v)+(x),(v)+(y))
+#include "heap-def.h"
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Apply the keypoint budget to the detected keypoints
+ **
+ ** @param f SIFT filter.
+ **
+ ** The function adds the keypoints of the current octave to the
+ ** budget heap, which retains the @c imageKeypointBudget strongest
+ ** keypoints found so far, and removes from the keypoint list the
+ ** ones that do not make it into the heap. The keypoints retained
+ ** are given consecutive ids starting from @c budgetNumKeys.
+ **/
+
+static void
+_vl_sift_apply_budget (VlSiftFilt *f)
+{
+  vl_uindex base = f->budgetNumKeys ;
+  vl_uindex * remap = f->keyRemap ;
+  vl_uindex i, n = 0 ;
+
+  if (f->nkeys == 0) return ;
+
+  for (i = 0 ; i < (unsigned) f->nkeys ; ++ i) {
+    VlSiftBudgetEntry entry ;
+    entry.score = vl_abs_f (f->keyPeaks[i]) ;
+    entry.id = base + i ;
+    if (f->budgetHeapNumNodes < f->imageKeypointBudget) {
+      f->budgetHeap [f->budgetHeapNumNodes] = entry ;
+      vl_sift_budget_heap_push (f->budgetHeap, &f->budgetHeapNumNodes) ;
+    } else if (_vl_sift_budget_cmp (&entry, f->budgetHeap) > 0) {
+      /* replace the weakest keypoint */
+      f->budgetHeap [0] = entry ;
+      vl_sift_budget_heap_update (f->budgetHeap, f->budgetHeapNumNodes, 0) ;
+    }
   }
 
-  return VL_ERR_OK ;
+  /* keep the keypoints of this octave that are in the heap */
+  for (i = 0 ; i < (unsigned) f->nkeys ; ++ i) remap [i] = (vl_uindex) -1 ;
+  for (i = 0 ; i < f->budgetHeapNumNodes ; ++ i) {
+    if (f->budgetHeap[i].id >= base) remap [f->budgetHeap[i].id - base] = 0 ;
+  }
+  for (i = 0 ; i < (unsigned) f->nkeys ; ++ i) {
+    if (remap [i] == (vl_uindex) -1) continue ;
+    remap [i] = n ;
+    f->keys [n ++] = f->keys [i] ;
+  }
+  for (i = 0 ; i < f->budgetHeapNumNodes ; ++ i) {
+    vl_uindex id = f->budgetHeap[i].id ;
+    if (id >= base) f->budgetHeap[i].id = base + remap [id - base] ;
+  }
+
+  f->nkeys = (int) n ;
+  f->budgetNumKeys = base + n ;
 }
 
 /** ------------------------------------------------------------------
@@ -1159,6 +1447,11 @@ vl_sift_process_next_octave (VlSiftFilt *f)
  ** internal keypoint buffer. Keypoints can be retrieved by
  ** ::vl_sift_get_keypoints().
  **
+ ** If a keypoint budget is set (::vl_sift_set_keypoint_budget), only
+ ** the keypoints that are among the strongest found so far in the
+ ** image are retained. Note that these may still be superseded by
+ ** stronger keypoints in the following octaves.
+ **
  ** @param f SIFT filter.
  **/
 
@@ -1252,9 +1545,15 @@ vl_sift_detect (VlSiftFilt * f)
               f->keys = vl_realloc (f->keys,
                                     f->keys_res *
                                     sizeof(VlSiftKeypoint)) ;
+              f->keyPeaks = vl_realloc (f->keyPeaks,
+                                        f->keys_res * sizeof(float)) ;
+              f->keyRemap = vl_realloc (f->keyRemap,
+                                        f->keys_res * sizeof(vl_uindex)) ;
             } else {
               f->keys = vl_malloc (f->keys_res *
                                    sizeof(VlSiftKeypoint)) ;
+              f->keyPeaks = vl_malloc (f->keys_res * sizeof(float)) ;
+              f->keyRemap = vl_malloc (f->keys_res * sizeof(vl_uindex)) ;
             }
           }
 
@@ -1434,6 +1733,7 @@ vl_sift_detect (VlSiftFilt * f)
         k-> x     = xn * xper ;
         k-> y     = yn * xper ;
         k-> sigma = f->sigma0 * pow (2.0, sn/f->S) * xper ;
+        f->keyPeaks [k - f->keys] = (float) val ;
         ++ k ;
       }
 
@@ -1442,105 +1742,132 @@ vl_sift_detect (VlSiftFilt * f)
 
   /* update keypoint count */
   f-> nkeys = (int)(k - f->keys) ;
+
+  if (f->imageKeypointBudget > 0) {
+    _vl_sift_apply_budget (f) ;
+  }
 }
 
 
 /** ------------------------------------------------------------------
  ** @internal
- ** @brief Update gradients to current GSS octave
+ ** @brief Compute the gradient of a level of the current octave
  **
  ** @param f SIFT filter.
- **
- ** The function makes sure that the gradient buffer is up-to-date
- ** with the current GSS data.
- **
- ** @remark The minimum octave size is 2x2xS.
+ ** @param s scale level (in the range @c s_min+1 to @c s_max-2).
  **/
 
 static void
-update_gradient (VlSiftFilt *f)
+_vl_sift_update_gradient_level (VlSiftFilt *f, int s)
 {
   int       s_min = f->s_min ;
-  int       s_max = f->s_max ;
   int       w     = vl_sift_get_octave_width  (f) ;
   int       h     = vl_sift_get_octave_height (f) ;
   int const xo    = 1 ;
   int const yo    = w ;
   int const so    = h * w ;
-  int y, s ;
-
-  if (f->grad_o == f->o_cur) return ;
-
-  for (s  = s_min + 1 ;
-       s <= s_max - 2 ; ++ s) {
-
-    vl_sift_pix *src, *end, *grad, gx, gy ;
+  int y ;
+  vl_sift_pix *src, *end, *grad, gx, gy ;
 
 #define SAVE_BACK                                                       \
-    *grad++ = vl_fast_sqrt_f (gx*gx + gy*gy) ;                          \
-    *grad++ = vl_mod_2pi_f   (vl_fast_atan2_f (gy, gx) + 2*VL_PI) ;     \
-    ++src ;                                                             \
+  *grad++ = vl_fast_sqrt_f (gx*gx + gy*gy) ;                            \
+  *grad++ = vl_mod_2pi_f   (vl_fast_atan2_f (gy, gx) + 2*VL_PI) ;       \
+  ++src ;                                                               \
+
+  src  = vl_sift_get_octave (f,s) ;
+  grad = f->grad + 2 * so * (s - s_min -1) ;
+
+  /* first pixel of the first row */
+  gx = src[+xo] - src[0] ;
+  gy = src[+yo] - src[0] ;
+  SAVE_BACK ;
+
+  /* middle pixels of the  first row */
+  end = (src - 1) + w - 1 ;
+  while (src < end) {
+    gx = 0.5 * (src[+xo] - src[-xo]) ;
+    gy =        src[+yo] - src[0] ;
+    SAVE_BACK ;
+  }
 
-    src  = vl_sift_get_octave (f,s) ;
-    grad = f->grad + 2 * so * (s - s_min -1) ;
+  /* last pixel of the first row */
+  gx = src[0]   - src[-xo] ;
+  gy = src[+yo] - src[0] ;
+  SAVE_BACK ;
 
-    /* first pixel of the first row */
-    gx = src[+xo] - src[0] ;
-    gy = src[+yo] - src[0] ;
+  for (y = 1 ; y < h -1 ; ++y) {
+
+    /* first pixel of the middle rows */
+    gx =        src[+xo] - src[0] ;
+    gy = 0.5 * (src[+yo] - src[-yo]) ;
     SAVE_BACK ;
 
-    /* middle pixels of the  first row */
+    /* middle pixels of the middle rows */
     end = (src - 1) + w - 1 ;
     while (src < end) {
       gx = 0.5 * (src[+xo] - src[-xo]) ;
-      gy =        src[+yo] - src[0] ;
+      gy = 0.5 * (src[+yo] - src[-yo]) ;
       SAVE_BACK ;
     }
 
-    /* last pixel of the first row */
-    gx = src[0]   - src[-xo] ;
-    gy = src[+yo] - src[0] ;
+    /* last pixel of the middle row */
+    gx =        src[0]   - src[-xo] ;
+    gy = 0.5 * (src[+yo] - src[-yo]) ;
     SAVE_BACK ;
+  }
 
-    for (y = 1 ; y < h -1 ; ++y) {
+  /* first pixel of the last row */
+  gx = src[+xo] - src[0] ;
+  gy = src[  0] - src[-yo] ;
+  SAVE_BACK ;
 
-      /* first pixel of the middle rows */
-      gx =        src[+xo] - src[0] ;
-      gy = 0.5 * (src[+yo] - src[-yo]) ;
-      SAVE_BACK ;
+  /* middle pixels of the last row */
+  end = (src - 1) + w - 1 ;
+  while (src < end) {
+    gx = 0.5 * (src[+xo] - src[-xo]) ;
+    gy =        src[0]   - src[-yo] ;
+    SAVE_BACK ;
+  }
 
-      /* middle pixels of the middle rows */
-      end = (src - 1) + w - 1 ;
-      while (src < end) {
-        gx = 0.5 * (src[+xo] - src[-xo]) ;
-        gy = 0.5 * (src[+yo] - src[-yo]) ;
-        SAVE_BACK ;
-      }
+  /* last pixel of the last row */
+  gx = src[0]   - src[-xo] ;
+  gy = src[0]   - src[-yo] ;
+  SAVE_BACK ;
+}
 
-      /* last pixel of the middle row */
-      gx =        src[0]   - src[-xo] ;
-      gy = 0.5 * (src[+yo] - src[-yo]) ;
-      SAVE_BACK ;
-    }
+/** @internal @brief Parallel body of ::update_gradient */
 
-    /* first pixel of the last row */
-    gx = src[+xo] - src[0] ;
-    gy = src[  0] - src[-yo] ;
-    SAVE_BACK ;
+static void
+_vl_sift_update_gradient_task (void * data,
+                               vl_uindex begin,
+                               vl_uindex end,
+                               vl_uindex slot VL_UNUSED)
+{
+  VlSiftFilt * f = data ;
+  vl_uindex s ;
+  for (s = begin ; s < end ; ++ s) {
+    _vl_sift_update_gradient_level (f, f->s_min + 1 + (int) s) ;
+  }
+}
 
-    /* middle pixels of the last row */
-    end = (src - 1) + w - 1 ;
-    while (src < end) {
-      gx = 0.5 * (src[+xo] - src[-xo]) ;
-      gy =        src[0]   - src[-yo] ;
-      SAVE_BACK ;
-    }
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Update gradients to current GSS octave
+ **
+ ** @param f SIFT filter.
+ **
+ ** The function makes sure that the gradient buffer is up-to-date
+ ** with the current GSS data. The levels are processed in parallel.
+ **
+ ** @remark The minimum octave size is 2x2xS.
+ **/
 
-    /* last pixel of the last row */
-    gx = src[0]   - src[-xo] ;
-    gy = src[0]   - src[-yo] ;
-    SAVE_BACK ;
-  }
+static void
+update_gradient (VlSiftFilt *f)
+{
+  if (f->grad_o == f->o_cur) return ;
+  vl_parallel_for (f->s_max - f->s_min - 2, 1,
+                   _vl_sift_update_gradient_task, f) ;
   f->grad_o = f->o_cur ;
 }
 
@@ -1731,6 +2058,75 @@ normalize_histogram
   return norm;
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Accumulate a SIFT descriptor by SIMD instructions
+ **
+ ** @param descr  SIFT descriptor (output).
+ ** @param window descriptor window.
+ **
+ ** The function accumulates the unnormalized histogram of the
+ ** gradient samples in @a window into @a descr using the best
+ ** vectorized implementation available. The samples are processed in
+ ** single precision, whereas the scalar code computes the sample
+ ** positions and the Gaussian window in double precision. The
+ ** normalized descriptors of the two differ by a few units in
+ ** @c 1e-6, which is up to about @c 1e-3 relative to the smallest
+ ** non-zero bins.
+ **
+ ** @return ::VL_FALSE if no vectorized implementation is available.
+ **/
+
+static vl_bool
+_vl_sift_accumulate_descriptor_simd (vl_sift_pix *descr,
+                                     VlSiftDescriptorWindow const *window)
+{
+#ifndef VL_DISABLE_AVX2
+  if (vl_cpu_has_avx2() && vl_cpu_has_fma() && vl_get_simd_enabled()) {
+    _vl_sift_accumulate_descriptor_avx2 (descr, window) ;
+    return VL_TRUE ;
+  }
+#endif
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2() && vl_get_simd_enabled()) {
+    _vl_sift_accumulate_descriptor_sse2 (descr, window) ;
+    return VL_TRUE ;
+  }
+#endif
+  return VL_FALSE ;
+}
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Initialize a SIFT descriptor window
+ **/
+
+static void
+_vl_sift_init_descriptor_window (VlSiftDescriptorWindow *window,
+                                 VlSiftFilt const *f,
+                                 vl_sift_pix const *pt, int yo,
+                                 int dxBegin, int dxEnd,
+                                 int dyBegin, int dyEnd,
+                                 double dx0, double dy0,
+                                 double SBP, double angle0)
+{
+  double wsigma = f->windowSize ;
+  window->grad = pt ;
+  window->yo = yo ;
+  window->dxBegin = dxBegin ;
+  window->dxEnd = dxEnd ;
+  window->dyBegin = dyBegin ;
+  window->dyEnd = dyEnd ;
+  window->dx0 = (float) dx0 ;
+  window->dy0 = (float) dy0 ;
+  window->ct = (float) (cos (angle0) / SBP) ;
+  window->st = (float) (sin (angle0) / SBP) ;
+  window->angle0 = (float) angle0 ;
+  window->expnScale = (float) ((EXPN_SZ / EXPN_MAX) / (2.0 * wsigma * wsigma)) ;
+  window->expnSize = (float) EXPN_SZ ;
+  window->expnTable = expn_tab_f ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Run the SIFT descriptor on raw data
  **
@@ -1796,6 +2192,7 @@ vl_sift_calc_raw_descriptor (VlSiftFilt const *f,
   int bin, dxi, dyi ;
   vl_sift_pix const *pt ;
   vl_sift_pix       *dpt ;
+  VlSiftDescriptorWindow window ;
 
   /* check bounds */
   if(xi    <  0               ||
@@ -1820,63 +2217,69 @@ vl_sift_calc_raw_descriptor (VlSiftFilt const *f,
    * Process pixels in the intersection of the image rectangle
    * (1,1)-(M-1,N-1) and the keypoint bounding box.
    */
-  for(dyi =  VL_MAX(- W,   - yi   ) ;
-      dyi <= VL_MIN(+ W, h - yi -1) ; ++ dyi) {
-
-    for(dxi =  VL_MAX(- W,   - xi   ) ;
-        dxi <= VL_MIN(+ W, w - xi -1) ; ++ dxi) {
-
-      /* retrieve */
-      vl_sift_pix mod   = *( pt + dxi*xo + dyi*yo + 0 ) ;
-      vl_sift_pix angle = *( pt + dxi*xo + dyi*yo + 1 ) ;
-      vl_sift_pix theta = vl_mod_2pi_f (angle - angle0) ;
-
-      /* fractional displacement */
-      vl_sift_pix dx = xi + dxi - x;
-      vl_sift_pix dy = yi + dyi - y;
-
-      /* get the displacement normalized w.r.t. the keypoint
-         orientation and extension */
-      vl_sift_pix nx = ( ct0 * dx + st0 * dy) / SBP ;
-      vl_sift_pix ny = (-st0 * dx + ct0 * dy) / SBP ;
-      vl_sift_pix nt = NBO * theta / (2 * VL_PI) ;
-
-      /* Get the Gaussian weight of the sample. The Gaussian window
-       * has a standard deviation equal to NBP/2. Note that dx and dy
-       * are in the normalized frame, so that -NBP/2 <= dx <=
-       * NBP/2. */
-      vl_sift_pix const wsigma = f->windowSize ;
-      vl_sift_pix win = fast_expn
-        ((nx*nx + ny*ny)/(2.0 * wsigma * wsigma)) ;
-
-      /* The sample will be distributed in 8 adjacent bins.
-         We start from the ``lower-left'' bin. */
-      int         binx = (int)vl_floor_f (nx - 0.5) ;
-      int         biny = (int)vl_floor_f (ny - 0.5) ;
-      int         bint = (int)vl_floor_f (nt) ;
-      vl_sift_pix rbinx = nx - (binx + 0.5) ;
-      vl_sift_pix rbiny = ny - (biny + 0.5) ;
-      vl_sift_pix rbint = nt - bint ;
-      int         dbinx ;
-      int         dbiny ;
-      int         dbint ;
-
-      /* Distribute the current sample into the 8 adjacent bins*/
-      for(dbinx = 0 ; dbinx < 2 ; ++dbinx) {
-        for(dbiny = 0 ; dbiny < 2 ; ++dbiny) {
-          for(dbint = 0 ; dbint < 2 ; ++dbint) {
-
-            if (binx + dbinx >= - (NBP/2) &&
-                binx + dbinx <    (NBP/2) &&
-                biny + dbiny >= - (NBP/2) &&
-                biny + dbiny <    (NBP/2) ) {
-              vl_sift_pix weight = win
-                * mod
-                * vl_abs_f (1 - dbinx - rbinx)
-                * vl_abs_f (1 - dbiny - rbiny)
-                * vl_abs_f (1 - dbint - rbint) ;
-
-              atd(binx+dbinx, biny+dbiny, (bint+dbint) % NBO) += weight ;
+  _vl_sift_init_descriptor_window (&window, f, pt, yo,
+                                   VL_MAX(- W,   - xi   ),
+                                   VL_MIN(+ W, w - xi -1),
+                                   VL_MAX(- W,   - yi   ),
+                                   VL_MIN(+ W, h - yi -1),
+                                   xi - x, yi - y, SBP, angle0) ;
+
+  if (! _vl_sift_accumulate_descriptor_simd (descr, &window)) {
+    for(dyi = window.dyBegin ; dyi <= window.dyEnd ; ++ dyi) {
+      for(dxi = window.dxBegin ; dxi <= window.dxEnd ; ++ dxi) {
+
+        /* retrieve */
+        vl_sift_pix mod   = *( pt + dxi*xo + dyi*yo + 0 ) ;
+        vl_sift_pix angle = *( pt + dxi*xo + dyi*yo + 1 ) ;
+        vl_sift_pix theta = vl_mod_2pi_f (angle - angle0) ;
+
+        /* fractional displacement */
+        vl_sift_pix dx = xi + dxi - x;
+        vl_sift_pix dy = yi + dyi - y;
+
+        /* get the displacement normalized w.r.t. the keypoint
+           orientation and extension */
+        vl_sift_pix nx = ( ct0 * dx + st0 * dy) / SBP ;
+        vl_sift_pix ny = (-st0 * dx + ct0 * dy) / SBP ;
+        vl_sift_pix nt = NBO * theta / (2 * VL_PI) ;
+
+        /* Get the Gaussian weight of the sample. The Gaussian window
+         * has a standard deviation equal to NBP/2. Note that dx and dy
+         * are in the normalized frame, so that -NBP/2 <= dx <=
+         * NBP/2. */
+        vl_sift_pix const wsigma = f->windowSize ;
+        vl_sift_pix win = fast_expn
+          ((nx*nx + ny*ny)/(2.0 * wsigma * wsigma)) ;
+
+        /* The sample will be distributed in 8 adjacent bins.
+           We start from the ``lower-left'' bin. */
+        int         binx = (int)vl_floor_f (nx - 0.5) ;
+        int         biny = (int)vl_floor_f (ny - 0.5) ;
+        int         bint = (int)vl_floor_f (nt) ;
+        vl_sift_pix rbinx = nx - (binx + 0.5) ;
+        vl_sift_pix rbiny = ny - (biny + 0.5) ;
+        vl_sift_pix rbint = nt - bint ;
+        int         dbinx ;
+        int         dbiny ;
+        int         dbint ;
+
+        /* Distribute the current sample into the 8 adjacent bins*/
+        for(dbinx = 0 ; dbinx < 2 ; ++dbinx) {
+          for(dbiny = 0 ; dbiny < 2 ; ++dbiny) {
+            for(dbint = 0 ; dbint < 2 ; ++dbint) {
+
+              if (binx + dbinx >= - (NBP/2) &&
+                  binx + dbinx <    (NBP/2) &&
+                  biny + dbiny >= - (NBP/2) &&
+                  biny + dbiny <    (NBP/2) ) {
+                vl_sift_pix weight = win
+                  * mod
+                  * vl_abs_f (1 - dbinx - rbinx)
+                  * vl_abs_f (1 - dbiny - rbiny)
+                  * vl_abs_f (1 - dbint - rbint) ;
+
+                atd(binx+dbinx, biny+dbiny, (bint+dbint) % NBO) += weight ;
+              }
             }
           }
         }
@@ -1985,6 +2388,7 @@ vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
   int bin, dxi, dyi ;
   vl_sift_pix const *pt ;
   vl_sift_pix       *dpt ;
+  VlSiftDescriptorWindow window ;
 
   /* check bounds */
   if(k->o  != f->o_cur        ||
@@ -2017,63 +2421,69 @@ vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
    * Process pixels in the intersection of the image rectangle
    * (1,1)-(M-1,N-1) and the keypoint bounding box.
    */
-  for(dyi =  VL_MAX (- W, 1 - yi    ) ;
-      dyi <= VL_MIN (+ W, h - yi - 2) ; ++ dyi) {
-
-    for(dxi =  VL_MAX (- W, 1 - xi    ) ;
-        dxi <= VL_MIN (+ W, w - xi - 2) ; ++ dxi) {
-
-      /* retrieve */
-      vl_sift_pix mod   = *( pt + dxi*xo + dyi*yo + 0 ) ;
-      vl_sift_pix angle = *( pt + dxi*xo + dyi*yo + 1 ) ;
-      vl_sift_pix theta = vl_mod_2pi_f (angle - angle0) ;
-
-      /* fractional displacement */
-      vl_sift_pix dx = xi + dxi - x;
-      vl_sift_pix dy = yi + dyi - y;
-
-      /* get the displacement normalized w.r.t. the keypoint
-         orientation and extension */
-      vl_sift_pix nx = ( ct0 * dx + st0 * dy) / SBP ;
-      vl_sift_pix ny = (-st0 * dx + ct0 * dy) / SBP ;
-      vl_sift_pix nt = NBO * theta / (2 * VL_PI) ;
-
-      /* Get the Gaussian weight of the sample. The Gaussian window
-       * has a standard deviation equal to NBP/2. Note that dx and dy
-       * are in the normalized frame, so that -NBP/2 <= dx <=
-       * NBP/2. */
-      vl_sift_pix const wsigma = f->windowSize ;
-      vl_sift_pix win = fast_expn
-        ((nx*nx + ny*ny)/(2.0 * wsigma * wsigma)) ;
-
-      /* The sample will be distributed in 8 adjacent bins.
-         We start from the ``lower-left'' bin. */
-      int         binx = (int)vl_floor_f (nx - 0.5) ;
-      int         biny = (int)vl_floor_f (ny - 0.5) ;
-      int         bint = (int)vl_floor_f (nt) ;
-      vl_sift_pix rbinx = nx - (binx + 0.5) ;
-      vl_sift_pix rbiny = ny - (biny + 0.5) ;
-      vl_sift_pix rbint = nt - bint ;
-      int         dbinx ;
-      int         dbiny ;
-      int         dbint ;
-
-      /* Distribute the current sample into the 8 adjacent bins*/
-      for(dbinx = 0 ; dbinx < 2 ; ++dbinx) {
-        for(dbiny = 0 ; dbiny < 2 ; ++dbiny) {
-          for(dbint = 0 ; dbint < 2 ; ++dbint) {
-
-            if (binx + dbinx >= - (NBP/2) &&
-                binx + dbinx <    (NBP/2) &&
-                biny + dbiny >= - (NBP/2) &&
-                biny + dbiny <    (NBP/2) ) {
-              vl_sift_pix weight = win
-                * mod
-                * vl_abs_f (1 - dbinx - rbinx)
-                * vl_abs_f (1 - dbiny - rbiny)
-                * vl_abs_f (1 - dbint - rbint) ;
-
-              atd(binx+dbinx, biny+dbiny, (bint+dbint) % NBO) += weight ;
+  _vl_sift_init_descriptor_window (&window, f, pt, yo,
+                                   VL_MAX (- W, 1 - xi    ),
+                                   VL_MIN (+ W, w - xi - 2),
+                                   VL_MAX (- W, 1 - yi    ),
+                                   VL_MIN (+ W, h - yi - 2),
+                                   xi - x, yi - y, SBP, angle0) ;
+
+  if (! _vl_sift_accumulate_descriptor_simd (descr, &window)) {
+    for(dyi = window.dyBegin ; dyi <= window.dyEnd ; ++ dyi) {
+      for(dxi = window.dxBegin ; dxi <= window.dxEnd ; ++ dxi) {
+
+        /* retrieve */
+        vl_sift_pix mod   = *( pt + dxi*xo + dyi*yo + 0 ) ;
+        vl_sift_pix angle = *( pt + dxi*xo + dyi*yo + 1 ) ;
+        vl_sift_pix theta = vl_mod_2pi_f (angle - angle0) ;
+
+        /* fractional displacement */
+        vl_sift_pix dx = xi + dxi - x;
+        vl_sift_pix dy = yi + dyi - y;
+
+        /* get the displacement normalized w.r.t. the keypoint
+           orientation and extension */
+        vl_sift_pix nx = ( ct0 * dx + st0 * dy) / SBP ;
+        vl_sift_pix ny = (-st0 * dx + ct0 * dy) / SBP ;
+        vl_sift_pix nt = NBO * theta / (2 * VL_PI) ;
+
+        /* Get the Gaussian weight of the sample. The Gaussian window
+         * has a standard deviation equal to NBP/2. Note that dx and dy
+         * are in the normalized frame, so that -NBP/2 <= dx <=
+         * NBP/2. */
+        vl_sift_pix const wsigma = f->windowSize ;
+        vl_sift_pix win = fast_expn
+          ((nx*nx + ny*ny)/(2.0 * wsigma * wsigma)) ;
+
+        /* The sample will be distributed in 8 adjacent bins.
+           We start from the ``lower-left'' bin. */
+        int         binx = (int)vl_floor_f (nx - 0.5) ;
+        int         biny = (int)vl_floor_f (ny - 0.5) ;
+        int         bint = (int)vl_floor_f (nt) ;
+        vl_sift_pix rbinx = nx - (binx + 0.5) ;
+        vl_sift_pix rbiny = ny - (biny + 0.5) ;
+        vl_sift_pix rbint = nt - bint ;
+        int         dbinx ;
+        int         dbiny ;
+        int         dbint ;
+
+        /* Distribute the current sample into the 8 adjacent bins*/
+        for(dbinx = 0 ; dbinx < 2 ; ++dbinx) {
+          for(dbiny = 0 ; dbiny < 2 ; ++dbiny) {
+            for(dbint = 0 ; dbint < 2 ; ++dbint) {
+
+              if (binx + dbinx >= - (NBP/2) &&
+                  binx + dbinx <    (NBP/2) &&
+                  biny + dbiny >= - (NBP/2) &&
+                  biny + dbiny <    (NBP/2) ) {
+                vl_sift_pix weight = win
+                  * mod
+                  * vl_abs_f (1 - dbinx - rbinx)
+                  * vl_abs_f (1 - dbiny - rbiny)
+                  * vl_abs_f (1 - dbint - rbint) ;
+
+                atd(binx+dbinx, biny+dbiny, (bint+dbint) % NBO) += weight ;
+              }
             }
           }
         }
@@ -2106,6 +2516,256 @@ vl_sift_calc_keypoint_descriptor (VlSiftFilt *f,
 
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Convert a float to IEEE half precision
+ **
+ ** @param x value.
+ ** @return half precision representation of @a x (rounded to nearest
+ ** even).
+ **/
+
+VL_INLINE vl_uint16
+_vl_sift_float_to_half (float x)
+{
+  union { float f ; vl_uint32 u ; } bits ;
+  vl_uint32 sign, mant, rem, halfway ;
+  vl_uint16 h ;
+  int e, shift ;
+
+  bits.f = x ;
+  sign = (bits.u >> 16) & 0x8000 ;
+  e = (int) ((bits.u >> 23) & 0xff) ;
+  mant = bits.u & 0x7fffff ;
+
+  /* infinity and NaN */
+  if (e == 0xff) return (vl_uint16) (sign | 0x7c00 | (mant ? 0x200 : 0)) ;
+
+  e = e - 127 + 15 ;
+  if (e >= 0x1f) return (vl_uint16) (sign | 0x7c00) ;
+
+  if (e <= 0) {
+    /* subnormal half */
+    if (e < -10) return (vl_uint16) sign ;
+    mant |= 0x800000 ;
+    shift = 14 - e ;
+    h = (vl_uint16) (mant >> shift) ;
+    rem = mant & ((1u << shift) - 1) ;
+    halfway = 1u << (shift - 1) ;
+  } else {
+    h = (vl_uint16) ((e << 10) | (mant >> 13)) ;
+    rem = mant & 0x1fff ;
+    halfway = 0x1000 ;
+  }
+  /* a carry into the exponent gives the correct result */
+  if (rem > halfway || (rem == halfway && (h & 1))) ++ h ;
+  return (vl_uint16) (sign | h) ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Get the size of a SIFT descriptor
+ **
+ ** @param format descriptor format.
+ ** @return size in bytes of a descriptor in the format @a format.
+ **
+ ** @sa ::vl_sift_pack_descriptor
+ **/
+
+VL_EXPORT
+vl_size
+vl_sift_get_descriptor_size (int format)
+{
+  switch (format & VL_SIFT_DESCR_TYPE_MASK) {
+    case VL_SIFT_DESCR_UINT8 : return NBO*NBP*NBP * sizeof(vl_uint8) ;
+    case VL_SIFT_DESCR_FLOAT16 : return NBO*NBP*NBP * sizeof(vl_uint16) ;
+    default : return NBO*NBP*NBP * sizeof(vl_sift_pix) ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Convert a SIFT descriptor to a given format
+ **
+ ** @param dst    converted descriptor (output).
+ ** @param format descriptor format.
+ ** @param descr  SIFT descriptor.
+ **
+ ** The function converts the standard SIFT descriptor @a descr (as
+ ** computed by ::vl_sift_calc_keypoint_descriptor) to the format
+ ** @a format and writes it to @a dst. @a format is one of
+ ** ::VL_SIFT_DESCR_FLOAT, ::VL_SIFT_DESCR_UINT8 and
+ ** ::VL_SIFT_DESCR_FLOAT16, optionally or-ed with
+ ** ::VL_SIFT_DESCR_ROOT:
+ **
+ ** - ::VL_SIFT_DESCR_ROOT computes the RootSIFT descriptor, i.e. the
+ **   square root of the @f$ l^1 @f$ normalized descriptor. The
+ **   Euclidean distance of RootSIFT descriptors is the Hellinger
+ **   distance of the original ones.
+ ** - ::VL_SIFT_DESCR_UINT8 stores each component @c x as
+ **   @c min(512x,255) truncated to an integer, as the MATLAB
+ **   interface and the command line driver do. RootSIFT components
+ **   range in [0,1] instead, and reach 1 when the gradient of the
+ **   patch falls in a single bin. With ::VL_SIFT_DESCR_ROOT each
+ **   component is therefore stored as @c 255x truncated to an
+ **   integer, which never saturates.
+ ** - ::VL_SIFT_DESCR_FLOAT16 stores each component as an IEEE half
+ **   precision number (rounded to nearest).
+ **
+ ** @a dst must have ::vl_sift_get_descriptor_size bytes.
+ **/
+
+VL_EXPORT
+void
+vl_sift_pack_descriptor (void *dst,
+                         int format,
+                         vl_sift_pix const *descr)
+{
+  vl_sift_pix root [NBO*NBP*NBP] ;
+  float scale = 512.0F ;
+  int bin ;
+
+  if (format & VL_SIFT_DESCR_ROOT) {
+    vl_sift_pix norm = 0 ;
+    for (bin = 0 ; bin < NBO*NBP*NBP ; ++ bin) {
+      norm += vl_abs_f (descr [bin]) ;
+    }
+    norm = (norm > 0) ? 1.0F / norm : 0.0F ;
+    for (bin = 0 ; bin < NBO*NBP*NBP ; ++ bin) {
+      root [bin] = (vl_sift_pix) sqrt (vl_abs_f (descr [bin]) * norm) ;
+    }
+    descr = root ;
+    scale = 255.0F ;
+  }
+
+  switch (format & VL_SIFT_DESCR_TYPE_MASK) {
+    case VL_SIFT_DESCR_UINT8 :
+    {
+      vl_uint8 *pt = dst ;
+      for (bin = 0 ; bin < NBO*NBP*NBP ; ++ bin) {
+        float x = scale * descr [bin] ;
+        x = (x < 255.0F) ? x : 255.0F ;
+        pt [bin] = (vl_uint8) x ;
+      }
+      break ;
+    }
+    case VL_SIFT_DESCR_FLOAT16 :
+    {
+      vl_uint16 *pt = dst ;
+      for (bin = 0 ; bin < NBO*NBP*NBP ; ++ bin) {
+        pt [bin] = _vl_sift_float_to_half (descr [bin]) ;
+      }
+      break ;
+    }
+    default :
+      if (dst != descr) {
+        memcpy (dst, descr, sizeof(vl_sift_pix) * NBO*NBP*NBP) ;
+      }
+      break ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Compute the descriptor of a keypoint in a given format
+ **
+ ** @param f        SIFT filter.
+ ** @param descr    SIFT descriptor (output).
+ ** @param format   descriptor format.
+ ** @param k        keypoint.
+ ** @param angle0   keypoint direction.
+ **
+ ** The function is the same as ::vl_sift_calc_keypoint_descriptor,
+ ** but writes the descriptor in the format @a format (see
+ ** ::vl_sift_pack_descriptor). @a descr must have
+ ** ::vl_sift_get_descriptor_size bytes. If the keypoint is not on
+ ** the current octave, the descriptor is set to zero.
+ **/
+
+VL_EXPORT
+void
+vl_sift_calc_keypoint_descriptor_format (VlSiftFilt *f,
+                                         void *descr,
+                                         int format,
+                                         VlSiftKeypoint const* k,
+                                         double angle0)
+{
+  vl_sift_pix buffer [NBO*NBP*NBP] ;
+  memset (buffer, 0, sizeof(buffer)) ;
+  vl_sift_calc_keypoint_descriptor (f, buffer, k, angle0) ;
+  vl_sift_pack_descriptor (descr, format, buffer) ;
+}
+
+/** @internal @brief Descriptors computed by ::vl_sift_calc_keypoint_descriptors */
+typedef struct _VlSiftDescriptorsTask
+{
+  VlSiftFilt * f ;
+  char * descrs ;
+  vl_size stride ;
+  int format ;
+  VlSiftKeypoint const * keys ;
+  double const * angles ;
+} VlSiftDescriptorsTask ;
+
+/** @internal @brief Compute a chunk of descriptors */
+
+static void
+_vl_sift_descriptors_format_task (void * data,
+                                  vl_uindex begin,
+                                  vl_uindex end,
+                                  vl_uindex slot VL_UNUSED)
+{
+  VlSiftDescriptorsTask * task = data ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++ i) {
+    vl_sift_calc_keypoint_descriptor_format
+      (task->f, task->descrs + i * task->stride, task->format,
+       task->keys + i, task->angles [i]) ;
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Compute the descriptors of several keypoints
+ **
+ ** @param f              SIFT filter.
+ ** @param descrs         SIFT descriptors (output).
+ ** @param stride         distance in bytes between descriptors.
+ ** @param format         descriptor format.
+ ** @param keys           keypoints.
+ ** @param angles         keypoint directions.
+ ** @param numDescriptors number of descriptors.
+ **
+ ** The function computes the descriptor of each keypoint @c keys[i]
+ ** with direction @c angles[i] in the format @a format (see
+ ** ::vl_sift_pack_descriptor) and writes it at @a descrs plus
+ ** @c i * @a stride bytes. Hence descriptors can be stored directly
+ ** in a record of a larger structure. @a stride must be at least
+ ** ::vl_sift_get_descriptor_size. The keypoints must be on the
+ ** current octave. The descriptors are computed in parallel
+ ** (@ref threads).
+ **/
+
+VL_EXPORT
+void
+vl_sift_calc_keypoint_descriptors (VlSiftFilt *f,
+                                   void *descrs,
+                                   vl_size stride,
+                                   int format,
+                                   VlSiftKeypoint const *keys,
+                                   double const *angles,
+                                   vl_size numDescriptors)
+{
+  VlSiftDescriptorsTask task ;
+  assert (stride >= vl_sift_get_descriptor_size (format)) ;
+  task.f = f ;
+  task.descrs = descrs ;
+  task.stride = stride ;
+  task.format = format ;
+  task.keys = keys ;
+  task.angles = angles ;
+
+  /* synchronize the gradient buffer before going parallel */
+  update_gradient (f) ;
+  vl_parallel_for (numDescriptors, 0, _vl_sift_descriptors_format_task, &task) ;
+}
+
 /** ------------------------------------------------------------------
  ** @brief Initialize a keypoint from its position and scale
  **
@@ -2209,3 +2869,540 @@ vl_sift_keypoint_init (VlSiftFilt const *f,
 
   k->sigma = sigma ;
 }
+
+/* ---------------------------------------------------------------- */
+/*                                                 Threaded pipeline */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Octave computed in the background by ::vl_sift_extract */
+typedef struct _VlSiftOctaveTask
+{
+  VlSiftFilt * f ;
+  vl_sift_pix * octave ;
+  vl_sift_pix const * previous ;
+  int width ;
+  int height ;
+} VlSiftOctaveTask ;
+
+/** @internal @brief Compute the octave following the current one */
+
+static void
+_vl_sift_octave_task (void * data)
+{
+  VlSiftOctaveTask * task = data ;
+  VlSiftFilt * f = task->f ;
+  _vl_sift_start_next_octave (f, task->octave, f->temp, task->previous,
+                              task->width, task->height) ;
+  _vl_sift_fill_octave (f, task->octave, f->temp,
+                        task->width / 2, task->height / 2) ;
+}
+
+/** @internal @brief Keypoints processed in parallel by ::vl_sift_extract */
+typedef struct _VlSiftKeypointsTask
+{
+  VlSiftFilt * f ;
+  VlSiftKeypoint const * keys ;
+  double * angles ;
+  int * numAngles ;
+  vl_size * offsets ;
+  vl_sift_pix * descriptors ;
+} VlSiftKeypointsTask ;
+
+/** @internal @brief Compute the orientations of a chunk of keypoints */
+
+static void
+_vl_sift_orientations_task (void * data,
+                            vl_uindex begin,
+                            vl_uindex end,
+                            vl_uindex slot VL_UNUSED)
+{
+  VlSiftKeypointsTask * task = data ;
+  vl_uindex i ;
+  for (i = begin ; i < end ; ++ i) {
+    task->numAngles[i] = vl_sift_calc_keypoint_orientations
+      (task->f, task->angles + 4 * i, task->keys + i) ;
+  }
+}
+
+/** @internal @brief Compute the descriptors of a chunk of keypoints */
+
+static void
+_vl_sift_descriptors_task (void * data,
+                           vl_uindex begin,
+                           vl_uindex end,
+                           vl_uindex slot VL_UNUSED)
+{
+  VlSiftKeypointsTask * task = data ;
+  vl_uindex i ;
+  int q ;
+  for (i = begin ; i < end ; ++ i) {
+    for (q = 0 ; q < task->numAngles[i] ; ++ q) {
+      vl_sift_pix * descr = task->descriptors + 128 * (task->offsets[i] + q) ;
+      /* the descriptor is left untouched if the keypoint is too close
+         to the boundary */
+      memset (descr, 0, sizeof(vl_sift_pix) * 128) ;
+      vl_sift_calc_keypoint_descriptor
+        (task->f, descr, task->keys + i, task->angles[4 * i + q]) ;
+    }
+  }
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Extract SIFT frames and descriptors from an image
+ **
+ ** @param f           SIFT filter.
+ ** @param im          image data.
+ ** @param frames      frames (output).
+ ** @param descriptors descriptors (output).
+ **
+ ** The function runs the whole SIFT pipeline on the image @a im,
+ ** which must have the dimensions given to ::vl_sift_new (or
+ ** ::vl_sift_reset_size). This is
+ ** equivalent to processing all the octaves by
+ ** ::vl_sift_process_first_octave and ::vl_sift_process_next_octave,
+ ** detecting the keypoints of each by ::vl_sift_detect and then
+ ** computing their orientations and descriptors, but the work is
+ ** parallelized (@ref threads):
+ **
+ ** - while the keypoints of an octave are detected and described,
+ **   the next octave is computed in the background;
+ ** - the gradient levels, the keypoint orientations and the
+ **   descriptors are computed in parallel.
+ **
+ ** The function returns the number @c n of frames. @a *frames is set
+ ** to a newly allocated array of @c 4 x @c n doubles, storing the
+ ** center, scale and orientation @c (x,y,sigma,angle) of each frame.
+ ** If @a descriptors is not @c NULL, @a *descriptors is set to a
+ ** newly allocated array of @c 128 x @c n descriptors. Frames are
+ ** returned in the same order as the sequential pipeline
+ ** (octave-by-octave, then keypoint-by-keypoint, then orientation by
+ ** orientation). The arrays must be released by ::vl_free.
+ **
+ ** If a keypoint budget is set (::vl_sift_set_keypoint_budget), only
+ ** the frames of the strongest keypoints are returned. Orientations
+ ** and descriptors are computed only for the keypoints that are
+ ** among the strongest at the time their octave is processed.
+ **
+ ** After the function returns, the filter state is the same as after
+ ** running the sequential pipeline to the last octave.
+ **
+ ** @return number of frames.
+ **/
+
+VL_EXPORT
+vl_size
+vl_sift_extract (VlSiftFilt *f,
+                 vl_sift_pix const *im,
+                 double **frames,
+                 vl_sift_pix **descriptors)
+{
+  vl_sift_pix * octaveBuffer = f->octave ;
+  vl_sift_pix * otherBuffer = NULL ;
+  vl_sift_pix * next = NULL ;
+  int numLevels = f->s_max - f->s_min + 1 ;
+  vl_size numFrames = 0 ;
+  vl_size numAllocatedFrames = 0 ;
+  double * angles = NULL ;
+  int * numAngles = NULL ;
+  vl_size * offsets = NULL ;
+  vl_size numAllocatedKeys = 0 ;
+  vl_uindex * frameKeys = NULL ;
+  vl_uindex keyBase = 0 ;
+  VlTaskGroup * group = vl_task_group_new () ;
+  int err ;
+
+  *frames = NULL ;
+  if (descriptors) *descriptors = NULL ;
+  if (group == NULL) {
+    vl_set_last_error (VL_ERR_ALLOC, "Could not allocate the task group.") ;
+    return 0 ;
+  }
+
+  /* the octave following the current one is computed in a second
+     buffer, large enough for the second octave */
+  if (f->O > 1) {
+    int w = VL_SHIFT_LEFT(f->width,  - f->o_min - 1) ;
+    int h = VL_SHIFT_LEFT(f->height, - f->o_min - 1) ;
+    otherBuffer = vl_malloc (sizeof(vl_sift_pix) * w * h * numLevels) ;
+  }
+  next = otherBuffer ;
+
+  err = vl_sift_process_first_octave (f, im) ;
+
+  while (err == VL_ERR_OK) {
+    VlSiftOctaveTask octaveTask ;
+    VlSiftKeypointsTask keysTask ;
+    vl_bool hasNext = (f->o_cur < f->o_min + f->O - 1) ;
+    vl_size numKeys, i ;
+    int q ;
+
+    /* compute the next octave in the background */
+    if (hasNext) {
+      octaveTask.f = f ;
+      octaveTask.octave = next ;
+      octaveTask.previous = f->octave ;
+      octaveTask.width = f->octave_width ;
+      octaveTask.height = f->octave_height ;
+      vl_task_group_run (group, _vl_sift_octave_task, &octaveTask) ;
+    }
+
+    /* detect and describe the keypoints of the current octave */
+    vl_sift_detect (f) ;
+    update_gradient (f) ;
+    numKeys = f->nkeys ;
+
+    if (numKeys > numAllocatedKeys) {
+      numAllocatedKeys = numKeys ;
+      angles = vl_realloc (angles, sizeof(double) * 4 * numKeys) ;
+      numAngles = vl_realloc (numAngles, sizeof(int) * numKeys) ;
+      offsets = vl_realloc (offsets, sizeof(vl_size) * numKeys) ;
+    }
+
+    keysTask.f = f ;
+    keysTask.keys = f->keys ;
+    keysTask.angles = angles ;
+    keysTask.numAngles = numAngles ;
+    keysTask.offsets = offsets ;
+    vl_parallel_for (numKeys, 0, _vl_sift_orientations_task, &keysTask) ;
+
+    /* allocate the output */
+    for (i = 0 ; i < numKeys ; ++ i) {
+      offsets[i] = numFrames ;
+      numFrames += numAngles[i] ;
+    }
+    if (numFrames > numAllocatedFrames) {
+      numAllocatedFrames = VL_MAX(numFrames, 2 * numAllocatedFrames) ;
+      *frames = vl_realloc (*frames,
+                            sizeof(double) * 4 * numAllocatedFrames) ;
+      if (f->imageKeypointBudget > 0) {
+        frameKeys = vl_realloc (frameKeys,
+                                sizeof(vl_uindex) * numAllocatedFrames) ;
+      }
+      if (descriptors) {
+        *descriptors = vl_realloc (*descriptors,
+                                   sizeof(vl_sift_pix) * 128 *
+                                   numAllocatedFrames) ;
+      }
+    }
+
+    for (i = 0 ; i < numKeys ; ++ i) {
+      for (q = 0 ; q < numAngles[i] ; ++ q) {
+        double * frame = *frames + 4 * (offsets[i] + q) ;
+        frame[0] = f->keys[i].x ;
+        frame[1] = f->keys[i].y ;
+        frame[2] = f->keys[i].sigma ;
+        frame[3] = angles[4 * i + q] ;
+        if (frameKeys) frameKeys [offsets[i] + q] = keyBase + i ;
+      }
+    }
+    keyBase += numKeys ;
+
+    if (descriptors) {
+      keysTask.descriptors = *descriptors ;
+      vl_parallel_for (numKeys, 0, _vl_sift_descriptors_task, &keysTask) ;
+    }
+
+    /* switch to the next octave */
+    vl_task_group_wait (group) ;
+    if (! hasNext) break ;
+
+    next = f->octave ;
+    f->octave = octaveTask.octave ;
+    f->o_cur += 1 ;
+    f->nkeys = 0 ;
+    f->octave_width  = VL_SHIFT_LEFT(f->width,  - f->o_cur) ;
+    f->octave_height = VL_SHIFT_LEFT(f->height, - f->o_cur) ;
+  }
+
+  /* drop the keypoints superseded by the ones of later octaves */
+  if (f->imageKeypointBudget > 0 && numFrames > 0) {
+    vl_bool * retained = vl_calloc (keyBase, sizeof(vl_bool)) ;
+    vl_size n = 0, i ;
+    for (i = 0 ; i < f->budgetHeapNumNodes ; ++ i) {
+      retained [f->budgetHeap[i].id] = VL_TRUE ;
+    }
+    for (i = 0 ; i < numFrames ; ++ i) {
+      if (! retained [frameKeys [i]]) continue ;
+      memmove (*frames + 4 * n, *frames + 4 * i, sizeof(double) * 4) ;
+      if (descriptors) {
+        memmove (*descriptors + 128 * n, *descriptors + 128 * i,
+                 sizeof(vl_sift_pix) * 128) ;
+      }
+      ++ n ;
+    }
+    numFrames = n ;
+    vl_free (retained) ;
+  }
+  if (frameKeys) vl_free (frameKeys) ;
+
+  /* restore the octave buffer owned by the filter */
+  if (f->octave != octaveBuffer) {
+    memcpy (octaveBuffer, f->octave,
+            sizeof(vl_sift_pix) * f->octave_width * f->octave_height *
+            numLevels) ;
+    f->octave = octaveBuffer ;
+  }
+
+  vl_task_group_delete (group) ;
+  if (otherBuffer) vl_free (otherBuffer) ;
+  if (angles) vl_free (angles) ;
+  if (numAngles) vl_free (numAngles) ;
+  if (offsets) vl_free (offsets) ;
+  return numFrames ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                      Tiled images */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Width of the Gaussian filter used by ::_vl_sift_smooth */
+#define VL_SIFT_SMOOTH_RADIUS(sigma) VL_MAX(ceil(4.0 * (sigma)), 1)
+
+/** ------------------------------------------------------------------
+ ** @brief Get the tile halo
+ **
+ ** @param f SIFT filter.
+ ** @return tile halo in pixels.
+ **
+ ** The function returns the number of pixels by which a tile must
+ ** extend beyond the region it is responsible for in
+ ** ::vl_sift_extract_tiled. The halo accounts for the support of the
+ ** Gaussian smoothing filters (which accumulates across levels and
+ ** octaves), for the keypoint refinement and for the extent of the
+ ** orientation and descriptor windows of the largest keypoints. It
+ ** is a multiple of the sampling step of the coarsest octave.
+ **/
+
+VL_EXPORT
+vl_size
+vl_sift_get_tile_halo (VlSiftFilt const *f)
+{
+  double radius = 0 ;
+  double halo = 0 ;
+  double sa, sb ;
+  vl_size step ;
+  int o, s ;
+
+  /* largest keypoint scale in octave units (with refinement) */
+  double sigma = f->sigma0 * pow (f->sigmak, f->s_max - 1) ;
+  double window = floor (sqrt(2.0) * f->magnif * sigma * (NBP + 1) / 2.0 + 0.5) ;
+  window = VL_MAX(window, 6) + 2 ;
+
+  for (o = f->o_min ; o < f->o_min + f->O ; ++ o) {
+    double scale = pow (2.0, o) ;
+    if (o == f->o_min) {
+      /* upsampling and initial smoothing */
+      if (o < 0) radius += - o ;
+      sa = f->sigma0 * pow (f->sigmak, f->s_min) ;
+      sb = f->sigman * pow (2.0, - f->o_min) ;
+    } else {
+      int s_best = VL_MIN(f->s_min + f->S, f->s_max) ;
+      sa = f->sigma0 * powf (f->sigmak, f->s_min) ;
+      sb = f->sigma0 * powf (f->sigmak, s_best - f->S) ;
+    }
+    if (sa > sb) {
+      radius += VL_SIFT_SMOOTH_RADIUS(sqrt (sa*sa - sb*sb)) * scale ;
+    }
+    for (s = f->s_min + 1 ; s <= f->s_max ; ++ s) {
+      radius += VL_SIFT_SMOOTH_RADIUS(f->dsigma0 * pow (f->sigmak, s)) * scale ;
+    }
+    halo = VL_MAX(halo, radius + window * scale) ;
+  }
+
+  /* round up to the step of the coarsest octave */
+  step = (vl_size) 1 << VL_MAX(f->o_min + f->O - 1, 0) ;
+  return ((vl_size) ceil (halo) + step - 1) / step * step ;
+}
+
+/** ------------------------------------------------------------------
+ ** @brief Extract SIFT frames and descriptors from a large image
+ **
+ ** @param f           SIFT filter.
+ ** @param width       image width.
+ ** @param height      image height.
+ ** @param reader      tile reader.
+ ** @param data        tile reader data.
+ ** @param frames      frames (output).
+ ** @param descriptors descriptors (output).
+ ** @param numFrames   number of frames (output).
+ **
+ ** The function is similar to ::vl_sift_extract, but processes an
+ ** image of arbitrary size @a width x @a height in tiles, so that
+ ** the memory used is bounded by the size of the filter @a f rather
+ ** than by the size of the image. The pixels are obtained tile by
+ ** tile by calling @a reader (hence the image itself does not need
+ ** to be in memory).
+ **
+ ** The image is partitioned in cores of size
+ ** <code>w - 2 h</code> x <code>h - 2 h</code> (rounded down to the
+ ** sampling step of the coarsest octave), where @c w x @c h is the
+ ** size of @a f and @c h is the halo computed by
+ ** ::vl_sift_get_tile_halo. Each core is processed together with the
+ ** surrounding halo (clipped to the image) and the function keeps
+ ** only the frames whose center falls in the core. Hence frames on
+ ** the seams between tiles are not duplicated. Since the tiles are
+ ** aligned to the sampling grids of all the octaves and the halo
+ ** covers the support of the computations, the frames and
+ ** descriptors are the same that ::vl_sift_extract would compute on
+ ** the whole image with the same parameters (including the number
+ ** of octaves), except for their order, which is tile by tile, and
+ ** for the rounding of the keypoint coordinates (which are stored in
+ ** single precision relative to the tile).
+ **
+ ** The tiles are processed by @a f itself, with its parameters
+ ** (number of octaves and levels, first octave and thresholds) but
+ ** without the keypoint budget, which is not applied. Besides the
+ ** buffers of @a f and the output, the function allocates one tile
+ ** of pixels and the scale space of one octave of
+ ** ::vl_sift_extract. On return, @a f is reset to its original size.
+ **
+ ** Tiling saves memory only if @a f is much smaller than the image,
+ ** yet large compared to the halo, which doubles with each
+ ** additional octave. For instance, with three octaves starting at
+ ** octave 0 the halo is 488 pixels: @a f must then be larger than
+ ** about 1000 x 1000 pixels, and a 2000 x 2000 filter spends three
+ ** quarters of its work on the halo. The number of octaves should
+ ** therefore be set explicitly to a small value when the filter is
+ ** created.
+ **
+ ** @a *frames and @a *descriptors (if @a descriptors is not @c NULL)
+ ** are set to newly allocated arrays in the same format as
+ ** ::vl_sift_extract, which must be released by ::vl_free.
+ **
+ ** @return error code. The function returns ::VL_ERR_BAD_ARG if the
+ ** filter is too small for its halo and ::VL_ERR_ALLOC if memory
+ ** could not be allocated (in which case no frame is returned).
+ **/
+
+VL_EXPORT
+int
+vl_sift_extract_tiled (VlSiftFilt *f,
+                       vl_size width,
+                       vl_size height,
+                       VlSiftTileReader reader,
+                       void *data,
+                       double **frames,
+                       vl_sift_pix **descriptors,
+                       vl_size *numFrames)
+{
+  vl_size halo = vl_sift_get_tile_halo (f) ;
+  vl_size step = (vl_size) 1 << VL_MAX(f->o_min + f->O - 1, 0) ;
+  int filtWidth = f->width ;
+  int filtHeight = f->height ;
+  vl_bool autoO = f->autoO ;
+  vl_size keypointBudget = f->keypointBudget ;
+  vl_size coreWidth, coreHeight ;
+  vl_size numAllocatedFrames = 0 ;
+  vl_size cx, cy ;
+  vl_sift_pix * tile ;
+  int err = VL_ERR_OK ;
+
+  *frames = NULL ;
+  if (descriptors) *descriptors = NULL ;
+  *numFrames = 0 ;
+
+  if ((vl_size) f->width <= 2 * halo + step ||
+      (vl_size) f->height <= 2 * halo + step) {
+    return vl_set_last_error (VL_ERR_BAD_ARG,
+                              "The SIFT filter (%dx%d) is too small for "
+                              "the tile halo (%d).",
+                              f->width, f->height, (int) halo) ;
+  }
+  coreWidth = (f->width - 2 * halo) / step * step ;
+  coreHeight = (f->height - 2 * halo) / step * step ;
+  tile = vl_malloc (sizeof(vl_sift_pix) *
+                    VL_MIN(coreWidth + 2 * halo, width) *
+                    VL_MIN(coreHeight + 2 * halo, height)) ;
+  if (tile == NULL) {
+    return vl_set_last_error (VL_ERR_ALLOC, "Could not allocate the SIFT tile.") ;
+  }
+
+  /* the tiles are at most as large as f, so resizing it never
+     reallocates its buffers; the number of octaves must not be
+     recomputed for the tile size */
+  f->autoO = VL_FALSE ;
+  f->keypointBudget = 0 ;
+
+  for (cy = 0 ; cy < height && ! err ; cy += coreHeight) {
+    for (cx = 0 ; cx < width && ! err ; cx += coreWidth) {
+      /* tile = core plus halo, clipped to the image */
+      vl_size x0 = (cx > halo) ? cx - halo : 0 ;
+      vl_size y0 = (cy > halo) ? cy - halo : 0 ;
+      vl_size x1 = VL_MIN(cx + coreWidth + halo, width) ;
+      vl_size y1 = VL_MIN(cy + coreHeight + halo, height) ;
+      double * tileFrames ;
+      vl_sift_pix * tileDescriptors = NULL ;
+      vl_size numTileFrames, i ;
+
+      if ((vl_size) f->width != x1 - x0 ||
+          (vl_size) f->height != y1 - y0) {
+        vl_sift_reset_size (f, (int) (x1 - x0), (int) (y1 - y0)) ;
+      }
+
+      reader (data, tile, (vl_index) x0, (vl_index) y0, x1 - x0, y1 - y0) ;
+      numTileFrames = vl_sift_extract (f, tile, &tileFrames,
+                                       descriptors ? &tileDescriptors : NULL) ;
+      if (numTileFrames > 0 &&
+          (tileFrames == NULL || (descriptors && tileDescriptors == NULL))) {
+        err = VL_ERR_ALLOC ;
+      }
+
+      /* keep the frames in the core */
+      for (i = 0 ; i < numTileFrames && ! err ; ++ i) {
+        double x = tileFrames [4 * i + 0] + x0 ;
+        double y = tileFrames [4 * i + 1] + y0 ;
+        if (x < (double) cx || x >= (double) (cx + coreWidth) ||
+            y < (double) cy || y >= (double) (cy + coreHeight)) {
+          continue ;
+        }
+        if (*numFrames >= numAllocatedFrames) {
+          vl_size n = VL_MAX(2 * numAllocatedFrames, 1024) ;
+          double * newFrames = vl_realloc (*frames, sizeof(double) * 4 * n) ;
+          if (newFrames == NULL) {
+            err = VL_ERR_ALLOC ;
+            break ;
+          }
+          *frames = newFrames ;
+          if (descriptors) {
+            vl_sift_pix * newDescriptors =
+              vl_realloc (*descriptors, sizeof(vl_sift_pix) * 128 * n) ;
+            if (newDescriptors == NULL) {
+              err = VL_ERR_ALLOC ;
+              break ;
+            }
+            *descriptors = newDescriptors ;
+          }
+          numAllocatedFrames = n ;
+        }
+        (*frames) [4 * *numFrames + 0] = x ;
+        (*frames) [4 * *numFrames + 1] = y ;
+        (*frames) [4 * *numFrames + 2] = tileFrames [4 * i + 2] ;
+        (*frames) [4 * *numFrames + 3] = tileFrames [4 * i + 3] ;
+        if (descriptors) {
+          memcpy (*descriptors + 128 * *numFrames,
+                  tileDescriptors + 128 * i,
+                  sizeof(vl_sift_pix) * 128) ;
+        }
+        ++ *numFrames ;
+      }
+
+      if (tileFrames) vl_free (tileFrames) ;
+      if (tileDescriptors) vl_free (tileDescriptors) ;
+    }
+  }
+
+  f->autoO = autoO ;
+  f->keypointBudget = keypointBudget ;
+  vl_sift_reset_size (f, filtWidth, filtHeight) ;
+  vl_free (tile) ;
+
+  if (err) {
+    if (*frames) vl_free (*frames) ;
+    if (descriptors && *descriptors) vl_free (*descriptors) ;
+    *frames = NULL ;
+    if (descriptors) *descriptors = NULL ;
+    *numFrames = 0 ;
+    return vl_set_last_error (err, "Could not allocate the SIFT frames.") ;
+  }
+  return VL_ERR_OK ;
+}
@@ -20,6 +20,40 @@ the terms of the BSD license (see the COPYING file).
 /** @brief SIFT filter pixel type */
 typedef float vl_sift_pix ;
 
+/** @name SIFT descriptor formats
+ ** @{ */
+#define VL_SIFT_DESCR_FLOAT     0x0 /**< 128 single precision values. */
+#define VL_SIFT_DESCR_UINT8     0x1 /**< 128 bytes (values times 512, or 255 for RootSIFT, clamped). */
+#define VL_SIFT_DESCR_FLOAT16   0x2 /**< 128 half precision values. */
+#define VL_SIFT_DESCR_TYPE_MASK 0x3 /**< Storage type mask. */
+#define VL_SIFT_DESCR_ROOT      0x4 /**< RootSIFT (Hellinger) normalization. */
+/** @} */
+
+/** ------------------------------------------------------------------
+ ** @brief SIFT tile reader
+ **
+ ** @param data   user data.
+ ** @param tile   tile buffer (output).
+ ** @param x      first column of the tile.
+ ** @param y      first row of the tile.
+ ** @param width  tile width.
+ ** @param height tile height.
+ **
+ ** The function must copy the image pixels in the rectangle of
+ ** origin (@a x, @a y) and size @a width x @a height to @a tile,
+ ** which is stored by rows without padding. The rectangle is always
+ ** contained in the image.
+ **
+ ** @sa ::vl_sift_extract_tiled
+ **/
+
+typedef void (*VlSiftTileReader) (void * data,
+                                  vl_sift_pix * tile,
+                                  vl_index x,
+                                  vl_index y,
+                                  vl_size width,
+                                  vl_size height) ;
+
 /** ------------------------------------------------------------------
  ** @brief SIFT filter keypoint
  **
@@ -41,6 +75,28 @@ typedef struct _VlSiftKeypoint
   float sigma ; /**< scale. */
 } VlSiftKeypoint ;
 
+/** @internal @brief Entry of the SIFT keypoint budget heap */
+typedef struct _VlSiftBudgetEntry
+{
+  float score ;   /**< absolute DoG peak value. */
+  vl_uindex id ;  /**< keypoint sequential index. */
+} VlSiftBudgetEntry ;
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief SIFT Gaussian filter
+ **
+ ** A normalized Gaussian kernel of standard deviation @c sigma and
+ ** support <code>[-width, width]</code>, cached by ::VlSiftFilt.
+ **/
+
+typedef struct _VlSiftGaussFilter
+{
+  double sigma ;        /**< standard deviation. */
+  vl_size width ;       /**< half-width of the support. */
+  vl_sift_pix *filter ; /**< filter coefficients (2*width+1). */
+} VlSiftGaussFilter ;
+
 /** ------------------------------------------------------------------
  ** @brief SIFT filter
  **
@@ -57,6 +113,7 @@ typedef struct _VlSiftFilt
   int width ;           /**< image width. */
   int height ;          /**< image height. */
   int O ;               /**< number of octaves. */
+  vl_bool autoO ;       /**< compute the number of octaves from the size. */
   int S ;               /**< number of levels per octave. */
   int o_min ;           /**< minimum octave index. */
   int s_min ;           /**< minimum level index. */
@@ -68,14 +125,16 @@ typedef struct _VlSiftFilt
   vl_sift_pix *dog ;    /**< current DoG data. */
   int octave_width ;    /**< current octave width. */
   int octave_height ;   /**< current octave height. */
+  vl_size numAllocatedPixels ; /**< capacity of the buffers (pixels per level). */
 
-  vl_sift_pix *gaussFilter ;  /**< current Gaussian filter */
-  double gaussFilterSigma ;   /**< current Gaussian filter std */
-  vl_size gaussFilterWidth ;  /**< current Gaussian filter width */
+  VlSiftGaussFilter *gaussFilters ; /**< cached Gaussian filters. */
+  vl_size numGaussFilters ;         /**< number of cached Gaussian filters. */
 
   VlSiftKeypoint* keys ;/**< detected keypoints. */
   int nkeys ;           /**< number of detected keypoints. */
   int keys_res ;        /**< size of the keys buffer. */
+  float *keyPeaks ;     /**< DoG peak values of the keypoints. */
+  vl_uindex *keyRemap ; /**< keypoint renumbering buffer. */
 
   double peak_thresh ;  /**< peak threshold. */
   double edge_thresh ;  /**< edge threshold. */
@@ -86,6 +145,13 @@ typedef struct _VlSiftFilt
   vl_sift_pix *grad ;   /**< GSS gradient data. */
   int grad_o ;          /**< GSS gradient data octave. */
 
+  vl_size keypointBudget ;          /**< maximum number of keypoints (0 for none). */
+  vl_size imageKeypointBudget ;     /**< budget of the current image. */
+  VlSiftBudgetEntry *budgetHeap ;   /**< strongest keypoints so far. */
+  vl_size budgetHeapNumNodes ;      /**< number of keypoints in the heap. */
+  vl_size budgetHeapSize ;          /**< size of the heap buffer. */
+  vl_uindex budgetNumKeys ;         /**< number of keypoints admitted so far. */
+
 } VlSiftFilt ;
 
 /** @name Create and destroy
@@ -97,6 +163,9 @@ VlSiftFilt*  vl_sift_new    (int width, int height,
                              int o_min) ;
 VL_EXPORT
 void         vl_sift_delete (VlSiftFilt *f) ;
+VL_EXPORT
+void         vl_sift_reset_size (VlSiftFilt *f,
+                                 int width, int height) ;
 /** @} */
 
 /** @name Process data
@@ -123,6 +192,30 @@ void  vl_sift_calc_keypoint_descriptor   (VlSiftFilt *f,
                                           VlSiftKeypoint const* k,
                                           double angle) ;
 
+VL_EXPORT
+void  vl_sift_calc_keypoint_descriptor_format (VlSiftFilt *f,
+                                               void *descr,
+                                               int format,
+                                               VlSiftKeypoint const* k,
+                                               double angle) ;
+
+VL_EXPORT
+void  vl_sift_calc_keypoint_descriptors  (VlSiftFilt *f,
+                                          void *descrs,
+                                          vl_size stride,
+                                          int format,
+                                          VlSiftKeypoint const *keys,
+                                          double const *angles,
+                                          vl_size numDescriptors) ;
+
+VL_EXPORT
+void  vl_sift_pack_descriptor            (void *dst,
+                                          int format,
+                                          vl_sift_pix const *descr) ;
+
+VL_EXPORT
+vl_size vl_sift_get_descriptor_size      (int format) ;
+
 VL_EXPORT
 void  vl_sift_calc_raw_descriptor        (VlSiftFilt const *f,
                                           vl_sift_pix const* image,
@@ -137,6 +230,25 @@ void  vl_sift_keypoint_init              (VlSiftFilt const *f,
                                           double x,
                                           double y,
                                           double sigma) ;
+
+VL_EXPORT
+vl_size vl_sift_extract                  (VlSiftFilt *f,
+                                          vl_sift_pix const *im,
+                                          double **frames,
+                                          vl_sift_pix **descriptors) ;
+
+VL_EXPORT
+int   vl_sift_extract_tiled              (VlSiftFilt *f,
+                                          vl_size width,
+                                          vl_size height,
+                                          VlSiftTileReader reader,
+                                          void *data,
+                                          double **frames,
+                                          vl_sift_pix **descriptors,
+                                          vl_size *numFrames) ;
+
+VL_EXPORT
+vl_size vl_sift_get_tile_halo            (VlSiftFilt const *f) ;
 /** @} */
 
 /** @name Retrieve data and parameters
@@ -154,6 +266,7 @@ VL_INLINE double vl_sift_get_edge_thresh    (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_norm_thresh    (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_magnif         (VlSiftFilt const *f) ;
 VL_INLINE double vl_sift_get_window_size    (VlSiftFilt const *f) ;
+VL_INLINE vl_size vl_sift_get_keypoint_budget (VlSiftFilt const *f) ;
 
 VL_INLINE vl_sift_pix *vl_sift_get_octave  (VlSiftFilt const *f, int s) ;
 VL_INLINE VlSiftKeypoint const *vl_sift_get_keypoints (VlSiftFilt const *f) ;
@@ -167,6 +280,7 @@ VL_INLINE void vl_sift_set_edge_thresh (VlSiftFilt *f, double t) ;
 VL_INLINE void vl_sift_set_norm_thresh (VlSiftFilt *f, double t) ;
 VL_INLINE void vl_sift_set_magnif      (VlSiftFilt *f, double m) ;
 VL_INLINE void vl_sift_set_window_size (VlSiftFilt *f, double m) ;
+VL_INLINE void vl_sift_set_keypoint_budget (VlSiftFilt *f, vl_size n) ;
 /** @} */
 
 /* -------------------------------------------------------------------
@@ -349,6 +463,19 @@ vl_sift_get_window_size (VlSiftFilt const *f)
   return f -> windowSize ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Get the keypoint budget
+ ** @param f SIFT filter.
+ ** @return keypoint budget (0 for none).
+ ** @sa ::vl_sift_set_keypoint_budget
+ **/
+
+VL_INLINE vl_size
+vl_sift_get_keypoint_budget (VlSiftFilt const *f)
+{
+  return f -> keypointBudget ;
+}
+
 
 
 /** ------------------------------------------------------------------
@@ -414,5 +541,22 @@ vl_sift_set_window_size (VlSiftFilt *f, double x)
   f -> windowSize = x ;
 }
 
+/** ------------------------------------------------------------------
+ ** @brief Set the keypoint budget
+ ** @param f SIFT filter.
+ ** @param n maximum number of keypoints per image (0 for none).
+ **
+ ** With a budget, the filter retains only the @a n keypoints with
+ ** the strongest DoG response (absolute peak value) across all
+ ** the octaves of an image. The change takes effect from the next
+ ** call to ::vl_sift_process_first_octave. See @ref sift-usage.
+ **/
+
+VL_INLINE void
+vl_sift_set_keypoint_budget (VlSiftFilt *f, vl_size n)
+{
+  f -> keypointBudget = n ;
+}
+
 /* VL_SIFT_H */
 #endif
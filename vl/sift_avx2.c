@@ -0,0 +1,172 @@
+/** @file sift_avx2.c
+ ** @brief SIFT descriptor accumulation - AVX2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_DISABLE_AVX2
+#if ! defined(__AVX2__) || ! defined(__FMA__)
+#  error "sift_avx2.c must be compiled with AVX2 and FMA intrinsics enabled"
+#endif
+
+#include <immintrin.h>
+#include <string.h>
+#include "mathop.h"
+#include "sift_avx2.h"
+
+/* See sift_sse2.c for the layout of the padded histogram. */
+#define PNB 8
+
+VL_EXPORT void
+_vl_sift_accumulate_descriptor_avx2 (vl_sift_pix *descr,
+                                     VlSiftDescriptorWindow const *window)
+{
+  float hist [PNB*PNB*PNB] ;
+  float pad [16] ;
+  float weights [8][8] ;
+  int bins [3][8] ;
+  float const *expnTable = window->expnTable ;
+  __m256 const twoPi = _mm256_set1_ps ((float) (2 * VL_PI)) ;
+  __m256 const invTwoPi = _mm256_set1_ps ((float) (1.0 / (2 * VL_PI))) ;
+  __m256 const ntScale = _mm256_set1_ps ((float) (8 / (2 * VL_PI))) ;
+  __m256 const half = _mm256_set1_ps (0.5f) ;
+  __m256 const one = _mm256_set1_ps (1.0f) ;
+  __m256 const ct = _mm256_set1_ps (window->ct) ;
+  __m256 const st = _mm256_set1_ps (window->st) ;
+  __m256 const angle0 = _mm256_set1_ps (window->angle0) ;
+  __m256 const expnScale = _mm256_set1_ps (window->expnScale) ;
+  __m256 const expnSize = _mm256_set1_ps (window->expnSize) ;
+  __m256i const expnLast = _mm256_set1_epi32 ((int) window->expnSize - 1) ;
+  __m256i const binMin = _mm256_set1_epi32 (-4) ;
+  __m256i const binMax = _mm256_set1_epi32 (2) ;
+  __m256i const lanes = _mm256_set_epi32 (7, 6, 5, 4, 3, 2, 1, 0) ;
+  int dxi, dyi, i, j, t ;
+
+  memset (hist, 0, sizeof(hist)) ;
+
+  for (dyi = window->dyBegin ; dyi <= window->dyEnd ; ++ dyi) {
+    vl_sift_pix const *row = window->grad + dyi * window->yo ;
+    __m256 dy = _mm256_add_ps (_mm256_set1_ps ((float) dyi),
+                               _mm256_set1_ps (window->dy0)) ;
+    __m256 sty = _mm256_mul_ps (st, dy) ;
+    __m256 cty = _mm256_mul_ps (ct, dy) ;
+
+    for (dxi = window->dxBegin ; dxi <= window->dxEnd ; dxi += 8) {
+      vl_sift_pix const *pt = row + 2 * dxi ;
+      int n = VL_MIN (8, window->dxEnd - dxi + 1) ;
+      __m256 p, q, mod, angle, dx, nx, ny, nt, theta, r2, u, a, b, win ;
+      __m256 binx, biny, bint, rbinx, rbiny, rbint, v, vx0, vx1 ;
+      __m256 vx0y0, vx0y1, vx1y0, vx1y1, rt0 ;
+      __m256i ibinx, ibiny, ibint, iexpn ;
+
+      /* load eight (mod, angle) pairs, padding the last ones by zero */
+      if (n < 8) {
+        memset (pad, 0, sizeof(pad)) ;
+        memcpy (pad, pt, sizeof(float) * 2 * n) ;
+        pt = pad ;
+      }
+      p = _mm256_loadu_ps (pt) ;
+      q = _mm256_loadu_ps (pt + 8) ;
+      mod = _mm256_castpd_ps (_mm256_permute4x64_pd
+                              (_mm256_castps_pd (_mm256_shuffle_ps (p, q, _MM_SHUFFLE(2,0,2,0))),
+                               _MM_SHUFFLE(3,1,2,0))) ;
+      angle = _mm256_castpd_ps (_mm256_permute4x64_pd
+                                (_mm256_castps_pd (_mm256_shuffle_ps (p, q, _MM_SHUFFLE(3,1,3,1))),
+                                 _MM_SHUFFLE(3,1,2,0))) ;
+
+      /* theta = mod(angle - angle0, 2 pi) */
+      theta = _mm256_sub_ps (angle, angle0) ;
+      theta = _mm256_fnmadd_ps (twoPi, _mm256_floor_ps
+                                (_mm256_mul_ps (theta, invTwoPi)), theta) ;
+
+      /* normalized displacement */
+      dx = _mm256_add_ps (_mm256_cvtepi32_ps
+                          (_mm256_add_epi32 (_mm256_set1_epi32 (dxi), lanes)),
+                          _mm256_set1_ps (window->dx0)) ;
+      nx = _mm256_fmadd_ps (ct, dx, sty) ;
+      ny = _mm256_fnmadd_ps (st, dx, cty) ;
+      nt = _mm256_mul_ps (ntScale, theta) ;
+
+      /* Gaussian window (linear interpolation of the exp table) */
+      r2 = _mm256_mul_ps (_mm256_fmadd_ps (nx, nx, _mm256_mul_ps (ny, ny)),
+                          expnScale) ;
+      u = _mm256_min_ps (r2, expnSize) ;
+      iexpn = _mm256_min_epi32 (_mm256_cvttps_epi32 (u), expnLast) ;
+      u = _mm256_sub_ps (u, _mm256_cvtepi32_ps (iexpn)) ;
+      a = _mm256_i32gather_ps (expnTable, iexpn, 4) ;
+      b = _mm256_i32gather_ps (expnTable + 1, iexpn, 4) ;
+      win = _mm256_fmadd_ps (u, _mm256_sub_ps (b, a), a) ;
+      win = _mm256_andnot_ps (_mm256_cmp_ps (r2, expnSize, _CMP_GT_OQ), win) ;
+
+      /* lower-left bin and residuals */
+      binx = _mm256_floor_ps (_mm256_sub_ps (nx, half)) ;
+      biny = _mm256_floor_ps (_mm256_sub_ps (ny, half)) ;
+      bint = _mm256_floor_ps (nt) ;
+      rbinx = _mm256_sub_ps (nx, _mm256_add_ps (binx, half)) ;
+      rbiny = _mm256_sub_ps (ny, _mm256_add_ps (biny, half)) ;
+      rbint = _mm256_sub_ps (nt, bint) ;
+
+      /* weights of the eight bins */
+      v = _mm256_mul_ps (win, mod) ;
+      vx0 = _mm256_mul_ps (v, _mm256_sub_ps (one, rbinx)) ;
+      vx1 = _mm256_mul_ps (v, rbinx) ;
+      vx0y0 = _mm256_mul_ps (vx0, _mm256_sub_ps (one, rbiny)) ;
+      vx0y1 = _mm256_mul_ps (vx0, rbiny) ;
+      vx1y0 = _mm256_mul_ps (vx1, _mm256_sub_ps (one, rbiny)) ;
+      vx1y1 = _mm256_mul_ps (vx1, rbiny) ;
+      rt0 = _mm256_sub_ps (one, rbint) ;
+      _mm256_storeu_ps (weights [0], _mm256_mul_ps (vx0y0, rt0)) ;
+      _mm256_storeu_ps (weights [1], _mm256_mul_ps (vx0y0, rbint)) ;
+      _mm256_storeu_ps (weights [2], _mm256_mul_ps (vx0y1, rt0)) ;
+      _mm256_storeu_ps (weights [3], _mm256_mul_ps (vx0y1, rbint)) ;
+      _mm256_storeu_ps (weights [4], _mm256_mul_ps (vx1y0, rt0)) ;
+      _mm256_storeu_ps (weights [5], _mm256_mul_ps (vx1y0, rbint)) ;
+      _mm256_storeu_ps (weights [6], _mm256_mul_ps (vx1y1, rt0)) ;
+      _mm256_storeu_ps (weights [7], _mm256_mul_ps (vx1y1, rbint)) ;
+
+      /* clamp the spatial bins to the padded histogram */
+      ibinx = _mm256_cvtps_epi32 (binx) ;
+      ibiny = _mm256_cvtps_epi32 (biny) ;
+      ibint = _mm256_cvtps_epi32 (bint) ;
+      ibinx = _mm256_max_epi32 (_mm256_min_epi32 (ibinx, binMax), binMin) ;
+      ibiny = _mm256_max_epi32 (_mm256_min_epi32 (ibiny, binMax), binMin) ;
+      _mm256_storeu_si256 ((__m256i*) bins [0], ibinx) ;
+      _mm256_storeu_si256 ((__m256i*) bins [1], ibiny) ;
+      _mm256_storeu_si256 ((__m256i*) bins [2], ibint) ;
+
+      /* scatter the samples in order */
+      for (i = 0 ; i < n ; ++ i) {
+        float *h = hist + ((bins [1][i] + 4) * PNB + (bins [0][i] + 4)) * PNB ;
+        int t0 = bins [2][i] & 7 ;
+        int t1 = (bins [2][i] + 1) & 7 ;
+        h [t0]                 += weights [0][i] ;
+        h [t1]                 += weights [1][i] ;
+        h [PNB*PNB + t0]       += weights [2][i] ;
+        h [PNB*PNB + t1]       += weights [3][i] ;
+        h [PNB + t0]           += weights [4][i] ;
+        h [PNB + t1]           += weights [5][i] ;
+        h [PNB*PNB + PNB + t0] += weights [6][i] ;
+        h [PNB*PNB + PNB + t1] += weights [7][i] ;
+      }
+    }
+  }
+
+  /* copy the central bins */
+  for (j = 0 ; j < 4 ; ++ j) {
+    for (i = 0 ; i < 4 ; ++ i) {
+      for (t = 0 ; t < 8 ; ++ t) {
+        descr [j * 32 + i * 8 + t] = hist [((j + 2) * PNB + (i + 2)) * PNB + t] ;
+      }
+    }
+  }
+}
+
+/* ! VL_DISABLE_AVX2 */
+#endif
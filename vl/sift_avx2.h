@@ -0,0 +1,29 @@
+/** @file sift_avx2.h
+ ** @brief SIFT descriptor accumulation - AVX2
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_SIFT_AVX2_H
+#define VL_SIFT_AVX2_H
+
+#include "sift.h"
+#include "sift_sse2.h" /* VlSiftDescriptorWindow */
+
+#ifndef VL_DISABLE_AVX2
+
+VL_EXPORT
+void _vl_sift_accumulate_descriptor_avx2 (vl_sift_pix *descr,
+                                          VlSiftDescriptorWindow const *window) ;
+
+#endif
+
+/* VL_SIFT_AVX2_H */
+#endif
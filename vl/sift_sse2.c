@@ -0,0 +1,194 @@
+/** @file sift_sse2.c
+ ** @brief SIFT descriptor accumulation - SSE2 - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_SSE2) & ! defined(__SSE2__)
+#error "Compiling with SSE2 enabled, but no __SSE2__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_SSE2)
+
+#include <emmintrin.h>
+#include <string.h>
+#include "mathop.h"
+#include "sift_sse2.h"
+
+/* The histogram is accumulated into a padded 8 x 8 x 8 buffer whose
+   spatial bins range in [-4, 3]. The bins of the descriptor are the
+   central 4 x 4 ones. Clamping the lower-left bin of a sample to
+   [-4, 2] sends the samples falling outside the descriptor to the
+   padding, so that no bound check is needed. */
+#define PNB 8
+
+/** @internal @brief Floor of a vector (as integers) */
+VL_INLINE __m128i
+_vl_floor_sse2 (__m128 x)
+{
+  __m128i t = _mm_cvttps_epi32 (x) ;
+  __m128 neg = _mm_cmplt_ps (x, _mm_cvtepi32_ps (t)) ;
+  return _mm_add_epi32 (t, _mm_castps_si128 (neg)) ;
+}
+
+VL_EXPORT void
+_vl_sift_accumulate_descriptor_sse2 (vl_sift_pix *descr,
+                                     VlSiftDescriptorWindow const *window)
+{
+  float hist [PNB*PNB*PNB] ;
+  float pad [8] ;
+  float weights [8][4] ;
+  int bins [3][4] ;
+  int expnIndex [4] ;
+  float const *expnTable = window->expnTable ;
+  __m128 const twoPi = _mm_set1_ps ((float) (2 * VL_PI)) ;
+  __m128 const invTwoPi = _mm_set1_ps ((float) (1.0 / (2 * VL_PI))) ;
+  __m128 const ntScale = _mm_set1_ps ((float) (8 / (2 * VL_PI))) ;
+  __m128 const half = _mm_set1_ps (0.5f) ;
+  __m128 const one = _mm_set1_ps (1.0f) ;
+  __m128 const ct = _mm_set1_ps (window->ct) ;
+  __m128 const st = _mm_set1_ps (window->st) ;
+  __m128 const angle0 = _mm_set1_ps (window->angle0) ;
+  __m128 const expnScale = _mm_set1_ps (window->expnScale) ;
+  __m128 const expnSize = _mm_set1_ps (window->expnSize) ;
+  __m128i const binMin = _mm_set1_epi32 (-4) ;
+  __m128i const binMax = _mm_set1_epi32 (2) ;
+  __m128i const lanes = _mm_set_epi32 (3, 2, 1, 0) ;
+  int dxi, dyi, i, j, t ;
+
+  memset (hist, 0, sizeof(hist)) ;
+
+  for (dyi = window->dyBegin ; dyi <= window->dyEnd ; ++ dyi) {
+    vl_sift_pix const *row = window->grad + dyi * window->yo ;
+    __m128 dy = _mm_add_ps (_mm_set1_ps ((float) dyi), _mm_set1_ps (window->dy0)) ;
+    __m128 sty = _mm_mul_ps (st, dy) ;
+    __m128 cty = _mm_mul_ps (ct, dy) ;
+
+    for (dxi = window->dxBegin ; dxi <= window->dxEnd ; dxi += 4) {
+      vl_sift_pix const *pt = row + 2 * dxi ;
+      int n = VL_MIN (4, window->dxEnd - dxi + 1) ;
+      __m128 p, q, mod, angle, dx, nx, ny, nt, theta, r2, u, win ;
+      __m128 binx, biny, bint, rbinx, rbiny, rbint, v, vx0, vx1 ;
+      __m128i ibinx, ibiny, ibint, iexpn ;
+
+      /* load four (mod, angle) pairs, padding the last ones by zero */
+      if (n < 4) {
+        memset (pad, 0, sizeof(pad)) ;
+        memcpy (pad, pt, sizeof(float) * 2 * n) ;
+        pt = pad ;
+      }
+      p = _mm_loadu_ps (pt) ;
+      q = _mm_loadu_ps (pt + 4) ;
+      mod = _mm_shuffle_ps (p, q, _MM_SHUFFLE(2,0,2,0)) ;
+      angle = _mm_shuffle_ps (p, q, _MM_SHUFFLE(3,1,3,1)) ;
+
+      /* theta = mod(angle - angle0, 2 pi) */
+      theta = _mm_sub_ps (angle, angle0) ;
+      theta = _mm_sub_ps (theta, _mm_mul_ps
+                          (twoPi, _mm_cvtepi32_ps
+                           (_vl_floor_sse2 (_mm_mul_ps (theta, invTwoPi))))) ;
+
+      /* normalized displacement */
+      dx = _mm_add_ps (_mm_cvtepi32_ps (_mm_add_epi32 (_mm_set1_epi32 (dxi), lanes)),
+                       _mm_set1_ps (window->dx0)) ;
+      nx = _mm_add_ps (_mm_mul_ps (ct, dx), sty) ;
+      ny = _mm_sub_ps (cty, _mm_mul_ps (st, dx)) ;
+      nt = _mm_mul_ps (ntScale, theta) ;
+
+      /* Gaussian window (linear interpolation of the exp table) */
+      r2 = _mm_mul_ps (_mm_add_ps (_mm_mul_ps (nx, nx), _mm_mul_ps (ny, ny)),
+                       expnScale) ;
+      u = _mm_min_ps (r2, expnSize) ;
+      iexpn = _mm_min_epi16 (_mm_cvttps_epi32 (u), /* see below */
+                             _mm_set1_epi32 ((int) window->expnSize - 1)) ;
+      u = _mm_sub_ps (u, _mm_cvtepi32_ps (iexpn)) ;
+      _mm_storeu_si128 ((__m128i*) expnIndex, iexpn) ;
+      {
+        __m128 a = _mm_set_ps (expnTable [expnIndex [3]],
+                               expnTable [expnIndex [2]],
+                               expnTable [expnIndex [1]],
+                               expnTable [expnIndex [0]]) ;
+        __m128 b = _mm_set_ps (expnTable [expnIndex [3] + 1],
+                               expnTable [expnIndex [2] + 1],
+                               expnTable [expnIndex [1] + 1],
+                               expnTable [expnIndex [0] + 1]) ;
+        win = _mm_add_ps (a, _mm_mul_ps (u, _mm_sub_ps (b, a))) ;
+        win = _mm_andnot_ps (_mm_cmpgt_ps (r2, expnSize), win) ;
+      }
+
+      /* lower-left bin and residuals */
+      ibinx = _vl_floor_sse2 (_mm_sub_ps (nx, half)) ;
+      ibiny = _vl_floor_sse2 (_mm_sub_ps (ny, half)) ;
+      ibint = _vl_floor_sse2 (nt) ;
+      binx = _mm_cvtepi32_ps (ibinx) ;
+      biny = _mm_cvtepi32_ps (ibiny) ;
+      bint = _mm_cvtepi32_ps (ibint) ;
+      rbinx = _mm_sub_ps (nx, _mm_add_ps (binx, half)) ;
+      rbiny = _mm_sub_ps (ny, _mm_add_ps (biny, half)) ;
+      rbint = _mm_sub_ps (nt, bint) ;
+
+      /* weights of the eight bins */
+      v = _mm_mul_ps (win, mod) ;
+      vx0 = _mm_mul_ps (v, _mm_sub_ps (one, rbinx)) ;
+      vx1 = _mm_mul_ps (v, rbinx) ;
+      {
+        __m128 vx0y0 = _mm_mul_ps (vx0, _mm_sub_ps (one, rbiny)) ;
+        __m128 vx0y1 = _mm_mul_ps (vx0, rbiny) ;
+        __m128 vx1y0 = _mm_mul_ps (vx1, _mm_sub_ps (one, rbiny)) ;
+        __m128 vx1y1 = _mm_mul_ps (vx1, rbiny) ;
+        __m128 rt0 = _mm_sub_ps (one, rbint) ;
+        _mm_storeu_ps (weights [0], _mm_mul_ps (vx0y0, rt0)) ;
+        _mm_storeu_ps (weights [1], _mm_mul_ps (vx0y0, rbint)) ;
+        _mm_storeu_ps (weights [2], _mm_mul_ps (vx0y1, rt0)) ;
+        _mm_storeu_ps (weights [3], _mm_mul_ps (vx0y1, rbint)) ;
+        _mm_storeu_ps (weights [4], _mm_mul_ps (vx1y0, rt0)) ;
+        _mm_storeu_ps (weights [5], _mm_mul_ps (vx1y0, rbint)) ;
+        _mm_storeu_ps (weights [6], _mm_mul_ps (vx1y1, rt0)) ;
+        _mm_storeu_ps (weights [7], _mm_mul_ps (vx1y1, rbint)) ;
+      }
+
+      /* clamp the spatial bins to the padded histogram (SSE2 has no
+         32-bit min/max, but 16-bit min/max give the same result for
+         integers that fit in 16 bits) */
+      ibinx = _mm_max_epi16 (_mm_min_epi16 (ibinx, binMax), binMin) ;
+      ibiny = _mm_max_epi16 (_mm_min_epi16 (ibiny, binMax), binMin) ;
+      _mm_storeu_si128 ((__m128i*) bins [0], ibinx) ;
+      _mm_storeu_si128 ((__m128i*) bins [1], ibiny) ;
+      _mm_storeu_si128 ((__m128i*) bins [2], ibint) ;
+
+      /* scatter the samples in order */
+      for (i = 0 ; i < n ; ++ i) {
+        float *h = hist + ((bins [1][i] + 4) * PNB + (bins [0][i] + 4)) * PNB ;
+        int t0 = bins [2][i] & 7 ;
+        int t1 = (bins [2][i] + 1) & 7 ;
+        h [t0]                 += weights [0][i] ;
+        h [t1]                 += weights [1][i] ;
+        h [PNB*PNB + t0]       += weights [2][i] ;
+        h [PNB*PNB + t1]       += weights [3][i] ;
+        h [PNB + t0]           += weights [4][i] ;
+        h [PNB + t1]           += weights [5][i] ;
+        h [PNB*PNB + PNB + t0] += weights [6][i] ;
+        h [PNB*PNB + PNB + t1] += weights [7][i] ;
+      }
+    }
+  }
+
+  /* copy the central bins */
+  for (j = 0 ; j < 4 ; ++ j) {
+    for (i = 0 ; i < 4 ; ++ i) {
+      for (t = 0 ; t < 8 ; ++ t) {
+        descr [j * 32 + i * 8 + t] = hist [((j + 2) * PNB + (i + 2)) * PNB + t] ;
+      }
+    }
+  }
+}
+
+/* ! VL_DISABLE_SSE2 */
+#endif
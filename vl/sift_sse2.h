@@ -0,0 +1,55 @@
+/** @file sift_sse2.h
+ ** @brief SIFT descriptor accumulation - SSE2
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_SIFT_SSE2_H
+#define VL_SIFT_SSE2_H
+
+#include "sift.h"
+
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief SIFT descriptor window
+ **
+ ** This structure describes the gradient samples accumulated into a
+ ** SIFT descriptor. It is passed to the vectorized implementations
+ ** of the descriptor accumulation step.
+ **/
+
+typedef struct _VlSiftDescriptorWindow
+{
+  vl_sift_pix const *grad ; /**< gradient (mod, angle) at the window center. */
+  int yo ;                  /**< gradient y-stride. */
+  int dxBegin ;             /**< first x-offset from the center. */
+  int dxEnd ;               /**< last x-offset from the center. */
+  int dyBegin ;             /**< first y-offset from the center. */
+  int dyEnd ;               /**< last y-offset from the center. */
+  float dx0 ;               /**< x-displacement of the center. */
+  float dy0 ;               /**< y-displacement of the center. */
+  float ct ;                /**< cosine of the angle over the bin size. */
+  float st ;                /**< sine of the angle over the bin size. */
+  float angle0 ;            /**< descriptor angle. */
+  float expnScale ;         /**< Gaussian window exponent scale. */
+  float expnSize ;          /**< size of @c expnTable minus one. */
+  float const *expnTable ;  /**< @f$ \exp(-x) @f$ table. */
+} VlSiftDescriptorWindow ;
+
+#ifndef VL_DISABLE_SSE2
+
+VL_EXPORT
+void _vl_sift_accumulate_descriptor_sse2 (vl_sift_pix *descr,
+                                          VlSiftDescriptorWindow const *window) ;
+
+#endif
+
+/* VL_SIFT_SSE2_H */
+#endif
@@ -0,0 +1,618 @@
+/** @file threads.c
+ ** @brief Thread pool - Definition
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+/**
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@page threads Thread pool
+@author Andrea Vedaldi
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+@ref threads.h implements a small thread pool shared by all VLFeat
+algorithms. The pool is part of the VLFeat global state: it is
+created the first time it is needed and destroyed when the library is
+unloaded or by ::vl_thread_pool_shutdown. Its size is controlled by ::vl_set_num_threads and
+::vl_get_max_threads (see @ref generic-state); algorithms never spawn
+threads on their own, so that running several of them does not
+oversubscribe the CPU.
+
+There are two ways of submitting work to the pool:
+
+- ::vl_parallel_for splits a range of elements into chunks and
+  executes them concurrently. The calling thread takes part in the
+  computation and the function returns only when all chunks have been
+  processed.
+
+- A ::VlTaskGroup collects independent tasks submitted by
+  ::vl_task_group_run. ::vl_task_group_wait blocks until all the tasks
+  in the group are complete.
+
+A thread waiting for a loop or a task group to complete executes
+pending tasks in the meanwhile. Hence parallel loops and task groups
+can be nested without deadlocking the pool.
+
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@section threads-state Thread specific state
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+Each worker thread owns its own ::VlThreadSpecificState, which is
+created when the worker starts. Hence the last error and the random
+number generator returned by ::vl_get_rand are private to each
+worker. Note however that which worker executes which chunk or task
+is not deterministic. Algorithms that need reproducible randomness
+should draw from an explicit ::VlRand instance rather than from
+::vl_get_rand within a parallel region.
+
+Parallel bodies should not allocate memory by ::vl_malloc and
+similar functions as the latter may be remapped to functions that
+are not thread safe (e.g. MATLAB @c mxMalloc). Scratch space should
+be allocated by the calling thread before the parallel region,
+typically one buffer per slot (see ::VlParallelForFunction).
+
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+@section threads-determinism Determinism
+<!-- ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~  -->
+
+If ::vl_parallel_for is given a non-zero grain size, the chunks
+boundaries depend only on the number of elements and on the grain
+size, but not on the number of threads. The index
+<code>begin / grainSize</code> can then be used to store partial
+results (e.g. sums) that are later combined in a fixed order, making
+the result independent of the number of threads.
+**/
+
+#include "threads.h"
+
+#include <stdlib.h>
+
+#if ! defined(VL_DISABLE_THREADS) && defined(VL_THREADS_POSIX)
+#include <pthread.h>
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                  Data structures */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Task group */
+struct _VlTaskGroup
+{
+  vl_size numPending ; /**< number of tasks not completed yet */
+} ;
+
+#if ! defined(VL_DISABLE_THREADS)
+
+/** @internal @brief Pending task */
+typedef struct _VlTask
+{
+  VlTaskFunction function ;
+  void * data ;
+  VlTaskGroup * group ;
+  struct _VlTask * next ;
+} VlTask ;
+
+/** @internal @brief Thread pool */
+struct _VlThreadPool
+{
+  vl_size numWorkers ;
+  vl_bool terminate ;
+  VlTask * first ;
+  VlTask * last ;
+#if defined(VL_THREADS_POSIX)
+  pthread_mutex_t mutex ;
+  pthread_cond_t taskAvailable ;
+  pthread_cond_t taskCompleted ;
+  pthread_t * workers ;
+#elif defined(VL_THREADS_WIN)
+  CRITICAL_SECTION mutex ;
+  CONDITION_VARIABLE taskAvailable ;
+  CONDITION_VARIABLE taskCompleted ;
+  HANDLE * workers ;
+  HMODULE module ;   /**< library module, referenced by each worker. */
+#endif
+} ;
+
+/* ---------------------------------------------------------------- */
+/*                                       Synchronization primitives */
+/* ---------------------------------------------------------------- */
+
+static void
+_vl_thread_pool_lock (VlThreadPool * self)
+{
+#if defined(VL_THREADS_POSIX)
+  pthread_mutex_lock (&self->mutex) ;
+#elif defined(VL_THREADS_WIN)
+  EnterCriticalSection (&self->mutex) ;
+#endif
+}
+
+static void
+_vl_thread_pool_unlock (VlThreadPool * self)
+{
+#if defined(VL_THREADS_POSIX)
+  pthread_mutex_unlock (&self->mutex) ;
+#elif defined(VL_THREADS_WIN)
+  LeaveCriticalSection (&self->mutex) ;
+#endif
+}
+
+#if defined(VL_THREADS_POSIX)
+#define VL_POOL_WAIT(self,cond) pthread_cond_wait(&(self)->cond, &(self)->mutex)
+#define VL_POOL_BROADCAST(self,cond) pthread_cond_broadcast(&(self)->cond)
+#define VL_POOL_SIGNAL(self,cond) pthread_cond_signal(&(self)->cond)
+#elif defined(VL_THREADS_WIN)
+#define VL_POOL_WAIT(self,cond) SleepConditionVariableCS(&(self)->cond, &(self)->mutex, INFINITE)
+#define VL_POOL_BROADCAST(self,cond) WakeAllConditionVariable(&(self)->cond)
+#define VL_POOL_SIGNAL(self,cond) WakeConditionVariable(&(self)->cond)
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                   Pool internals */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Pop the next pending task
+ ** @param self thread pool (locked).
+ ** @return task or @c NULL if the queue is empty.
+ **/
+
+static VlTask *
+_vl_thread_pool_pop (VlThreadPool * self)
+{
+  VlTask * task = self->first ;
+  if (task) {
+    self->first = task->next ;
+    if (self->first == NULL) self->last = NULL ;
+  }
+  return task ;
+}
+
+/** @internal @brief Execute a task and release it
+ ** @param self thread pool (unlocked).
+ ** @param task task to execute.
+ **/
+
+static void
+_vl_thread_pool_execute (VlThreadPool * self, VlTask * task)
+{
+  VlTaskGroup * group = task->group ;
+  task->function (task->data) ;
+  free (task) ;
+  _vl_thread_pool_lock (self) ;
+  if (-- group->numPending == 0) {
+    VL_POOL_BROADCAST (self, taskCompleted) ;
+  }
+  _vl_thread_pool_unlock (self) ;
+}
+
+/** @internal @brief Worker thread main loop */
+
+#if defined(VL_THREADS_POSIX)
+static void *
+_vl_thread_pool_worker (void * arg)
+#elif defined(VL_THREADS_WIN)
+static DWORD WINAPI
+_vl_thread_pool_worker (LPVOID arg)
+#endif
+{
+  VlThreadPool * self = (VlThreadPool *) arg ;
+  VlTask * task ;
+
+  /* give this worker its own error state, RNG and timer */
+  vl_get_thread_specific_state () ;
+
+  _vl_thread_pool_lock (self) ;
+  while (1) {
+    while (self->first == NULL && ! self->terminate) {
+      VL_POOL_WAIT (self, taskAvailable) ;
+    }
+    task = _vl_thread_pool_pop (self) ;
+    if (task == NULL) break ;
+    _vl_thread_pool_unlock (self) ;
+    _vl_thread_pool_execute (self, task) ;
+    _vl_thread_pool_lock (self) ;
+  }
+  _vl_thread_pool_unlock (self) ;
+#if defined(VL_THREADS_WIN)
+  /* release the reference taken by _vl_thread_pool_get */
+  FreeLibraryAndExitThread (self->module, 0) ;
+#endif
+  return 0 ;
+}
+
+/** @internal @brief Get the thread pool
+ ** @param numWorkers minimum number of worker threads.
+ ** @return the thread pool or @c NULL if the pool could not be created.
+ **
+ ** The function creates the pool the first time it is called and
+ ** adds workers as needed. Workers are never removed until the
+ ** library is unloaded; if there are more than @a numWorkers, the
+ ** extra ones simply stay idle.
+ **/
+
+static VlThreadPool *
+_vl_thread_pool_get (vl_size numWorkers)
+{
+  VlState * state = vl_get_state() ;
+  VlThreadPool * self ;
+
+  vl_lock_state() ;
+  self = state->threadPool ;
+  if (self == NULL) {
+    self = malloc(sizeof(VlThreadPool)) ;
+    if (self == NULL) goto done ;
+    self->numWorkers = 0 ;
+    self->terminate = VL_FALSE ;
+    self->first = NULL ;
+    self->last = NULL ;
+    self->workers = NULL ;
+#if defined(VL_THREADS_POSIX)
+    pthread_mutex_init (&self->mutex, NULL) ;
+    pthread_cond_init (&self->taskAvailable, NULL) ;
+    pthread_cond_init (&self->taskCompleted, NULL) ;
+#elif defined(VL_THREADS_WIN)
+    InitializeCriticalSection (&self->mutex) ;
+    InitializeConditionVariable (&self->taskAvailable) ;
+    InitializeConditionVariable (&self->taskCompleted) ;
+#endif
+    state->threadPool = self ;
+  }
+
+  if (self->numWorkers < numWorkers) {
+    void * workers = realloc (self->workers,
+                              sizeof(self->workers[0]) * numWorkers) ;
+    if (workers == NULL) goto done ;
+    self->workers = workers ;
+    while (self->numWorkers < numWorkers) {
+#if defined(VL_THREADS_POSIX)
+      if (pthread_create (self->workers + self->numWorkers, NULL,
+                          _vl_thread_pool_worker, self)) break ;
+#elif defined(VL_THREADS_WIN)
+      /* each worker keeps the library loaded until it exits */
+      if (! GetModuleHandleEx (GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                               (LPCTSTR) _vl_thread_pool_worker,
+                               &self->module)) break ;
+      self->workers[self->numWorkers] =
+        CreateThread (NULL, 0, _vl_thread_pool_worker, self, 0, NULL) ;
+      if (self->workers[self->numWorkers] == NULL) {
+        FreeLibrary (self->module) ;
+        break ;
+      }
+#endif
+      self->numWorkers ++ ;
+    }
+  }
+done:
+  vl_unlock_state() ;
+  return self ;
+}
+
+/** @internal @brief Delete the thread pool
+ ** @param self thread pool (can be @c NULL).
+ **
+ ** The function waits for the workers to drain the queue and
+ ** terminate. It must not be called while the loader lock is held
+ ** (e.g. from @c DllMain) as the workers could not exit.
+ **/
+
+static void
+_vl_thread_pool_delete (VlThreadPool * self)
+{
+  vl_uindex i ;
+  if (self == NULL) return ;
+  _vl_thread_pool_lock (self) ;
+  self->terminate = VL_TRUE ;
+  VL_POOL_BROADCAST (self, taskAvailable) ;
+  _vl_thread_pool_unlock (self) ;
+  for (i = 0 ; i < self->numWorkers ; ++i) {
+#if defined(VL_THREADS_POSIX)
+    pthread_join (self->workers[i], NULL) ;
+#elif defined(VL_THREADS_WIN)
+    WaitForSingleObject (self->workers[i], INFINITE) ;
+    CloseHandle (self->workers[i]) ;
+#endif
+  }
+#if defined(VL_THREADS_POSIX)
+  pthread_cond_destroy (&self->taskCompleted) ;
+  pthread_cond_destroy (&self->taskAvailable) ;
+  pthread_mutex_destroy (&self->mutex) ;
+#elif defined(VL_THREADS_WIN)
+  DeleteCriticalSection (&self->mutex) ;
+#endif
+  free (self->workers) ;
+  free (self) ;
+}
+
+/** @internal @brief Run a task in a task group
+ ** @param self task group.
+ ** @param pool thread pool (or @c NULL).
+ ** @param function task function.
+ ** @param data task data.
+ **/
+
+static void
+_vl_task_group_run (VlTaskGroup * self,
+                    VlThreadPool * pool,
+                    VlTaskFunction function,
+                    void * data)
+{
+  VlTask * task = NULL ;
+  if (pool) task = malloc(sizeof(VlTask)) ;
+  if (task) {
+    task->function = function ;
+    task->data = data ;
+    task->group = self ;
+    task->next = NULL ;
+    _vl_thread_pool_lock (pool) ;
+    self->numPending ++ ;
+    if (pool->last) {
+      pool->last->next = task ;
+    } else {
+      pool->first = task ;
+    }
+    pool->last = task ;
+    VL_POOL_SIGNAL (pool, taskAvailable) ;
+    _vl_thread_pool_unlock (pool) ;
+    return ;
+  }
+  /* no pool available: run the task immediately */
+  function (data) ;
+}
+
+/** @internal @brief Wait for the tasks in a group
+ ** @param self task group.
+ ** @param pool thread pool (or @c NULL).
+ **
+ ** While waiting, the calling thread executes pending tasks.
+ **/
+
+static void
+_vl_task_group_wait (VlTaskGroup * self, VlThreadPool * pool)
+{
+  VlTask * task ;
+  if (pool == NULL) return ;
+  _vl_thread_pool_lock (pool) ;
+  while (self->numPending > 0) {
+    task = _vl_thread_pool_pop (pool) ;
+    if (task) {
+      _vl_thread_pool_unlock (pool) ;
+      _vl_thread_pool_execute (pool, task) ;
+      _vl_thread_pool_lock (pool) ;
+    } else {
+      VL_POOL_WAIT (pool, taskCompleted) ;
+    }
+  }
+  _vl_thread_pool_unlock (pool) ;
+}
+
+/* VL_DISABLE_THREADS */
+#else
+
+static void
+_vl_thread_pool_lock (VlThreadPool * self VL_UNUSED) { }
+
+static void
+_vl_thread_pool_unlock (VlThreadPool * self VL_UNUSED) { }
+
+static void
+_vl_task_group_run (VlTaskGroup * self VL_UNUSED,
+                    VlThreadPool * pool VL_UNUSED,
+                    VlTaskFunction function,
+                    void * data)
+{
+  function (data) ;
+}
+
+static void
+_vl_task_group_wait (VlTaskGroup * self VL_UNUSED,
+                     VlThreadPool * pool VL_UNUSED) { }
+
+#endif
+
+/* ---------------------------------------------------------------- */
+/*                                                       Life cycle */
+/* ---------------------------------------------------------------- */
+
+/** @brief Shut the thread pool down
+ **
+ ** The function waits for the pending tasks to complete, terminates
+ ** the worker threads and releases the pool. A new pool is created
+ ** the next time a parallel computation needs one. The function must
+ ** not be called while a parallel loop or a task group is running.
+ **
+ ** On POSIX systems the library destructor shuts the pool down
+ ** automatically. On Windows the workers cannot be joined while the
+ ** DLL is being unloaded; instead, each worker keeps a reference to
+ ** the DLL. A client that unloads the library by @c FreeLibrary must
+ ** call this function beforehand, or the DLL stays loaded.
+ **/
+
+VL_EXPORT void
+vl_thread_pool_shutdown ()
+{
+#if ! defined(VL_DISABLE_THREADS)
+  VlState * state = vl_get_state() ;
+  VlThreadPool * pool ;
+  vl_lock_state() ;
+  pool = state->threadPool ;
+  state->threadPool = NULL ;
+  vl_unlock_state() ;
+  _vl_thread_pool_delete (pool) ;
+#endif
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                      Task groups */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Get the pool to run tasks on
+ ** @return thread pool or @c NULL to run tasks in the calling thread.
+ **/
+
+static VlThreadPool *
+_vl_get_thread_pool ()
+{
+#if ! defined(VL_DISABLE_THREADS)
+  vl_size numThreads = vl_get_max_threads() ;
+  if (numThreads > 1) {
+    return _vl_thread_pool_get (numThreads - 1) ;
+  }
+#endif
+  return NULL ;
+}
+
+/** @brief Create a new task group
+ ** @return new task group or @c NULL if the memory cannot be allocated.
+ **/
+
+VL_EXPORT VlTaskGroup *
+vl_task_group_new ()
+{
+  VlTaskGroup * self = vl_malloc(sizeof(VlTaskGroup)) ;
+  if (self == NULL) return NULL ;
+  self->numPending = 0 ;
+  return self ;
+}
+
+/** @brief Delete a task group
+ ** @param self task group.
+ **
+ ** The function waits for the pending tasks to complete before
+ ** disposing of the group.
+ **/
+
+VL_EXPORT void
+vl_task_group_delete (VlTaskGroup * self)
+{
+  vl_task_group_wait (self) ;
+  vl_free (self) ;
+}
+
+/** @brief Run a task in a task group
+ ** @param self task group.
+ ** @param function task function.
+ ** @param data task data.
+ **
+ ** The task is queued in the VLFeat thread pool and executed as soon
+ ** as a thread is available. If the maximum number of threads is one
+ ** (::vl_get_max_threads), the task is executed immediately by the
+ ** calling thread.
+ **/
+
+VL_EXPORT void
+vl_task_group_run (VlTaskGroup * self, VlTaskFunction function, void * data)
+{
+  _vl_task_group_run (self, _vl_get_thread_pool(), function, data) ;
+}
+
+/** @brief Wait for all the tasks in a group to complete
+ ** @param self task group.
+ **/
+
+VL_EXPORT void
+vl_task_group_wait (VlTaskGroup * self)
+{
+  _vl_task_group_wait (self, vl_get_state()->threadPool) ;
+}
+
+/* ---------------------------------------------------------------- */
+/*                                                   Parallel loops */
+/* ---------------------------------------------------------------- */
+
+/** @internal @brief Parallel loop state */
+typedef struct _VlParallelFor
+{
+  VlParallelForFunction function ;
+  void * data ;
+  VlThreadPool * pool ;
+  vl_size numElements ;
+  vl_size grainSize ;
+  vl_uindex nextChunk ;
+  vl_uindex nextSlot ;
+} VlParallelFor ;
+
+/** @internal @brief Process chunks until the loop is exhausted */
+
+static void
+_vl_parallel_for_task (void * data)
+{
+  VlParallelFor * self = data ;
+  vl_size numChunks = (self->numElements + self->grainSize - 1) / self->grainSize ;
+  vl_uindex slot ;
+  vl_uindex chunk ;
+
+  if (self->pool) _vl_thread_pool_lock (self->pool) ;
+  slot = self->nextSlot ++ ;
+  while (self->nextChunk < numChunks) {
+    vl_uindex begin, end ;
+    chunk = self->nextChunk ++ ;
+    if (self->pool) _vl_thread_pool_unlock (self->pool) ;
+    begin = chunk * self->grainSize ;
+    end = VL_MIN(begin + self->grainSize, self->numElements) ;
+    self->function (self->data, begin, end, slot) ;
+    if (self->pool) _vl_thread_pool_lock (self->pool) ;
+  }
+  if (self->pool) _vl_thread_pool_unlock (self->pool) ;
+}
+
+/** @brief Execute a loop in parallel
+ ** @param numElements number of elements.
+ ** @param grainSize number of elements in a chunk (0 for automatic).
+ ** @param function loop body.
+ ** @param data user data passed to @a function.
+ **
+ ** The range <code>[0, numElements)</code> is divided into chunks of
+ ** @a grainSize elements (the last chunk may be smaller) and
+ ** @a function is called once for each chunk, from up to
+ ** ::vl_get_max_threads threads at the same time. The function
+ ** returns when all chunks have been processed.
+ **
+ ** If @a grainSize is zero, a chunk size is chosen automatically
+ ** based on the number of threads. In this case the chunk boundaries
+ ** depend on ::vl_get_max_threads (see @ref threads-determinism).
+ **/
+
+VL_EXPORT void
+vl_parallel_for (vl_size numElements,
+                 vl_size grainSize,
+                 VlParallelForFunction function,
+                 void * data)
+{
+  VlParallelFor loop ;
+  VlTaskGroup group ;
+  vl_size numThreads = vl_get_max_threads() ;
+  vl_size numChunks ;
+  vl_size numTasks ;
+  vl_uindex t ;
+
+  if (numElements == 0) return ;
+  if (grainSize == 0) {
+    grainSize = VL_MAX(numElements / (4 * numThreads), 1) ;
+  }
+  numChunks = (numElements + grainSize - 1) / grainSize ;
+  numTasks = VL_MIN(numChunks, numThreads) ;
+
+  loop.function = function ;
+  loop.data = data ;
+  loop.pool = (numTasks > 1) ? _vl_get_thread_pool() : NULL ;
+  loop.numElements = numElements ;
+  loop.grainSize = grainSize ;
+  loop.nextChunk = 0 ;
+  loop.nextSlot = 0 ;
+  group.numPending = 0 ;
+
+  if (loop.pool) {
+    for (t = 1 ; t < numTasks ; ++t) {
+      _vl_task_group_run (&group, loop.pool, _vl_parallel_for_task, &loop) ;
+    }
+  }
+  _vl_parallel_for_task (&loop) ;
+  _vl_task_group_wait (&group, loop.pool) ;
+}
@@ -0,0 +1,69 @@
+/** @file threads.h
+ ** @brief Thread pool (@ref threads)
+ ** @author Andrea Vedaldi
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_THREADS_H
+#define VL_THREADS_H
+
+#include "generic.h"
+
+/** @brief Parallel-for body
+ ** @param data user data.
+ ** @param begin first element of the chunk.
+ ** @param end one past the last element of the chunk.
+ ** @param slot index of the executing slot.
+ **
+ ** @a slot is smaller than ::vl_get_max_threads and no two chunks
+ ** running concurrently share the same slot. It can be used to index
+ ** per-thread scratch buffers.
+ **/
+typedef void (*VlParallelForFunction) (void * data,
+                                       vl_uindex begin,
+                                       vl_uindex end,
+                                       vl_uindex slot) ;
+
+/** @brief Task function
+ ** @param data user data.
+ **/
+typedef void (*VlTaskFunction) (void * data) ;
+
+/** @brief Task group (opaque) */
+typedef struct _VlTaskGroup VlTaskGroup ;
+
+/** @internal @brief Thread pool (opaque) */
+typedef struct _VlThreadPool VlThreadPool ;
+
+/** @name Parallel loops
+ ** @{ */
+VL_EXPORT void vl_parallel_for (vl_size numElements,
+                                vl_size grainSize,
+                                VlParallelForFunction function,
+                                void * data) ;
+/** @} */
+
+/** @name Task groups
+ ** @{ */
+VL_EXPORT VlTaskGroup * vl_task_group_new () ;
+VL_EXPORT void vl_task_group_delete (VlTaskGroup * self) ;
+VL_EXPORT void vl_task_group_run (VlTaskGroup * self,
+                                  VlTaskFunction function,
+                                  void * data) ;
+VL_EXPORT void vl_task_group_wait (VlTaskGroup * self) ;
+/** @} */
+
+/** @name Thread pool life cycle
+ ** @{ */
+VL_EXPORT void vl_thread_pool_shutdown () ;
+/** @} */
+
+/* VL_THREADS_H */
+#endif